@@ -16,6 +16,7 @@
 #include "VirtualTrackball.h"
 #include "Model.h"
 #include "TextureFBO.h"
+#include "GPUTimer.hpp"
 
 #include <IL/IL.h>
 #include <IL/ILU.h>
@@ -161,8 +162,14 @@ private:
     // Program used to debug render textures
     std::shared_ptr<GLUtils::Program> debug;
     
+    // Device time of the geometry pass and of the screen space pass
+    std::shared_ptr<GLTimer> geometry_timer;
+    std::shared_ptr<GLTimer> shading_timer;
+    
     static RenderMode mode;
     static float fovx;
+    static float geometry_time;
+    static float shading_time;
 };
 
 #endif
@@ -1,8 +1,15 @@
 import numpy as np
 import matplotlib.pyplot as plt
 import json
+import os
 from pprint import pprint
 
+# OpenCL runs of run_euler.sh forced away from the defaults, plotted
+# where every grid size was run
+variants = [('IMAGES_', 'g-o', 'OpenCL images'),
+            ('SHARED_', 'm-o', 'OpenCL shared primitives'),
+            ('X4_', 'c-o', 'OpenCL 4 cells per work-item')]
+
 y1 = []
 y2 = []
 x = []
@@ -25,7 +32,18 @@ for n in range(0,30):
 plt.title('Euler OpenCL vs OpenGL Performance')
 plt.ylabel('Time(ms)')
 plt.xlabel('Grid size')
-plt.plot(x,y1,'r-o', label='OpenCL')
+plt.plot(x,y1,'r-o', label='OpenCL buffers')
 plt.plot(x,y2,'b-o', label='OpenGL')
+for variant, style, label in variants:
+    names = ['GPU_CLEULER_{v}{sx}x{sx}.json'.format(v=variant, sx=s) for s in x]
+    if not all(os.path.exists(name) for name in names):
+        continue
+    y = []
+    for name in names:
+        json_data=open(name)
+        data = json.load(json_data)
+        y.append(data['average_timestep']*1000.0)
+        json_data.close()
+    plt.plot(x,y,style, label=label)
 plt.legend()
 plt.savefig('euler_perf_graph.png')
\ No newline at end of file
@@ -0,0 +1,25 @@
+import numpy as np
+import matplotlib.pyplot as plt
+import json
+from pprint import pprint
+
+# Average time step per layout on the CPU device, 1k^2 to 16k^2 cells
+layouts = [('', 'r-o', 'Rows'), ('TILES_', 'b-o', '32x32 tiles'), ('MORTON_', 'g-o', 'Z-order tiles')]
+sizes = [1024, 2048, 4096, 8192, 16384]
+
+for layout, style, label in layouts:
+    y = []
+    for s in sizes:
+        json_data=open('CPU_CLEULER_{l}{sx}x{sx}.json'.format(l=layout, sx=s))
+        data = json.load(json_data)
+        # Per cell, so the grid sizes compare
+        y.append(data['average_timestep']*1.0e9/(s*s))
+        json_data.close()
+    plt.plot(sizes,y,style, label=label)
+
+plt.title('Euler OpenCL CPU cell layouts')
+plt.ylabel('Time per cell(ns)')
+plt.xlabel('Grid size')
+plt.xscale('log', base=2)
+plt.legend()
+plt.savefig('layout_perf_graph.png')
@@ -0,0 +1,42 @@
+import numpy as np
+import matplotlib.pyplot as plt
+import json
+
+# Time to accuracy of the face quadratures. Errors are the mean absolute
+# density error against the finest Gauss run, averaged down to each grid.
+ref_size = 1600
+sizes = [100, 200, 400, 800]
+
+ref = np.fromfile('GPU_CLEULER_{sx}x{sx}_rho.raw'.format(sx=ref_size), dtype=np.float32)
+ref = ref.reshape(ref_size, ref_size)
+
+def point(name, s):
+    json_data=open('{n}_{sx}x{sx}.json'.format(n=name, sx=s))
+    data = json.load(json_data)
+    json_data.close()
+    
+    rho = np.fromfile('{n}_{sx}x{sx}_rho.raw'.format(n=name, sx=s), dtype=np.float32).reshape(s, s)
+    f = ref_size//s
+    coarse = ref.reshape(s, f, s, f).mean(axis=(1,3))
+    return data['total_sim_time']*1000.0, np.abs(rho-coarse).mean()
+
+x1 = []
+y1 = []
+x2 = []
+y2 = []
+for s in sizes:
+    t, e = point('GPU_CLEULER', s)
+    x1.append(t)
+    y1.append(e)
+    
+    t, e = point('GPU_CLEULER_MIDPOINT', s)
+    x2.append(t)
+    y2.append(e)
+
+plt.title('Euler face quadrature, time to accuracy')
+plt.ylabel('Density L1 error')
+plt.xlabel('Time(ms)')
+plt.loglog(x1,y1,'r-o', label='Gauss')
+plt.loglog(x2,y2,'b-o', label='Midpoint')
+plt.legend()
+plt.savefig('quadrature_accuracy_graph.png')
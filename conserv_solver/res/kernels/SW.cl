@@ -1,3 +1,12 @@
+/***
+ * Index type, 64 bit for buffers past the reach of 32 bit indices
+ ****/
+#ifdef LARGE_GRID
+typedef ulong index_t;
+#else
+typedef uint index_t;
+#endif
+
 /***
  * Function dec
  ****/
@@ -16,19 +25,19 @@ void    storef(__global float* array, float value, unsigned int x, unsigned int
  *
  ****/
 float4 fetch(__global float4* array, unsigned int x, unsigned int y, unsigned int offset){
-    unsigned int k = ((Nx+4) * (y+offset) + (x+offset));
+    index_t k = ((index_t)(Nx+4) * (y+offset) + (x+offset));
     return array[k];
 }
 float fetchf(__global float* array, unsigned int x, unsigned int y, unsigned int offset){
-    unsigned int k = ((Nx+4) * (y+offset) + (x+offset));
+    index_t k = ((index_t)(Nx+4) * (y+offset) + (x+offset));
     return array[k];
 }
 void store(__global float4* array, float4 value, unsigned int x, unsigned int y, unsigned int offset){
-    unsigned int k = ((Nx+4) * (y+offset) + (x+offset));
+    index_t k = ((index_t)(Nx+4) * (y+offset) + (x+offset));
     array[k] = value;
 }
 void storef(__global float* array, float value, unsigned int x, unsigned int y, unsigned int offset){
-    unsigned int k = ((Nx+4) * (y+offset) + (x+offset));
+    index_t k = ((index_t)(Nx+4) * (y+offset) + (x+offset));
     array[k] = value;
 }
 
@@ -145,6 +154,49 @@ __kernel void computeNumericalFlux(__global float4* Q_in, __global float4* Sx_in
     //store(G_out, (float)y+1, x, y, 2);
 }
 
+/****
+ *
+ * The two flux directions as kernels of their own, so they can run side by
+ * side. Launched with a global offset past the edge row and column the RK
+ * step never reads, so they need no branch for it.
+ *
+ ****/
+__kernel void computeNumericalFluxX(__global float4* Q_in, __global float4* Sx_in, __global float4* Sy_in,
+                                    float g, __global float4* F_out){
+    unsigned int x = get_global_id(0);
+    unsigned int y = get_global_id(1);
+    
+    const float k = 0.2886751346f;
+    
+    float4 Q    = fetch(Q_in,x,y,1);
+    float4 Sx   = fetch(Sx_in,x,y,1);
+    float4 Sy   = fetch(Sy_in,x,y,1);
+    
+    float4 Q1   = fetch(Q_in,x+1,y,1);
+    float4 Sxp  = fetch(Sx_in,x+1,y,1);
+    float4 Syp  = fetch(Sy_in,x+1,y,1);
+    
+    store(F_out, xFlux(k, g, Q, Q1, Sx, Sy, Sxp, Syp), x, y, 1);
+}
+
+__kernel void computeNumericalFluxY(__global float4* Q_in, __global float4* Sx_in, __global float4* Sy_in,
+                                    float g, __global float4* G_out){
+    unsigned int x = get_global_id(0);
+    unsigned int y = get_global_id(1);
+    
+    const float k = 0.2886751346f;
+    
+    float4 Q    = fetch(Q_in,x,y,1);
+    float4 Sx   = fetch(Sx_in,x,y,1);
+    float4 Sy   = fetch(Sy_in,x,y,1);
+    
+    float4 Q1   = fetch(Q_in,x,y+1,1);
+    float4 Sxp  = fetch(Sx_in,x,y+1,1);
+    float4 Syp  = fetch(Sy_in,x,y+1,1);
+    
+    store(G_out, yFlux(k, g, Q, Q1, Sx, Sy, Sxp, Syp), x, y, 1);
+}
+
 
 /****
  *
@@ -1,6 +1,27 @@
+/***
+ * Index type, 64 bit for buffers past the reach of 32 bit indices
+ ****/
+#ifdef LARGE_GRID
+typedef ulong index_t;
+#else
+typedef uint index_t;
+#endif
+
+/***
+ * Cell layout, rows of Nx+4 cells by default. LAYOUT_TILES stores the
+ * cells of TILE x TILE blocks together, row by row within a block, and
+ * LAYOUT_MORTON in Z-order within a block, so y neighbours are close.
+ ****/
+#ifndef TILE
+#define TILE 32
+#endif
+#define TILES_X ((Nx+4+TILE-1)/TILE)
+
 /***
  * Function dec
  ****/
+index_t cellIndex(unsigned int x, unsigned int y);
+unsigned int spreadBits(unsigned int v);
 float4  fetch(__global float4* array, unsigned int x, unsigned int y, unsigned int offset);
 float   fetchf(__global float* array, unsigned int x, unsigned int y, unsigned int offset);
 void    store(__global float4* array, float4 value, unsigned int x, unsigned int y, unsigned int offset);
@@ -11,20 +32,39 @@ void    storef(__global float* array, float value, unsigned int x, unsigned int
  * Utils
  *
  ****/
+unsigned int spreadBits(unsigned int v){
+    // Bit i moves to bit 2i, for v below 256
+    v = (v | (v << 4)) & 0x0F0F;
+    v = (v | (v << 2)) & 0x3333;
+    v = (v | (v << 1)) & 0x5555;
+    return v;
+}
+index_t cellIndex(unsigned int x, unsigned int y){
+#if defined(LAYOUT_TILES) || defined(LAYOUT_MORTON)
+    index_t tile = (index_t)(y/TILE)*TILES_X + x/TILE;
+#ifdef LAYOUT_MORTON
+    return tile*TILE*TILE + (spreadBits(x%TILE) | (spreadBits(y%TILE) << 1));
+#else
+    return tile*TILE*TILE + (y%TILE)*TILE + x%TILE;
+#endif
+#else
+    return (index_t)(Nx+4)*y + x;
+#endif
+}
 float4 fetch(__global float4* array, unsigned int x, unsigned int y, unsigned int offset){
-    unsigned int k = ((Nx+4) * (y+offset) + (x+offset));
+    index_t k = cellIndex(x+offset, y+offset);
     return array[k];
 }
 float fetchf(__global float* array, unsigned int x, unsigned int y, unsigned int offset){
-    unsigned int k = ((Nx+4) * (y+offset) + (x+offset));
+    index_t k = cellIndex(x+offset, y+offset);
     return array[k];
 }
 void store(__global float4* array, float4 value, unsigned int x, unsigned int y, unsigned int offset){
-    unsigned int k = ((Nx+4) * (y+offset) + (x+offset));
+    index_t k = cellIndex(x+offset, y+offset);
     array[k] = value;
 }
 void storef(__global float* array, float value, unsigned int x, unsigned int y, unsigned int offset){
-    unsigned int k = ((Nx+4) * (y+offset) + (x+offset));
+    index_t k = cellIndex(x+offset, y+offset);
     array[k] = value;
 }
 
@@ -33,46 +73,51 @@ void storef(__global float* array, float value, unsigned int x, unsigned int y,
  * Set boundary conditions
  *
  ****/
-__kernel void setBoundsX(__global float4* Q){
+__kernel void setBoundsX(__global float4* Q, unsigned int rows, unsigned int sides){
     unsigned int i = get_global_id(0);
     
-    unsigned int Nx0 = Nx+4;
-    unsigned int Ny0 = Ny+4;
+    // Buffers hold rows interior rows, bit 0 of sides is the bottom edge
+    // and bit 1 the top one, bands in between have neither
+    unsigned int Ny0 = rows+4;
     
-    unsigned int k0 = (Nx0 * 0 + (i+2));
-    unsigned int k1 = (Nx0 * 1 + (i+2));
-    unsigned int k2 = (Nx0 * 2 + (i+2));
-    unsigned int k3 = (Nx0 * 3 + (i+2));
-    Q[k0] = Q[k1] = Q[k2];
-    //Q[k0] = (float4)(Q[k3].x,Q[k3].y,-Q[k3].z,Q[k3].w);
-    //Q[k1] = (float4)(Q[k2].x,Q[k2].y,-Q[k2].z,Q[k2].w);
+    index_t k0, k1, k2, k3;
+    if (sides & 1) {
+        k0 = cellIndex(i+2, 0);
+        k1 = cellIndex(i+2, 1);
+        k2 = cellIndex(i+2, 2);
+        k3 = cellIndex(i+2, 3);
+        Q[k0] = Q[k1] = Q[k2];
+        //Q[k0] = (float4)(Q[k3].x,Q[k3].y,-Q[k3].z,Q[k3].w);
+        //Q[k1] = (float4)(Q[k2].x,Q[k2].y,-Q[k2].z,Q[k2].w);
+    }
     
-    k0 = (Nx0 * (Ny0-1) + (i+2));
-    k1 = (Nx0 * (Ny0-2) + (i+2));
-    k2 = (Nx0 * (Ny0-3) + (i+2));
-    k3 = (Nx0 * (Ny0-4) + (i+2));
-    Q[k0] = Q[k1] = Q[k2];
-    //Q[k0] = (float4)(Q[k3].x,Q[k3].y,-Q[k3].z,Q[k3].w);
-    //Q[k1] = (float4)(Q[k2].x,Q[k2].y,-Q[k2].z,Q[k2].w);
+    if (sides & 2) {
+        k0 = cellIndex(i+2, Ny0-1);
+        k1 = cellIndex(i+2, Ny0-2);
+        k2 = cellIndex(i+2, Ny0-3);
+        k3 = cellIndex(i+2, Ny0-4);
+        Q[k0] = Q[k1] = Q[k2];
+        //Q[k0] = (float4)(Q[k3].x,Q[k3].y,-Q[k3].z,Q[k3].w);
+        //Q[k1] = (float4)(Q[k2].x,Q[k2].y,-Q[k2].z,Q[k2].w);
+    }
 }
 __kernel void setBoundsY(__global float4* Q){
     unsigned int i = get_global_id(0);
     
     unsigned int Nx0 = Nx+4;
-    unsigned int Ny0 = Ny+4;
 
-    unsigned int k0 = (Nx0 * (i+2) + 0);
-    unsigned int k1 = (Nx0 * (i+2) + 1);
-    unsigned int k2 = (Nx0 * (i+2) + 2);
-    unsigned int k3 = (Nx0 * (i+2) + 3);
+    index_t k0 = cellIndex(0, i+2);
+    index_t k1 = cellIndex(1, i+2);
+    index_t k2 = cellIndex(2, i+2);
+    index_t k3 = cellIndex(3, i+2);
     Q[k0] = Q[k1] = Q[k2];
     //Q[k0] = (float4)(Q[k3].x,-Q[k3].y,Q[k3].z,Q[k3].w);
     //Q[k1] = (float4)(Q[k2].x,-Q[k2].y,Q[k2].z,Q[k2].w);
     
-    k0 = (Nx0 * (i+2) + (Nx0-1));
-    k1 = (Nx0 * (i+2) + (Nx0-2));
-    k2 = (Nx0 * (i+2) + (Nx0-3));
-    k3 = (Nx0 * (i+2) + (Nx0-4));
+    k0 = cellIndex(Nx0-1, i+2);
+    k1 = cellIndex(Nx0-2, i+2);
+    k2 = cellIndex(Nx0-3, i+2);
+    k3 = cellIndex(Nx0-4, i+2);
     Q[k0] = Q[k1] = Q[k2];
     //Q[k0] = (float4)(Q[k3].x,-Q[k3].y,Q[k3].z,Q[k3].w);
     //Q[k1] = (float4)(Q[k2].x,-Q[k2].y,Q[k2].z,Q[k2].w);
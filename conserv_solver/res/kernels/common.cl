@@ -1,33 +1,95 @@
+/***
+ * Index type, 64 bit for buffers past the reach of 32 bit indices
+ ****/
+#ifdef LARGE_GRID
+typedef ulong index_t;
+#else
+typedef uint index_t;
+#endif
+
+/***
+ * Cell layout, rows of Nx+4 cells by default. LAYOUT_TILES stores the
+ * cells of TILE x TILE blocks together, row by row within a block, and
+ * LAYOUT_MORTON in Z-order within a block, so y neighbours are close.
+ ****/
+#ifndef TILE
+#define TILE 32
+#endif
+#define TILES_X ((Nx+4+TILE-1)/TILE)
+
+/***
+ * Cells a work-item walks along x in the coarsened kernels, neighbours
+ * loaded for one cell stay in registers for the next
+ ****/
+#ifndef COARSEN
+#define COARSEN 1
+#endif
+
 /***
  * Function dec
  ****/
+index_t cellIndex(unsigned int x, unsigned int y);
+unsigned int spreadBits(unsigned int v);
 float4  minmod(float4 a, float4 b);
 float4  fetch(__global float4* array, unsigned int x, unsigned int y, unsigned int offset);
 float   fetchf(__global float* array, unsigned int x, unsigned int y, unsigned int offset);
 void    store(__global float4* array, float4 value, unsigned int x, unsigned int y, unsigned int offset);
 void    storef(__global float* array, float value, unsigned int x, unsigned int y, unsigned int offset);
+float4  fetchImage(__read_only image2d_t image, unsigned int x, unsigned int y, unsigned int offset);
+void    storeImage(__write_only image2d_t image, float4 value, unsigned int x, unsigned int y, unsigned int offset);
+
+/***
+ * Image reads go through the texture cache, coordinates are clamped to the
+ * edge in hardware
+ ****/
+__constant sampler_t nearest = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_NEAREST;
 
 /****
  *
  * Utils
  *
  ****/
+unsigned int spreadBits(unsigned int v){
+    // Bit i moves to bit 2i, for v below 256
+    v = (v | (v << 4)) & 0x0F0F;
+    v = (v | (v << 2)) & 0x3333;
+    v = (v | (v << 1)) & 0x5555;
+    return v;
+}
+index_t cellIndex(unsigned int x, unsigned int y){
+#if defined(LAYOUT_TILES) || defined(LAYOUT_MORTON)
+    index_t tile = (index_t)(y/TILE)*TILES_X + x/TILE;
+#ifdef LAYOUT_MORTON
+    return tile*TILE*TILE + (spreadBits(x%TILE) | (spreadBits(y%TILE) << 1));
+#else
+    return tile*TILE*TILE + (y%TILE)*TILE + x%TILE;
+#endif
+#else
+    return (index_t)(Nx+4)*y + x;
+#endif
+}
 float4 fetch(__global float4* array, unsigned int x, unsigned int y, unsigned int offset){
-    unsigned int k = ((Nx+4) * (y+offset) + (x+offset));
+    index_t k = cellIndex(x+offset, y+offset);
     return array[k];
 }
 float fetchf(__global float* array, unsigned int x, unsigned int y, unsigned int offset){
-    unsigned int k = ((Nx+4) * (y+offset) + (x+offset));
+    index_t k = cellIndex(x+offset, y+offset);
     return array[k];
 }
 void store(__global float4* array, float4 value, unsigned int x, unsigned int y, unsigned int offset){
-    unsigned int k = ((Nx+4) * (y+offset) + (x+offset));
+    index_t k = cellIndex(x+offset, y+offset);
     array[k] = value;
 }
 void storef(__global float* array, float value, unsigned int x, unsigned int y, unsigned int offset){
-    unsigned int k = ((Nx+4) * (y+offset) + (x+offset));
+    index_t k = cellIndex(x+offset, y+offset);
     array[k] = value;
 }
+float4 fetchImage(__read_only image2d_t image, unsigned int x, unsigned int y, unsigned int offset){
+    return read_imagef(image, nearest, (int2)(x+offset,y+offset));
+}
+void storeImage(__write_only image2d_t image, float4 value, unsigned int x, unsigned int y, unsigned int offset){
+    write_imagef(image, (int2)(x+offset,y+offset), value);
+}
 
 /****
  *
@@ -41,6 +103,31 @@ float4 minmod(float4 a, float4 b){
 
 __kernel void piecewiseReconstruction(__global float4* Q_in,
                                       __global float4* Sx_out, __global float4* Sy_out){
+#if COARSEN > 1
+    unsigned int x0 = get_global_id(0)*COARSEN;
+    unsigned int y  = get_global_id(1);
+    
+    float4 QW   = fetch(Q_in,x0-1,y,1);
+    float4 Q    = fetch(Q_in,x0,y,1);
+    
+    #pragma unroll
+    for (unsigned int i = 0; i < COARSEN; i++) {
+        unsigned int x = x0+i;
+        if (x >= Nx+2) {
+            break;
+        }
+        
+        float4 QE   = fetch(Q_in,x+1,y,1);
+        float4 QN   = fetch(Q_in,x,y+1,1);
+        float4 QS   = fetch(Q_in,x,y-1,1);
+        
+        store(Sx_out, minmod(Q-QW,QE-Q), x, y, 1);
+        store(Sy_out, minmod(Q-QS,QN-Q), x, y, 1);
+        
+        QW  = Q;
+        Q   = QE;
+    }
+#else
     unsigned int x = get_global_id(0);
     unsigned int y = get_global_id(1);
     
@@ -52,6 +139,28 @@ __kernel void piecewiseReconstruction(__global float4* Q_in,
     
     store(Sx_out, minmod(Q-QW,QE-Q), x, y, 1);
     store(Sy_out, minmod(Q-QS,QN-Q), x, y, 1);
+#endif
+}
+
+/****
+ *
+ * Reconstruction reading the state through an image, the slopes are written
+ * to images for the flux kernel to read the same way
+ *
+ ****/
+__kernel void piecewiseReconstructionImage(__read_only image2d_t Q_in,
+                                           __write_only image2d_t Sx_out, __write_only image2d_t Sy_out){
+    unsigned int x = get_global_id(0);
+    unsigned int y = get_global_id(1);
+    
+    float4 Q    = fetchImage(Q_in,x,y,1);
+    float4 QE   = fetchImage(Q_in,x+1,y,1);
+    float4 QW   = fetchImage(Q_in,x-1,y,1);
+    float4 QN   = fetchImage(Q_in,x,y+1,1);
+    float4 QS   = fetchImage(Q_in,x,y-1,1);
+    
+    storeImage(Sx_out, minmod(Q-QW,QE-Q), x, y, 1);
+    storeImage(Sy_out, minmod(Q-QS,QN-Q), x, y, 1);
 }
 
 /****
@@ -60,10 +169,39 @@ __kernel void piecewiseReconstruction(__global float4* Q_in,
  *
  ****/
 __kernel void computeRK(__global float4* Q_in, __global float4* Qk_in, __global float4* F_in,
-                        __global float4* G_in, float2 c, float2 dXY, float dT, __global float4* Q_out){
+                        __global float4* G_in, float2 c, float2 dXY, __global const float* dT_in,
+                        __global float4* Q_out){
     unsigned int x = get_global_id(0);
     unsigned int y = get_global_id(1);
     
+    // dt lives on the device so the kernel arguments stay the same every step
+    float dT    = dT_in[0];
+    
+#if COARSEN > 1
+    unsigned int x0 = x*COARSEN;
+    float4 FW   = fetch(F_in,x0-1,y,2);
+    
+    #pragma unroll
+    for (unsigned int i = 0; i < COARSEN; i++) {
+        x = x0+i;
+        if (x >= Nx) {
+            break;
+        }
+        
+        float4 FE   = fetch(F_in,x,y,2);
+        float4 GN   = fetch(G_in,x,y,2);
+        float4 GS   = fetch(G_in,x,y-1,2);
+        
+        float4 L    = -((FE-FW)/dXY.x+(GN-GS)/dXY.y);
+        
+        float4 Q    = fetch(Q_in,x,y,2);
+        float4 Qk   = fetch(Qk_in,x,y,2);
+        
+        store(Q_out, c.x*Q+c.y*(Qk+dT*L), x, y,2);
+        
+        FW  = FE;
+    }
+#else
     float4 FE   = fetch(F_in,x,y,2);
     float4 FW   = fetch(F_in,x-1,y,2);
     float4 GN   = fetch(G_in,x,y,2);
@@ -76,6 +214,7 @@ __kernel void computeRK(__global float4* Q_in, __global float4* Qk_in, __global
     
     float4 v    = c.x*Q+c.y*(Qk+dT*L);
     store(Q_out, v, x, y,2);
+#endif
 }
 
 /****
@@ -88,19 +227,88 @@ __kernel void copy(__global float4* Q_in, __global float4* Q_out){
     unsigned int y = get_global_id(1);
     
     // copy with ghost cells
-    size_t k = ((Nx+4) * y + x);
+    index_t k = cellIndex(x, y);
     Q_out[k] = Q_in[k];
 }
 
 /****
  *
- * Prepare for visualization
+ * Copy whole rows, ghost columns included, from row src_row on of one
+ * buffer to row dst_row on of another. Seams of the blocked layouts,
+ * where a row is not contiguous.
  *
  ****/
-__kernel void copyToTexture(__global float4* Q_in, __write_only image2d_t tex_out){
+__kernel void copyRows(__global float4* Q_in, __global float4* Q_out,
+                       unsigned int src_row, unsigned int dst_row){
     unsigned int x = get_global_id(0);
     unsigned int y = get_global_id(1);
     
-    size_t k = ((Nx+4) * (y+2) + (x+2));
-    write_imagef(tex_out, (int2)(x,y), Q_in[k]);
-}
\ No newline at end of file
+    store(Q_out, fetch(Q_in, x, src_row+y, 0), x, dst_row+y, 0);
+}
+
+/****
+ *
+ * Prepare for visualization, every stride'th cell when the grid is larger
+ * than a texture can be. Texel rows from tex_row on are taken from buffer
+ * rows src_row, src_row+stride, ...
+ *
+ ****/
+__kernel void copyToTexture(__global float4* Q_in, __write_only image2d_t tex_out,
+                            unsigned int stride, unsigned int src_row, unsigned int tex_row){
+    unsigned int x = get_global_id(0);
+    unsigned int y = get_global_id(1);
+    
+    write_imagef(tex_out, (int2)(x,tex_row+y), fetch(Q_in, x*stride, src_row+y*stride, 2));
+}
+
+/****
+ *
+ * Copy a state buffer, ghost cells included, into an image of the same size
+ *
+ ****/
+__kernel void copyToImage(__global float4* Q_in, __write_only image2d_t Q_out){
+    unsigned int x = get_global_id(0);
+    unsigned int y = get_global_id(1);
+    
+    storeImage(Q_out, fetch(Q_in,x,y,0), x, y, 0);
+}
+
+/****
+ *
+ * Gather a decimated subregion, keeping only the selected components
+ * (bit c of fields selects component c), packed row by row
+ *
+ ****/
+__kernel void extractRegion(__global float4* Q_in, __global float* out,
+                            unsigned int x0, unsigned int y0, unsigned int stride, unsigned int fields){
+    unsigned int x = get_global_id(0);
+    unsigned int y = get_global_id(1);
+    
+    float4 Q    = fetch(Q_in, x0+x*stride, y0+y*stride, 2);
+    float q[4]  = {Q.x, Q.y, Q.z, Q.w};
+    
+    unsigned int n = 0;
+    for (unsigned int c = 0; c < 4; c++) {
+        n += (fields >> c) & 1;
+    }
+    
+    index_t k = ((index_t)get_global_size(0)*y + x)*n;
+    for (unsigned int c = 0; c < 4; c++) {
+        if (fields & (1 << c)) {
+            out[k++] = q[c];
+        }
+    }
+}
+/****
+ *
+ * Record the state at probe cells into one slot of the ring buffer. Cells
+ * hold x and y within the band and the probe number, work-items start at
+ * cell first.
+ *
+ ****/
+__kernel void sampleProbes(__global float4* Q_in, __global int4* cells,
+                           __global float4* ring, unsigned int slot, unsigned int probes,
+                           unsigned int first){
+    int4 cell   = cells[first + get_global_id(0)];
+    ring[slot*probes + cell.z] = fetch(Q_in, cell.x, cell.y, 2);
+}
@@ -1,37 +1,106 @@
+/***
+ * Index type, 64 bit for buffers past the reach of 32 bit indices
+ ****/
+#ifdef LARGE_GRID
+typedef ulong index_t;
+#else
+typedef uint index_t;
+#endif
+
+/***
+ * Cell layout, rows of Nx+4 cells by default. LAYOUT_TILES stores the
+ * cells of TILE x TILE blocks together, row by row within a block, and
+ * LAYOUT_MORTON in Z-order within a block, so y neighbours are close.
+ ****/
+#ifndef TILE
+#define TILE 32
+#endif
+#define TILES_X ((Nx+4+TILE-1)/TILE)
+
+/***
+ * Gauss points per face the fluxes are integrated with, 2 for the two
+ * point Gauss rule, 1 for the midpoint rule at half the flux work
+ ****/
+#ifndef FLUX_QUADRATURE
+#define FLUX_QUADRATURE 2
+#endif
+
+/***
+ * Cells a work-item walks along x in the coarsened kernels, neighbours
+ * loaded for one cell stay in registers for the next
+ ****/
+#ifndef COARSEN
+#define COARSEN 1
+#endif
+
 /***
  * Function dec
  ****/
+index_t cellIndex(unsigned int x, unsigned int y);
+unsigned int spreadBits(unsigned int v);
 float   pressure(float gamma, float4 Q);
 float4  fflux(float gamma, float4 Q);
 float4  gflux(float gamma, float4 Q);
+float4  primitives(float gamma, float4 Q);
+float4  ffluxW(float4 Q, float4 W);
+float4  gfluxW(float4 Q, float4 W);
 float4  xFlux(float k, float gamma, float4 Q, float4 Q1, float4 Sx, float4 Sy, float4 Sxp, float4 Syp);
 float4  yFlux(float k, float gamma, float4 Q, float4 Q1, float4 Sx, float4 Sy, float4 Sxp, float4 Syp);
 float4  fetch(__global float4* array, unsigned int x, unsigned int y, unsigned int offset);
 float   fetchf(__global float* array, unsigned int x, unsigned int y, unsigned int offset);
 void    store(__global float4* array, float4 value, unsigned int x, unsigned int y, unsigned int offset);
 void    storef(__global float* array, float value, unsigned int x, unsigned int y, unsigned int offset);
+float4  fetchImage(__read_only image2d_t image, unsigned int x, unsigned int y, unsigned int offset);
+
+/***
+ * Image reads go through the texture cache, coordinates are clamped to the
+ * edge in hardware
+ ****/
+__constant sampler_t nearest = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_NEAREST;
 
 /****
  *
  * Utils
  *
  ****/
+unsigned int spreadBits(unsigned int v){
+    // Bit i moves to bit 2i, for v below 256
+    v = (v | (v << 4)) & 0x0F0F;
+    v = (v | (v << 2)) & 0x3333;
+    v = (v | (v << 1)) & 0x5555;
+    return v;
+}
+index_t cellIndex(unsigned int x, unsigned int y){
+#if defined(LAYOUT_TILES) || defined(LAYOUT_MORTON)
+    index_t tile = (index_t)(y/TILE)*TILES_X + x/TILE;
+#ifdef LAYOUT_MORTON
+    return tile*TILE*TILE + (spreadBits(x%TILE) | (spreadBits(y%TILE) << 1));
+#else
+    return tile*TILE*TILE + (y%TILE)*TILE + x%TILE;
+#endif
+#else
+    return (index_t)(Nx+4)*y + x;
+#endif
+}
 float4 fetch(__global float4* array, unsigned int x, unsigned int y, unsigned int offset){
-    unsigned int k = ((Nx+4) * (y+offset) + (x+offset));
+    index_t k = cellIndex(x+offset, y+offset);
     return array[k];
 }
 float fetchf(__global float* array, unsigned int x, unsigned int y, unsigned int offset){
-    unsigned int k = ((Nx+4) * (y+offset) + (x+offset));
+    index_t k = cellIndex(x+offset, y+offset);
     return array[k];
 }
 void store(__global float4* array, float4 value, unsigned int x, unsigned int y, unsigned int offset){
-    unsigned int k = ((Nx+4) * (y+offset) + (x+offset));
+    index_t k = cellIndex(x+offset, y+offset);
     array[k] = value;
 }
 void storef(__global float* array, float value, unsigned int x, unsigned int y, unsigned int offset){
-    unsigned int k = ((Nx+4) * (y+offset) + (x+offset));
+    index_t k = cellIndex(x+offset, y+offset);
     array[k] = value;
 }
+float4 fetchImage(__read_only image2d_t image, unsigned int x, unsigned int y, unsigned int offset){
+    return read_imagef(image, nearest, (int2)(x+offset,y+offset));
+}
 
 /****
  *
@@ -54,16 +123,54 @@ float4 gflux(float gamma, float4 Q){
     return (float4)(Q.z, Q.y*v, (Q.z*v)+p, v*(Q.w+p));
 }
 
+/***
+ * With SHARED_PRIMITIVES every state gets its reciprocal density, velocity
+ * and pressure once, W = (1/rho, u, v, p), which its flux and wave speeds
+ * then share. One division per state instead of up to three.
+ ****/
+float4 primitives(float gamma, float4 Q){
+    float r     = 1.0f/Q.x;
+    float2 uv   = Q.yz*r;
+    return (float4)(r, uv, (gamma-1.0f)*(Q.w-0.5f*dot(Q.yz,uv)));
+}
+
+float4 ffluxW(float4 Q, float4 W){
+    return (float4)(Q.y, (Q.y*W.y)+W.w, Q.z*W.y, W.y*(Q.w+W.w));
+}
+
+float4 gfluxW(float4 Q, float4 W){
+    return (float4)(Q.z, Q.y*W.z, (Q.z*W.z)+W.w, W.z*(Q.w+W.w));
+}
+
 float4 xFlux(float k, float gamma, float4 Q, float4 Q1, float4 Sx, float4 Sy, float4 Sxp, float4 Syp){
     float4 QW   = Q + Sx*0.5f;
-    float4 QWp  = Q + Sx*0.5f + Sy*k;
-    float4 QWm  = Q + Sx*0.5f - Sy*k;
-    
     float4 QE   = Q1 - Sxp*0.5f;
-    float4 QEp  = Q1 - Sxp*0.5f + Syp*k;
-    float4 QEm  = Q1 - Sxp*0.5f - Syp*k;
     
     float c, ap, am;
+#ifdef SHARED_PRIMITIVES
+    float4 WW   = primitives(gamma, QW);
+    float4 WE   = primitives(gamma, QE);
+    c           = sqrt(gamma*WW.w*WW.x);
+    ap          = max(WW.y+c,0.0f);
+    am          = min(WW.y-c,0.0f);
+    c           = sqrt(gamma*WE.w*WE.x);
+    ap          = max(WE.y+c,ap);
+    am          = min(WE.y-c,am);
+    
+    float d     = 1.0f/(ap-am);
+#if FLUX_QUADRATURE == 1
+    return ((ap*ffluxW(QW, WW) - am*ffluxW(QE, WE)) + (ap*am)*(QE-QW))*d;
+#else
+    float4 QWp  = QW + Sy*k;
+    float4 QWm  = QW - Sy*k;
+    float4 QEp  = QE + Syp*k;
+    float4 QEm  = QE - Syp*k;
+    
+    float4 Fp   = ((ap*ffluxW(QWp, primitives(gamma, QWp)) - am*ffluxW(QEp, primitives(gamma, QEp))) + (ap*am)*(QEp-QWp))*d;
+    float4 Fm   = ((ap*ffluxW(QWm, primitives(gamma, QWm)) - am*ffluxW(QEm, primitives(gamma, QEm))) + (ap*am)*(QEm-QWm))*d;
+    return mix(Fp, Fm, 0.5f);
+#endif
+#else
     c           = sqrt(gamma*QW.x*pressure(gamma, QW));
     ap          = max((QW.y+c)/QW.x,0.0f);
     am          = min((QW.y-c)/QW.x,0.0f);
@@ -71,21 +178,50 @@ float4 xFlux(float k, float gamma, float4 Q, float4 Q1, float4 Sx, float4 Sy, fl
     ap          = max((QE.y+c)/QE.x,ap);
     am          = min((QE.y-c)/QE.x,am);
     
+#if FLUX_QUADRATURE == 1
+    return ((ap*fflux(gamma, QW) - am*fflux(gamma, QE)) + (ap*am)*(QE-QW))/(ap-am);
+#else
+    float4 QWp  = QW + Sy*k;
+    float4 QWm  = QW - Sy*k;
+    float4 QEp  = QE + Syp*k;
+    float4 QEm  = QE - Syp*k;
+    
     float4 Fp   = ((ap*fflux(gamma, QWp) - am*fflux(gamma, QEp)) + (ap*am)*(QEp-QWp))/(ap-am);
     float4 Fm   = ((ap*fflux(gamma, QWm) - am*fflux(gamma, QEm)) + (ap*am)*(QEm-QWm))/(ap-am);
     return mix(Fp, Fm, 0.5f);
+#endif
+#endif
 }
 
 float4 yFlux(float k, float gamma, float4 Q, float4 Q1, float4 Sx, float4 Sy, float4 Sxp, float4 Syp){
     float4 QS   = Q + Sy*0.5f;
-    float4 QSp  = Q + Sy*0.5f + Sx*k;
-    float4 QSm  = Q + Sy*0.5f - Sx*k;
-    
     float4 QN   = Q1 - Syp*0.5f;
-    float4 QNp  = Q1 - Syp*0.5f + Sxp*k;
-    float4 QNm  = Q1 - Syp*0.5f - Sxp*k;
     
     float c, ap, am;
+#ifdef SHARED_PRIMITIVES
+    float4 WS   = primitives(gamma, QS);
+    float4 WN   = primitives(gamma, QN);
+    c           = sqrt(gamma*WS.w*WS.x);
+    ap          = max(WS.z+c,0.0f);
+    am          = min(WS.z-c,0.0f);
+    c           = sqrt(gamma*WN.w*WN.x);
+    ap          = max(WN.z+c,ap);
+    am          = min(WN.z-c,am);
+    
+    float d     = 1.0f/(ap-am);
+#if FLUX_QUADRATURE == 1
+    return ((ap*gfluxW(QS, WS) - am*gfluxW(QN, WN)) + (ap*am)*(QN-QS))*d;
+#else
+    float4 QSp  = QS + Sx*k;
+    float4 QSm  = QS - Sx*k;
+    float4 QNp  = QN + Sxp*k;
+    float4 QNm  = QN - Sxp*k;
+    
+    float4 Gp   = ((ap*gfluxW(QSp, primitives(gamma, QSp)) - am*gfluxW(QNp, primitives(gamma, QNp))) + (ap*am)*(QNp-QSp))*d;
+    float4 Gm   = ((ap*gfluxW(QSm, primitives(gamma, QSm)) - am*gfluxW(QNm, primitives(gamma, QNm))) + (ap*am)*(QNm-QSm))*d;
+    return mix(Gp, Gm, 0.5f);
+#endif
+#else
     c           = sqrt(gamma*QS.x*pressure(gamma, QS));
     ap          = max((QS.z+c)/QS.x,0.0f);
     am          = min((QS.z-c)/QS.x,0.0f);
@@ -93,18 +229,69 @@ float4 yFlux(float k, float gamma, float4 Q, float4 Q1, float4 Sx, float4 Sy, fl
     ap          = max((QN.z+c)/QN.x,ap);
     am          = min((QN.z-c)/QN.x,am);
     
+#if FLUX_QUADRATURE == 1
+    return ((ap*gflux(gamma, QS) - am*gflux(gamma, QN)) + (ap*am)*(QN-QS))/(ap-am);
+#else
+    float4 QSp  = QS + Sx*k;
+    float4 QSm  = QS - Sx*k;
+    float4 QNp  = QN + Sxp*k;
+    float4 QNm  = QN - Sxp*k;
+    
     float4 Gp   = ((ap*gflux(gamma, QSp) - am*gflux(gamma, QNp)) + (ap*am)*(QNp-QSp))/(ap-am);
     float4 Gm   = ((ap*gflux(gamma, QSm) - am*gflux(gamma, QNm)) + (ap*am)*(QNm-QSm))/(ap-am);
     return mix(Gp, Gm, 0.5f);
+#endif
+#endif
 }
 
 __kernel void computeNumericalFlux(__global float4* Q_in, __global float4* Sx_in, __global float4* Sy_in,
                                    float gamma, __global float4* F_out, __global float4* G_out){
+    const float k = 0.2886751346f;
+    
+#if COARSEN > 1
+    unsigned int x0 = get_global_id(0)*COARSEN;
+    unsigned int y  = get_global_id(1);
+    
+    // The east cell of one face is the west cell of the next
+    float4 Q    = fetch(Q_in,x0,y,1);
+    float4 Sx   = fetch(Sx_in,x0,y,1);
+    float4 Sy   = fetch(Sy_in,x0,y,1);
+    
+    #pragma unroll
+    for (unsigned int i = 0; i < COARSEN; i++) {
+        unsigned int x = x0+i;
+        if (x >= Nx+1) {
+            break;
+        }
+        
+        float4 Q1   = fetch(Q_in,x+1,y,1);
+        float4 Sxp  = fetch(Sx_in,x+1,y,1);
+        float4 Syp  = fetch(Sy_in,x+1,y,1);
+        
+        if(y == 0){
+            store(F_out, (float4)(0.0f,0.0f,0.0f,0.0f), x, y, 1);
+        }else{
+            store(F_out, xFlux(k, gamma, Q, Q1, Sx, Sy, Sxp, Syp), x, y, 1);
+        }
+        
+        float4 QN   = fetch(Q_in,x,y+1,1);
+        float4 SxN  = fetch(Sx_in,x,y+1,1);
+        float4 SyN  = fetch(Sy_in,x,y+1,1);
+        
+        if(x == 0){
+            store(G_out, (float4)(0.0f,0.0f,0.0f,0.0f), x, y, 1);
+        }else{
+            store(G_out, yFlux(k, gamma, Q, QN, Sx, Sy, SxN, SyN), x, y, 1);
+        }
+        
+        Q   = Q1;
+        Sx  = Sxp;
+        Sy  = Syp;
+    }
+#else
     unsigned int x = get_global_id(0);
     unsigned int y = get_global_id(1);
     
-    const float k = 0.2886751346f;
-    
     float4 Q    = fetch(Q_in,x,y,1);
     float4 Sx   = fetch(Sx_in,x,y,1);
     float4 Sy   = fetch(Sy_in,x,y,1);
@@ -130,6 +317,88 @@ __kernel void computeNumericalFlux(__global float4* Q_in, __global float4* Sx_in
         store(G_out, yFlux(k, gamma, Q, Q1, Sx, Sy, Sxp, Syp), x, y, 1);
     }
     //store(G_out, (float)y+1, x, y, 2);
+#endif
+}
+
+/****
+ *
+ * Fluxes reading the state and slopes through images
+ *
+ ****/
+__kernel void computeNumericalFluxImage(__read_only image2d_t Q_in, __read_only image2d_t Sx_in,
+                                        __read_only image2d_t Sy_in,
+                                        float gamma, __global float4* F_out, __global float4* G_out){
+    unsigned int x = get_global_id(0);
+    unsigned int y = get_global_id(1);
+    
+    const float k = 0.2886751346f;
+    
+    float4 Q    = fetchImage(Q_in,x,y,1);
+    float4 Sx   = fetchImage(Sx_in,x,y,1);
+    float4 Sy   = fetchImage(Sy_in,x,y,1);
+    
+    float4 Q1   = fetchImage(Q_in,x+1,y,1);
+    float4 Sxp  = fetchImage(Sx_in,x+1,y,1);
+    float4 Syp  = fetchImage(Sy_in,x+1,y,1);
+    
+    if(y == 0){
+        store(F_out, (float4)(0.0f,0.0f,0.0f,0.0f), x, y, 1);
+    }else{
+        store(F_out, xFlux(k, gamma, Q, Q1, Sx, Sy, Sxp, Syp), x, y, 1);
+    }
+    
+    Q1   = fetchImage(Q_in,x,y+1,1);
+    Sxp  = fetchImage(Sx_in,x,y+1,1);
+    Syp  = fetchImage(Sy_in,x,y+1,1);
+    
+    if(x == 0){
+        store(G_out, (float4)(0.0f,0.0f,0.0f,0.0f), x, y, 1);
+    }else{
+        store(G_out, yFlux(k, gamma, Q, Q1, Sx, Sy, Sxp, Syp), x, y, 1);
+    }
+}
+
+/****
+ *
+ * The two flux directions as kernels of their own, so they can run side by
+ * side. Launched with a global offset past the edge row and column the RK
+ * step never reads, so they need no branch for it.
+ *
+ ****/
+__kernel void computeNumericalFluxX(__global float4* Q_in, __global float4* Sx_in, __global float4* Sy_in,
+                                    float gamma, __global float4* F_out){
+    unsigned int x = get_global_id(0);
+    unsigned int y = get_global_id(1);
+    
+    const float k = 0.2886751346f;
+    
+    float4 Q    = fetch(Q_in,x,y,1);
+    float4 Sx   = fetch(Sx_in,x,y,1);
+    float4 Sy   = fetch(Sy_in,x,y,1);
+    
+    float4 Q1   = fetch(Q_in,x+1,y,1);
+    float4 Sxp  = fetch(Sx_in,x+1,y,1);
+    float4 Syp  = fetch(Sy_in,x+1,y,1);
+    
+    store(F_out, xFlux(k, gamma, Q, Q1, Sx, Sy, Sxp, Syp), x, y, 1);
+}
+
+__kernel void computeNumericalFluxY(__global float4* Q_in, __global float4* Sx_in, __global float4* Sy_in,
+                                    float gamma, __global float4* G_out){
+    unsigned int x = get_global_id(0);
+    unsigned int y = get_global_id(1);
+    
+    const float k = 0.2886751346f;
+    
+    float4 Q    = fetch(Q_in,x,y,1);
+    float4 Sx   = fetch(Sx_in,x,y,1);
+    float4 Sy   = fetch(Sy_in,x,y,1);
+    
+    float4 Q1   = fetch(Q_in,x,y+1,1);
+    float4 Sxp  = fetch(Sx_in,x,y+1,1);
+    float4 Syp  = fetch(Sy_in,x,y+1,1);
+    
+    store(G_out, yFlux(k, gamma, Q, Q1, Sx, Sy, Sxp, Syp), x, y, 1);
 }
 
 /****
@@ -142,8 +411,14 @@ __kernel void eigenvalue(__global float4* Q_in, float gamma, __global float* E_o
     unsigned int y = get_global_id(1);
     
     float4 Q    = fetch(Q_in, x, y,2);
+#ifdef SHARED_PRIMITIVES
+    float4 W    = primitives(gamma, Q);
+    float2 uv   = W.yz;
+    float c     = sqrt(gamma*W.w*W.x);
+#else
     float2 uv   = Q.yz/Q.x;
     float c     = sqrt(gamma*pressure(gamma,Q)/Q.x);
+#endif
     
     float eigen;
     eigen = max(fabs(uv.x)-c,0.0f);
@@ -1,6 +1,27 @@
+/***
+ * Index type, 64 bit for buffers past the reach of 32 bit indices
+ ****/
+#ifdef LARGE_GRID
+typedef ulong index_t;
+#else
+typedef uint index_t;
+#endif
+
+/***
+ * Cell layout, rows of Nx+4 cells by default. LAYOUT_TILES stores the
+ * cells of TILE x TILE blocks together, row by row within a block, and
+ * LAYOUT_MORTON in Z-order within a block, so y neighbours are close.
+ ****/
+#ifndef TILE
+#define TILE 32
+#endif
+#define TILES_X ((Nx+4+TILE-1)/TILE)
+
 /***
  * Function dec
  ****/
+index_t cellIndex(unsigned int x, unsigned int y);
+unsigned int spreadBits(unsigned int v);
 float4  dambreakAt(float2 pos);
 float4  shockbubbleAt(float gamma, float2 pos);
 float4  riemannAt(float gamma, float2 pos, float4 R1, float4 R2, float4 R3, float4 R4);
@@ -17,20 +38,39 @@ void    storef(__global float* array, float value, unsigned int x, unsigned int
  * Utils
  *
  ****/
+unsigned int spreadBits(unsigned int v){
+    // Bit i moves to bit 2i, for v below 256
+    v = (v | (v << 4)) & 0x0F0F;
+    v = (v | (v << 2)) & 0x3333;
+    v = (v | (v << 1)) & 0x5555;
+    return v;
+}
+index_t cellIndex(unsigned int x, unsigned int y){
+#if defined(LAYOUT_TILES) || defined(LAYOUT_MORTON)
+    index_t tile = (index_t)(y/TILE)*TILES_X + x/TILE;
+#ifdef LAYOUT_MORTON
+    return tile*TILE*TILE + (spreadBits(x%TILE) | (spreadBits(y%TILE) << 1));
+#else
+    return tile*TILE*TILE + (y%TILE)*TILE + x%TILE;
+#endif
+#else
+    return (index_t)(Nx+4)*y + x;
+#endif
+}
 float4 fetch(__global float4* array, unsigned int x, unsigned int y, unsigned int offset){
-    unsigned int k = ((Nx+4) * (y+offset) + (x+offset));
+    index_t k = cellIndex(x+offset, y+offset);
     return array[k];
 }
 float fetchf(__global float* array, unsigned int x, unsigned int y, unsigned int offset){
-    unsigned int k = ((Nx+4) * (y+offset) + (x+offset));
+    index_t k = cellIndex(x+offset, y+offset);
     return array[k];
 }
 void store(__global float4* array, float4 value, unsigned int x, unsigned int y, unsigned int offset){
-    unsigned int k = ((Nx+4) * (y+offset) + (x+offset));
+    index_t k = cellIndex(x+offset, y+offset);
     array[k] = value;
 }
 void storef(__global float* array, float value, unsigned int x, unsigned int y, unsigned int offset){
-    unsigned int k = ((Nx+4) * (y+offset) + (x+offset));
+    index_t k = cellIndex(x+offset, y+offset);
     array[k] = value;
 }
 
@@ -49,14 +89,14 @@ float4 dambreakAt(float2 pos){
     return value;
 }
 
-__kernel void dambreak(float g, float2 dXY, __global float4* Q_out){
+__kernel void dambreak(float g, float2 dXY, __global float4* Q_out, unsigned int y_offset){
     unsigned int x = get_global_id(0);
     unsigned int y = get_global_id(1);
     
     float xfac  = 0.28867513459481288225f*dXY.x;
     float yfac  = 0.28867513459481288225f*dXY.y;
     
-    float2 pos  = (float2)((float)x/(float)Nx,(float)y/(float)Ny);
+    float2 pos  = (float2)((float)x/(float)Nx,(float)(y+y_offset)/(float)Ny);
     float2 pos0 = (float2)(pos.x-xfac, pos.y-yfac);
     float2 pos1 = (float2)(pos.x+xfac, pos.y-yfac);
     float2 pos2 = (float2)(pos.x-xfac, pos.y+yfac);
@@ -101,14 +141,14 @@ float4 shockbubbleAt(float gamma, float2 pos){
     return value;
 }
 
-__kernel void shockbubble(float gamma, float2 dXY, __global float4* Q_out){
+__kernel void shockbubble(float gamma, float2 dXY, __global float4* Q_out, unsigned int y_offset){
     unsigned int x = get_global_id(0);
     unsigned int y = get_global_id(1);
     
     float xfac  = 0.28867513459481288225f*dXY.x;
     float yfac  = 0.28867513459481288225f*dXY.y;
     
-    float2 pos  = (float2)((float)x/(float)Nx,(float)y/(float)Ny);
+    float2 pos  = (float2)((float)x/(float)Nx,(float)(y+y_offset)/(float)Ny);
     float2 pos0 = (float2)(pos.x-xfac, pos.y-yfac);
     float2 pos1 = (float2)(pos.x+xfac, pos.y-yfac);
     float2 pos2 = (float2)(pos.x-xfac, pos.y+yfac);
@@ -141,7 +181,7 @@ float4  riemannAt(float gamma, float2 pos, float4 R1, float4 R2, float4 R3, floa
     return value;
 }
 
-__kernel void riemann(float gamma, float2 dXY, __global float4* Q_out){
+__kernel void riemann(float gamma, float2 dXY, __global float4* Q_out, unsigned int y_offset){
     unsigned int x = get_global_id(0);
     unsigned int y = get_global_id(1);
     
@@ -153,7 +193,7 @@ __kernel void riemann(float gamma, float2 dXY, __global float4* Q_out){
     float4 R3 = (float4)(0.138f,0.138f*1.206f,0.138f*1.206f,E(0.138f, 1.206f, 1.206f, gamma, 0.028f));
     float4 R4 = (float4)(0.5323f,0.0f,0.5323f*1.206f,E(0.5323f, 0.0f, 1.206f, gamma, 0.3f));
     
-    float2 pos  = (float2)((float)x/(float)Nx,(float)y/(float)Ny);
+    float2 pos  = (float2)((float)x/(float)Nx,(float)(y+y_offset)/(float)Ny);
     float2 pos0 = (float2)(pos.x-xfac, pos.y-yfac);
     float2 pos1 = (float2)(pos.x+xfac, pos.y-yfac);
     float2 pos2 = (float2)(pos.x-xfac, pos.y+yfac);
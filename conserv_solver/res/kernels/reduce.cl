@@ -0,0 +1,104 @@
+/***
+ * Index type, 64 bit for buffers past the reach of 32 bit indices
+ ****/
+#ifdef LARGE_GRID
+typedef ulong index_t;
+#else
+typedef uint index_t;
+#endif
+
+/***
+ * Cell layout, rows of Nx+4 cells by default. LAYOUT_TILES stores the
+ * cells of TILE x TILE blocks together, row by row within a block, and
+ * LAYOUT_MORTON in Z-order within a block, so y neighbours are close.
+ ****/
+#ifndef TILE
+#define TILE 32
+#endif
+#define TILES_X ((Nx+4+TILE-1)/TILE)
+
+/***
+ * Function dec
+ ****/
+index_t cellIndex(unsigned int x, unsigned int y);
+unsigned int spreadBits(unsigned int v);
+float4  fetch(__global float4* array, unsigned int x, unsigned int y, unsigned int offset);
+
+/****
+ *
+ * Utils
+ *
+ ****/
+unsigned int spreadBits(unsigned int v){
+    // Bit i moves to bit 2i, for v below 256
+    v = (v | (v << 4)) & 0x0F0F;
+    v = (v | (v << 2)) & 0x3333;
+    v = (v | (v << 1)) & 0x5555;
+    return v;
+}
+index_t cellIndex(unsigned int x, unsigned int y){
+#if defined(LAYOUT_TILES) || defined(LAYOUT_MORTON)
+    index_t tile = (index_t)(y/TILE)*TILES_X + x/TILE;
+#ifdef LAYOUT_MORTON
+    return tile*TILE*TILE + (spreadBits(x%TILE) | (spreadBits(y%TILE) << 1));
+#else
+    return tile*TILE*TILE + (y%TILE)*TILE + x%TILE;
+#endif
+#else
+    return (index_t)(Nx+4)*y + x;
+#endif
+}
+float4 fetch(__global float4* array, unsigned int x, unsigned int y, unsigned int offset){
+    index_t k = cellIndex(x+offset, y+offset);
+    return array[k];
+}
+
+/****
+ *
+ * Conservation and range diagnostics. Every work-group reduces a strided
+ * share of the interior cells and writes its sum of the conserved
+ * variables followed by the min and max of (rho, u, v, E). The handful of
+ * partial results is combined on the host. Local size must be a power of two.
+ * The buffer holds rows interior rows, results go from group first_group on.
+ *
+ ****/
+__kernel void reduceDiagnostics(__global float4* Q_in, __global float4* partial_out,
+                                __local float4* sum, __local float4* lo, __local float4* hi,
+                                unsigned int rows, unsigned int first_group){
+    unsigned int lid    = get_local_id(0);
+    unsigned int lsize  = get_local_size(0);
+    
+    float4 s    = (float4)(0.0f);
+    float4 mn   = (float4)(MAXFLOAT);
+    float4 mx   = (float4)(-MAXFLOAT);
+    
+    for (index_t i = get_global_id(0); i < (index_t)Nx*rows; i += get_global_size(0)) {
+        float4 Q = fetch(Q_in, i % Nx, i / Nx, 2);
+        float4 P = (float4)(Q.x, Q.y/Q.x, Q.z/Q.x, Q.w);
+        
+        s   += Q;
+        mn  = fmin(mn, P);
+        mx  = fmax(mx, P);
+    }
+    
+    sum[lid]    = s;
+    lo[lid]     = mn;
+    hi[lid]     = mx;
+    barrier(CLK_LOCAL_MEM_FENCE);
+    
+    for (unsigned int stride = lsize/2; stride > 0; stride >>= 1) {
+        if (lid < stride) {
+            sum[lid]    += sum[lid+stride];
+            lo[lid]     = fmin(lo[lid], lo[lid+stride]);
+            hi[lid]     = fmax(hi[lid], hi[lid+stride]);
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+    
+    if (lid == 0) {
+        unsigned int g = first_group + get_group_id(0);
+        partial_out[3*g+0] = sum[0];
+        partial_out[3*g+1] = lo[0];
+        partial_out[3*g+2] = hi[0];
+    }
+}
@@ -0,0 +1,14 @@
+/***
+ * Function dec
+ ****/
+
+/****
+ *
+ * STREAM triad, two reads and one write per element
+ *
+ ****/
+__kernel void streamTriad(__global const float4* B_in, __global const float4* C_in,
+                          float s, __global float4* A_out){
+    size_t i = get_global_id(0);
+    A_out[i] = B_in[i] + s*C_in[i];
+}
@@ -0,0 +1,12 @@
+#version 150
+
+out vec4 color;
+
+uniform sampler2D QTex;
+
+uniform ivec2 origin;
+uniform int stride;
+
+void main() {
+    color = texelFetch(QTex, origin + ivec2(gl_FragCoord.xy)*stride, 0);
+}
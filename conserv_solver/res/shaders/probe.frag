@@ -0,0 +1,12 @@
+#version 150
+
+out vec4 color;
+
+uniform sampler2D QTex;
+uniform sampler2D CellTex;
+
+// One fragment per probe, the cell to sample is stored in the probe texture
+void main() {
+    ivec2 cell = ivec2(texelFetch(CellTex, ivec2(gl_FragCoord.x, 0), 0).xy);
+    color = texelFetch(QTex, cell, 0);
+}
@@ -0,0 +1,13 @@
+#version 150
+
+out vec4 color;
+
+uniform sampler2D BTex;
+uniform sampler2D CTex;
+uniform float s;
+
+// STREAM triad, two texel reads and one write per fragment
+void main() {
+    ivec2 p = ivec2(gl_FragCoord.xy);
+    color = texelFetch(BTex, p, 0) + s*texelFetch(CTex, p, 0);
+}
@@ -1,34 +1,41 @@
  make
- ./main --xn=100 --yn=100 --nt=5 --time=1.0 --type=CLEULER
- ./main --xn=200 --yn=200 --nt=5 --time=1.0 --type=CLEULER
- ./main --xn=300 --yn=300 --nt=5 --time=1.0 --type=CLEULER
- ./main --xn=400 --yn=400 --nt=5 --time=1.0 --type=CLEULER
- ./main --xn=500 --yn=500 --nt=5 --time=1.0 --type=CLEULER
- ./main --xn=600 --yn=600 --nt=5 --time=1.0 --type=CLEULER
- ./main --xn=700 --yn=700 --nt=5 --time=1.0 --type=CLEULER
- ./main --xn=800 --yn=800 --nt=5 --time=1.0 --type=CLEULER
- ./main --xn=900 --yn=900 --nt=5 --time=1.0 --type=CLEULER
- ./main --xn=1000 --yn=1000 --nt=5 --time=1.0 --type=CLEULER
- ./main --xn=1100 --yn=1100 --nt=5 --time=1.0 --type=CLEULER
- ./main --xn=1200 --yn=1200 --nt=5 --time=1.0 --type=CLEULER
- ./main --xn=1300 --yn=1300 --nt=5 --time=1.0 --type=CLEULER
- ./main --xn=1400 --yn=1400 --nt=5 --time=1.0 --type=CLEULER
- ./main --xn=1500 --yn=1500 --nt=5 --time=1.0 --type=CLEULER
- ./main --xn=1600 --yn=1600 --nt=5 --time=1.0 --type=CLEULER
- ./main --xn=1700 --yn=1700 --nt=5 --time=1.0 --type=CLEULER
- ./main --xn=1800 --yn=1800 --nt=5 --time=1.0 --type=CLEULER
- ./main --xn=1900 --yn=1900 --nt=5 --time=1.0 --type=CLEULER
- ./main --xn=2000 --yn=2000 --nt=5 --time=1.0 --type=CLEULER
- ./main --xn=2100 --yn=2100 --nt=5 --time=1.0 --type=CLEULER
- ./main --xn=2200 --yn=2200 --nt=5 --time=1.0 --type=CLEULER
- ./main --xn=2300 --yn=2300 --nt=5 --time=1.0 --type=CLEULER
- ./main --xn=2400 --yn=2400 --nt=5 --time=1.0 --type=CLEULER
- ./main --xn=2500 --yn=2500 --nt=5 --time=1.0 --type=CLEULER
- ./main --xn=2600 --yn=2600 --nt=5 --time=1.0 --type=CLEULER
- ./main --xn=2700 --yn=2700 --nt=5 --time=1.0 --type=CLEULER
- ./main --xn=2800 --yn=2800 --nt=5 --time=1.0 --type=CLEULER
- ./main --xn=2900 --yn=2900 --nt=5 --time=1.0 --type=CLEULER
- ./main --xn=3000 --yn=3000 --nt=5 --time=1.0 --type=CLEULER
+ # The baseline reads buffers, so image reads compare against them
+ ./main --xn=100 --yn=100 --nt=5 --time=1.0 --type=CLEULER --reads=BUFFERS
+ ./main --xn=200 --yn=200 --nt=5 --time=1.0 --type=CLEULER --reads=BUFFERS
+ ./main --xn=300 --yn=300 --nt=5 --time=1.0 --type=CLEULER --reads=BUFFERS
+ ./main --xn=400 --yn=400 --nt=5 --time=1.0 --type=CLEULER --reads=BUFFERS
+ ./main --xn=500 --yn=500 --nt=5 --time=1.0 --type=CLEULER --reads=BUFFERS
+ ./main --xn=600 --yn=600 --nt=5 --time=1.0 --type=CLEULER --reads=BUFFERS
+ ./main --xn=700 --yn=700 --nt=5 --time=1.0 --type=CLEULER --reads=BUFFERS
+ ./main --xn=800 --yn=800 --nt=5 --time=1.0 --type=CLEULER --reads=BUFFERS
+ ./main --xn=900 --yn=900 --nt=5 --time=1.0 --type=CLEULER --reads=BUFFERS
+ ./main --xn=1000 --yn=1000 --nt=5 --time=1.0 --type=CLEULER --reads=BUFFERS
+ ./main --xn=1100 --yn=1100 --nt=5 --time=1.0 --type=CLEULER --reads=BUFFERS
+ ./main --xn=1200 --yn=1200 --nt=5 --time=1.0 --type=CLEULER --reads=BUFFERS
+ ./main --xn=1300 --yn=1300 --nt=5 --time=1.0 --type=CLEULER --reads=BUFFERS
+ ./main --xn=1400 --yn=1400 --nt=5 --time=1.0 --type=CLEULER --reads=BUFFERS
+ ./main --xn=1500 --yn=1500 --nt=5 --time=1.0 --type=CLEULER --reads=BUFFERS
+ ./main --xn=1600 --yn=1600 --nt=5 --time=1.0 --type=CLEULER --reads=BUFFERS
+ ./main --xn=1700 --yn=1700 --nt=5 --time=1.0 --type=CLEULER --reads=BUFFERS
+ ./main --xn=1800 --yn=1800 --nt=5 --time=1.0 --type=CLEULER --reads=BUFFERS
+ ./main --xn=1900 --yn=1900 --nt=5 --time=1.0 --type=CLEULER --reads=BUFFERS
+ ./main --xn=2000 --yn=2000 --nt=5 --time=1.0 --type=CLEULER --reads=BUFFERS
+ ./main --xn=2100 --yn=2100 --nt=5 --time=1.0 --type=CLEULER --reads=BUFFERS
+ ./main --xn=2200 --yn=2200 --nt=5 --time=1.0 --type=CLEULER --reads=BUFFERS
+ ./main --xn=2300 --yn=2300 --nt=5 --time=1.0 --type=CLEULER --reads=BUFFERS
+ ./main --xn=2400 --yn=2400 --nt=5 --time=1.0 --type=CLEULER --reads=BUFFERS
+ ./main --xn=2500 --yn=2500 --nt=5 --time=1.0 --type=CLEULER --reads=BUFFERS
+ ./main --xn=2600 --yn=2600 --nt=5 --time=1.0 --type=CLEULER --reads=BUFFERS
+ ./main --xn=2700 --yn=2700 --nt=5 --time=1.0 --type=CLEULER --reads=BUFFERS
+ ./main --xn=2800 --yn=2800 --nt=5 --time=1.0 --type=CLEULER --reads=BUFFERS
+ ./main --xn=2900 --yn=2900 --nt=5 --time=1.0 --type=CLEULER --reads=BUFFERS
+ ./main --xn=3000 --yn=3000 --nt=5 --time=1.0 --type=CLEULER --reads=BUFFERS
+ # OpenCL variants forced away from the defaults
+ for variant in "--reads=IMAGES" "--primitives=SHARED --reads=BUFFERS" "--coarsen=4 --reads=BUFFERS"; do
+     for s in $(seq 100 100 3000); do
+         ./main --xn=$s --yn=$s --nt=5 --time=1.0 --type=CLEULER $variant
+     done
+ done
  ./main --xn=100 --yn=100 --nt=5 --time=1.0 --type=GLEULER
  ./main --xn=200 --yn=200 --nt=5 --time=1.0 --type=GLEULER
  ./main --xn=300 --yn=300 --nt=5 --time=1.0 --type=GLEULER
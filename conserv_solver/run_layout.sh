@@ -0,0 +1,16 @@
+ make
+ ./main --xn=1024 --yn=1024 --nt=5 --time=1.0 --type=CLEULER --device=CPU --reads=BUFFERS --flux=FUSED
+ ./main --xn=2048 --yn=2048 --nt=5 --time=1.0 --type=CLEULER --device=CPU --reads=BUFFERS --flux=FUSED
+ ./main --xn=4096 --yn=4096 --nt=5 --time=1.0 --type=CLEULER --device=CPU --reads=BUFFERS --flux=FUSED
+ ./main --xn=8192 --yn=8192 --nt=5 --time=1.0 --type=CLEULER --device=CPU --reads=BUFFERS --flux=FUSED
+ ./main --xn=16384 --yn=16384 --nt=5 --time=1.0 --type=CLEULER --device=CPU --reads=BUFFERS --flux=FUSED
+ ./main --xn=1024 --yn=1024 --nt=5 --time=1.0 --type=CLEULER --device=CPU --layout=TILES --reads=BUFFERS --flux=FUSED
+ ./main --xn=2048 --yn=2048 --nt=5 --time=1.0 --type=CLEULER --device=CPU --layout=TILES --reads=BUFFERS --flux=FUSED
+ ./main --xn=4096 --yn=4096 --nt=5 --time=1.0 --type=CLEULER --device=CPU --layout=TILES --reads=BUFFERS --flux=FUSED
+ ./main --xn=8192 --yn=8192 --nt=5 --time=1.0 --type=CLEULER --device=CPU --layout=TILES --reads=BUFFERS --flux=FUSED
+ ./main --xn=16384 --yn=16384 --nt=5 --time=1.0 --type=CLEULER --device=CPU --layout=TILES --reads=BUFFERS --flux=FUSED
+ ./main --xn=1024 --yn=1024 --nt=5 --time=1.0 --type=CLEULER --device=CPU --layout=MORTON --reads=BUFFERS --flux=FUSED
+ ./main --xn=2048 --yn=2048 --nt=5 --time=1.0 --type=CLEULER --device=CPU --layout=MORTON --reads=BUFFERS --flux=FUSED
+ ./main --xn=4096 --yn=4096 --nt=5 --time=1.0 --type=CLEULER --device=CPU --layout=MORTON --reads=BUFFERS --flux=FUSED
+ ./main --xn=8192 --yn=8192 --nt=5 --time=1.0 --type=CLEULER --device=CPU --layout=MORTON --reads=BUFFERS --flux=FUSED
+ ./main --xn=16384 --yn=16384 --nt=5 --time=1.0 --type=CLEULER --device=CPU --layout=MORTON --reads=BUFFERS --flux=FUSED
@@ -0,0 +1,13 @@
+ make
+ ./main --xn=2048 --yn=2048 --nt=5 --time=1.0 --type=CLEULER --device=CPU --roofline
+ ./main --xn=4096 --yn=4096 --nt=5 --time=1.0 --type=CLEULER --device=CPU --roofline
+ ./main --xn=8192 --yn=8192 --nt=5 --time=1.0 --type=CLEULER --device=CPU --roofline
+ ./main --xn=2048 --yn=2048 --nt=5 --time=1.0 --type=CLEULER --device=CPU --roofline --huge-pages
+ ./main --xn=4096 --yn=4096 --nt=5 --time=1.0 --type=CLEULER --device=CPU --roofline --huge-pages
+ ./main --xn=8192 --yn=8192 --nt=5 --time=1.0 --type=CLEULER --device=CPU --roofline --huge-pages
+ ./main --xn=2048 --yn=2048 --nt=5 --time=1.0 --type=CLEULER --device=CPU --roofline --numa
+ ./main --xn=4096 --yn=4096 --nt=5 --time=1.0 --type=CLEULER --device=CPU --roofline --numa
+ ./main --xn=8192 --yn=8192 --nt=5 --time=1.0 --type=CLEULER --device=CPU --roofline --numa
+ ./main --xn=2048 --yn=2048 --nt=5 --time=1.0 --type=CLEULER --device=CPU --roofline --numa --huge-pages
+ ./main --xn=4096 --yn=4096 --nt=5 --time=1.0 --type=CLEULER --device=CPU --roofline --numa --huge-pages
+ ./main --xn=8192 --yn=8192 --nt=5 --time=1.0 --type=CLEULER --device=CPU --roofline --numa --huge-pages
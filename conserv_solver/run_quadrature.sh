@@ -0,0 +1,10 @@
+ make
+ ./main --xn=1600 --yn=1600 --nt=100000 --time=0.2 --type=CLEULER --device=GPU --final
+ ./main --xn=100 --yn=100 --nt=100000 --time=0.2 --type=CLEULER --device=GPU --final
+ ./main --xn=200 --yn=200 --nt=100000 --time=0.2 --type=CLEULER --device=GPU --final
+ ./main --xn=400 --yn=400 --nt=100000 --time=0.2 --type=CLEULER --device=GPU --final
+ ./main --xn=800 --yn=800 --nt=100000 --time=0.2 --type=CLEULER --device=GPU --final
+ ./main --xn=100 --yn=100 --nt=100000 --time=0.2 --type=CLEULER --device=GPU --final --quadrature=MIDPOINT
+ ./main --xn=200 --yn=200 --nt=100000 --time=0.2 --type=CLEULER --device=GPU --final --quadrature=MIDPOINT
+ ./main --xn=400 --yn=400 --nt=100000 --time=0.2 --type=CLEULER --device=GPU --final --quadrature=MIDPOINT
+ ./main --xn=800 --yn=800 --nt=100000 --time=0.2 --type=CLEULER --device=GPU --final --quadrature=MIDPOINT
@@ -16,9 +16,32 @@
 #include "SimulatorCLSW.h"
 #include "SimulatorGLEuler.h"
 #include "SimulatorCLEuler.h"
+#include "Trace.h"
+#include "Perf.h"
+#include "EnergyMeter.h"
+#include "DeviceMemory.hpp"
 
 
 AppManager::AppManager(){
+    snapshots = NULL;
+    probes = NULL;
+    snapshot_interval = 0;
+    diagnostics_interval = 0;
+    probe_interval = 0;
+    trace = false;
+    roofline = false;
+    perf_counters = false;
+    stream_rows = 0;
+    stream_steps = 1;
+    flux_mode = FLUX_AUTO;
+    read_path = READ_AUTO;
+    shared_primitives = false;
+    quadrature = QUADRATURE_GAUSS;
+    coarsening = 1;
+    layout = LAYOUT_ROWS;
+    numa_placement = false;
+    huge_pages = false;
+    final_output = false;
 }
 
 AppManager::~AppManager(){
@@ -44,21 +67,72 @@ void AppManager::init(size_t Nx, size_t Ny, Solver type, const char* dev){
         prefix = "GPU_";
     }
     
+    if (perf_counters) {
+        if (type != GL_EULER && dev_type == CL_DEVICE_TYPE_CPU) {
+            Perf::begin();
+        } else {
+            std::cout << "Hardware counters need an OpenCL CPU device, not reading them" << std::endl;
+        }
+    }
+    if ((numa_placement || huge_pages) && dev_type != CL_DEVICE_TYPE_CPU) {
+        std::cout << "NUMA placement and huge pages only apply to OpenCL CPU devices" << std::endl;
+    }
+    
     switch (type) {
         case GL_EULER:
             simulator   = new SimulatorGLEuler();
             break;
         case CL_EULER:
-            simulator   = new SimulatorCLEuler(dev_type);
+        {
+            SimulatorCLEuler* euler = new SimulatorCLEuler(dev_type, numa_placement);
+            euler->setStreaming(stream_rows, stream_steps);
+            euler->setFluxMode(flux_mode);
+            euler->setReadPath(read_path);
+            euler->setSharedPrimitives(shared_primitives);
+            euler->setQuadrature(quadrature);
+            euler->setCoarsening(coarsening);
+            euler->setLayout(layout);
+            euler->setHugePages(huge_pages);
+            simulator   = euler;
             break;
+        }
         case CL_SW:
-            simulator   = new SimulatorCLSW(dev_type);
+        {
+            SimulatorCLSW* sw = new SimulatorCLSW(dev_type);
+            sw->setFluxMode(flux_mode);
+            simulator   = sw;
             break;
+        }
         default:
             THROW_EXCEPTION("Unknown solver");
             break;
     }
     
+    if (type != CL_EULER && (stream_rows > 0 || stream_steps > 1)) {
+        std::cout << "Streaming needs the CLEULER solver, keeping the grid on the device" << std::endl;
+    }
+    if (type == GL_EULER && flux_mode != FLUX_AUTO) {
+        std::cout << "Flux kernels can only be chosen for the OpenCL solvers" << std::endl;
+    }
+    if (type != CL_EULER && read_path != READ_AUTO) {
+        std::cout << "Stencil reads can only be chosen for the CLEULER solver" << std::endl;
+    }
+    if (type != CL_EULER && shared_primitives) {
+        std::cout << "Primitive variables can only be chosen for the CLEULER solver" << std::endl;
+    }
+    if (type != CL_EULER && quadrature != QUADRATURE_GAUSS) {
+        std::cout << "Face quadrature can only be chosen for the CLEULER solver" << std::endl;
+    }
+    if (type != CL_EULER && coarsening != 1) {
+        std::cout << "Coarsening can only be chosen for the CLEULER solver" << std::endl;
+    }
+    if (type != CL_EULER && layout != LAYOUT_ROWS) {
+        std::cout << "Cell layout can only be chosen for the CLEULER solver" << std::endl;
+    }
+    if (type != CL_EULER && (numa_placement || huge_pages)) {
+        std::cout << "NUMA placement and huge pages need the CLEULER solver" << std::endl;
+    }
+    
     simulator->init(Nx,Ny,"");
     
     visualizer->setSimulator(simulator);
@@ -75,25 +149,107 @@ void AppManager::begin(size_t N, float T){
         results.Nx << "x" << results.Ny << "] grid" << std::endl;
     
     results.total_sim_time = 0;
+    results.time = simulator->getTime();
     size_t c = 0;
     
+    if (trace) {
+        Trace::begin(runName() + "_trace.json");
+        Trace::setThreadName("main");
+    }
+    if (roofline) {
+        Trace::enableStats();
+    }
+    
+    results.diagnostics = diagnostics_interval > 0;
+    if (results.diagnostics) {
+        results.initial = simulator->getDiagnostics();
+        results.final = results.initial;
+        printDiagnostics(0, results.initial);
+    }
+    
+    if (snapshot_interval > 0) {
+        snapshots = new SnapshotWriter(simulator, runName() + ".snap", snapshot_interval,
+                                       snapshot_compression);
+    }
+    
+    if (!probe_points.empty() && probe_interval > 0) {
+        glm::ivec2 size = simulator->getGridSize();
+        std::vector<glm::ivec2> cells;
+        for (size_t i = 0; i < probe_points.size(); i++) {
+            // Cell containing the point, the upper edge belongs to the last cell
+            int x = glm::clamp((int)(probe_points[i].x*size.x), 0, size.x-1);
+            int y = glm::clamp((int)(probe_points[i].y*size.y), 0, size.y-1);
+            cells.push_back(glm::ivec2(x,y));
+        }
+        probes = new ProbeRecorder(simulator, runName() + "_probes.csv", cells, probe_interval);
+        
+        SimDetail initial;
+        initial.sim_time = 0;
+        initial.time = simulator->getTime();
+        initial.dt = 0;
+        initial.steps = 0;
+        probes->update(0, initial);
+    }
+    
+    EnergyMeter energy;
+    energy.start();
+    
     while (!glfwWindowShouldClose(visualizer->getWindow()) && c < N) {
+        TRACE_ZONE("step");
+        
         /* Poll for and process events */
-        glfwPollEvents();
+        {
+            TRACE_ZONE("glfwPollEvents");
+            glfwPollEvents();
+        }
         
-        SimDetail details = simulator->simulate();
-        visualizer->render();
+        SimDetail details;
+        {
+            TRACE_ZONE("simulate");
+            // Only the step itself, not rendering or waiting for vsync
+            energy.resume();
+            details = simulator->simulate();
+            energy.update();
+        }
+        {
+            TRACE_ZONE("render");
+            visualizer->render();
+        }
         
         results.total_sim_time += details.sim_time;
         results.time = details.time;
         
-        results.max_sim_time = glm::max(results.max_sim_time, (float)details.sim_time);
-        results.min_sim_time = glm::min(results.min_sim_time, (float)details.sim_time);
+        // Streamed strips advance several steps per call
+        float step_time = (float)(details.sim_time/details.steps);
+        results.max_sim_time = glm::max(results.max_sim_time, step_time);
+        results.min_sim_time = glm::min(results.min_sim_time, step_time);
         
         /* Swap front and back buffers */
-        glfwSwapBuffers(visualizer->getWindow());
+        {
+            TRACE_ZONE("glfwSwapBuffers");
+            glfwSwapBuffers(visualizer->getWindow());
+        }
+        
+        c += details.steps;
+        
+        if (snapshots != NULL) {
+            TRACE_ZONE("snapshots");
+            snapshots->update(c, details);
+        }
+        
+        if (probes != NULL) {
+            TRACE_ZONE("probes");
+            probes->update(c, details);
+        }
+        
+        if (results.diagnostics && c/diagnostics_interval != (c-details.steps)/diagnostics_interval) {
+            TRACE_ZONE("diagnostics");
+            results.final = simulator->getDiagnostics();
+            printDiagnostics(c, results.final);
+        }
         
-        c++;
+        // Device commands of this step are done by now, turn them into slices
+        Trace::collect();
         
         if (details.time > T) {
             break;
@@ -101,22 +257,165 @@ void AppManager::begin(size_t N, float T){
     }
     
     results.average_timestep = results.total_sim_time/c;
+    results.average_device_timestep = simulator->getDeviceTime();
     results.N = c;
+    results.flux_mode = simulator->getFluxMode();
+    results.read_path = simulator->getReadPath();
+    
+    results.energy = energy.available() && c > 0;
+    results.energy_per_step = 0;
+    results.energy_per_mcell = 0;
+    if (results.energy) {
+        results.energy_per_step = energy.getJoules()/c;
+        results.energy_per_mcell = results.energy_per_step/(results.Nx*results.Ny*1e-6);
+        
+        std::cout << "Energy: " << energy.getJoules() << " J, " << results.energy_per_step
+            << " J per step, " << results.energy_per_mcell << " J per million cell updates (";
+        for (size_t i = 0; i < energy.getZoneCount(); i++) {
+            std::cout << (i > 0 ? ", " : "") << energy.getZoneName(i) << " " << energy.getZoneJoules(i) << " J";
+        }
+        std::cout << ")" << std::endl;
+    } else {
+        std::cout << "Energy: RAPL counters not readable, not measured" << std::endl;
+    }
+    
+    results.snapshots_written = 0;
+    results.snapshots_dropped = 0;
+    results.snapshot_ratio = 0;
+    results.snapshot_compress_rate = 0;
+    if (snapshots != NULL) {
+        snapshots->finish();
+        
+        results.snapshots_written = snapshots->getFramesWritten();
+        results.snapshots_dropped = snapshots->getFramesDropped();
+        
+        if (results.snapshots_written > 0) {
+            results.snapshot_ratio = (float)snapshots->getRawBytes()/snapshots->getBytesWritten();
+            results.snapshot_compress_rate = snapshots->getRawBytes()/(1024.0*1024.0)/snapshots->getCompressTime();
+        }
+        
+        std::cout << "Wrote " << results.snapshots_written << " snapshots ("
+            << results.snapshots_dropped << " dropped), ";
+        // Small snapshots can be written in less than the timer resolution
+        if (snapshots->getWriteTime() > 0) {
+            std::cout << snapshots->getRawBytes()/(1024.0*1024.0)/snapshots->getWriteTime() << " MB/s, ";
+        }
+        std::cout << "compression ratio " << results.snapshot_ratio << " at "
+            << results.snapshot_compress_rate << " MB/s" << std::endl;
+    }
+    
+    results.probe_samples = 0;
+    if (probes != NULL) {
+        probes->finish();
+        results.probe_samples = probes->getSamples();
+        
+        std::cout << "Recorded " << results.probe_samples << " samples at "
+            << probes->getProbes() << " probes" << std::endl;
+    }
+    
+    results.stream_bandwidth = 0;
+    results.kernels.clear();
+    if (roofline) {
+        results.kernels = simulator->getKernelProfile();
+        results.stream_bandwidth = simulator->measureBandwidth();
+        printRoofline();
+    }
+    
+    if (Perf::enabled()) {
+        printPerfCounters();
+    }
     
+    if (final_output) {
+        writeFinal();
+    }
     writeJSON();
     
+    Trace::end();
+    Perf::end();
+    
     /* Clean up everything */
     quit();
 }
 
 void AppManager::quit(){
+    delete snapshots;
+    delete probes;
     delete simulator;
     delete visualizer;
+    
+    // Anything still live at this point has leaked
+    DeviceMemory::report(std::cout);
 }
 
-void AppManager::writeJSON(){
-    std::ofstream output;
+void AppManager::writeFinal(){
+    std::vector<float> rho = simulator->getRegion(0, 0, results.Nx, results.Ny, 1, FIELD_RHO);
+    
     std::stringstream file;
+    file << runName() << "_rho.raw";
+    std::cout << "Saving final density as: " << file.str() << std::endl;
+    
+    std::ofstream output(file.str().c_str(), std::ios::binary);
+    if (!output) {
+        THROW_EXCEPTION("Could not open final density file");
+    }
+    output.write((const char*)rho.data(), rho.size()*sizeof(float));
+}
+
+void AppManager::printDiagnostics(size_t step, const SimDiagnostics& diag){
+    glm::vec4 drift = diag.sum - results.initial.sum;
+    
+    std::cout << "Diagnostics @ s " << step << " t " << results.time << ": " << std::endl <<
+        "p range: [" << diag.min.x << "," << diag.max.x << "]" << std::endl <<
+        "u range: [" << diag.min.y << "," << diag.max.y << "]" << std::endl <<
+        "v range: [" << diag.min.z << "," << diag.max.z << "]" << std::endl <<
+        "E range: [" << diag.min.w << "," << diag.max.w << "]" << std::endl <<
+        "p, pu, pv, E summation: " << diag.sum.x << ", " << diag.sum.y << ", "
+            << diag.sum.z << ", " << diag.sum.w << std::endl <<
+        "p, pu, pv, E drift: " << drift.x << ", " << drift.y << ", "
+            << drift.z << ", " << drift.w << std::endl << std::endl;
+}
+
+void AppManager::printRoofline(){
+    std::cout << "Stream triad bandwidth: " << results.stream_bandwidth*1e-9 << " GB/s" << std::endl;
+    
+    for (size_t i = 0; i < results.kernels.size(); i++) {
+        const KernelProfile& k = results.kernels[i];
+        if (k.calls == 0 || k.time <= 0.0) {
+            std::cout << k.name << ": not timed" << std::endl;
+            continue;
+        }
+        double time = k.time/k.calls;
+        double bandwidth = k.items*k.bytes/time;
+        
+        std::cout << k.name << ": " << time*1e3 << " ms, "
+            << bandwidth*1e-9 << " GB/s ("
+            << 100.0*bandwidth/results.stream_bandwidth << "% of stream), "
+            << k.items*k.flops/time*1e-9 << " GFLOP/s" << std::endl;
+    }
+    std::cout << std::endl;
+}
+
+void AppManager::printPerfCounters(){
+    std::map<std::string, Perf::Counts> phases = Perf::getPhases();
+    
+    for (std::map<std::string, Perf::Counts>::iterator it = phases.begin(); it != phases.end(); ++it) {
+        const Perf::Counts& p = it->second;
+        std::cout << it->first << " (" << p.calls << " calls):";
+        for (size_t c = 0; c < Perf::COUNTERS; c++) {
+            if (Perf::available((Perf::Counter)c)) {
+                std::cout << " " << Perf::name((Perf::Counter)c) << " " << p.value[c]/p.calls;
+            }
+        }
+        if (Perf::available(Perf::CYCLES) && Perf::available(Perf::INSTRUCTIONS)) {
+            std::cout << " ipc " << p.value[Perf::INSTRUCTIONS]/p.value[Perf::CYCLES];
+        }
+        std::cout << std::endl;
+    }
+    std::cout << std::endl;
+}
+
+std::string AppManager::runName(){
+    std::stringstream name;
     
     std::string str;
     switch (this->type) {
@@ -124,7 +423,43 @@ void AppManager::writeJSON(){
             str   = "GLEULER_";
             break;
         case CL_EULER:
+            // Variants forced away from the defaults are kept apart to
+            // compare against them
             str   = "CLEULER_";
+            if (read_path == READ_IMAGES) {
+                str += "IMAGES_";
+            }
+            if (shared_primitives) {
+                str += "SHARED_";
+            }
+            if (quadrature == QUADRATURE_MIDPOINT) {
+                str += "MIDPOINT_";
+            }
+            if (coarsening != 1) {
+                std::stringstream coarse;
+                coarse << "X" << coarsening << "_";
+                str += coarse.str();
+            }
+            if (layout == LAYOUT_TILES) {
+                str += "TILES_";
+            } else if (layout == LAYOUT_MORTON) {
+                str += "MORTON_";
+            }
+            if (numa_placement) {
+                str += "NUMA_";
+            }
+            if (huge_pages) {
+                str += "HUGE_";
+            }
+            if (stream_rows > 0) {
+                std::stringstream stream;
+                stream << "STREAM";
+                if (stream_steps > 1) {
+                    stream << stream_steps;
+                }
+                stream << "_";
+                str += stream.str();
+            }
             break;
         case CL_SW:
             str   = "CLSW_";
@@ -134,7 +469,15 @@ void AppManager::writeJSON(){
             break;
     }
     
-    file << prefix << str << results.Nx << "x" << results.Ny << ".json";
+    name << prefix << str << results.Nx << "x" << results.Ny;
+    return name.str();
+}
+
+void AppManager::writeJSON(){
+    std::ofstream output;
+    std::stringstream file;
+    
+    file << runName() << ".json";
     
     std::cout << "Saving simulation details as: " << file.str() << std::endl;
     
@@ -143,11 +486,85 @@ void AppManager::writeJSON(){
     
     output  << "\t\"total_sim_time\":" << results.total_sim_time << "," << std::endl;
     output  << "\t\"average_timestep\":" << results.average_timestep << "," << std::endl;
+    output  << "\t\"average_device_timestep\":" << results.average_device_timestep << "," << std::endl;
+    if (results.energy) {
+        output  << "\t\"energy_per_step\":" << results.energy_per_step << "," << std::endl;
+        output  << "\t\"energy_per_mcell_update\":" << results.energy_per_mcell << "," << std::endl;
+    } else {
+        output  << "\t\"energy_per_step\":null," << std::endl;
+        output  << "\t\"energy_per_mcell_update\":null," << std::endl;
+    }
     output  << "\t\"max_timestep\":" << results.max_sim_time << "," << std::endl;
     output  << "\t\"min_timestep\":" << results.min_sim_time << "," << std::endl;
     output  << "\t\"N\":" << results.N << "," << std::endl;
+    // Which kernels produced the timings, auto where the solver has no choice
+    output  << "\t\"flux_mode\":\"" << (results.flux_mode == FLUX_FUSED ? "FUSED" :
+                                          results.flux_mode == FLUX_SPLIT ? "SPLIT" : "AUTO") << "\"," << std::endl;
+    output  << "\t\"read_path\":\"" << (results.read_path == READ_BUFFERS ? "BUFFERS" :
+                                          results.read_path == READ_IMAGES ? "IMAGES" : "AUTO") << "\"," << std::endl;
     output  << "\t\"Nx\":" << results.Nx << "," << std::endl;
     output  << "\t\"Ny\":" << results.Ny << "," << std::endl;
+    output  << "\t\"snapshots_written\":" << results.snapshots_written << "," << std::endl;
+    output  << "\t\"snapshots_dropped\":" << results.snapshots_dropped << "," << std::endl;
+    output  << "\t\"snapshot_ratio\":" << results.snapshot_ratio << "," << std::endl;
+    output  << "\t\"snapshot_compress_rate\":" << results.snapshot_compress_rate << "," << std::endl;
+    output  << "\t\"probe_samples\":" << results.probe_samples << "," << std::endl;
+    if (roofline) {
+        // Per call averages, rates in GB/s and GFLOP/s
+        output  << "\t\"stream_bandwidth\":" << results.stream_bandwidth*1e-9 << "," << std::endl;
+        output  << "\t\"kernels\":[" << std::endl;
+        for (size_t i = 0; i < results.kernels.size(); i++) {
+            const KernelProfile& k = results.kernels[i];
+            double time = k.calls > 0 ? k.time/k.calls : 0.0;
+            double bandwidth = time > 0.0 ? k.items*k.bytes/time*1e-9 : 0.0;
+            double gflops = time > 0.0 ? k.items*k.flops/time*1e-9 : 0.0;
+            output  << "\t\t{\"name\":\"" << k.name << "\""
+                << ",\"calls\":" << k.calls
+                << ",\"time\":" << time
+                << ",\"bytes\":" << k.items*k.bytes
+                << ",\"flops\":" << k.items*k.flops
+                << ",\"intensity\":" << (k.bytes > 0.0 ? k.flops/k.bytes : 0.0)
+                << ",\"bandwidth\":" << bandwidth
+                << ",\"gflops\":" << gflops
+                << ",\"roof_fraction\":" << (results.stream_bandwidth > 0.0 ? bandwidth*1e9/results.stream_bandwidth : 0.0)
+                << "}" << (i+1 < results.kernels.size() ? "," : "") << std::endl;
+        }
+        output  << "\t]," << std::endl;
+    }
+    if (Perf::enabled()) {
+        // Totals per phase, null for counters that could not be opened
+        std::map<std::string, Perf::Counts> phases = Perf::getPhases();
+        output  << "\t\"perf_counters\":[" << std::endl;
+        for (std::map<std::string, Perf::Counts>::iterator it = phases.begin(); it != phases.end(); ++it) {
+            output  << "\t\t{\"phase\":\"" << it->first << "\",\"calls\":" << it->second.calls;
+            for (size_t c = 0; c < Perf::COUNTERS; c++) {
+                output  << ",\"" << Perf::name((Perf::Counter)c) << "\":";
+                if (Perf::available((Perf::Counter)c)) {
+                    output  << (uint64_t)it->second.value[c];
+                } else {
+                    output  << "null";
+                }
+            }
+            output  << "}" << (std::next(it) != phases.end() ? "," : "") << std::endl;
+        }
+        output  << "\t]," << std::endl;
+    }
+    {
+        // Peak bytes in total and per purpose
+        std::map<std::string, DeviceMemory::Usage> tags = DeviceMemory::getTags();
+        output  << "\t\"device_memory_peak\":" << DeviceMemory::getTotal().peak << "," << std::endl;
+        output  << "\t\"device_memory\":{";
+        for (std::map<std::string, DeviceMemory::Usage>::iterator it = tags.begin(); it != tags.end(); ++it) {
+            output  << (it != tags.begin() ? "," : "") << "\"" << it->first << "\":" << it->second.peak;
+        }
+        output  << "}," << std::endl;
+    }
+    if (results.diagnostics) {
+        const glm::vec4& a = results.initial.sum;
+        const glm::vec4& b = results.final.sum;
+        output  << "\t\"conserved_initial\":[" << a.x << "," << a.y << "," << a.z << "," << a.w << "]," << std::endl;
+        output  << "\t\"conserved_final\":[" << b.x << "," << b.y << "," << b.z << "," << b.w << "]," << std::endl;
+    }
     output  << "\t\"time\":" << results.time << std::endl;
 
     output  << "}";
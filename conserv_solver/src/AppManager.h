@@ -17,6 +17,8 @@
 
 #include "Visualizer.h"
 #include "SimulatorBase.h"
+#include "SnapshotWriter.h"
+#include "ProbeRecorder.h"
 
 #include <vector>
 
@@ -49,6 +51,116 @@ public:
 	 */
 	void begin(size_t N, float T);
     
+    /**
+     * Write a snapshot of the field every N steps, 0 disables
+     */
+    void setSnapshotInterval(size_t N){this->snapshot_interval = N;}
+    
+    /**
+     * Compress snapshots with byte shuffle, rANS and temporal deltas
+     */
+    void setSnapshotCompression(bool enable){
+        snapshot_compression.entropy = enable;
+        snapshot_compression.delta = enable;
+    }
+    
+    /**
+     * Absolute error allowed in stored density and energy, 0 is lossless
+     */
+    void setSnapshotErrorBound(float eps){
+        snapshot_compression.error_bound[0] = eps;
+        snapshot_compression.error_bound[3] = eps;
+    }
+    
+    /**
+     * Print conservation and range diagnostics every N steps, 0 disables
+     */
+    void setDiagnosticsInterval(size_t N){this->diagnostics_interval = N;}
+    
+    /**
+     * Record the state at points given in [0,1]x[0,1] domain coordinates,
+     * reading the device ring back every N steps
+     */
+    void setProbes(const std::vector<glm::vec2>& points, size_t N){
+        this->probe_points = points;
+        this->probe_interval = N;
+    }
+    
+    /**
+     * Write a Chrome trace of the main loop and device commands
+     */
+    void setTrace(bool enable){this->trace = enable;}
+    
+    /**
+     * Time every step kernel and report its bandwidth and FLOP rate against
+     * a STREAM-like bandwidth probe of the device
+     */
+    void setRoofline(bool enable){this->roofline = enable;}
+    
+    /**
+     * Read hardware counters per step phase on OpenCL CPU devices. Has to
+     * be called before init, the counters must exist before the OpenCL
+     * runtime starts its worker threads.
+     */
+    void setPerfCounters(bool enable){this->perf_counters = enable;}
+    
+    /**
+     * Stream the state through the device in strips of rows rows, taking
+     * steps steps per strip visit. Rows 0 streams only grids that do not fit
+     * on the device. OpenCL Euler solver only, has to be called before init.
+     */
+    void setStreaming(size_t rows, size_t steps){stream_rows = rows; stream_steps = steps;}
+    
+    /**
+     * Fused or per direction flux kernels, auto picks per device. OpenCL
+     * solvers only, has to be called before init.
+     */
+    void setFluxMode(FluxMode mode){flux_mode = mode;}
+    
+    /**
+     * Stencil reads through buffers or images, auto picks per device.
+     * OpenCL Euler solver only, has to be called before init.
+     */
+    void setReadPath(ReadPath path){read_path = path;}
+    
+    /**
+     * Share primitive variables between fluxes and wave speeds in the
+     * kernels, or recompute them as before. OpenCL Euler solver only, has
+     * to be called before init.
+     */
+    void setSharedPrimitives(bool shared){shared_primitives = shared;}
+    
+    /**
+     * Face quadrature of the fluxes. OpenCL Euler solver only, has to be
+     * called before init.
+     */
+    void setQuadrature(FluxQuadrature rule){quadrature = rule;}
+    
+    /**
+     * Cells per work-item along x in the stencil kernels. OpenCL Euler
+     * solver only, has to be called before init.
+     */
+    void setCoarsening(size_t cells){coarsening = cells;}
+    
+    /**
+     * Cell order in the device buffers. OpenCL Euler solver only, has to be
+     * called before init.
+     */
+    void setLayout(MemoryLayout order){layout = order;}
+    
+    /**
+     * Place the bands of rows on the NUMA nodes of a CPU device, each run
+     * by a sub-device of its node, and back them with huge pages. OpenCL
+     * Euler solver only, has to be called before init.
+     */
+    void setNumaPlacement(bool numa, bool huge){numa_placement = numa; huge_pages = huge;}
+    
+    /**
+     * Write the final density as raw float32, row major, next to the JSON
+     * results, to measure the error against a reference run
+     */
+    void setFinalOutput(bool enable){this->final_output = enable;}
+    
 private:
     /**
 	 * Quit function
@@ -60,12 +172,59 @@ private:
      */
     void writeJSON();
     
+    /**
+     * Write the density of the current state to disk
+     */
+    void writeFinal();
+    
+    /**
+     * Print device side diagnostics of the current state
+     */
+    void printDiagnostics(size_t step, const SimDiagnostics& diag);
+    
+    /**
+     * Print achieved bandwidth and FLOP rate of every profiled kernel
+     */
+    void printRoofline();
+    
+    /**
+     * Print the hardware counters of every step phase
+     */
+    void printPerfCounters();
+    
+    /**
+     * Name of the run used for output files, e.g. GPU_CLEULER_128x128
+     */
+    std::string runName();
+    
 private:
     static const unsigned int window_width  = 800;
 	static const unsigned int window_height = 600;
     
     Visualizer*         visualizer;
     SimulatorBase*      simulator;
+    SnapshotWriter*     snapshots;
+    ProbeRecorder*      probes;
+    
+    size_t snapshot_interval;
+    SnapshotCompression snapshot_compression;
+    size_t diagnostics_interval;
+    std::vector<glm::vec2> probe_points;
+    size_t probe_interval;
+    bool trace;
+    bool roofline;
+    bool perf_counters;
+    size_t stream_rows;
+    size_t stream_steps;
+    FluxMode flux_mode;
+    ReadPath read_path;
+    bool shared_primitives;
+    FluxQuadrature quadrature;
+    size_t coarsening;
+    MemoryLayout layout;
+    bool numa_placement;
+    bool huge_pages;
+    bool final_output;
     
     Solver type;
     std::string prefix;
@@ -73,12 +232,28 @@ private:
     struct{
         float total_sim_time;
         float average_timestep;
+        float average_device_timestep;
+        bool energy;                // RAPL counters were readable
+        double energy_per_step;     // joules
+        double energy_per_mcell;    // joules per million cell updates
         size_t N;
         size_t Nx;
         size_t Ny;
         float time;
         float max_sim_time;
         float min_sim_time;
+        size_t snapshots_written;
+        size_t snapshots_dropped;
+        float snapshot_ratio;
+        float snapshot_compress_rate;
+        size_t probe_samples;
+        bool diagnostics;
+        SimDiagnostics initial;
+        SimDiagnostics final;
+        double stream_bandwidth;    // bytes per second, 0 if not measured
+        std::vector<KernelProfile> kernels;
+        FluxMode flux_mode;         // as chosen by the solver
+        ReadPath read_path;
     }results;
 };
 
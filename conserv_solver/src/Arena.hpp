@@ -0,0 +1,206 @@
+#ifndef _ARENA_HPP__
+#define _ARENA_HPP__
+
+#include <vector>
+#include <sstream>
+
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#else
+#include <cl.h>
+#endif
+
+#include "Numa.h"
+
+namespace CLUtils {
+
+    /**
+     * Buffers carved as sub-buffers out of a few large allocations. Blocks
+     * are allocated when first needed, as large as what is left of the
+     * capacity, up to the largest allocation the device allows, so usually
+     * there is one. Regions start at the alignment sub-buffers need.
+     *
+     * Rewinding to a mark lets the regions carved after it alias the ones
+     * carved before, for buffers that are never live at the same time.
+     * Sub-buffers keep their block alive, so the arena may go first.
+     *
+     * On devices sharing host memory the blocks may be host memory of our
+     * own, first touched by threads pinned to a NUMA node so the pages
+     * live there, and backed by huge pages if asked for.
+     */
+    class Arena {
+    public:
+        struct Region{
+            cl_mem  parent;
+            size_t  offset;
+        };
+
+        struct Mark{
+            size_t  block;
+            size_t  used;
+        };
+
+        Arena(CLcontext& context, size_t capacity, int node = -1, bool huge = false){
+            this->context = &context;
+            this->capacity = capacity;
+            this->node = node;
+            this->huge = huge;
+            this->opened = 0;
+            this->current = 0;
+
+            cl_uint align_bits = 0;
+            cl_ulong max_alloc = 0;
+            clGetDeviceInfo(context.device, CL_DEVICE_MEM_BASE_ADDR_ALIGN, sizeof(cl_uint), &align_bits, NULL);
+            clGetDeviceInfo(context.device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(cl_ulong), &max_alloc, NULL);
+            this->alignment = align_bits >= 8 ? align_bits/8 : 1;
+            this->max_block = max_alloc;
+        }
+
+        ~Arena(){
+            for (size_t i = 0; i < blocks.size(); i++) {
+                clReleaseMemObject(blocks[i].mem);
+            }
+        }
+
+        /**
+         * Bytes a region of bytes takes up in the arena
+         */
+        size_t round(size_t bytes) const {
+            return (bytes + alignment-1)/alignment*alignment;
+        }
+
+        /**
+         * Grow the capacity by count regions of bytes, as they will be
+         * carved. Only has an effect before the first block is opened.
+         */
+        void reserve(size_t count, size_t bytes){
+            capacity += count*round(bytes);
+        }
+
+        Region carve(size_t bytes){
+            size_t size = round(bytes);
+            while (current < blocks.size() && blocks[current].used + size > blocks[current].size) {
+                current++;
+            }
+            if (current == blocks.size()) {
+                open(size);
+            }
+
+            Block& block = blocks[current];
+            Region region = {block.mem, block.used};
+            block.used += size;
+            return region;
+        }
+
+        Mark mark() const {
+            Mark m = {current, current < blocks.size() ? blocks[current].used : 0};
+            return m;
+        }
+
+        void rewind(const Mark& m){
+            current = m.block;
+            if (current < blocks.size()) {
+                blocks[current].used = m.used;
+            }
+        }
+
+        /**
+         * Driver allocations made so far
+         */
+        size_t allocations() const {
+            return blocks.size();
+        }
+
+        CLcontext& getContext(){
+            return *context;
+        }
+
+    private:
+        Arena(const Arena&);
+        Arena& operator=(const Arena&);
+
+        struct Block{
+            cl_mem  mem;
+            size_t  size;
+            size_t  used;
+        };
+
+        void open(size_t size){
+            size_t left = capacity > opened ? capacity - opened : 0;
+            size_t bytes = size > left ? size : left;
+            bytes = bytes > max_block ? max_block : bytes;
+            if (size > bytes) {
+                THROW_EXCEPTION("Region exceeds the largest device allocation");
+            }
+
+            // Host accessible storage on devices sharing host memory, as MO does
+            cl_mem_flags flags = CL_MEM_READ_WRITE;
+            if (context->unified) {
+                flags |= CL_MEM_ALLOC_HOST_PTR;
+            }
+
+            HostMemory* host = NULL;
+            if (context->unified && (node >= 0 || huge)) {
+                host = new HostMemory;
+                host->ptr = Numa::allocate(bytes, huge);
+                host->bytes = bytes;
+                if (host->ptr == NULL) {
+                    delete host;
+                    THROW_EXCEPTION("Failed to allocate arena host memory");
+                }
+                if (node >= 0) {
+                    Numa::firstTouch(host->ptr, bytes, node);
+                }
+                flags = CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR;
+            }
+
+            cl_int err;
+            Block block;
+            block.mem = clCreateBuffer(context->context, flags, bytes, host != NULL ? host->ptr : NULL, &err);
+            block.size = bytes;
+            block.used = 0;
+            if (err == CL_SUCCESS && host != NULL) {
+                // The memory has to outlive the block and its sub-buffers
+                err = clSetMemObjectDestructorCallback(block.mem, releaseHost, host);
+                if (err != CL_SUCCESS) {
+                    clReleaseMemObject(block.mem);
+                }
+            }
+            if(err != CL_SUCCESS){
+                if (host != NULL) {
+                    Numa::release(host->ptr, host->bytes);
+                    delete host;
+                }
+                std::stringstream ss;
+                ss << "Failed to create arena block! Error: " << err;
+                THROW_EXCEPTION(ss.str().c_str());
+            }
+            blocks.push_back(block);
+            opened += bytes;
+        }
+
+        struct HostMemory{
+            void*   ptr;
+            size_t  bytes;
+        };
+
+        static void CL_CALLBACK releaseHost(cl_mem mem, void* data){
+            HostMemory* host = (HostMemory*)data;
+            Numa::release(host->ptr, host->bytes);
+            delete host;
+        }
+
+        CLcontext* context;
+        std::vector<Block> blocks;
+        size_t current;
+        size_t capacity;
+        size_t opened;
+        size_t alignment;
+        size_t max_block;
+        int node;       // NUMA node of the host memory, -1 for none
+        bool huge;
+    };
+
+};//namespace CLUtils
+
+#endif
@@ -2,22 +2,27 @@
 #define _BO_HPP__
 
 #include <GL/glew.h>
+#include "DeviceMemory.hpp"
 
 namespace GLUtils {
 
 template <GLenum T>
 class BO {
 public:
-	BO(const void* data, unsigned int bytes, int usage=GL_STATIC_DRAW) {
+	BO(const void* data, unsigned int bytes, int usage=GL_STATIC_DRAW, const char* tag="buffer") {
+		this->bytes = bytes;
+		this->tag = tag;
 		glGenBuffers(1, &vbo_name);
 		bind();
 		glBufferData(T, bytes, data, usage);
 		unbind();
+		DeviceMemory::allocate(this->tag, bytes);
 	}
 
 	~BO() {
 		unbind();
 		glDeleteBuffers(1, &vbo_name);
+		DeviceMemory::release(tag, bytes);
 	}
 
 	inline void bind() {
@@ -35,6 +40,8 @@ public:
 private:
 	BO() {}
 	GLuint vbo_name; //< VBO name
+	unsigned int bytes;
+	std::string tag;
 };
 
 };//namespace GLUtils
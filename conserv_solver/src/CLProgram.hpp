@@ -61,7 +61,7 @@ namespace CLUtils {
                 THROW_EXCEPTION("Failed to create program");
             }
             
-            compile(context.device, options);
+            compile(context, options);
         }
         
         cl_kernel createKernel(std::string func) {
@@ -80,7 +80,7 @@ namespace CLUtils {
         }
 
     private:
-        void compile(cl_device_id device, std::string* options) {
+        void compile(CLcontext& context, std::string* options) {
             cl_int err;
             
             const char* opts = NULL;
@@ -88,7 +88,11 @@ namespace CLUtils {
                 opts = options->c_str();
             }
             
-            err = clBuildProgram(prog, 1, &device, opts, NULL, NULL);
+            // For the sub-devices of the context as well, if it has any
+            cl_device_id device = context.device;
+            std::vector<cl_device_id> devices(1, device);
+            devices.insert(devices.end(), context.nodes.begin(), context.nodes.end());
+            err = clBuildProgram(prog, (cl_uint)devices.size(), devices.data(), opts, NULL, NULL);
             if(err != CL_SUCCESS){
                 std::stringstream ss;
                 ss << "Kernel failed to compile.\n";
@@ -0,0 +1,69 @@
+//
+//  CLTimer.hpp
+//  GLAppNative
+//
+//  Created by Jens Kristoffer Reitan Markussen on 28.12.13.
+//  Copyright (c) 2013 Jens Kristoffer Reitan Markussen. All rights reserved.
+//
+
+#ifndef GLAppNative_CLTimer_hpp
+#define GLAppNative_CLTimer_hpp
+
+#include "GPUTimer.hpp"
+#include "CLUtils.hpp"
+
+/**
+ *  OpenCL timer built from profiled markers on an in-order queue. The
+ *  marker enqueued by begin() completes before anything after it starts,
+ *  the one from end() after everything before it, so the span between
+ *  their end times covers the work in between. The queue needs
+ *  CL_QUEUE_PROFILING_ENABLE.
+ */
+class CLTimer : public GPUTimer {
+public:
+    CLTimer(cl_command_queue queue, size_t frames = 4) : GPUTimer(frames),
+        queue(queue), events(2*frames, (cl_event)NULL) {};
+
+    virtual ~CLTimer() {
+        for (size_t i = 0; i < events.size(); i++) {
+            if (events[i] != NULL) {
+                clReleaseEvent(events[i]);
+            }
+        }
+    };
+
+protected:
+    virtual void mark(size_t frame, size_t which) {
+        cl_event& event = events[2*frame+which];
+        if (event != NULL) {
+            clReleaseEvent(event);
+            event = NULL;
+        }
+        if (clEnqueueMarkerWithWaitList(queue, 0, NULL, &event) != CL_SUCCESS) {
+            THROW_EXCEPTION("Failed to enqueue timer marker");
+        }
+    };
+
+    virtual double result(size_t frame) {
+        cl_int status;
+        clGetEventInfo(events[2*frame+1], CL_EVENT_COMMAND_EXECUTION_STATUS,
+                       sizeof(cl_int), &status, NULL);
+        if (status < 0) {
+            THROW_EXCEPTION("Timed commands failed");
+        }
+        if (status != CL_COMPLETE) {
+            return -1.0;
+        }
+
+        cl_ulong start, end;
+        clGetEventProfilingInfo(events[2*frame+0], CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &start, NULL);
+        clGetEventProfilingInfo(events[2*frame+1], CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, NULL);
+        return (end - start)*1e-9;
+    };
+
+private:
+    cl_command_queue queue;
+    std::vector<cl_event> events;
+};
+
+#endif
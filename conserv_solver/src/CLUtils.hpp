@@ -29,7 +29,8 @@ namespace CLUtils {
         cl_device_id        device;
         cl_context          context;
         cl_platform_id      platform;
-        
+        cl_bool             unified;    // device shares memory with the host
+        std::vector<cl_device_id> nodes; // sub-devices per NUMA node, when split
     };
     
     inline void printDeviceInfo(cl_device_id device){
@@ -48,7 +49,12 @@ namespace CLUtils {
         std::cout << vendor << " : " << name << std::endl;
     }
     
-    inline void createContext(CLcontext& c, cl_device_type type){
+    /**
+     * Create a context on the first device of type. With numa set, CPU
+     * devices are also split into a sub-device per NUMA node that joins the
+     * context, if there is more than one node.
+     */
+    inline void createContext(CLcontext& c, cl_device_type type, bool numa = false){
         cl_int err = CL_SUCCESS;
         err |= clGetPlatformIDs(1, &c.platform, NULL);
         if(err != CL_SUCCESS){
@@ -63,6 +69,28 @@ namespace CLUtils {
             THROW_EXCEPTION("Failed to find device ID");
         }
         
+        // CPU devices and integrated GPUs, buffers are then allocated host
+        // accessible and mapped rather than copied
+        c.unified = CL_FALSE;
+        clGetDeviceInfo(c.device, CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(cl_bool), &c.unified, NULL);
+        
+        // Sub-devices come in the order of the nodes
+        c.nodes.clear();
+        if (numa && type == CL_DEVICE_TYPE_CPU) {
+            cl_device_partition_property partition[] = {
+                CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN, CL_DEVICE_AFFINITY_DOMAIN_NUMA, 0
+            };
+            cl_uint count = 0;
+            if (clCreateSubDevices(c.device, partition, 0, NULL, &count) == CL_SUCCESS && count > 1) {
+                c.nodes.resize(count);
+                if (clCreateSubDevices(c.device, partition, count, c.nodes.data(), NULL) != CL_SUCCESS) {
+                    c.nodes.clear();
+                }
+            }
+        }
+        std::vector<cl_device_id> devices(1, c.device);
+        devices.insert(devices.end(), c.nodes.begin(), c.nodes.end());
+        
         // Create the properties for this context.
         cl_context_properties prop[] = {
             // We need to add information about the OpenGL context with
@@ -72,12 +100,13 @@ namespace CLUtils {
             0 , 0 ,
         };
         
-        c.context   = clCreateContext(prop, 1, &c.device, NULL, NULL, &err);
+        c.context   = clCreateContext(prop, (cl_uint)devices.size(), devices.data(), NULL, NULL, &err);
         if(err != CL_SUCCESS){
             THROW_EXCEPTION("Failed to create context");
         }
         
-        c.queue     = clCreateCommandQueue(c.context, c.device, 0, &err);
+        // Profiling gives every event device timestamps, used by tracing
+        c.queue     = clCreateCommandQueue(c.context, c.device, CL_QUEUE_PROFILING_ENABLE, &err);
         if(err != CL_SUCCESS){
             THROW_EXCEPTION("Failed to initialize command queue");
         }
@@ -88,6 +117,9 @@ namespace CLUtils {
         clFlush(c.queue);
         
         clReleaseCommandQueue(c.queue);
+        for (size_t i = 0; i < c.nodes.size(); i++) {
+            clReleaseDevice(c.nodes[i]);
+        }
         clReleaseDevice(c.device);
         clReleaseContext(c.context);
     }
@@ -95,7 +127,9 @@ namespace CLUtils {
 }; //Namespace CLUtils
 
 #include "MO.hpp"
+#include "StagingPool.hpp"
 #include "CLProgram.hpp"
 #include "ImageBuffer.hpp"
+#include "CommandBuffer.hpp"
 
 #endif
\ No newline at end of file
@@ -0,0 +1,142 @@
+#ifndef _COMMANDBUFFER_HPP__
+#define _COMMANDBUFFER_HPP__
+
+#include <string>
+
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#else
+#include <cl.h>
+#include <cl_ext.h>
+#endif
+
+namespace CLUtils {
+
+    /**
+     * Kernels recorded once into a cl_khr_command_buffer and replayed as a
+     * whole on the context queue. Kernel arguments are captured when the
+     * kernel is recorded. Each command waits on the one recorded before it,
+     * so a replay runs in recording order. Without the extension in the
+     * headers or on the device supported() is false and nothing else may
+     * be used.
+     */
+    class CommandBuffer {
+    public:
+        static bool supported(CLcontext& context){
+#ifdef cl_khr_command_buffer
+            size_t size = 0;
+            clGetDeviceInfo(context.device, CL_DEVICE_EXTENSIONS, 0, NULL, &size);
+            std::string extensions(size, ' ');
+            clGetDeviceInfo(context.device, CL_DEVICE_EXTENSIONS, size, &extensions[0], NULL);
+            extensions += " ";
+            if (extensions.find("cl_khr_command_buffer ") == std::string::npos) {
+                return false;
+            }
+
+            // Our queue only asks for profiling
+            cl_command_queue_properties required = 0;
+            clGetDeviceInfo(context.device, CL_DEVICE_COMMAND_BUFFER_REQUIRED_QUEUE_PROPERTIES_KHR,
+                            sizeof(required), &required, NULL);
+            return (required & ~(cl_command_queue_properties)CL_QUEUE_PROFILING_ENABLE) == 0;
+#else
+            (void)context;
+            return false;
+#endif
+        }
+
+        CommandBuffer(CLcontext& context){
+            this->context = &context;
+            this->recorded = 0;
+#ifdef cl_khr_command_buffer
+            createFn    = (clCreateCommandBufferKHR_fn)load("clCreateCommandBufferKHR");
+            ndrangeFn   = (clCommandNDRangeKernelKHR_fn)load("clCommandNDRangeKernelKHR");
+            finalizeFn  = (clFinalizeCommandBufferKHR_fn)load("clFinalizeCommandBufferKHR");
+            enqueueFn   = (clEnqueueCommandBufferKHR_fn)load("clEnqueueCommandBufferKHR");
+            releaseFn   = (clReleaseCommandBufferKHR_fn)load("clReleaseCommandBufferKHR");
+
+            cl_int err;
+            buffer = createFn(1, &context.queue, NULL, &err);
+            if(err != CL_SUCCESS){
+                THROW_EXCEPTION("Failed to create command buffer");
+            }
+#else
+            THROW_EXCEPTION("Command buffers are not supported");
+#endif
+        }
+
+        ~CommandBuffer(){
+#ifdef cl_khr_command_buffer
+            releaseFn(buffer);
+#endif
+        }
+
+        cl_int kernel(cl_kernel kernel, cl_uint dims, const size_t* offset, const size_t* global){
+#ifdef cl_khr_command_buffer
+            cl_sync_point_khr point;
+            cl_int err = ndrangeFn(buffer, NULL, NULL, kernel, dims, offset, global, NULL,
+                                   recorded > 0 ? 1 : 0, recorded > 0 ? &last : NULL, &point, NULL);
+            if (err == CL_SUCCESS) {
+                last = point;
+                recorded++;
+            }
+            return err;
+#else
+            return CL_INVALID_OPERATION;
+#endif
+        }
+
+        void finalize(){
+#ifdef cl_khr_command_buffer
+            if(finalizeFn(buffer) != CL_SUCCESS){
+                THROW_EXCEPTION("Failed to finalize command buffer");
+            }
+#endif
+        }
+
+        void enqueue(){
+#ifdef cl_khr_command_buffer
+            cl_int err = enqueueFn(1, &context->queue, buffer, 0, NULL, NULL);
+            if(err != CL_SUCCESS){
+                std::stringstream ss;
+                ss << "Failed to enqueue command buffer! Error: " << err;
+                THROW_EXCEPTION(ss.str().c_str());
+            }
+#endif
+        }
+
+        size_t size(){
+            return recorded;
+        }
+
+    private:
+        CommandBuffer(const CommandBuffer&);
+        CommandBuffer& operator=(const CommandBuffer&);
+
+        CLcontext* context;
+        size_t recorded;
+
+#ifdef cl_khr_command_buffer
+        void* load(const char* name){
+            void* fn = clGetExtensionFunctionAddressForPlatform(context->platform, name);
+            if (fn == NULL) {
+                std::string err = "Missing command buffer entry point ";
+                err.append(name);
+                THROW_EXCEPTION(err);
+            }
+            return fn;
+        }
+
+        cl_command_buffer_khr           buffer;
+        cl_sync_point_khr               last;
+
+        clCreateCommandBufferKHR_fn     createFn;
+        clCommandNDRangeKernelKHR_fn    ndrangeFn;
+        clFinalizeCommandBufferKHR_fn   finalizeFn;
+        clEnqueueCommandBufferKHR_fn    enqueueFn;
+        clReleaseCommandBufferKHR_fn    releaseFn;
+#endif
+    };
+
+}; //Namespace CLUtils
+
+#endif
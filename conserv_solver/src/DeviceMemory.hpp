@@ -0,0 +1,99 @@
+#ifndef _DEVICE_MEMORY_HPP__
+#define _DEVICE_MEMORY_HPP__
+
+#include <string>
+#include <map>
+#include <mutex>
+#include <ostream>
+
+/**
+ *  Registry of device memory allocated through the buffer, image and
+ *  texture wrappers, by purpose tag. Sizes are what was requested, drivers
+ *  may pad or place things in host memory. Objects shared between OpenCL
+ *  and OpenGL are counted once, by whoever allocated the storage.
+ */
+namespace DeviceMemory {
+    
+    struct Usage{
+        size_t bytes;       // currently allocated
+        size_t peak;
+        size_t count;       // live allocations
+    };
+    
+    struct Registry{
+        std::mutex lock;
+        std::map<std::string, Usage> tags;
+        Usage total;
+        
+        Registry() {
+            total.bytes = 0;
+            total.peak = 0;
+            total.count = 0;
+        }
+    };
+    
+    inline Registry& registry(){
+        static Registry r;
+        return r;
+    }
+    
+    inline void allocate(const std::string& tag, size_t bytes){
+        Registry& r = registry();
+        std::unique_lock<std::mutex> guard(r.lock);
+        
+        Usage& u = r.tags[tag];
+        u.bytes += bytes;
+        u.count++;
+        u.peak = u.bytes > u.peak ? u.bytes : u.peak;
+        
+        r.total.bytes += bytes;
+        r.total.count++;
+        r.total.peak = r.total.bytes > r.total.peak ? r.total.bytes : r.total.peak;
+    }
+    
+    inline void release(const std::string& tag, size_t bytes){
+        Registry& r = registry();
+        std::unique_lock<std::mutex> guard(r.lock);
+        
+        Usage& u = r.tags[tag];
+        u.bytes -= bytes;
+        u.count--;
+        
+        r.total.bytes -= bytes;
+        r.total.count--;
+    }
+    
+    inline Usage getTotal(){
+        Registry& r = registry();
+        std::unique_lock<std::mutex> guard(r.lock);
+        return r.total;
+    }
+    
+    inline std::map<std::string, Usage> getTags(){
+        Registry& r = registry();
+        std::unique_lock<std::mutex> guard(r.lock);
+        return r.tags;
+    }
+    
+    /**
+     * Peak and current usage per tag in MB
+     */
+    inline void report(std::ostream& out){
+        std::map<std::string, Usage> tags = getTags();
+        Usage total = getTotal();
+        
+        out << "Device memory peak " << total.peak/(1024.0*1024.0) << " MB, "
+            << total.bytes/(1024.0*1024.0) << " MB in " << total.count << " allocations still live" << std::endl;
+        for (std::map<std::string, Usage>::iterator it = tags.begin(); it != tags.end(); ++it) {
+            out << "\t" << it->first << ": peak " << it->second.peak/(1024.0*1024.0) << " MB";
+            if (it->second.count > 0) {
+                out << ", " << it->second.bytes/(1024.0*1024.0) << " MB in "
+                    << it->second.count << " live";
+            }
+            out << std::endl;
+        }
+    }
+    
+};//namespace DeviceMemory
+
+#endif
@@ -0,0 +1,94 @@
+//
+//  EnergyMeter
+//  GLAppNative
+//
+//  Created by Jens Kristoffer Reitan Markussen on 28.12.13.
+//  Copyright (c) 2013 Jens Kristoffer Reitan Markussen. All rights reserved.
+//
+
+#include "EnergyMeter.h"
+
+#include <fstream>
+#include <dirent.h>
+
+namespace {
+    const char* POWERCAP = "/sys/class/powercap/";
+
+    bool readValue(const std::string& file, double& value){
+        std::ifstream in(file.c_str());
+        return (bool)(in >> value);
+    }
+
+    bool readName(const std::string& file, std::string& name){
+        std::ifstream in(file.c_str());
+        return (bool)std::getline(in, name);
+    }
+}
+
+EnergyMeter::EnergyMeter(){
+    DIR* dir = opendir(POWERCAP);
+    if (dir == NULL) {
+        return;
+    }
+
+    // Packages and their DRAM subzones. Core and uncore are part of the
+    // package, psys covers the package too, so those are left out.
+    while (dirent* entry = readdir(dir)) {
+        std::string zone = entry->d_name;
+        if (zone.compare(0, 11, "intel-rapl:") != 0) {
+            continue;
+        }
+
+        std::string path = POWERCAP + zone + "/";
+        Zone z;
+        if (!readName(path + "name", z.name) ||
+            (z.name.compare(0, 7, "package") != 0 && z.name != "dram")) {
+            continue;
+        }
+
+        z.file = path + "energy_uj";
+        z.total = 0.0;
+        if (readValue(path + "max_energy_range_uj", z.range) && readValue(z.file, z.last)) {
+            z.name = zone + " " + z.name;
+            zones.push_back(z);
+        }
+    }
+    closedir(dir);
+}
+
+void EnergyMeter::start(){
+    for (size_t i = 0; i < zones.size(); i++) {
+        readValue(zones[i].file, zones[i].last);
+        zones[i].total = 0.0;
+    }
+}
+
+void EnergyMeter::resume(){
+    for (size_t i = 0; i < zones.size(); i++) {
+        readValue(zones[i].file, zones[i].last);
+    }
+}
+
+void EnergyMeter::update(){
+    for (size_t i = 0; i < zones.size(); i++) {
+        Zone& z = zones[i];
+        double now;
+        if (!readValue(z.file, now)) {
+            continue;
+        }
+        double used = now - z.last;
+        if (used < 0.0) {
+            used += z.range;
+        }
+        z.total += used*1e-6;
+        z.last = now;
+    }
+}
+
+double EnergyMeter::getJoules(){
+    double joules = 0.0;
+    for (size_t i = 0; i < zones.size(); i++) {
+        joules += zones[i].total;
+    }
+    return joules;
+}
@@ -0,0 +1,67 @@
+//
+//  EnergyMeter
+//  GLAppNative
+//
+//  Created by Jens Kristoffer Reitan Markussen on 28.12.13.
+//  Copyright (c) 2013 Jens Kristoffer Reitan Markussen. All rights reserved.
+//
+
+#ifndef GLAppNative_EnergyMeter_h
+#define GLAppNative_EnergyMeter_h
+
+#include <string>
+#include <vector>
+
+/**
+ *  Energy used by the CPU packages and DRAM, read from the RAPL counters
+ *  Linux exposes in /sys/class/powercap (intel-rapl, also used for AMD).
+ *  The counters wrap around, so update() has to be called at least once
+ *  per wrap, which is minutes even at full load.
+ *
+ *  Reading energy_uj is root only on recent kernels. Without readable
+ *  zones the meter is not available and reports nothing.
+ */
+class EnergyMeter {
+public:
+    EnergyMeter();
+
+    bool available(){return !zones.empty();}
+
+    /**
+     * Start counting from zero
+     */
+    void start();
+
+    /**
+     * Continue counting from now, energy used since the last update is not
+     * counted
+     */
+    void resume();
+
+    /**
+     * Accumulate energy used since the last update or resume
+     */
+    void update();
+
+    /**
+     * Joules since start, summed over all zones
+     */
+    double getJoules();
+
+    size_t getZoneCount(){return zones.size();}
+    const std::string& getZoneName(size_t i){return zones[i].name;}
+    double getZoneJoules(size_t i){return zones[i].total;}
+
+private:
+    struct Zone{
+        std::string name;
+        std::string file;
+        double range;       // microjoules the counter counts to before wrapping
+        double last;
+        double total;       // joules
+    };
+
+    std::vector<Zone> zones;
+};
+
+#endif
@@ -12,6 +12,7 @@
 
 #include "GLProgram.hpp"
 #include "BO.hpp"
+#include "PackPool.hpp"
 
 #define BUFFER_OFFSET(i) ((char *)NULL + (i))
 #define CHECK_GL_ERRORS() GLUtils::checkGLErrors(__FILE__, __LINE__)
@@ -0,0 +1,146 @@
+//
+//  GPUTimer.hpp
+//  GLAppNative
+//
+//  Created by Jens Kristoffer Reitan Markussen on 28.12.13.
+//  Copyright (c) 2013 Jens Kristoffer Reitan Markussen. All rights reserved.
+//
+
+#ifndef GLAppNative_GPUTimer_hpp
+#define GLAppNative_GPUTimer_hpp
+
+#include "GLUtils.hpp"
+
+#include <vector>
+
+/**
+ *  Times device work between begin() and end() without waiting for it.
+ *  Measurements go into a ring of frames and are picked up once the device
+ *  is done with them, typically a few frames later. If every frame in the
+ *  ring is still in flight the new measurement is skipped rather than
+ *  stalling. Times are in seconds.
+ */
+class GPUTimer {
+public:
+    GPUTimer(size_t frames) : frames(frames), head(0), in_flight(0),
+        skipping(false), last(-1.0), total(0.0), samples(0) {};
+
+    virtual ~GPUTimer() {};
+
+    /**
+     * Start measuring the device work submitted from now on
+     */
+    void begin() {
+        collect();
+        skipping = in_flight == frames;
+        if (!skipping) {
+            mark((head + in_flight) % frames, 0);
+        }
+    };
+
+    /**
+     * Stop measuring, the result shows up once the device gets here
+     */
+    void end() {
+        if (!skipping) {
+            mark((head + in_flight) % frames, 1);
+            in_flight++;
+        }
+    };
+
+    /**
+     * Latest finished measurement, negative until the first one is in
+     */
+    double elapsed() {
+        collect();
+        return last;
+    };
+
+    /**
+     * Average of all finished measurements, negative if there are none
+     */
+    double average() {
+        collect();
+        return samples > 0 ? total/samples : -1.0;
+    };
+
+    size_t getSamples() {return samples;}
+
+protected:
+    /**
+     * Record the start (which = 0) or end (which = 1) of frame frame
+     */
+    virtual void mark(size_t frame, size_t which) = 0;
+
+    /**
+     * Returns the duration of a frame if the device is done with it,
+     * negative otherwise
+     */
+    virtual double result(size_t frame) = 0;
+
+private:
+    void collect() {
+        while (in_flight > 0) {
+            double t = result(head);
+            if (t < 0.0) {
+                break;
+            }
+            last = t;
+            total += t;
+            samples++;
+            head = (head + 1) % frames;
+            in_flight--;
+        }
+    };
+
+protected:
+    size_t frames;
+
+private:
+    size_t head;
+    size_t in_flight;
+    bool skipping;
+
+    double last;
+    double total;
+    size_t samples;
+};
+
+/**
+ *  OpenGL timer built from GL_TIMESTAMP query pairs. Unlike GL_TIME_ELAPSED
+ *  queries, timestamps can be nested and overlapped, so several timers can
+ *  run at once.
+ */
+class GLTimer : public GPUTimer {
+public:
+    GLTimer(size_t frames = 4) : GPUTimer(frames), queries(2*frames) {
+        glGenQueries(2*frames, &queries[0]);
+    };
+
+    virtual ~GLTimer() {
+        glDeleteQueries(2*frames, &queries[0]);
+    };
+
+protected:
+    virtual void mark(size_t frame, size_t which) {
+        glQueryCounter(queries[2*frame+which], GL_TIMESTAMP);
+    };
+
+    virtual double result(size_t frame) {
+        GLint available = 0;
+        glGetQueryObjectiv(queries[2*frame+1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            return -1.0;
+        }
+
+        GLuint64 start, end;
+        glGetQueryObjectui64v(queries[2*frame+0], GL_QUERY_RESULT, &start);
+        glGetQueryObjectui64v(queries[2*frame+1], GL_QUERY_RESULT, &end);
+        return (end - start)*1e-9;
+    };
+
+private:
+    std::vector<GLuint> queries;
+};
+
+#endif
@@ -7,19 +7,26 @@
 #include <cl.h>
 #endif
 
+#include "DeviceMemory.hpp"
+
 namespace CLUtils {
     
     template <cl_mem_flags T>
     class ImageBuffer {
     public:
-        ImageBuffer(CLcontext context, unsigned short width, unsigned short height, void* data) {
+        ImageBuffer(CLcontext context, size_t width, size_t height, void* data,
+                    const char* tag = "image") {
             cl_int err;
             
+            this->texture = 0;
+            this->bytes = width*height*4*sizeof(cl_float);
+            this->tag = tag;
+            
             cl_image_format format;
             format.image_channel_order = CL_RGBA;
             format.image_channel_data_type = CL_FLOAT;
             
-            cl_image_desc desc;
+            cl_image_desc desc = {};
             desc.image_width = width;
             desc.image_height = height;
             desc.image_type = CL_MEM_OBJECT_IMAGE2D;
@@ -28,28 +35,37 @@ namespace CLUtils {
             if(err != CL_SUCCESS){
                 THROW_EXCEPTION("Failed to create memory object");
             }
+            DeviceMemory::allocate(this->tag, bytes);
         }
         
         ImageBuffer(CLcontext context, const GLuint& texture){
             cl_int err;
             
+            // Storage belongs to the texture and is counted by its owner
+            this->texture = 0;
+            this->bytes = 0;
+            
             image = clCreateFromGLTexture(context.context, T, GL_TEXTURE_2D, 0, texture, &err);
             if(err != CL_SUCCESS){
                 THROW_EXCEPTION("Failed to create memory object");
             }
         }
         
-        ImageBuffer(CLcontext context, GLuint& texture, unsigned short width, unsigned short height, void* data = NULL){
+        ImageBuffer(CLcontext context, GLuint& texture, size_t width, size_t height, void* data = NULL,
+                    const char* tag = "image"){
             
             cl_int err;
             
+            this->bytes = width*height*4*sizeof(GLfloat);
+            this->tag = tag;
+            
             glGenTextures(1, &texture);
             glBindTexture(GL_TEXTURE_2D, texture);
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, data);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, (GLsizei)width, (GLsizei)height, 0, GL_RGBA, GL_FLOAT, data);
             
             image = clCreateFromGLTexture(context.context, T, GL_TEXTURE_2D, 0, texture, &err);
             if(err != CL_SUCCESS){
@@ -57,10 +73,20 @@ namespace CLUtils {
             }
             
             glBindTexture(GL_TEXTURE_2D, 0);
+            
+            // The texture is created here, so it goes with the image
+            this->texture = texture;
+            DeviceMemory::allocate(this->tag, bytes);
         }
         
         ~ImageBuffer() {
             clReleaseMemObject(image);
+            if (texture != 0) {
+                glDeleteTextures(1, &texture);
+            }
+            if (bytes > 0) {
+                DeviceMemory::release(tag, bytes);
+            }
         }
         
         cl_image& getRef(){
@@ -70,6 +96,9 @@ namespace CLUtils {
     private:
         ImageBuffer() {}
         cl_image image;
+        GLuint texture;     // owned texture, 0 if none
+        size_t bytes;       // 0 for shared objects
+        std::string tag;
     };
     
 };//namespace CLUtils
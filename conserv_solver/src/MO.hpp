@@ -7,52 +7,151 @@
 #include <cl.h>
 #endif
 
+#include "DeviceMemory.hpp"
+#include "Arena.hpp"
+
 namespace CLUtils {
     
     template <cl_mem_flags T>
     class MO {
     public:
-        MO(CLcontext& context, size_t bytes, void* data) {
+        MO(CLcontext& context, size_t bytes, void* data, const char* tag = "buffer") {
             cl_int err;
             
             this->bytes = bytes;
             this->context = &context;
+            this->tag = tag;
+            
+            // Host accessible storage on devices sharing host memory, so
+            // mapping it is free
+            cl_mem_flags flags = T;
+            if (context.unified && (T & CL_MEM_USE_HOST_PTR) == 0) {
+                flags |= CL_MEM_ALLOC_HOST_PTR;
+            }
             
-            mem = clCreateBuffer(context.context, T, bytes, data, &err);
+            mem = clCreateBuffer(context.context, flags, bytes, data, &err);
             if(err != CL_SUCCESS){
                 THROW_EXCEPTION("Failed to create memory object");
             }
+            DeviceMemory::allocate(this->tag, bytes);
         }
         
-        MO(CLcontext& context, GLUtils::BO<GL_ARRAY_BUFFER> buffer){
+        /**
+         * Sub-buffer carved out of an arena. A NULL tag leaves the bytes
+         * uncounted, for regions aliasing another buffer.
+         */
+        MO(Arena& arena, size_t bytes, const char* tag = "buffer") {
             cl_int err;
             
             this->bytes = bytes;
+            this->context = &arena.getContext();
+            this->tag = tag != NULL ? tag : "";
+            
+            // Host pointer flags come from the arena block
+            Arena::Region region = arena.carve(bytes);
+            cl_buffer_region info = {region.offset, bytes};
+            mem = clCreateSubBuffer(region.parent, T & (CL_MEM_READ_WRITE|CL_MEM_READ_ONLY|CL_MEM_WRITE_ONLY),
+                                    CL_BUFFER_CREATE_TYPE_REGION, &info, &err);
+            if(err != CL_SUCCESS){
+                THROW_EXCEPTION("Failed to create sub-buffer");
+            }
+            if (!this->tag.empty()) {
+                DeviceMemory::allocate(this->tag, bytes);
+            }
+        }
+        
+        MO(MO&& other){
+            take(other);
+        }
+        
+        MO& operator=(MO&& other){
+            if (this != &other) {
+                release();
+                take(other);
+            }
+            return *this;
+        }
+        
+        MO(const MO&) = delete;
+        MO& operator=(const MO&) = delete;
+        
+        MO(CLcontext& context, GLUtils::BO<GL_ARRAY_BUFFER>& buffer){
+            cl_int err;
+            
             this->context = &context;
             
+            // Storage belongs to the GL buffer and is counted there
             mem = clCreateFromGLBuffer(context.context, T, buffer.name(), &err);
             if(err != CL_SUCCESS){
                 THROW_EXCEPTION("Failed to create memory object");
             }
+            clGetMemObjectInfo(mem, CL_MEM_SIZE, sizeof(size_t), &bytes, NULL);
         }
         
         void upload(void* data){
             clEnqueueWriteBuffer(context->queue, mem, CL_TRUE, 0, bytes, data, 0, NULL, NULL);
         }
-        
+
+        void* map(cl_map_flags flags){
+            return map(flags, 0, bytes);
+        }
+
+        void* map(cl_map_flags flags, size_t offset, size_t size){
+            cl_int err;
+
+            void* ptr = clEnqueueMapBuffer(context->queue, mem, CL_TRUE, flags, offset, size, 0, NULL, NULL, &err);
+            if(err != CL_SUCCESS){
+                THROW_EXCEPTION("Failed to map memory object");
+            }
+            return ptr;
+        }
+
+        void unmap(void* ptr){
+            clEnqueueUnmapMemObject(context->queue, mem, ptr, 0, NULL, NULL);
+        }
+
+        size_t size(){
+            return bytes;
+        }
+
         cl_mem& getRef(){
             return mem;
         }
         
         ~MO() {
-            clReleaseMemObject(mem);
+            release();
         }
         
     private:
         MO() {}
+        
+        void take(MO& other){
+            mem = other.mem;
+            context = other.context;
+            bytes = other.bytes;
+            tag = other.tag;
+            
+            // Nothing left to release in the moved from handle
+            other.mem = NULL;
+            other.tag.clear();
+        }
+        
+        void release(){
+            if (mem != NULL) {
+                clReleaseMemObject(mem);
+            }
+            if (!tag.empty()) {
+                DeviceMemory::release(tag, bytes);
+            }
+            mem = NULL;
+            tag.clear();
+        }
+        
         cl_mem mem;
         CLcontext* context;
         size_t bytes;
+        std::string tag;    // empty for shared objects
+
     };
     
 };//namespace CLUtils
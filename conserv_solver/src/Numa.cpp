@@ -0,0 +1,165 @@
+//
+//  Numa
+//  GLAppNative
+//
+//  Created by Jens Kristoffer Reitan Markussen on 28.12.13.
+//  Copyright (c) 2013 Jens Kristoffer Reitan Markussen. All rights reserved.
+//
+
+#include "Numa.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <algorithm>
+
+#ifdef __linux__
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#endif
+
+namespace {
+
+    /**
+     * CPUs of a sysfs cpulist such as "0-7,16-23"
+     */
+    std::vector<int> parseList(const std::string& list){
+        std::vector<int> cpus;
+        std::stringstream ss(list);
+        std::string range;
+        while (std::getline(ss, range, ',')) {
+            int first, last;
+            int n = sscanf(range.c_str(), "%d-%d", &first, &last);
+            if (n == 1) {
+                last = first;
+            } else if (n != 2) {
+                continue;
+            }
+            for (int c = first; c <= last; c++) {
+                cpus.push_back(c);
+            }
+        }
+        return cpus;
+    }
+
+    /**
+     * CPUs of every node that has any, one empty node where that is unknown
+     */
+    std::vector<std::vector<int> > readTopology(){
+        std::vector<std::vector<int> > topology;
+#ifdef __linux__
+        // Node numbers may have gaps
+        for (size_t node = 0; node < 256; node++) {
+            std::stringstream path;
+            path << "/sys/devices/system/node/node" << node << "/cpulist";
+            std::ifstream file(path.str().c_str());
+            if (!file.good()) {
+                continue;
+            }
+
+            std::string list;
+            std::getline(file, list);
+            std::vector<int> cpus = parseList(list);
+            if (!cpus.empty()) {
+                topology.push_back(cpus);
+            }
+        }
+#endif
+        if (topology.empty()) {
+            topology.push_back(std::vector<int>());
+        }
+        return topology;
+    }
+
+    const std::vector<std::vector<int> >& topology(){
+        static const std::vector<std::vector<int> > t = readTopology();
+        return t;
+    }
+}
+
+namespace Numa {
+
+    size_t nodes(){
+        return topology().size();
+    }
+
+    bool pin(size_t node){
+        if (node >= nodes() || topology()[node].empty()) {
+            return false;
+        }
+#ifdef __linux__
+        const std::vector<int>& cpus = topology()[node];
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (size_t i = 0; i < cpus.size(); i++) {
+            CPU_SET(cpus[i], &set);
+        }
+        return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+        return false;
+#endif
+    }
+
+    void* allocate(size_t bytes, bool huge){
+#ifdef __linux__
+        void* ptr = mmap(NULL, bytes, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if (ptr == MAP_FAILED) {
+            return NULL;
+        }
+#ifdef MADV_HUGEPAGE
+        // Fewer TLB misses on the stencils' row-apart neighbours
+        if (huge) {
+            madvise(ptr, bytes, MADV_HUGEPAGE);
+        }
+#endif
+        return ptr;
+#else
+        void* ptr = NULL;
+        if (posix_memalign(&ptr, 4096, bytes) != 0) {
+            return NULL;
+        }
+        return ptr;
+#endif
+    }
+
+    void release(void* ptr, size_t bytes){
+        if (ptr == NULL) {
+            return;
+        }
+#ifdef __linux__
+        munmap(ptr, bytes);
+#else
+        free(ptr);
+#endif
+    }
+
+    void firstTouch(void* ptr, size_t bytes, size_t node){
+        size_t cpus = node < nodes() ? topology()[node].size() : 0;
+        if (cpus == 0) {
+            memset(ptr, 0, bytes);
+            return;
+        }
+
+        // Whole pages per thread, the calling thread is left unpinned
+        const size_t page = 4096;
+        size_t share = ((bytes+page-1)/page + cpus-1)/cpus*page;
+        std::vector<std::thread> threads;
+        for (size_t start = 0; start < bytes; start += share) {
+            char* first = (char*)ptr + start;
+            size_t length = std::min(share, bytes - start);
+            threads.push_back(std::thread([=](){
+                pin(node);
+                memset(first, 0, length);
+            }));
+        }
+        for (size_t i = 0; i < threads.size(); i++) {
+            threads[i].join();
+        }
+    }
+}
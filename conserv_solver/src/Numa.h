@@ -0,0 +1,50 @@
+//
+//  Numa
+//  GLAppNative
+//
+//  Created by Jens Kristoffer Reitan Markussen on 28.12.13.
+//  Copyright (c) 2013 Jens Kristoffer Reitan Markussen. All rights reserved.
+//
+
+#ifndef GLAppNative_Numa_h
+#define GLAppNative_Numa_h
+
+#include <stddef.h>
+
+/**
+ *  Placement of host memory on the NUMA nodes of a Linux machine. Pages are
+ *  placed by first touch, so memory zeroed by threads pinned to a node
+ *  lives on that node. The topology is read from sysfs, without libnuma.
+ *
+ *  Elsewhere there is a single node, pinning does nothing and memory is
+ *  touched by the calling thread.
+ */
+namespace Numa {
+
+    /**
+     * Nodes with CPUs, at least one
+     */
+    size_t nodes();
+
+    /**
+     * Pin the calling thread to the CPUs of node, returns false if it could
+     * not be pinned
+     */
+    bool pin(size_t node);
+
+    /**
+     * Page aligned memory, backed by transparent huge pages where huge is
+     * set and the kernel allows it. Pages are not touched.
+     */
+    void* allocate(size_t bytes, bool huge);
+
+    void release(void* ptr, size_t bytes);
+
+    /**
+     * Zero bytes at ptr from a thread per CPU of node, pinned to it, so the
+     * pages are placed on node
+     */
+    void firstTouch(void* ptr, size_t bytes, size_t node);
+}
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef _PACK_POOL_HPP__
+#define _PACK_POOL_HPP__
+
+#include <vector>
+#include <GL/glew.h>
+#include "BO.hpp"
+
+namespace GLUtils {
+
+/**
+ * Pixel pack buffers for reading back textures and framebuffers, reused
+ * once given back instead of reading into fresh host arrays. A request
+ * gets the smallest free buffer that fits.
+ */
+class PackPool {
+public:
+	typedef BO<GL_PIXEL_PACK_BUFFER> PBO;
+	
+	/**
+	 * Buffer borrowed for a scope
+	 */
+	class Lease {
+	public:
+		Lease(PackPool& pool, size_t bytes) : pool(pool) {
+			pbo = pool.borrow(bytes);
+		}
+		
+		~Lease() {
+			pool.giveBack(pbo);
+		}
+		
+		PBO* get() {
+			return pbo;
+		}
+		
+	private:
+		Lease(const Lease&);
+		Lease& operator=(const Lease&);
+		
+		PackPool& pool;
+		PBO* pbo;
+	};
+	
+	PackPool() {}
+	
+	~PackPool() {
+		for (size_t i = 0; i < entries.size(); i++) {
+			delete entries[i].pbo;
+		}
+	}
+	
+	PBO* borrow(size_t bytes) {
+		size_t best = entries.size();
+		for (size_t i = 0; i < entries.size(); i++) {
+			if (!entries[i].used && entries[i].bytes >= bytes &&
+				(best == entries.size() || entries[i].bytes < entries[best].bytes)) {
+				best = i;
+			}
+		}
+		
+		if (best == entries.size()) {
+			Entry e;
+			e.pbo = new PBO(NULL, (unsigned int)bytes, GL_STREAM_READ, "staging");
+			e.bytes = bytes;
+			entries.push_back(e);
+		}
+		
+		entries[best].used = true;
+		return entries[best].pbo;
+	}
+	
+	void giveBack(PBO* pbo) {
+		for (size_t i = 0; i < entries.size(); i++) {
+			if (entries[i].pbo == pbo) {
+				entries[i].used = false;
+				return;
+			}
+		}
+	}
+	
+private:
+	PackPool(const PackPool&);
+	PackPool& operator=(const PackPool&);
+	
+	struct Entry{
+		PBO* pbo;
+		size_t bytes;
+		bool used;
+	};
+	
+	std::vector<Entry> entries;
+};
+
+};//namespace GLUtils
+
+#endif
@@ -0,0 +1,182 @@
+//
+//  Perf
+//  GLAppNative
+//
+//  Created by Jens Kristoffer Reitan Markussen on 28.12.13.
+//  Copyright (c) 2013 Jens Kristoffer Reitan Markussen. All rights reserved.
+//
+
+#include "Perf.h"
+
+#include <string.h>
+#include <stdint.h>
+#include <fstream>
+#include <iostream>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+    struct State{
+        bool enabled;
+        int fd[Perf::COUNTERS];
+        std::map<std::string, Perf::Counts> phases;
+
+        State() : enabled(false) {
+            for (size_t i = 0; i < Perf::COUNTERS; i++) {
+                fd[i] = -1;
+            }
+        }
+    };
+
+    State& state(){
+        static State s;
+        return s;
+    }
+
+#ifdef __linux__
+    int openCounter(uint32_t type, uint64_t config){
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size           = sizeof(attr);
+        attr.type           = type;
+        attr.config         = config;
+        attr.inherit        = 1;    // follow threads created later
+        attr.exclude_kernel = 1;    // allowed with perf_event_paranoid 2
+        attr.exclude_hv     = 1;
+        attr.read_format    = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+
+    uint64_t cacheMiss(uint64_t cache){
+        return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    }
+
+    bool isIntel(){
+        std::ifstream cpuinfo("/proc/cpuinfo");
+        std::string line;
+        while (std::getline(cpuinfo, line)) {
+            if (line.compare(0, 9, "vendor_id") == 0) {
+                return line.find("GenuineIntel") != std::string::npos;
+            }
+        }
+        return false;
+    }
+#endif
+
+    /**
+     * Current value of every counter, extrapolated over the time it was
+     * not scheduled when more counters are open than the PMU has
+     */
+    void readAll(double* values){
+        State& s = state();
+        for (size_t i = 0; i < Perf::COUNTERS; i++) {
+            values[i] = 0.0;
+#ifdef __linux__
+            uint64_t data[3];   // value, time enabled, time running
+            if (s.fd[i] >= 0 && read(s.fd[i], data, sizeof(data)) == sizeof(data) && data[2] > 0) {
+                values[i] = (double)data[0]*data[1]/data[2];
+            }
+#endif
+        }
+    }
+}
+
+namespace Perf {
+
+    bool begin(){
+        State& s = state();
+        if (s.enabled) {
+            return true;
+        }
+#ifdef __linux__
+        s.fd[CYCLES]        = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+        s.fd[INSTRUCTIONS]  = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+        s.fd[LLC_MISSES]    = openCounter(PERF_TYPE_HW_CACHE, cacheMiss(PERF_COUNT_HW_CACHE_LL));
+        s.fd[DTLB_MISSES]   = openCounter(PERF_TYPE_HW_CACHE, cacheMiss(PERF_COUNT_HW_CACHE_DTLB));
+        if (isIntel()) {
+            // FP_ARITH_INST_RETIRED, 128, 256 and 512 bit packed single
+            s.fd[VECTOR_INSTRUCTIONS] = openCounter(PERF_TYPE_RAW, 0xA8C7);
+        }
+
+        for (size_t i = 0; i < COUNTERS; i++) {
+            s.enabled |= s.fd[i] >= 0;
+        }
+#endif
+        if (!s.enabled) {
+            std::cout << "Hardware counters are not available, check perf_event_paranoid" << std::endl;
+            return false;
+        }
+        for (size_t i = 0; i < COUNTERS; i++) {
+            if (s.fd[i] < 0) {
+                std::cout << "Counter " << name((Counter)i) << " is not available" << std::endl;
+            }
+        }
+        return true;
+    }
+
+    void end(){
+        State& s = state();
+        for (size_t i = 0; i < COUNTERS; i++) {
+#ifdef __linux__
+            if (s.fd[i] >= 0) {
+                close(s.fd[i]);
+            }
+#endif
+            s.fd[i] = -1;
+        }
+        s.enabled = false;
+    }
+
+    bool enabled(){
+        return state().enabled;
+    }
+
+    bool available(Counter c){
+        return state().fd[c] >= 0;
+    }
+
+    const char* name(Counter c){
+        static const char* names[COUNTERS] = {
+            "cycles", "instructions", "llc_misses", "dtlb_misses", "vector_instructions"
+        };
+        return names[c];
+    }
+
+    std::map<std::string, Counts> getPhases(){
+        return state().phases;
+    }
+
+    Phase::Phase(const char* name, cl_command_queue queue){
+        this->name = name;
+        this->queue = queue;
+        this->active = enabled();
+        if (active) {
+            if (queue != NULL) {
+                clFinish(queue);
+            }
+            readAll(start);
+        }
+    }
+
+    Phase::~Phase(){
+        if (!active || !enabled()) {
+            return;
+        }
+        if (queue != NULL) {
+            clFinish(queue);
+        }
+        double end[COUNTERS];
+        readAll(end);
+
+        Counts& counts = state().phases[name];
+        counts.calls++;
+        for (size_t i = 0; i < COUNTERS; i++) {
+            counts.value[i] += end[i] - start[i];
+        }
+    }
+}
@@ -0,0 +1,94 @@
+//
+//  Perf
+//  GLAppNative
+//
+//  Created by Jens Kristoffer Reitan Markussen on 28.12.13.
+//  Copyright (c) 2013 Jens Kristoffer Reitan Markussen. All rights reserved.
+//
+
+#ifndef GLAppNative_Perf_h
+#define GLAppNative_Perf_h
+
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#else
+#include <cl.h>
+#endif
+
+#include <string>
+#include <map>
+
+/**
+ *  Hardware performance counters per phase of a step, read with Linux
+ *  perf_event_open. Counters are opened for the whole process and inherited
+ *  by threads started afterwards, so when begin() runs before the OpenCL
+ *  context is created the worker threads of a CPU device are counted too.
+ *  Threads of our own, like the snapshot writer, are counted as well.
+ *
+ *  Everything is a no-op until begin() succeeds. Counters the CPU or the
+ *  perf_event_paranoid setting do not allow are reported as unavailable.
+ */
+namespace Perf {
+
+    enum Counter{
+        CYCLES,
+        INSTRUCTIONS,
+        LLC_MISSES,
+        DTLB_MISSES,
+        VECTOR_INSTRUCTIONS,    // packed single precision arithmetic, Intel only
+        COUNTERS
+    };
+
+    /**
+     * Summed counts of all runs of a phase, scaled for multiplexing
+     */
+    struct Counts{
+        size_t calls;
+        double value[COUNTERS];
+    };
+
+    /**
+     * Open the counters, returns false if none could be opened
+     */
+    bool begin();
+
+    /**
+     * Close the counters
+     */
+    void end();
+
+    bool enabled();
+
+    bool available(Counter c);
+
+    /**
+     * Name of a counter as used in the results
+     */
+    const char* name(Counter c);
+
+    /**
+     * Totals of every phase so far
+     */
+    std::map<std::string, Counts> getPhases();
+
+    /**
+     * Scoped phase. If a queue is given it is finished on entry and exit so
+     * the device work of the phase is counted in it and nothing else.
+     */
+    class Phase {
+    public:
+        Phase(const char* name, cl_command_queue queue = NULL);
+        ~Phase();
+    private:
+        const char* name;
+        cl_command_queue queue;
+        double start[COUNTERS];
+        bool active;
+    };
+}
+
+#define PERF_CONCAT_(a,b) a##b
+#define PERF_CONCAT(a,b) PERF_CONCAT_(a,b)
+#define PERF_PHASE(...) Perf::Phase PERF_CONCAT(perf_phase_,__LINE__)(__VA_ARGS__)
+
+#endif
@@ -0,0 +1,90 @@
+//
+//  ProbeRecorder
+//  GLAppNative
+//
+//  Created by Jens Kristoffer Reitan Markussen on 28.12.13.
+//  Copyright (c) 2013 Jens Kristoffer Reitan Markussen. All rights reserved.
+//
+
+#include "ProbeRecorder.h"
+
+#include <algorithm>
+
+ProbeRecorder::ProbeRecorder(SimulatorBase* sim, std::string file,
+                             const std::vector<glm::ivec2>& cells, size_t interval){
+    if (cells.empty() || interval == 0) {
+        THROW_EXCEPTION("No probes to record");
+    }
+    
+    this->sim = sim;
+    this->cells = cells;
+    this->capacity = interval;
+    this->samples = 0;
+    this->pending = 0;
+    
+    slot_step.resize(capacity);
+    slot_time.resize(capacity);
+    
+    sim->createProbes(cells, capacity);
+    
+    output.open(file.c_str());
+    if (!output) {
+        THROW_EXCEPTION("Could not open probe file");
+    }
+    output << "step,time,probe,x,y";
+    for (size_t c = 0; c < 4; c++) {
+        output << "," << sim->getFieldName(c);
+    }
+    output << '\n';
+}
+
+ProbeRecorder::~ProbeRecorder(){
+    output.close();
+}
+
+void ProbeRecorder::update(size_t step, const SimDetail& detail){
+    size_t slot = samples % capacity;
+    
+    sim->sampleProbes(slot);
+    slot_step[slot] = step;
+    slot_time[slot] = detail.time;
+    
+    samples++;
+    pending++;
+    
+    if (pending == capacity) {
+        flush();
+    }
+}
+
+void ProbeRecorder::finish(){
+    if (pending > 0) {
+        flush();
+    }
+    output.flush();
+}
+
+void ProbeRecorder::flush(){
+    size_t first = (samples - pending) % capacity;
+    size_t probes = cells.size();
+    
+    // Pending slots wrap around the end of the ring at most once
+    std::vector<float> data(pending*probes*4);
+    size_t head = std::min(pending, capacity - first);
+    sim->readProbes(first, head, data.data());
+    if (head < pending) {
+        sim->readProbes(0, pending - head, data.data() + head*probes*4);
+    }
+    
+    for (size_t i = 0; i < pending; i++) {
+        size_t slot = (first + i) % capacity;
+        for (size_t p = 0; p < probes; p++) {
+            const float* q = &data[(i*probes + p)*4];
+            output << slot_step[slot] << "," << slot_time[slot] << "," << p << ","
+                << cells[p].x << "," << cells[p].y << ","
+                << q[0] << "," << q[1] << "," << q[2] << "," << q[3] << '\n';
+        }
+    }
+    
+    pending = 0;
+}
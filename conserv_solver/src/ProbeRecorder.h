@@ -0,0 +1,73 @@
+//
+//  ProbeRecorder
+//  GLAppNative
+//
+//  Created by Jens Kristoffer Reitan Markussen on 28.12.13.
+//  Copyright (c) 2013 Jens Kristoffer Reitan Markussen. All rights reserved.
+//
+
+#ifndef GLAppNative_ProbeRecorder_h
+#define GLAppNative_ProbeRecorder_h
+
+#include "SimulatorBase.h"
+
+#include <string>
+#include <vector>
+#include <fstream>
+
+/**
+ *  Time series of the state at a few fixed cells, e.g. pressure gauges
+ *  along a wall. Every step the simulator samples the probes into a ring
+ *  buffer on the device; the ring is only read back once it is full and
+ *  when recording finishes, so the step itself never waits on a transfer.
+ *  Samples are written as CSV, one line per probe and step.
+ */
+class ProbeRecorder{
+public:
+    /**
+	 * Constructor, interval is the number of steps kept on the device
+	 * between reads
+	 */
+	ProbeRecorder(SimulatorBase* sim, std::string file,
+                  const std::vector<glm::ivec2>& cells, size_t interval);
+
+	/**
+	 * Destructor
+	 */
+	~ProbeRecorder();
+
+    /**
+     * Samples the current state, called once per step
+     */
+    void update(size_t step, const SimDetail& detail);
+
+    /**
+     * Reads back and writes what is left in the ring
+     */
+    void finish();
+
+    size_t getSamples(){return samples;}
+    size_t getProbes(){return cells.size();}
+
+private:
+    /**
+     * Reads the pending slots and appends them to the file
+     */
+    void flush();
+
+private:
+    SimulatorBase* sim;
+    std::vector<glm::ivec2> cells;
+    size_t capacity;
+
+    std::ofstream output;
+
+    // Step and time of every slot, the values themselves stay on the device
+    std::vector<size_t> slot_step;
+    std::vector<float>  slot_time;
+
+    size_t samples;
+    size_t pending;
+};
+
+#endif
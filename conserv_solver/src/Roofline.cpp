@@ -0,0 +1,87 @@
+//
+//  Roofline
+//  GLAppNative
+//
+//  Created by Jens Kristoffer Reitan Markussen on 28.12.13.
+//  Copyright (c) 2013 Jens Kristoffer Reitan Markussen. All rights reserved.
+//
+
+#include "Roofline.h"
+#include "Trace.h"
+
+#include <map>
+#include <algorithm>
+
+namespace Roofline {
+
+    double streamCL(CLUtils::CLcontext& context){
+        static const size_t RUNS = 6;
+        
+        // 64 MB per array is far past any last level cache
+        cl_ulong max_alloc = 0;
+        clGetDeviceInfo(context.device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(cl_ulong), &max_alloc, NULL);
+        size_t n = std::min((size_t)max_alloc, (size_t)64 << 20)/sizeof(cl_float4);
+        size_t bytes = n*sizeof(cl_float4);
+        
+        CLUtils::Program program(context, "res/kernels/stream.cl");
+        cl_kernel triad = program.createKernel("streamTriad");
+        
+        CLUtils::MO<CL_MEM_READ_WRITE> A(context, bytes, NULL, "stream probe");
+        CLUtils::MO<CL_MEM_READ_WRITE> B(context, bytes, NULL, "stream probe");
+        CLUtils::MO<CL_MEM_READ_WRITE> C(context, bytes, NULL, "stream probe");
+        
+        cl_int err = CL_SUCCESS;
+        cl_float one = 1.0f;
+        cl_float s = 3.0f;
+        err |= clEnqueueFillBuffer(context.queue, B.getRef(), &one, sizeof(cl_float), 0, bytes, 0, NULL, NULL);
+        err |= clEnqueueFillBuffer(context.queue, C.getRef(), &one, sizeof(cl_float), 0, bytes, 0, NULL, NULL);
+        
+        err |= clSetKernelArg(triad, 0, sizeof(cl_mem), &(B.getRef()));
+        err |= clSetKernelArg(triad, 1, sizeof(cl_mem), &(C.getRef()));
+        err |= clSetKernelArg(triad, 2, sizeof(cl_float), &s);
+        err |= clSetKernelArg(triad, 3, sizeof(cl_mem), &(A.getRef()));
+        
+        // First run pages everything in and is not counted
+        double best = 0.0;
+        for (size_t i = 0; i <= RUNS && err == CL_SUCCESS; i++) {
+            cl_event event;
+            size_t global[] = {n};
+            err |= clEnqueueNDRangeKernel(context.queue, triad, 1, NULL, global, NULL, 0, NULL, &event);
+            if (err != CL_SUCCESS) {
+                break;
+            }
+            clWaitForEvents(1, &event);
+            
+            cl_ulong start = 0, end = 0;
+            err |= clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, NULL);
+            err |= clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, NULL);
+            clReleaseEvent(event);
+            
+            if (i > 0 && end > start) {
+                best = std::max(best, 3.0*bytes/((end - start)*1e-9));
+            }
+        }
+        clReleaseKernel(triad);
+        
+        if(err != CL_SUCCESS) {
+            std::stringstream ss;
+            ss << "Failed to run bandwidth probe! Error: " << err;
+            THROW_EXCEPTION(ss.str().c_str());
+        }
+        
+        return best;
+    }
+
+    void attachStats(std::vector<KernelProfile>& kernels){
+        Trace::collect();
+        std::map<std::string, Trace::Stat> stats = Trace::getStats();
+        
+        for (size_t i = 0; i < kernels.size(); i++) {
+            std::map<std::string, Trace::Stat>::iterator it = stats.find(kernels[i].name);
+            if (it != stats.end()) {
+                kernels[i].calls = it->second.calls;
+                kernels[i].time  = it->second.time;
+            }
+        }
+    }
+}
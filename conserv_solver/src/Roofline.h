@@ -0,0 +1,36 @@
+//
+//  Roofline
+//  GLAppNative
+//
+//  Created by Jens Kristoffer Reitan Markussen on 28.12.13.
+//  Copyright (c) 2013 Jens Kristoffer Reitan Markussen. All rights reserved.
+//
+
+#ifndef GLAppNative_Roofline_h
+#define GLAppNative_Roofline_h
+
+#include "GLUtils.hpp"
+#include "CLUtils.hpp"
+#include "SimulatorBase.h"
+
+#include <vector>
+
+/**
+ *  Helpers for placing the solver kernels on a roofline, achieved bandwidth
+ *  and FLOP rate against what the device memory can sustain.
+ */
+namespace Roofline {
+
+    /**
+     * Best triad bandwidth of the context's device in bytes per second
+     */
+    double streamCL(CLUtils::CLcontext& context);
+
+    /**
+     * Fill in calls and device time of each kernel from the command stats
+     * gathered by Trace, matched by kernel name
+     */
+    void attachStats(std::vector<KernelProfile>& kernels);
+}
+
+#endif
@@ -0,0 +1,76 @@
+//
+//  SPSCQueue.hpp
+//  GLAppNative
+//
+//  Created by Jens Kristoffer Reitan Markussen on 28.12.13.
+//  Copyright (c) 2013 Jens Kristoffer Reitan Markussen. All rights reserved.
+//
+
+#ifndef GLAppNative_SPSCQueue_hpp
+#define GLAppNative_SPSCQueue_hpp
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+
+/**
+ *  Bounded lock-free queue for exactly one producer and one consumer
+ *  thread. Capacity is rounded up to a power of two.
+ */
+template <typename T>
+class SPSCQueue {
+public:
+    SPSCQueue(size_t capacity) : head(0), tail(0) {
+        size_t size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        items.resize(size);
+        mask = size-1;
+    }
+
+    /**
+     * Producer side. Returns false if the queue is full.
+     */
+    bool push(const T& item) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) > mask) {
+            return false;
+        }
+        items[t & mask] = item;
+        tail.store(t+1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Consumer side. Returns false if the queue is empty.
+     */
+    bool pop(T& item) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = items[h & mask];
+        head.store(h+1, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+
+private:
+    SPSCQueue(const SPSCQueue&);
+    SPSCQueue& operator=(const SPSCQueue&);
+
+    std::vector<T> items;
+    size_t mask;
+
+    // Keep the indices on separate cache lines to avoid false sharing
+    char pad0[64];
+    std::atomic<size_t> head;
+    char pad1[64];
+    std::atomic<size_t> tail;
+};
+
+#endif
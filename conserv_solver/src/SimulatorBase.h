@@ -13,10 +13,71 @@
 #include <vector>
 #include <glm/glm.hpp>
 
+#include "SimException.h"
+
 struct SimDetail{
     double sim_time;
     float time;
     float dt;
+    size_t steps;       // time steps taken, several per call when streaming
+};
+
+// Components of the state vector, combined as a mask in getRegion
+enum SimField{
+    FIELD_RHO   = 1 << 0,
+    FIELD_RHOU  = 1 << 1,
+    FIELD_RHOV  = 1 << 2,
+    FIELD_E     = 1 << 3,
+    FIELD_ALL   = FIELD_RHO | FIELD_RHOU | FIELD_RHOV | FIELD_E
+};
+
+// How the OpenCL solvers evaluate fluxes, one kernel for both directions or
+// one per direction running concurrently. Auto times both on the device.
+enum FluxMode{
+    FLUX_AUTO,
+    FLUX_FUSED,
+    FLUX_SPLIT
+};
+
+// Where the stencils of the OpenCL Euler solver read the state and slopes,
+// plain buffers or images through the texture cache. Auto times both.
+enum ReadPath{
+    READ_AUTO,
+    READ_BUFFERS,
+    READ_IMAGES
+};
+
+// Points per cell face the fluxes of the OpenCL Euler solver are integrated
+// with, the midpoint rule does half the flux work of two point Gauss
+enum FluxQuadrature{
+    QUADRATURE_MIDPOINT = 1,
+    QUADRATURE_GAUSS    = 2
+};
+
+// Order of the cells in the buffers of the OpenCL Euler solver, rows, or
+// square tiles with their cells in rows or in Z-order within a tile
+enum MemoryLayout{
+    LAYOUT_ROWS,
+    LAYOUT_TILES,
+    LAYOUT_MORTON
+};
+
+struct SimDiagnostics{
+    glm::vec4 sum;      // rho, rhou, rhov, E summed over the domain
+    glm::vec4 min;      // rho, u, v, E
+    glm::vec4 max;      // rho, u, v, E
+};
+
+// Measured device time of a kernel or pass next to its modelled cost. Bytes
+// are compulsory traffic, every array a work-item touches read or written
+// once, with neighbour fetches of the stencils assumed to hit in cache.
+struct KernelProfile{
+    std::string name;
+    size_t items;       // work-items (or fragments) per call
+    double bytes;       // per work-item
+    double flops;       // per work-item
+    size_t calls;
+    double time;        // seconds, summed over calls
 };
 
 class SimulatorBase{
@@ -51,6 +112,14 @@ public:
      */
     virtual std::vector<float> getData() = 0;
     
+    /**
+     * Read back every stride'th cell of the w*h region at (x0,y0), keeping
+     * only the components in fields. Values are packed row by row with the
+     * selected components of a cell next to each other.
+     */
+    virtual std::vector<float> getRegion(size_t x0, size_t y0, size_t w, size_t h,
+                                         size_t stride = 1, unsigned int fields = FIELD_ALL) = 0;
+    
     /**
      * Return the size of the grid
      */
@@ -65,6 +134,116 @@ public:
      * Get current sim time
      */
     virtual float getTime() = 0;
+    
+    /**
+     * Name of component c of the state vector, the Euler variables unless a
+     * solver says otherwise
+     */
+    virtual const char* getFieldName(size_t c){
+        static const char* names[] = {"rho", "rhou", "rhov", "E"};
+        return names[c];
+    }
+    
+    /**
+     * Flux kernels the steps run after init has settled any auto choice,
+     * auto for solvers without a choice
+     */
+    virtual FluxMode getFluxMode(){return FLUX_AUTO;}
+    
+    /**
+     * Where the stencils read after init, auto for solvers without a choice
+     */
+    virtual ReadPath getReadPath(){return READ_AUTO;}
+    
+    /**
+     * Allocate pinned host staging slots for asynchronous downloads
+     */
+    virtual void createStaging(size_t slots) = 0;
+    
+    /**
+     * Start a non-blocking download of the current state (Nx*Ny float4,
+     * no ghost cells) into a staging slot
+     */
+    virtual void beginDownload(size_t slot) = 0;
+    
+    /**
+     * Returns the host pointer of the slot once its download has
+     * completed, NULL while it is still in flight
+     */
+    virtual const float* pollDownload(size_t slot) = 0;
+    
+    /**
+     * Hand the slot back after the host is done reading it
+     */
+    virtual void endDownload(size_t slot) = 0;
+    
+    /**
+     * Conservation sums and value ranges of the current state, reduced on
+     * the device so only a few floats are read back
+     */
+    virtual SimDiagnostics getDiagnostics() = 0;
+    
+    /**
+     * Average device time of a step in seconds, measured asynchronously,
+     * negative until the first measurement has finished
+     */
+    virtual double getDeviceTime() = 0;
+    
+    /**
+     * Modelled cost and measured device time of the kernels in a step,
+     * calls and time are zero for kernels that were not timed
+     */
+    virtual std::vector<KernelProfile> getKernelProfile() = 0;
+    
+    /**
+     * Sustained device memory bandwidth in bytes per second, measured with
+     * a STREAM-like triad on buffers far larger than any cache
+     */
+    virtual double measureBandwidth() = 0;
+    
+    /**
+     * Allocate a device ring buffer of capacity samples for probes at the
+     * given cells, replacing any earlier probes
+     */
+    virtual void createProbes(const std::vector<glm::ivec2>& cells, size_t capacity) = 0;
+    
+    /**
+     * Record the current state at every probe into ring slot slot. Runs on
+     * the device only, nothing is read back.
+     */
+    virtual void sampleProbes(size_t slot) = 0;
+    
+    /**
+     * Read count consecutive ring slots starting at first, one float4 per
+     * probe and slot
+     */
+    virtual void readProbes(size_t first, size_t count, float* out) = 0;
+    
+protected:
+    /**
+     * Validates a region request and returns the decimated size of it
+     */
+    glm::ivec2 regionSize(size_t x0, size_t y0, size_t w, size_t h, size_t stride, unsigned int fields){
+        glm::ivec2 size = getGridSize();
+        if (w == 0 || h == 0 || x0 + w > (size_t)size.x || y0 + h > (size_t)size.y) {
+            THROW_EXCEPTION("Region outside of domain");
+        }
+        if (stride == 0 || fields == 0 || (fields & ~FIELD_ALL) != 0) {
+            THROW_EXCEPTION("Invalid region stride or fields");
+        }
+        return glm::ivec2((w+stride-1)/stride, (h+stride-1)/stride);
+    }
+    
+    /**
+     * Number of components selected by a field mask
+     */
+    static size_t fieldCount(unsigned int fields){
+        size_t n = 0;
+        for (size_t c = 0; c < 4; c++) {
+            n += (fields >> c) & 1;
+        }
+        return n;
+    }
 };
 
 #endif
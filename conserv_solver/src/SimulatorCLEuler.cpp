@@ -7,40 +7,163 @@
 //
 
 #include "SimulatorCLEuler.h"
+#include "Trace.h"
+#include "Roofline.h"
+#include "Perf.h"
 #include <vector>
+#include <algorithm>
+#include <sys/mman.h>
+#include <unistd.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtx/transform2.hpp>
 
-SimulatorCLEuler::SimulatorCLEuler(cl_device_type device){
+namespace {
+    /**
+     * First of the rows y0, y0+stride, ... at or past row
+     */
+    size_t firstRow(size_t y0, size_t stride, size_t row){
+        return row <= y0 ? 0 : (row - y0 + stride - 1)/stride;
+    }
+    
+    /**
+     * Zeroed host memory backed by an unlinked file in the working
+     * directory, so the state can outgrow RAM
+     */
+    float* mapHostState(size_t bytes){
+        char name[] = "stream_XXXXXX";
+        int fd = mkstemp(name);
+        if (fd < 0) {
+            THROW_EXCEPTION("Failed to create host state file");
+        }
+        unlink(name);
+        
+        if (ftruncate(fd, bytes) != 0) {
+            close(fd);
+            THROW_EXCEPTION("Failed to size host state file");
+        }
+        void* ptr = mmap(NULL, bytes, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (ptr == MAP_FAILED) {
+            THROW_EXCEPTION("Failed to map host state");
+        }
+        
+        // Strips are swept front to back
+        madvise(ptr, bytes, MADV_SEQUENTIAL);
+        return (float*)ptr;
+    }
+}
+
+SimulatorCLEuler::SimulatorCLEuler(cl_device_type device, bool numa){
     this->gamma = 1.4f;
     this->time = 0;
     
-    CLUtils::createContext(context,device);
+    this->D_set = NULL;
+    this->X_set = NULL;
+    this->P_cells = NULL;
+    this->P_ring = NULL;
+    this->probes = 0;
+    this->large_indices = false;
+    this->render_stride = 1;
+    
+    this->stream_rows = 0;
+    this->stream_steps = 1;
+    this->stream_halo = 0;
+    this->stream_dt = 0.0f;
+    this->host_state[0] = NULL;
+    this->host_state[1] = NULL;
+    this->host_current = 0;
+    this->upload_queue = NULL;
+    this->download_queue = NULL;
+    this->flux_mode = FLUX_AUTO;
+    this->flux_queue = NULL;
+    this->read_path = READ_AUTO;
+    this->shared_primitives = false;
+    this->quadrature = QUADRATURE_GAUSS;
+    this->coarsening = 1;
+    this->layout = LAYOUT_ROWS;
+    this->numa_bands = false;
+    this->huge_pages = false;
+    
+    this->common_program = NULL;
+    this->boundary_program = NULL;
+    this->euler_program = NULL;
+    this->step_prepare = NULL;
+    for (size_t n = 0; n < N_RK; n++) {
+        this->step_bounds[n] = NULL;
+        this->step_stages[n] = NULL;
+    }
+    this->recording = NULL;
+    this->step_dt = 0.0f;
+    this->T_set = NULL;
+    
+    CLUtils::createContext(context,device,numa);
+    
+    pool = new CLUtils::StagingPool(context);
+    device_timer = new CLTimer(context.queue);
 }
 
 SimulatorCLEuler::~SimulatorCLEuler(){
-    clReleaseKernel(compute_reconstruct);
-    clReleaseKernel(evaluate_flux);
-    clReleaseKernel(compute_RK);
-    clReleaseKernel(compute_eigenvalues);
-    clReleaseKernel(copy_domain);
     clReleaseKernel(prepare_render);
     clReleaseKernel(set_initial);
-    clReleaseKernel(set_boundary_x);
-    clReleaseKernel(set_boundary_y);
-    
-    delete Sx_set;
-    delete Sy_set;
-    delete F_set;
-    delete G_set;
-    delete E_set;
+    clReleaseKernel(reduce_diagnostics);
+    clReleaseKernel(extract_region);
+    clReleaseKernel(copy_rows);
+    clReleaseKernel(sample_probes);
+    
+    for (size_t b = 0; b < bands.size(); b++) {
+        releaseBand(bands[b]);
+    }
+    for (size_t i = 0; i < slots.size(); i++) {
+        if (slots[i].done != NULL) {
+            clWaitForEvents(1, &slots[i].done);
+            clReleaseEvent(slots[i].done);
+        }
+        releaseBand(slots[i].band);
+    }
+    if (upload_queue != NULL) {
+        clReleaseCommandQueue(upload_queue);
+        clReleaseCommandQueue(download_queue);
+    }
+    if (flux_queue != NULL) {
+        clReleaseCommandQueue(flux_queue);
+    }
+    for (size_t i = 0; i < 2; i++) {
+        if (host_state[i] != NULL) {
+            munmap(host_state[i], Nx*Ny*sizeof(cl_float4));
+        }
+    }
+    delete step_prepare;
+    for (size_t n = 0; n < N_RK; n++) {
+        delete step_bounds[n];
+        delete step_stages[n];
+    }
+    delete common_program;
+    delete boundary_program;
+    delete euler_program;
+    
+    delete T_set;
+    delete D_set;
+    delete X_set;
+    delete P_cells;
+    delete P_ring;
     delete R_tex;
-    for (size_t i = 0; i <= N_RK; i++) {
-        delete Q_set[i];
+    for (size_t i = 0; i < staging_ptr.size(); i++) {
+        if (stream_rows > 0) {
+            // Plain host slot of the streamed solver
+            delete [] staging_ptr[i];
+            continue;
+        }
+        if (staging_event[i] != NULL) {
+            clWaitForEvents(1, &staging_event[i]);
+            clReleaseEvent(staging_event[i]);
+        }
     }
+    delete pool;
 
+    delete device_timer;
+    
     CLUtils::releaseContext(context);
 }
 
@@ -50,52 +173,106 @@ void SimulatorCLEuler::init(size_t Nx, size_t Ny, std::string initialKernel){
     
     std::cout << "Simulating Euler using OpenCL kernels on device: ";
     CLUtils::printDeviceInfo(context.device);
+    if (context.unified) {
+        std::cout << "Device shares host memory, buffers are mapped in place" << std::endl;
+    }
     
+    planStreaming();
+    if (stream_rows == 0) {
+        planBands();
+    }
+    planReadPath();
+    if (numa_bands && flux_mode != FLUX_FUSED) {
+        // Split fluxes synchronize through the context queue
+        if (flux_mode == FLUX_SPLIT) {
+            std::cout << "Bands on NUMA nodes evaluate fluxes fused, not split" << std::endl;
+        }
+        flux_mode = FLUX_FUSED;
+    }
     createKernels("riemann");
     createBuffers();
     
     applyInitial();
+    pickReadPath();
+    pickFluxMode();
+    recordStep();
 }
 
 SimDetail SimulatorCLEuler::simulate(){
-    setBoundary(Q_set[N_RK]);
-    copy(Q_set[N_RK], Q_set[0]);
+    if (stream_rows > 0) {
+        return streamStep();
+    }
+    
+    // Replays leave no events per kernel, so not while those are wanted
+    if (step_prepare != NULL && !Trace::enabled() && !Trace::counting() && !Perf::enabled()) {
+        return replayStep();
+    }
+    
+    // Phases only split the step when hardware counters are read
+    {
+        PERF_PHASE("setBounds", context.queue);
+        setBoundary(N_RK);
+    }
+    {
+        PERF_PHASE("copy", context.queue);
+        copy();
+    }
 
-    float dt = computeDt(Q_set[0]);
+    float dt;
+    {
+        PERF_PHASE("computeDt", context.queue);
+        dt = computeDt();
+        setTimestep(dt);
+    }
     
     timer.restart();
+    device_timer->begin();
     SimDetail detail;
     detail.sim_time = 0.0f;
     
     for (size_t n = 1; n <= N_RK; n++) {
         // apply boundary condition
-        setBoundary(Q_set[n-1]);
+        {
+            PERF_PHASE("setBounds", context.queue);
+            setBoundary(n-1);
+        }
         
         timer.restart();
         
         // reconstruct point values
-        reconstruct(Q_set[n-1]);
-        clFinish(context.queue);
+        {
+            PERF_PHASE("piecewiseReconstruction", context.queue);
+            reconstruct(n-1);
+            finish();
+        }
         
         detail.sim_time += timer.elapsedAndRestart();
         
         // evaluate fluxes
-        evaluateFluxes(Q_set[n-1]);
-        clFinish(context.queue);
+        {
+            PERF_PHASE("computeNumericalFlux", context.queue);
+            evaluateFluxes(n-1);
+            finish();
+        }
         
         detail.sim_time += timer.elapsedAndRestart();
         
         // compute RK
-        computeRK(n, dt);
-        clFinish(context.queue);
+        {
+            PERF_PHASE("computeRK", context.queue);
+            computeRK(n);
+            finish();
+        }
         
         detail.sim_time += timer.elapsed();
     }
     
-    clFinish(context.queue);
+    device_timer->end();
+    finish();
     
     //detail.sim_time = timer.elapsed();
     detail.dt = dt;
+    detail.steps = 1;
     time+=dt;
     detail.time = time;
 
@@ -106,11 +283,50 @@ SimDetail SimulatorCLEuler::simulate(){
 size_t SimulatorCLEuler::getTexture(){
     cl_int err = CL_SUCCESS;
     
-    err |= clSetKernelArg(prepare_render, 0, sizeof(cl_mem), &Q_set[N_RK]->getRef());
+    cl_uint stride = render_stride;
+    size_t width = (Nx+render_stride-1)/render_stride;
+    
+    if (stream_rows > 0) {
+        // Sampled straight from the host state
+        size_t height = (Ny+render_stride-1)/render_stride;
+        CLUtils::StagingPool::Lease lease(*pool, width*height*sizeof(cl_float4));
+        float* texels = lease.get<float>();
+        const float* Q = host_state[host_current];
+        for (size_t y = 0; y < height; y++) {
+            for (size_t x = 0; x < width; x++) {
+                const float* q = Q + ((y*render_stride)*Nx + x*render_stride)*4;
+                std::copy(q, q+4, &texels[(y*width + x)*4]);
+            }
+        }
+        
+        glBindTexture(GL_TEXTURE_2D, tex);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, (GLsizei)width, (GLsizei)height, GL_RGBA, GL_FLOAT, texels);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        return tex;
+    }
+    
     err |= clSetKernelArg(prepare_render, 1, sizeof(cl_image), &(R_tex->getRef()));
+    err |= clSetKernelArg(prepare_render, 2, sizeof(cl_uint), &stride);
     
-    size_t global[] = {Nx,Ny};
-    err |= clEnqueueNDRangeKernel(context.queue, prepare_render, 2, NULL, global, NULL, 0, NULL, NULL);
+    for (size_t b = 0; b < bands.size(); b++) {
+        // Texel rows whose source row lies in this band
+        size_t first = firstRow(0, render_stride, bands[b].y0);
+        size_t last  = firstRow(0, render_stride, bands[b].y0+bands[b].rows);
+        if (first == last) {
+            continue;
+        }
+        
+        cl_uint src_row = first*render_stride - bands[b].y0;
+        cl_uint tex_row = first;
+        
+        err |= clSetKernelArg(prepare_render, 0, sizeof(cl_mem), &(bands[b].Q[N_RK]->getRef()));
+        err |= clSetKernelArg(prepare_render, 3, sizeof(cl_uint), &src_row);
+        err |= clSetKernelArg(prepare_render, 4, sizeof(cl_uint), &tex_row);
+        
+        size_t global[] = {width, last-first};
+        err |= clEnqueueNDRangeKernel(context.queue, prepare_render, 2, NULL, global, NULL, 0, NULL,
+                                      Trace::command("copyToTexture", context.queue));
+    }
     if(err != CL_SUCCESS) {
         std::stringstream ss;
         ss << "Failed to prepare render! Error: " << err;
@@ -121,165 +337,653 @@ size_t SimulatorCLEuler::getTexture(){
 }
 
 std::vector<float> SimulatorCLEuler::getData(){
-    THROW_EXCEPTION("Not implemented");
+    return getRegion(0, 0, Nx, Ny);
 }
 
-void SimulatorCLEuler::createBuffers(){
-    // Initialize all buffers with 2 ghost cell on each edge
-    for (size_t i = 0; i <= N_RK; i++) {
-        Q_set[i] = new CLUtils::MO<CL_MEM_READ_WRITE>(context, (Nx+4)*(Ny+4)*sizeof(cl_float4), NULL);
+std::vector<float> SimulatorCLEuler::getRegion(size_t x0, size_t y0, size_t w, size_t h,
+                                        size_t stride, unsigned int fields){
+    glm::ivec2 size = regionSize(x0, y0, w, h, stride, fields);
+    size_t n = fieldCount(fields);
+    std::vector<float> data((size_t)size.x*size.y*n);
+    
+    if (stream_rows > 0) {
+        // The state is on the host already
+        const float* Q = host_state[host_current];
+        float* out = data.data();
+        for (size_t j = 0; j < (size_t)size.y; j++) {
+            for (size_t i = 0; i < (size_t)size.x; i++) {
+                const float* q = Q + ((y0+j*stride)*Nx + x0+i*stride)*4;
+                for (size_t c = 0; c < 4; c++) {
+                    if (fields & (1 << c)) {
+                        *out++ = q[c];
+                    }
+                }
+            }
+        }
+        return data;
+    }
+    
+    cl_int err = CL_SUCCESS;
+    
+    for (size_t b = 0; b < bands.size(); b++) {
+        const Band& band = bands[b];
+        
+        // Output rows taken from this band
+        size_t first = firstRow(y0, stride, band.y0);
+        size_t last  = glm::min(firstRow(y0, stride, band.y0+band.rows), (size_t)size.y);
+        if (first >= last) {
+            continue;
+        }
+        float* out = data.data() + first*size.x*n;
+        
+        if (stride == 1 && fields == FIELD_ALL && layout == LAYOUT_ROWS) {
+            // Plain subrectangle, copied straight out of the ghost-padded buffer
+            size_t buffer_origin[]  = {(x0+2)*sizeof(cl_float4), y0+first-band.y0+2, 0};
+            size_t host_origin[]    = {0, 0, 0};
+            size_t region[]         = {w*sizeof(cl_float4), last-first, 1};
+            
+            err |= clEnqueueReadBufferRect(context.queue, band.Q[N_RK]->getRef(), CL_TRUE,
+                                           buffer_origin, host_origin, region,
+                                           (Nx+4)*sizeof(cl_float4), 0, w*sizeof(cl_float4), 0,
+                                           out, 0, NULL, Trace::command("read region", context.queue));
+        } else {
+            // Gather on the device so only the selected values cross the bus,
+            // and blocked layouts come back in rows
+            size_t bytes = (last-first)*size.x*n*sizeof(cl_float);
+            err |= extractRegion(band, x0, y0 + first*stride - band.y0, size.x, last-first, stride, fields);
+            err |= clEnqueueReadBuffer(context.queue, X_set->getRef(), CL_TRUE, 0,
+                                       bytes, out, 0, NULL, Trace::command("read region", context.queue));
+        }
+    }
+    
+    if(err != CL_SUCCESS) {
+        std::stringstream ss;
+        ss << "Failed to read region! Error: " << err;
+        THROW_EXCEPTION(ss.str().c_str());
     }
-    Sx_set = new CLUtils::MO<CL_MEM_READ_WRITE>(context, (Nx+4)*(Ny+4)*sizeof(cl_float4), NULL);
-    Sy_set = new CLUtils::MO<CL_MEM_READ_WRITE>(context, (Nx+4)*(Ny+4)*sizeof(cl_float4), NULL);
-    F_set  = new CLUtils::MO<CL_MEM_READ_WRITE>(context, (Nx+4)*(Ny+4)*sizeof(cl_float4), NULL);
-    G_set  = new CLUtils::MO<CL_MEM_READ_WRITE>(context, (Nx+4)*(Ny+4)*sizeof(cl_float4), NULL);
-    E_set  = new CLUtils::MO<CL_MEM_WRITE_ONLY>(context, (Nx+4)*(Ny+4)*sizeof(cl_float), NULL);
     
-    // We dont need to visualize ghost cells
-    R_tex  = new CLUtils::ImageBuffer<CL_MEM_READ_WRITE>(context, tex, (Nx), (Ny), NULL);
+    return data;
 }
 
-void SimulatorCLEuler::createKernels(std::string initial){
-    std::stringstream ss;
-    ss << "-D Nx=" << Nx << " -D Ny=" << Ny;
-    std::string options = ss.str();
+cl_int SimulatorCLEuler::extractRegion(const Band& band, size_t x0, size_t y0, size_t w, size_t h,
+                                       size_t stride, unsigned int fields){
+    size_t bytes = w*h*fieldCount(fields)*sizeof(cl_float);
+    if (X_set == NULL || X_set->size() < bytes) {
+        delete X_set;
+        X_set = new CLUtils::MO<CL_MEM_READ_WRITE>(context, bytes, NULL, "region");
+    }
     
-    CLUtils::Program* common    = new CLUtils::Program(context, "res/kernels/common.cl", &options);
-    CLUtils::Program* boundary  = new CLUtils::Program(context, "res/kernels/boundary.cl", &options);
-    CLUtils::Program* initialp  = new CLUtils::Program(context, "res/kernels/initial.cl", &options);
-    CLUtils::Program* euler        = new CLUtils::Program(context, "res/kernels/euler.cl", &options);
+    cl_uint origin_x = x0;
+    cl_uint origin_y = y0;
+    cl_uint step = stride;
+    cl_uint mask = fields;
     
+    cl_int err = CL_SUCCESS;
+    err |= clSetKernelArg(extract_region, 0, sizeof(cl_mem), &(band.Q[N_RK]->getRef()));
+    err |= clSetKernelArg(extract_region, 1, sizeof(cl_mem), &(X_set->getRef()));
+    err |= clSetKernelArg(extract_region, 2, sizeof(cl_uint), &origin_x);
+    err |= clSetKernelArg(extract_region, 3, sizeof(cl_uint), &origin_y);
+    err |= clSetKernelArg(extract_region, 4, sizeof(cl_uint), &step);
+    err |= clSetKernelArg(extract_region, 5, sizeof(cl_uint), &mask);
     
-    compute_reconstruct = common->createKernel("piecewiseReconstruction");
-    evaluate_flux       = euler->createKernel("computeNumericalFlux");
-    compute_RK          = common->createKernel("computeRK");
-    compute_eigenvalues = euler->createKernel("eigenvalue");
-    copy_domain         = common->createKernel("copy");
-    prepare_render      = common->createKernel("copyToTexture");
-    set_initial         = initialp->createKernel(initial);
-    set_boundary_x      = boundary->createKernel("setBoundsX");
-    set_boundary_y      = boundary->createKernel("setBoundsY");
+    size_t global[] = {w, h};
+    err |= clEnqueueNDRangeKernel(context.queue, extract_region, 2,
+                                  NULL, global, NULL, 0, NULL, Trace::command("extractRegion", context.queue));
+    return err;
 }
 
-void SimulatorCLEuler::applyInitial(){
-    cl_int err = CL_SUCCESS;
+void SimulatorCLEuler::createStaging(size_t slots){
+    for (size_t i = 0; i < slots && stream_rows > 0; i++) {
+        // Downloads are host copies when streaming
+        staging_ptr.push_back(new float[Nx*Ny*4]);
+        staging_event.push_back(NULL);
+    }
+    for (size_t i = 0; i < slots && stream_rows == 0; i++) {
+        staging_ptr.push_back((float*)pool->borrow(Nx*Ny*sizeof(cl_float4)));
+        staging_event.push_back(NULL);
+    }
+}
+
+void SimulatorCLEuler::beginDownload(size_t slot){
+    if (stream_rows > 0) {
+        const float* Q = host_state[host_current];
+        std::copy(Q, Q + Nx*Ny*4, staging_ptr[slot]);
+        return;
+    }
     
-    err |= clSetKernelArg(set_initial, 0, sizeof(cl_float), &gamma);
-    err |= clSetKernelArg(set_initial, 1, sizeof(cl_float2),
-                          glm::value_ptr(glm::vec2((1.0f/(float)Nx),(1.0f/(float)Ny))));
-    err |= clSetKernelArg(set_initial, 2, sizeof(cl_mem), &(Q_set[N_RK]->getRef()));
+    cl_int err = CL_SUCCESS;
     
-    size_t global[] = {Nx,Ny};
-    err |= clEnqueueNDRangeKernel(context.queue, set_initial, 2, NULL, global, NULL, 0, NULL, NULL);
+    // Strip the ghost cells while copying into the pinned slot. The queue is
+    // in order, so the last band's event covers all of them.
+    for (size_t b = 0; b < bands.size(); b++) {
+        bool last = b+1 == bands.size();
+        if (layout != LAYOUT_ROWS) {
+            // Gathered into rows first, the next band's gather waits for
+            // this read on the in-order queue
+            err |= extractRegion(bands[b], 0, 0, Nx, bands[b].rows, 1, FIELD_ALL);
+            err |= clEnqueueReadBuffer(context.queue, X_set->getRef(), CL_FALSE, 0,
+                                       Nx*bands[b].rows*sizeof(cl_float4),
+                                       staging_ptr[slot] + bands[b].y0*Nx*4, 0, NULL,
+                                       last ? &staging_event[slot] : NULL);
+            continue;
+        }
+        
+        size_t buffer_origin[]  = {2*sizeof(cl_float4), 2, 0};
+        size_t host_origin[]    = {0, 0, 0};
+        size_t region[]         = {Nx*sizeof(cl_float4), bands[b].rows, 1};
+        
+        err |= clEnqueueReadBufferRect(context.queue, bands[b].Q[N_RK]->getRef(), CL_FALSE,
+                                       buffer_origin, host_origin, region,
+                                       (Nx+4)*sizeof(cl_float4), 0, Nx*sizeof(cl_float4), 0,
+                                       staging_ptr[slot] + bands[b].y0*Nx*4, 0, NULL,
+                                       last ? &staging_event[slot] : NULL);
+    }
+    clFlush(context.queue);
+    Trace::retain("download", context.queue, staging_event[slot]);
     
     if(err != CL_SUCCESS) {
         std::stringstream ss;
-        ss << "Failed to apply initial condition! Error: " << err;
+        ss << "Failed to start download! Error: " << err;
         THROW_EXCEPTION(ss.str().c_str());
     }
 }
 
-void SimulatorCLEuler::setBoundary(CLUtils::MO<CL_MEM_READ_WRITE>* Qn){
-    cl_int err = CL_SUCCESS;
-    
-    err |= clSetKernelArg(set_boundary_x, 0, sizeof(cl_mem), &(Qn->getRef()));
-    size_t globalx[] = {Nx};
-    err |= clEnqueueNDRangeKernel(context.queue, set_boundary_x,
-                                  1, NULL, globalx, NULL, 0, NULL, NULL);
+const float* SimulatorCLEuler::pollDownload(size_t slot){
+    if (stream_rows > 0) {
+        return staging_ptr[slot];
+    }
     
-    err |= clSetKernelArg(set_boundary_y, 0, sizeof(cl_mem), &(Qn->getRef()));
-    size_t globaly[] = {Ny};
-    err |= clEnqueueNDRangeKernel(context.queue, set_boundary_y,
-                                  1, NULL, globaly, NULL, 0, NULL, NULL);
+    cl_int status;
+    cl_int err = clGetEventInfo(staging_event[slot], CL_EVENT_COMMAND_EXECUTION_STATUS,
+                                sizeof(cl_int), &status, NULL);
     
-    if(err != CL_SUCCESS) {
+    if(err != CL_SUCCESS || status < 0) {
         std::stringstream ss;
-        ss << "Failed to set boundary! Error: " << err;
+        ss << "Download failed! Error: " << (err != CL_SUCCESS ? err : status);
         THROW_EXCEPTION(ss.str().c_str());
     }
+    
+    if (status != CL_COMPLETE) {
+        return NULL;
+    }
+    
+    clReleaseEvent(staging_event[slot]);
+    staging_event[slot] = NULL;
+    
+    return staging_ptr[slot];
+}
+
+void SimulatorCLEuler::endDownload(size_t slot){
+    // Slot stays mapped, nothing to hand back to the driver
 }
 
-float SimulatorCLEuler::computeDt(CLUtils::MO<CL_MEM_READ_WRITE>* Qn){
+SimDiagnostics SimulatorCLEuler::getDiagnostics(){
+    if (stream_rows > 0) {
+        // One pass over the host state, summed in double
+        SimDiagnostics diag;
+        glm::dvec4 sum(0.0);
+        diag.min = glm::vec4( std::numeric_limits<float>().max());
+        diag.max = glm::vec4(-std::numeric_limits<float>().max());
+        const float* Q = host_state[host_current];
+        for (size_t i = 0; i < Nx*Ny; i++) {
+            glm::vec4 q = glm::make_vec4(Q + 4*i);
+            glm::vec4 p = glm::vec4(q.x, q.y/q.x, q.z/q.x, q.w);
+            sum += glm::dvec4(q);
+            diag.min = glm::min(diag.min, p);
+            diag.max = glm::max(diag.max, p);
+        }
+        diag.sum = glm::vec4(sum);
+        return diag;
+    }
+    
     cl_int err = CL_SUCCESS;
-    static const float CFL = 0.5f;
     
-    err |= clSetKernelArg(compute_eigenvalues, 0, sizeof(cl_mem), &(Qn->getRef()));
-    err |= clSetKernelArg(compute_eigenvalues, 1, sizeof(cl_float), &gamma);
-    err |= clSetKernelArg(compute_eigenvalues, 2, sizeof(cl_mem), &(E_set->getRef()));
+    err |= clSetKernelArg(reduce_diagnostics, 1, sizeof(cl_mem), &(D_set->getRef()));
+    err |= clSetKernelArg(reduce_diagnostics, 2, reduce_local*sizeof(cl_float4), NULL);
+    err |= clSetKernelArg(reduce_diagnostics, 3, reduce_local*sizeof(cl_float4), NULL);
+    err |= clSetKernelArg(reduce_diagnostics, 4, reduce_local*sizeof(cl_float4), NULL);
     
-    size_t global[] = {Nx,Ny};
-    err |= clEnqueueNDRangeKernel(context.queue, compute_eigenvalues,
-                                  2, NULL, global, NULL, 0, NULL, NULL);
+    // Every band fills its own run of groups
+    for (size_t b = 0; b < bands.size(); b++) {
+        cl_uint rows = bands[b].rows;
+        cl_uint first_group = b*reduce_groups;
+        
+        err |= clSetKernelArg(reduce_diagnostics, 0, sizeof(cl_mem), &(bands[b].Q[N_RK]->getRef()));
+        err |= clSetKernelArg(reduce_diagnostics, 5, sizeof(cl_uint), &rows);
+        err |= clSetKernelArg(reduce_diagnostics, 6, sizeof(cl_uint), &first_group);
+        
+        size_t global[] = {reduce_groups*reduce_local};
+        size_t local[]  = {reduce_local};
+        err |= clEnqueueNDRangeKernel(context.queue, reduce_diagnostics, 1,
+                                      NULL, global, local, 0, NULL, Trace::command("reduceDiagnostics", context.queue));
+    }
     
-    std::vector<cl_float> data((Nx+4)*(Ny+4));
-    err |= clEnqueueReadBuffer(context.queue, E_set->getRef(), CL_TRUE, 0,
-                               (Nx+4)*(Ny+4)*sizeof(cl_float), data.data(), 0, NULL, NULL);
+    size_t groups = reduce_groups*bands.size();
+    std::vector<glm::vec4> partial(3*groups);
+    err |= clEnqueueReadBuffer(context.queue, D_set->getRef(), CL_TRUE, 0,
+                               3*groups*sizeof(cl_float4), partial.data(), 0, NULL, Trace::command("read diagnostics", context.queue));
     
     if(err != CL_SUCCESS) {
         std::stringstream ss;
-        ss << "Failed to compute dt! Error: " << err;
+        ss << "Failed to reduce diagnostics! Error: " << err;
         THROW_EXCEPTION(ss.str().c_str());
     }
     
-    float eig = -std::numeric_limits<float>().max();
+    SimDiagnostics diag;
+    diag.sum = glm::vec4(0.0f);
+    diag.min = glm::vec4( std::numeric_limits<float>().max());
+    diag.max = glm::vec4(-std::numeric_limits<float>().max());
+    for (size_t g = 0; g < groups; g++) {
+        diag.sum += partial[3*g+0];
+        diag.min = glm::min(diag.min, partial[3*g+1]);
+        diag.max = glm::max(diag.max, partial[3*g+2]);
+    }
+    
+    return diag;
+}
+
+std::vector<KernelProfile> SimulatorCLEuler::getKernelProfile(){
+    // Per work-item bytes and flops, boundary items fix a ghost cell pair
+    // on both sides. Items are per launch, a launch covers one band or
+    // strip of R rows on average. Streamed strips also sweep their halos.
+    size_t L = bands.size();
+    size_t R = Ny;
+    if (stream_rows > 0) {
+        L = (Ny+stream_rows-1)/stream_rows;
+        R = Ny + 2*stream_halo*(L-1);
+    }
+    R = R/L;
+    size_t T = ((Nx+render_stride-1)/render_stride)*((Ny+render_stride-1)/render_stride);
+    
+    // The midpoint rule drops four face states and half the flux evaluations.
+    // Shared primitives let the midpoint fluxes reuse the primitives of the
+    // wave speeds, with two point Gauss they mostly trade divisions for
+    // multiplications and add a few for the wave speeds' own primitives.
+    double flux;
+    if (quadrature == QUADRATURE_MIDPOINT) {
+        flux = shared_primitives ? 200.0 : 230.0;
+    } else {
+        flux = shared_primitives ? 440.0 : 430.0;
+    }
+    KernelProfile kernels[] = {
+        {"setBoundsX",              Nx,                 96.0,   0.0,  0, 0.0},
+        {"setBoundsY",              R,                  96.0,   0.0,  0, 0.0},
+        {"copy",                    (Nx+4)*(R+4),       32.0,   0.0,  0, 0.0},
+        {"eigenvalue",              Nx*Ny/L,            20.0,  21.0,  0, 0.0},
+        {"piecewiseReconstruction", (Nx+2)*(R+2),       48.0,  48.0,  0, 0.0},
+        {"computeNumericalFlux",    (Nx+1)*(R+1),       80.0, flux,   0, 0.0},
+        {"computeNumericalFluxX",   (Nx+1)*R,           64.0, flux/2, 0, 0.0},
+        {"computeNumericalFluxY",   Nx*(R+1),           64.0, flux/2, 0, 0.0},
+        {"copyToImage",             (Nx+4)*(R+4),       32.0,   0.0,  0, 0.0},
+        {"piecewiseReconstructionImage", (Nx+2)*(R+2),  48.0,  48.0,  0, 0.0},
+        {"computeNumericalFluxImage", (Nx+1)*(R+1),     80.0, flux,   0, 0.0},
+        {"computeRK",               Nx*R,               80.0,  44.0,  0, 0.0},
+        {"copyToTexture",           T/L,                32.0,   0.0,  0, 0.0}
+    };
     
-    for (size_t x = 2; x < Nx+2; x++) {
-        for (size_t y = 2; y < Ny+2; y++) {
-            size_t k = ((Nx+4) * y + x);
-            eig = glm::max(eig, data[k]);
+    std::vector<KernelProfile> profile;
+    for (size_t i = 0; i < sizeof(kernels)/sizeof(kernels[0]); i++) {
+        // Only the reconstruction and flux kernels of the paths in use
+        const std::string& name = kernels[i].name;
+        bool images = read_path == READ_IMAGES;
+        bool used = true;
+        if (name == "piecewiseReconstruction") {
+            used = !images;
+        } else if (name == "computeNumericalFlux") {
+            used = !images && flux_mode != FLUX_SPLIT;
+        } else if (name == "computeNumericalFluxX" || name == "computeNumericalFluxY") {
+            used = !images && flux_mode == FLUX_SPLIT;
+        } else if (name.find("Image") != std::string::npos) {
+            used = images;
+        }
+        if (used) {
+            profile.push_back(kernels[i]);
+        }
+    }
+    Roofline::attachStats(profile);
+    return profile;
+}
+
+double SimulatorCLEuler::measureBandwidth(){
+    return Roofline::streamCL(context);
+}
+
+void SimulatorCLEuler::createProbes(const std::vector<glm::ivec2>& cells, size_t capacity){
+    glm::ivec2 size = getGridSize();
+    for (size_t i = 0; i < cells.size(); i++) {
+        if (cells[i].x < 0 || cells[i].y < 0 || cells[i].x >= size.x || cells[i].y >= size.y) {
+            THROW_EXCEPTION("Probe outside of domain");
         }
     }
     
-    float dx = 1.0f/(float)Nx;
-    float dy = 1.0f/(float)Ny;
-    float dt = CFL*glm::min(dx/eig,dy/eig);
+    delete P_cells;
+    delete P_ring;
+    P_cells = NULL;
+    P_ring = NULL;
     
-    //std::cout << "Dt: " << dt << " Max eigenvalue: " << eig << std::endl << std::endl;
+    probes = cells.size();
+    if (probes == 0 || capacity == 0) {
+        return;
+    }
     
-    return dt;
+    if (stream_rows > 0) {
+        // Sampled from the host state
+        probe_cells = cells;
+        probe_ring.assign(probes*capacity, glm::vec4(0.0f));
+        return;
+    }
+    
+    // Cells grouped by band, each keeps its probe number for the ring slot
+    std::vector<cl_int4> data;
+    for (size_t b = 0; b < bands.size(); b++) {
+        bands[b].probe_first = data.size();
+        for (size_t i = 0; i < probes; i++) {
+            size_t y = cells[i].y;
+            if (y >= bands[b].y0 && y < bands[b].y0+bands[b].rows) {
+                cl_int4 cell;
+                cell.s[0] = cells[i].x;
+                cell.s[1] = y - bands[b].y0;
+                cell.s[2] = i;
+                cell.s[3] = 0;
+                data.push_back(cell);
+            }
+        }
+        bands[b].probe_count = data.size() - bands[b].probe_first;
+    }
+    
+    P_cells = new CLUtils::MO<CL_MEM_READ_ONLY>(context, probes*sizeof(cl_int4), NULL, "probes");
+    P_cells->upload(data.data());
+    P_ring  = new CLUtils::MO<CL_MEM_READ_WRITE>(context, probes*capacity*sizeof(cl_float4), NULL, "probes");
 }
 
-void SimulatorCLEuler::reconstruct(CLUtils::MO<CL_MEM_READ_WRITE>* Qn){
+void SimulatorCLEuler::sampleProbes(size_t slot){
+    if (stream_rows > 0) {
+        const float* Q = host_state[host_current];
+        for (size_t i = 0; i < probes; i++) {
+            probe_ring[slot*probes + i] = glm::make_vec4(Q + (probe_cells[i].y*Nx + probe_cells[i].x)*4);
+        }
+        return;
+    }
+    
     cl_int err = CL_SUCCESS;
+    cl_uint ring_slot = slot;
+    cl_uint count = probes;
     
-    err |= clSetKernelArg(compute_reconstruct, 0, sizeof(cl_mem), &(Qn->getRef()));
-    err |= clSetKernelArg(compute_reconstruct, 1, sizeof(cl_mem), &(Sx_set->getRef()));
-    err |= clSetKernelArg(compute_reconstruct, 2, sizeof(cl_mem), &(Sy_set->getRef()));
+    err |= clSetKernelArg(sample_probes, 1, sizeof(cl_mem), &(P_cells->getRef()));
+    err |= clSetKernelArg(sample_probes, 2, sizeof(cl_mem), &(P_ring->getRef()));
+    err |= clSetKernelArg(sample_probes, 3, sizeof(cl_uint), &ring_slot);
+    err |= clSetKernelArg(sample_probes, 4, sizeof(cl_uint), &count);
     
-    size_t global[] = {Nx+2,Ny+2};
-    err |= clEnqueueNDRangeKernel(context.queue, compute_reconstruct, 2,
-                                  NULL, global, NULL, 0, NULL, NULL);
+    for (size_t b = 0; b < bands.size(); b++) {
+        if (bands[b].probe_count == 0) {
+            continue;
+        }
+        cl_uint first = bands[b].probe_first;
+        
+        err |= clSetKernelArg(sample_probes, 0, sizeof(cl_mem), &(bands[b].Q[N_RK]->getRef()));
+        err |= clSetKernelArg(sample_probes, 5, sizeof(cl_uint), &first);
+        
+        size_t global[] = {bands[b].probe_count};
+        err |= clEnqueueNDRangeKernel(context.queue, sample_probes, 1,
+                                      NULL, global, NULL, 0, NULL, Trace::command("sampleProbes", context.queue));
+    }
     
     if(err != CL_SUCCESS) {
         std::stringstream ss;
-        ss << "Failed to run reconstruction! Error: " << err;
+        ss << "Failed to sample probes! Error: " << err;
         THROW_EXCEPTION(ss.str().c_str());
     }
 }
 
-void SimulatorCLEuler::evaluateFluxes(CLUtils::MO<CL_MEM_READ_WRITE>* Qn){
-    cl_int err = CL_SUCCESS;
-    
-    err |= clSetKernelArg(evaluate_flux, 0, sizeof(cl_mem), &(Qn->getRef()));
-    err |= clSetKernelArg(evaluate_flux, 1, sizeof(cl_mem), &(Sx_set->getRef()));
-    err |= clSetKernelArg(evaluate_flux, 2, sizeof(cl_mem), &(Sy_set->getRef()));
-    err |= clSetKernelArg(evaluate_flux, 3, sizeof(cl_float), &gamma);
-    err |= clSetKernelArg(evaluate_flux, 4, sizeof(cl_mem), &(F_set->getRef()));
-    err |= clSetKernelArg(evaluate_flux, 5, sizeof(cl_mem), &(G_set->getRef()));
+void SimulatorCLEuler::readProbes(size_t first, size_t count, float* out){
+    if (stream_rows > 0) {
+        const float* ring = glm::value_ptr(probe_ring[first*probes]);
+        std::copy(ring, ring + count*probes*4, out);
+        return;
+    }
     
-    size_t global[] = {Nx+1,Ny+1};
-    err |= clEnqueueNDRangeKernel(context.queue, evaluate_flux, 2,
-                                  NULL, global, NULL, 0, NULL, NULL);
+    // Slots are contiguous, so a run of them is a single read
+    cl_int err = clEnqueueReadBuffer(context.queue, P_ring->getRef(), CL_TRUE,
+                                     first*probes*sizeof(cl_float4), count*probes*sizeof(cl_float4),
+                                     out, 0, NULL, Trace::command("read probes", context.queue));
     
     if(err != CL_SUCCESS) {
         std::stringstream ss;
-        ss << "Failed to evalute fluxes! Error: " << err;
+        ss << "Failed to read probes! Error: " << err;
         THROW_EXCEPTION(ss.str().c_str());
     }
 }
 
-void SimulatorCLEuler::computeRK(size_t n, float dt){
-    cl_int err = CL_SUCCESS;
+void SimulatorCLEuler::planBands(){
+    // Rows of Nx+4 float4 that fit in one allocation, less the ghost rows.
+    // Tiles pad the rows to whole tiles both ways.
+    cl_ulong max_alloc = 0;
+    clGetDeviceInfo(context.device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(cl_ulong), &max_alloc, NULL);
+    size_t width = layout == LAYOUT_ROWS ? Nx+4 : (Nx+4+TILE-1)/TILE*TILE;
+    size_t row_bytes = width*sizeof(cl_float4);
+    size_t fit_rows = max_alloc/row_bytes;
+    if (layout != LAYOUT_ROWS) {
+        fit_rows = fit_rows/TILE*TILE;
+    }
+    size_t max_rows = fit_rows > 4 ? fit_rows - 4 : 0;
+    
+    // With a sub-device per NUMA node every node owns a run of whole bands
+    size_t count = max_rows > 0 ? (Ny+max_rows-1)/max_rows : 0;
+    size_t nodes = context.nodes.size();
+    numa_bands = count > 0 && nodes > 1 && Ny/nodes >= 2;
+    if (numa_bands) {
+        count = (count+nodes-1)/nodes*nodes;
+    }
+    
+    // Seams copy two rows each way, so every band needs at least two
+    if (count == 0 || Ny/count < 2) {
+        THROW_EXCEPTION("Grid rows do not fit in device allocations");
+    }
+    
+    // Rows spread evenly, the first Ny%count bands get one more
+    bands.resize(count);
+    size_t y0 = 0;
+    for (size_t b = 0; b < count; b++) {
+        bands[b].y0     = y0;
+        bands[b].rows   = Ny/count + (b < Ny%count ? 1 : 0);
+        bands[b].sides  = (b == 0 ? 1 : 0) | (b+1 == count ? 2 : 0);
+        bands[b].node   = numa_bands ? (int)(b*nodes/count) : -1;
+        bands[b].probe_first = 0;
+        bands[b].probe_count = 0;
+        y0 += bands[b].rows;
+    }
+    
+    // Float indices into the widest band, the gather buffer included
+    size_t elements = layoutCells(bands[0].rows)*4;
+    large_indices = elements > 0xFFFFFFFFul;
+    
+    if (count > 1 || large_indices) {
+        std::cout << "Large grid: " << count << " band(s) of up to " << bands[0].rows << " rows"
+                  << (large_indices ? ", 64 bit indices" : "") << std::endl;
+    }
+    if (numa_bands) {
+        std::cout << "NUMA: " << count << " band(s) on " << nodes << " nodes, each run by the sub-device of its node"
+                  << std::endl;
+    }
+}
+
+void SimulatorCLEuler::planStreaming(){
+    cl_ulong global_mem = 0;
+    cl_ulong max_alloc = 0;
+    clGetDeviceInfo(context.device, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(cl_ulong), &global_mem, NULL);
+    clGetDeviceInfo(context.device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(cl_ulong), &max_alloc, NULL);
+    
+    // Bytes per row of a band, all of its state, slope and flux buffers with
+    // the eigenvalues in the slopes and the images the stencils may read,
+    // and what the whole grid takes with a quarter spare
+    size_t buffers     = N_RK+5 + (read_path != READ_BUFFERS ? 3 : 0);
+    size_t row_bytes   = (Nx+4)*sizeof(cl_float4);
+    size_t band_bytes  = (Nx+4)*buffers*sizeof(cl_float4);
+    if (stream_rows == 0 && layoutCells(Ny)*buffers*sizeof(cl_float4) <= global_mem - global_mem/4) {
+        return;
+    }
+    
+    // Strips move between host and device as rectangles of rows
+    if (layout != LAYOUT_ROWS) {
+        std::cout << "Streamed strips keep the cells in rows" << std::endl;
+        layout = LAYOUT_ROWS;
+    }
+    
+    // Each step runs three stages that each reach two rows further in
+    stream_steps = glm::max(stream_steps, (size_t)1);
+    stream_halo  = 6*stream_steps;
+    
+    size_t max_rows = max_alloc/row_bytes > 4 ? max_alloc/row_bytes - 4 : 0;
+    if (stream_rows == 0) {
+        // Three slots in half of the device memory
+        size_t rows = global_mem/2/3/band_bytes;
+        rows = glm::min(rows > 4 ? rows - 4 : 0, max_rows);
+        stream_rows = rows > 2*stream_halo ? rows - 2*stream_halo : 0;
+        if (stream_rows == 0) {
+            THROW_EXCEPTION("Grid rows are too wide to stream through the device");
+        }
+    } else if (stream_rows + 2*stream_halo > max_rows) {
+        THROW_EXCEPTION("Strips do not fit in device allocations");
+    }
+    stream_rows = glm::min(stream_rows, Ny);
+    
+    size_t elements = (Nx+4)*(stream_rows+2*stream_halo+4)*4;
+    large_indices = elements > 0xFFFFFFFFul;
+    
+    std::cout << "Streaming: strips of " << stream_rows << " rows, " << stream_halo << " halo rows, "
+              << stream_steps << " step(s) per visit" << (large_indices ? ", 64 bit indices" : "") << std::endl;
+}
+
+size_t SimulatorCLEuler::layoutCells(size_t rows) const {
+    if (layout == LAYOUT_ROWS) {
+        return (Nx+4)*(rows+4);
+    }
+    size_t tiles_x = (Nx+4+TILE-1)/TILE;
+    size_t tiles_y = (rows+4+TILE-1)/TILE;
+    return tiles_x*tiles_y*TILE*TILE;
+}
+
+size_t SimulatorCLEuler::cellIndex(size_t x, size_t y) const {
+    if (layout == LAYOUT_ROWS) {
+        return (Nx+4)*y + x;
+    }
+    
+    // As cellIndex in the kernels
+    size_t tile = (y/TILE)*((Nx+4+TILE-1)/TILE) + x/TILE;
+    size_t tx = x%TILE;
+    size_t ty = y%TILE;
+    if (layout == LAYOUT_TILES) {
+        return tile*TILE*TILE + ty*TILE + tx;
+    }
+    size_t z = 0;
+    for (size_t b = 0; (1u << b) < TILE; b++) {
+        z |= ((tx >> b) & 1) << (2*b);
+        z |= ((ty >> b) & 1) << (2*b+1);
+    }
+    return tile*TILE*TILE + z;
+}
+
+void SimulatorCLEuler::createBuffers(){
+    // Bound to the RK kernels of every band
+    T_set = new CLUtils::MO<CL_MEM_READ_ONLY>(context, sizeof(cl_float), NULL, "timestep");
+    
+    if (flux_mode != FLUX_FUSED) {
+        // Without out-of-order execution the split kernels still run, one
+        // after the other
+        cl_command_queue_properties props = 0;
+        clGetDeviceInfo(context.device, CL_DEVICE_QUEUE_PROPERTIES, sizeof(props), &props, NULL);
+        props &= CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE;
+        
+        cl_int err;
+        flux_queue = clCreateCommandQueue(context.context, context.device, props | CL_QUEUE_PROFILING_ENABLE, &err);
+        if(err != CL_SUCCESS){
+            THROW_EXCEPTION("Failed to initialize flux queue");
+        }
+    }
+    
+    if (stream_rows > 0) {
+        // Host state and three device slots to pipeline the strips through
+        host_state[0] = mapHostState(Nx*Ny*sizeof(cl_float4));
+        host_state[1] = mapHostState(Nx*Ny*sizeof(cl_float4));
+        
+        cl_int err = CL_SUCCESS;
+        upload_queue    = clCreateCommandQueue(context.context, context.device, CL_QUEUE_PROFILING_ENABLE, &err);
+        download_queue  = clCreateCommandQueue(context.context, context.device, CL_QUEUE_PROFILING_ENABLE, &err);
+        if(err != CL_SUCCESS){
+            THROW_EXCEPTION("Failed to initialize transfer queues");
+        }
+        
+        slots.resize(3);
+        for (size_t i = 0; i < slots.size(); i++) {
+            slots[i].band.y0    = 0;
+            slots[i].band.rows  = stream_rows + 2*stream_halo;
+            slots[i].band.sides = 3;
+            slots[i].band.node  = -1;
+            slots[i].done       = NULL;
+            slots[i].rows       = 0;
+            slots[i].eig.resize(Nx*stream_rows);
+            createBand(slots[i].band);
+        }
+    } else {
+        for (size_t b = 0; b < bands.size(); b++) {
+            createBand(bands[b]);
+        }
+        
+        // Sum, min and max per reduction work-group
+        D_set  = new CLUtils::MO<CL_MEM_READ_WRITE>(context, 3*reduce_groups*bands.size()*sizeof(cl_float4), NULL, "diagnostics");
+    }
+    
+    // We dont need to visualize ghost cells, and show every few cells of
+    // grids larger than a texture
+    GLint max_tex = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_tex);
+    render_stride = 1;
+    if (max_tex > 0) {
+        render_stride = glm::max((Nx+max_tex-1)/max_tex, (Ny+max_tex-1)/max_tex);
+        render_stride = glm::max(render_stride, (size_t)1);
+    }
+    R_tex  = new CLUtils::ImageBuffer<CL_MEM_READ_WRITE>(context, tex, (Nx+render_stride-1)/render_stride,
+                                                         (Ny+render_stride-1)/render_stride, NULL, "render texture");
+}
+
+void SimulatorCLEuler::createBand(Band& band){
+    // Initialize all buffers with 2 ghost cell on each edge, carved out of
+    // one allocation where the device allows it
+    size_t cells = layoutCells(band.rows);
+    band.arena = new CLUtils::Arena(context, 0, band.node, huge_pages);
+    band.arena->reserve(N_RK+5, cells*sizeof(cl_float4));
+    
+    // Kernels of a band placed on a node run on the node's sub-device
+    band.queue = context.queue;
+    if (band.node >= 0) {
+        cl_int err;
+        band.queue = clCreateCommandQueue(context.context, context.nodes[band.node], CL_QUEUE_PROFILING_ENABLE, &err);
+        if(err != CL_SUCCESS){
+            THROW_EXCEPTION("Failed to initialize band queue");
+        }
+    }
+    for (size_t i = 0; i <= N_RK; i++) {
+        band.Q[i] = new CLUtils::MO<CL_MEM_READ_WRITE>(*band.arena, cells*sizeof(cl_float4), "state");
+    }
+    band.F  = new CLUtils::MO<CL_MEM_READ_WRITE>(*band.arena, cells*sizeof(cl_float4), "fluxes");
+    band.G  = new CLUtils::MO<CL_MEM_READ_WRITE>(*band.arena, cells*sizeof(cl_float4), "fluxes");
+    
+    // Eigenvalues are read back before the stages reconstruct, so they
+    // share the slopes' memory
+    CLUtils::Arena::Mark slopes = band.arena->mark();
+    band.Sx = new CLUtils::MO<CL_MEM_READ_WRITE>(*band.arena, cells*sizeof(cl_float4), "slopes");
+    band.Sy = new CLUtils::MO<CL_MEM_READ_WRITE>(*band.arena, cells*sizeof(cl_float4), "slopes");
+    band.arena->rewind(slopes);
+    band.E  = new CLUtils::MO<CL_MEM_WRITE_ONLY>(*band.arena, cells*sizeof(cl_float), NULL);
+    
+    band.IQ  = NULL;
+    band.ISx = NULL;
+    band.ISy = NULL;
+    if (read_path != READ_BUFFERS) {
+        band.IQ  = new CLUtils::ImageBuffer<CL_MEM_READ_WRITE>(context, Nx+4, band.rows+4, NULL, "images");
+        band.ISx = new CLUtils::ImageBuffer<CL_MEM_READ_WRITE>(context, Nx+4, band.rows+4, NULL, "images");
+        band.ISy = new CLUtils::ImageBuffer<CL_MEM_READ_WRITE>(context, Nx+4, band.rows+4, NULL, "images");
+    }
     
     static const glm::vec2 c[3][3] =
     {
@@ -295,41 +999,918 @@ void SimulatorCLEuler::computeRK(size_t n, float dt){
             glm::vec2(0.75f,0.25f),
             glm::vec2(0.333f,0.666f)}
     };
+    glm::vec2 dXY = glm::vec2((1.0f/(float)Nx),(1.0f/(float)Ny));
     
-    err |= clSetKernelArg(compute_RK, 0, sizeof(cl_mem), &(Q_set[0]->getRef()));
-    err |= clSetKernelArg(compute_RK, 1, sizeof(cl_mem), &(Q_set[n-1]->getRef()));
-    err |= clSetKernelArg(compute_RK, 2, sizeof(cl_mem), &(F_set->getRef()));
-    err |= clSetKernelArg(compute_RK, 3, sizeof(cl_mem), &(G_set->getRef()));
-    err |= clSetKernelArg(compute_RK, 4, sizeof(cl_float2), glm::value_ptr(c[N_RK-1][n-1]));
-    err |= clSetKernelArg(compute_RK, 5, sizeof(cl_float2),
-                          glm::value_ptr(glm::vec2((1.0f/(float)Nx),(1.0f/(float)Ny))));
-    err |= clSetKernelArg(compute_RK, 6, sizeof(cl_float), &dt);
-    err |= clSetKernelArg(compute_RK, 7, sizeof(cl_mem), &(Q_set[n]->getRef()));
+    // One kernel object per stage, so a step only has to enqueue them
+    cl_int err = CL_SUCCESS;
+    for (size_t n = 0; n <= N_RK; n++) {
+        band.bounds_x[n] = boundary_program->createKernel("setBoundsX");
+        err |= clSetKernelArg(band.bounds_x[n], 0, sizeof(cl_mem), &(band.Q[n]->getRef()));
+        err |= clSetKernelArg(band.bounds_x[n], 2, sizeof(cl_uint), &band.sides);
+        
+        band.bounds_y[n] = boundary_program->createKernel("setBoundsY");
+        err |= clSetKernelArg(band.bounds_y[n], 0, sizeof(cl_mem), &(band.Q[n]->getRef()));
+    }
+    
+    for (size_t n = 0; n < N_RK; n++) {
+        band.reconstruct[n] = common_program->createKernel("piecewiseReconstruction");
+        err |= clSetKernelArg(band.reconstruct[n], 0, sizeof(cl_mem), &(band.Q[n]->getRef()));
+        err |= clSetKernelArg(band.reconstruct[n], 1, sizeof(cl_mem), &(band.Sx->getRef()));
+        err |= clSetKernelArg(band.reconstruct[n], 2, sizeof(cl_mem), &(band.Sy->getRef()));
+        
+        band.flux[n] = euler_program->createKernel("computeNumericalFlux");
+        err |= clSetKernelArg(band.flux[n], 0, sizeof(cl_mem), &(band.Q[n]->getRef()));
+        err |= clSetKernelArg(band.flux[n], 1, sizeof(cl_mem), &(band.Sx->getRef()));
+        err |= clSetKernelArg(band.flux[n], 2, sizeof(cl_mem), &(band.Sy->getRef()));
+        err |= clSetKernelArg(band.flux[n], 3, sizeof(cl_float), &gamma);
+        err |= clSetKernelArg(band.flux[n], 4, sizeof(cl_mem), &(band.F->getRef()));
+        err |= clSetKernelArg(band.flux[n], 5, sizeof(cl_mem), &(band.G->getRef()));
+        
+        band.flux_x[n] = euler_program->createKernel("computeNumericalFluxX");
+        band.flux_y[n] = euler_program->createKernel("computeNumericalFluxY");
+        cl_kernel split[] = {band.flux_x[n], band.flux_y[n]};
+        CLUtils::MO<CL_MEM_READ_WRITE>* out[] = {band.F, band.G};
+        for (size_t d = 0; d < 2; d++) {
+            err |= clSetKernelArg(split[d], 0, sizeof(cl_mem), &(band.Q[n]->getRef()));
+            err |= clSetKernelArg(split[d], 1, sizeof(cl_mem), &(band.Sx->getRef()));
+            err |= clSetKernelArg(split[d], 2, sizeof(cl_mem), &(band.Sy->getRef()));
+            err |= clSetKernelArg(split[d], 3, sizeof(cl_float), &gamma);
+            err |= clSetKernelArg(split[d], 4, sizeof(cl_mem), &(out[d]->getRef()));
+        }
+        
+        band.rk[n] = common_program->createKernel("computeRK");
+        err |= clSetKernelArg(band.rk[n], 0, sizeof(cl_mem), &(band.Q[0]->getRef()));
+        err |= clSetKernelArg(band.rk[n], 1, sizeof(cl_mem), &(band.Q[n]->getRef()));
+        err |= clSetKernelArg(band.rk[n], 2, sizeof(cl_mem), &(band.F->getRef()));
+        err |= clSetKernelArg(band.rk[n], 3, sizeof(cl_mem), &(band.G->getRef()));
+        err |= clSetKernelArg(band.rk[n], 4, sizeof(cl_float2), glm::value_ptr(c[N_RK-1][n]));
+        err |= clSetKernelArg(band.rk[n], 5, sizeof(cl_float2), glm::value_ptr(dXY));
+        err |= clSetKernelArg(band.rk[n], 6, sizeof(cl_mem), &(T_set->getRef()));
+        err |= clSetKernelArg(band.rk[n], 7, sizeof(cl_mem), &(band.Q[n+1]->getRef()));
+    }
+    
+    band.copy = common_program->createKernel("copy");
+    err |= clSetKernelArg(band.copy, 0, sizeof(cl_mem), &(band.Q[N_RK]->getRef()));
+    err |= clSetKernelArg(band.copy, 1, sizeof(cl_mem), &(band.Q[0]->getRef()));
     
-    size_t global[] = {Nx,Ny};
-    err |= clEnqueueNDRangeKernel(context.queue, compute_RK, 2,
-                                  NULL, global, NULL, 0, NULL, NULL);
+    band.eigenvalues = euler_program->createKernel("eigenvalue");
+    err |= clSetKernelArg(band.eigenvalues, 0, sizeof(cl_mem), &(band.Q[N_RK]->getRef()));
+    err |= clSetKernelArg(band.eigenvalues, 1, sizeof(cl_float), &gamma);
+    err |= clSetKernelArg(band.eigenvalues, 2, sizeof(cl_mem), &(band.E->getRef()));
+    
+    // Every stage copies its state into the same image, so only the copy
+    // differs between stages
+    band.reconstruct_image = NULL;
+    band.flux_image = NULL;
+    for (size_t n = 0; n < N_RK; n++) {
+        band.to_image[n] = NULL;
+    }
+    if (band.IQ != NULL) {
+        for (size_t n = 0; n < N_RK; n++) {
+            band.to_image[n] = common_program->createKernel("copyToImage");
+            err |= clSetKernelArg(band.to_image[n], 0, sizeof(cl_mem), &(band.Q[n]->getRef()));
+            err |= clSetKernelArg(band.to_image[n], 1, sizeof(cl_mem), &(band.IQ->getRef()));
+        }
+        
+        band.reconstruct_image = common_program->createKernel("piecewiseReconstructionImage");
+        err |= clSetKernelArg(band.reconstruct_image, 0, sizeof(cl_mem), &(band.IQ->getRef()));
+        err |= clSetKernelArg(band.reconstruct_image, 1, sizeof(cl_mem), &(band.ISx->getRef()));
+        err |= clSetKernelArg(band.reconstruct_image, 2, sizeof(cl_mem), &(band.ISy->getRef()));
+        
+        band.flux_image = euler_program->createKernel("computeNumericalFluxImage");
+        err |= clSetKernelArg(band.flux_image, 0, sizeof(cl_mem), &(band.IQ->getRef()));
+        err |= clSetKernelArg(band.flux_image, 1, sizeof(cl_mem), &(band.ISx->getRef()));
+        err |= clSetKernelArg(band.flux_image, 2, sizeof(cl_mem), &(band.ISy->getRef()));
+        err |= clSetKernelArg(band.flux_image, 3, sizeof(cl_float), &gamma);
+        err |= clSetKernelArg(band.flux_image, 4, sizeof(cl_mem), &(band.F->getRef()));
+        err |= clSetKernelArg(band.flux_image, 5, sizeof(cl_mem), &(band.G->getRef()));
+    }
     
     if(err != CL_SUCCESS) {
         std::stringstream ss;
-        ss << "Failed to run rk kernel! Error: " << err;
+        ss << "Failed to bind kernels! Error: " << err;
         THROW_EXCEPTION(ss.str().c_str());
     }
+    bindRows(band);
 }
 
-void SimulatorCLEuler::copy(CLUtils::MO<CL_MEM_READ_WRITE>* src,
-                         CLUtils::MO<CL_MEM_READ_WRITE>* dest){
+void SimulatorCLEuler::bindRows(Band& band){
     cl_int err = CL_SUCCESS;
+    cl_uint rows = band.rows;
     
-    err |= clSetKernelArg(copy_domain, 0, sizeof(cl_mem), &(src->getRef()));
-    err |= clSetKernelArg(copy_domain, 1, sizeof(cl_mem), &(dest->getRef()));
-    
-    size_t global[] = {Nx+4,Ny+4};
-    err |= clEnqueueNDRangeKernel(context.queue, copy_domain, 2, NULL, global, NULL, 0, NULL, NULL);
+    for (size_t n = 0; n <= N_RK; n++) {
+        err |= clSetKernelArg(band.bounds_x[n], 1, sizeof(cl_uint), &rows);
+    }
     
     if(err != CL_SUCCESS) {
         std::stringstream ss;
-        ss << "Failed to copy domain! Error: " << err;
+        ss << "Failed to bind kernels! Error: " << err;
         THROW_EXCEPTION(ss.str().c_str());
     }
 }
+
+void SimulatorCLEuler::releaseBand(Band& band){
+    if (band.queue != context.queue) {
+        clFinish(band.queue);
+        clReleaseCommandQueue(band.queue);
+    }
+    for (size_t i = 0; i <= N_RK; i++) {
+        delete band.Q[i];
+        clReleaseKernel(band.bounds_x[i]);
+        clReleaseKernel(band.bounds_y[i]);
+    }
+    for (size_t i = 0; i < N_RK; i++) {
+        clReleaseKernel(band.reconstruct[i]);
+        clReleaseKernel(band.flux[i]);
+        clReleaseKernel(band.flux_x[i]);
+        clReleaseKernel(band.flux_y[i]);
+        clReleaseKernel(band.rk[i]);
+    }
+    clReleaseKernel(band.copy);
+    clReleaseKernel(band.eigenvalues);
+    if (band.IQ != NULL) {
+        for (size_t i = 0; i < N_RK; i++) {
+            clReleaseKernel(band.to_image[i]);
+        }
+        clReleaseKernel(band.reconstruct_image);
+        clReleaseKernel(band.flux_image);
+    }
+    delete band.IQ;
+    delete band.ISx;
+    delete band.ISy;
+    delete band.Sx;
+    delete band.Sy;
+    delete band.F;
+    delete band.G;
+    delete band.E;
+    delete band.arena;
+}
+
+void SimulatorCLEuler::createKernels(std::string initial){
+    std::stringstream ss;
+    ss << "-D Nx=" << Nx << " -D Ny=" << Ny;
+    if (large_indices) {
+        ss << " -D LARGE_GRID";
+    }
+    if (layout != LAYOUT_ROWS) {
+        ss << (layout == LAYOUT_TILES ? " -D LAYOUT_TILES" : " -D LAYOUT_MORTON") << " -D TILE=" << TILE;
+    }
+    std::string options = ss.str();
+    
+    std::stringstream common_ss;
+    common_ss << options << " -D COARSEN=" << coarsening;
+    std::string common_options = common_ss.str();
+    
+    common_program      = new CLUtils::Program(context, "res/kernels/common.cl", &common_options);
+    boundary_program    = new CLUtils::Program(context, "res/kernels/boundary.cl", &options);
+    std::stringstream euler_ss;
+    euler_ss << common_options << " -D FLUX_QUADRATURE=" << (int)quadrature;
+    if (shared_primitives) {
+        euler_ss << " -D SHARED_PRIMITIVES";
+    }
+    std::string euler_options = euler_ss.str();
+    euler_program       = new CLUtils::Program(context, "res/kernels/euler.cl", &euler_options);
+    CLUtils::Program* initialp  = new CLUtils::Program(context, "res/kernels/initial.cl", &options);
+    CLUtils::Program* reduce    = new CLUtils::Program(context, "res/kernels/reduce.cl", &options);
+    
+    
+    prepare_render      = common_program->createKernel("copyToTexture");
+    extract_region      = common_program->createKernel("extractRegion");
+    copy_rows           = common_program->createKernel("copyRows");
+    sample_probes       = common_program->createKernel("sampleProbes");
+    set_initial         = initialp->createKernel(initial);
+    reduce_diagnostics  = reduce->createKernel("reduceDiagnostics");
+    
+    // Arguments that stay the same for the whole run
+    cl_int err = CL_SUCCESS;
+    err |= clSetKernelArg(set_initial, 0, sizeof(cl_float), &gamma);
+    err |= clSetKernelArg(set_initial, 1, sizeof(cl_float2),
+                          glm::value_ptr(glm::vec2((1.0f/(float)Nx),(1.0f/(float)Ny))));
+    if(err != CL_SUCCESS) {
+        std::stringstream ss;
+        ss << "Failed to bind kernels! Error: " << err;
+        THROW_EXCEPTION(ss.str().c_str());
+    }
+    
+    // Largest power of two work-group the reduction can run with, capped at 256
+    size_t max_local = 1;
+    clGetKernelWorkGroupInfo(reduce_diagnostics, context.device, CL_KERNEL_WORK_GROUP_SIZE,
+                             sizeof(size_t), &max_local, NULL);
+    reduce_local = 1;
+    while (reduce_local*2 <= glm::min(max_local, (size_t)256)) {
+        reduce_local *= 2;
+    }
+    reduce_groups = 64;
+}
+
+void SimulatorCLEuler::applyInitial(){
+    if (stream_rows > 0) {
+        stream_dt = dtFromEigenvalue(streamSweep(0, 0.0f));
+        return;
+    }
+    
+    for (size_t b = 0; b < bands.size(); b++) {
+        applyInitial(bands[b]);
+    }
+    forkBands();
+}
+
+void SimulatorCLEuler::applyInitial(const Band& band){
+    cl_int err = CL_SUCCESS;
+    cl_uint y_offset = band.y0;
+    
+    err |= clSetKernelArg(set_initial, 2, sizeof(cl_mem), &(band.Q[N_RK]->getRef()));
+    err |= clSetKernelArg(set_initial, 3, sizeof(cl_uint), &y_offset);
+    
+    size_t global[] = {Nx,band.rows};
+    err |= clEnqueueNDRangeKernel(context.queue, set_initial, 2, NULL, global, NULL, 0, NULL,
+                                  Trace::command("initial", context.queue));
+    
+    if(err != CL_SUCCESS) {
+        std::stringstream ss;
+        ss << "Failed to apply initial condition! Error: " << err;
+        THROW_EXCEPTION(ss.str().c_str());
+    }
+}
+
+void SimulatorCLEuler::setBoundary(size_t n){
+    for (size_t b = 0; b < bands.size(); b++) {
+        setBoundary(bands[b], n);
+    }
+    exchangeHalos(n);
+}
+
+void SimulatorCLEuler::setBoundary(const Band& band, size_t n){
+    cl_int err = CL_SUCCESS;
+    
+    if (band.sides != 0) {
+        size_t globalx[] = {Nx};
+        err |= launch(band.queue, band.bounds_x[n], 1, NULL, globalx, "setBoundsX");
+    }
+    
+    size_t globaly[] = {band.rows};
+    err |= launch(band.queue, band.bounds_y[n], 1, NULL, globaly, "setBoundsY");
+    
+    if(err != CL_SUCCESS) {
+        std::stringstream ss;
+        ss << "Failed to set boundary! Error: " << err;
+        THROW_EXCEPTION(ss.str().c_str());
+    }
+}
+
+void SimulatorCLEuler::exchangeHalos(size_t n){
+    if (bands.size() < 2) {
+        return;
+    }
+    
+    // Seams are copied on the context queue once every band has its bounds
+    joinBands();
+    cl_int err = CL_SUCCESS;
+    
+    // Whole rows, so the ghost columns set above come along
+    size_t row = (Nx+4)*sizeof(cl_float4);
+    for (size_t b = 0; b+1 < bands.size(); b++) {
+        Band& lo = bands[b];
+        Band& hi = bands[b+1];
+        
+        if (layout != LAYOUT_ROWS) {
+            // Rows of tiles are not contiguous, copied cell by cell
+            size_t global[] = {Nx+4, 2};
+            cl_uint lo_row = lo.rows;
+            cl_uint hi_row = 0;
+            err |= clSetKernelArg(copy_rows, 0, sizeof(cl_mem), &(lo.Q[n]->getRef()));
+            err |= clSetKernelArg(copy_rows, 1, sizeof(cl_mem), &(hi.Q[n]->getRef()));
+            err |= clSetKernelArg(copy_rows, 2, sizeof(cl_uint), &lo_row);
+            err |= clSetKernelArg(copy_rows, 3, sizeof(cl_uint), &hi_row);
+            err |= clEnqueueNDRangeKernel(context.queue, copy_rows, 2, NULL, global, NULL, 0, NULL,
+                                          Trace::command("exchangeHalos", context.queue));
+            
+            lo_row = lo.rows+2;
+            hi_row = 2;
+            err |= clSetKernelArg(copy_rows, 0, sizeof(cl_mem), &(hi.Q[n]->getRef()));
+            err |= clSetKernelArg(copy_rows, 1, sizeof(cl_mem), &(lo.Q[n]->getRef()));
+            err |= clSetKernelArg(copy_rows, 2, sizeof(cl_uint), &hi_row);
+            err |= clSetKernelArg(copy_rows, 3, sizeof(cl_uint), &lo_row);
+            err |= clEnqueueNDRangeKernel(context.queue, copy_rows, 2, NULL, global, NULL, 0, NULL,
+                                          Trace::command("exchangeHalos", context.queue));
+            continue;
+        }
+        
+        err |= clEnqueueCopyBuffer(context.queue, lo.Q[n]->getRef(), hi.Q[n]->getRef(),
+                                   lo.rows*row, 0, 2*row, 0, NULL,
+                                   Trace::command("exchangeHalos", context.queue));
+        err |= clEnqueueCopyBuffer(context.queue, hi.Q[n]->getRef(), lo.Q[n]->getRef(),
+                                   2*row, (lo.rows+2)*row, 2*row, 0, NULL,
+                                   Trace::command("exchangeHalos", context.queue));
+    }
+    
+    if(err != CL_SUCCESS) {
+        std::stringstream ss;
+        ss << "Failed to exchange halos! Error: " << err;
+        THROW_EXCEPTION(ss.str().c_str());
+    }
+    forkBands();
+}
+
+float SimulatorCLEuler::computeDt(){
+    for (size_t b = 0; b < bands.size(); b++) {
+        computeEigenvalues(bands[b], 0, bands[b].rows);
+    }
+    return readDt();
+}
+
+float SimulatorCLEuler::readDt(){
+    float eig = -std::numeric_limits<float>().max();
+    
+    joinBands();
+    
+    // Pinned and the same every step, the first band is the widest
+    cl_float* data = NULL;
+    if (!context.unified) {
+        data = (cl_float*)pool->borrow(layoutCells(bands[0].rows)*sizeof(cl_float));
+    }
+    
+    for (size_t b = 0; b < bands.size(); b++) {
+        const Band& band = bands[b];
+        
+        cl_int err = CL_SUCCESS;
+        const cl_float* E = NULL;
+        if (context.unified) {
+            // Memory is shared with the host, read the eigenvalues in place
+            E = (const cl_float*)band.E->map(CL_MAP_READ);
+        } else {
+            err = clEnqueueReadBuffer(context.queue, band.E->getRef(), CL_TRUE, 0,
+                                      layoutCells(band.rows)*sizeof(cl_float), data, 0, NULL, Trace::command("read eigenvalues", context.queue));
+            E = data;
+        }
+        if(err != CL_SUCCESS) {
+            pool->giveBack(data);
+            std::stringstream ss;
+            ss << "Failed to compute dt! Error: " << err;
+            THROW_EXCEPTION(ss.str().c_str());
+        }
+        
+        for (size_t y = 2; y < band.rows+2; y++) {
+            for (size_t x = 2; x < Nx+2; x++) {
+                eig = glm::max(eig, E[cellIndex(x, y)]);
+            }
+        }
+        
+        if (context.unified) {
+            band.E->unmap((void*)E);
+        }
+    }
+    if (data != NULL) {
+        pool->giveBack(data);
+    }
+    
+    return dtFromEigenvalue(eig);
+}
+
+void SimulatorCLEuler::setTimestep(float dt){
+    // Not blocking, step_dt only changes again once the queue has drained
+    step_dt = dt;
+    cl_int err = clEnqueueWriteBuffer(context.queue, T_set->getRef(), CL_FALSE, 0, sizeof(cl_float), &step_dt,
+                                      0, NULL, Trace::command("write dt", context.queue));
+    forkBands();
+    
+    if(err != CL_SUCCESS) {
+        std::stringstream ss;
+        ss << "Failed to set timestep! Error: " << err;
+        THROW_EXCEPTION(ss.str().c_str());
+    }
+}
+
+float SimulatorCLEuler::dtFromEigenvalue(float eig){
+    static const float CFL = 0.5f;
+    
+    float dx = 1.0f/(float)Nx;
+    float dy = 1.0f/(float)Ny;
+    float dt = CFL*glm::min(dx/eig,dy/eig);
+    
+    //std::cout << "Dt: " << dt << " Max eigenvalue: " << eig << std::endl << std::endl;
+    
+    return dt;
+}
+
+void SimulatorCLEuler::computeEigenvalues(const Band& band, size_t first, size_t rows){
+    size_t offset[] = {0,first};
+    size_t global[] = {Nx,rows};
+    cl_int err = launch(band.queue, band.eigenvalues, 2, offset, global, "eigenvalue");
+    
+    if(err != CL_SUCCESS) {
+        std::stringstream ss;
+        ss << "Failed to compute eigenvalues! Error: " << err;
+        THROW_EXCEPTION(ss.str().c_str());
+    }
+}
+
+void SimulatorCLEuler::reconstruct(size_t n){
+    for (size_t b = 0; b < bands.size(); b++) {
+        reconstruct(bands[b], n);
+    }
+}
+
+void SimulatorCLEuler::reconstruct(const Band& band, size_t n){
+    size_t global[] = {Nx+2,band.rows+2};
+    cl_int err = CL_SUCCESS;
+    if (read_path == READ_IMAGES) {
+        // Boundaries are set on the buffer, so the image is refreshed per stage
+        size_t cells[] = {Nx+4,band.rows+4};
+        err |= launch(band.queue, band.to_image[n], 2, NULL, cells, "copyToImage");
+        err |= launch(band.queue, band.reconstruct_image, 2, NULL, global, "piecewiseReconstructionImage");
+    } else {
+        size_t coarse[] = {(Nx+2+coarsening-1)/coarsening,band.rows+2};
+        err |= launch(band.queue, band.reconstruct[n], 2, NULL, coarse, "piecewiseReconstruction");
+    }
+    
+    if(err != CL_SUCCESS) {
+        std::stringstream ss;
+        ss << "Failed to run reconstruction! Error: " << err;
+        THROW_EXCEPTION(ss.str().c_str());
+    }
+}
+
+void SimulatorCLEuler::evaluateFluxes(size_t n){
+    for (size_t b = 0; b < bands.size(); b++) {
+        evaluateFluxes(bands[b], n);
+    }
+}
+
+void SimulatorCLEuler::evaluateFluxes(const Band& band, size_t n){
+    if (read_path != READ_IMAGES && flux_mode == FLUX_SPLIT) {
+        evaluateSplitFluxes(band, n);
+        return;
+    }
+    
+    size_t global[] = {Nx+1,band.rows+1};
+    cl_int err = CL_SUCCESS;
+    if (read_path == READ_IMAGES) {
+        err |= launch(band.queue, band.flux_image, 2, NULL, global, "computeNumericalFluxImage");
+    } else {
+        size_t coarse[] = {(Nx+1+coarsening-1)/coarsening,band.rows+1};
+        err |= launch(band.queue, band.flux[n], 2, NULL, coarse, "computeNumericalFlux");
+    }
+    
+    if(err != CL_SUCCESS) {
+        std::stringstream ss;
+        ss << "Failed to evalute fluxes! Error: " << err;
+        THROW_EXCEPTION(ss.str().c_str());
+    }
+}
+
+void SimulatorCLEuler::evaluateSplitFluxes(const Band& band, size_t n){
+    // Past the zero row of F and zero column of G, which RK never reads
+    size_t offset_x[] = {0,1};
+    size_t global_x[] = {Nx+1,band.rows};
+    size_t offset_y[] = {1,0};
+    size_t global_y[] = {Nx,band.rows+1};
+    
+    cl_int err = CL_SUCCESS;
+    if (recording != NULL) {
+        // Recorded commands run in order anyway
+        err |= launch(band.queue, band.flux_x[n], 2, offset_x, global_x, "computeNumericalFluxX");
+        err |= launch(band.queue, band.flux_y[n], 2, offset_y, global_y, "computeNumericalFluxY");
+    } else {
+        // Both directions wait on the reconstruction through a marker and
+        // the main queue waits on both through a barrier
+        cl_event ready = NULL;
+        cl_event done[] = {NULL, NULL};
+        err |= clEnqueueMarkerWithWaitList(context.queue, 0, NULL, &ready);
+        err |= clFlush(context.queue);
+        err |= clEnqueueNDRangeKernel(flux_queue, band.flux_x[n], 2, offset_x, global_x, NULL,
+                                      1, &ready, &done[0]);
+        err |= clEnqueueNDRangeKernel(flux_queue, band.flux_y[n], 2, offset_y, global_y, NULL,
+                                      1, &ready, &done[1]);
+        err |= clFlush(flux_queue);
+        err |= clEnqueueBarrierWithWaitList(context.queue, 2, done, NULL);
+        
+        Trace::retain("computeNumericalFluxX", flux_queue, done[0]);
+        Trace::retain("computeNumericalFluxY", flux_queue, done[1]);
+        clReleaseEvent(ready);
+        clReleaseEvent(done[0]);
+        clReleaseEvent(done[1]);
+    }
+    
+    if(err != CL_SUCCESS) {
+        std::stringstream ss;
+        ss << "Failed to evalute split fluxes! Error: " << err;
+        THROW_EXCEPTION(ss.str().c_str());
+    }
+}
+
+void SimulatorCLEuler::pickFluxMode(){
+    if (read_path == READ_IMAGES) {
+        if (flux_mode == FLUX_SPLIT) {
+            std::cout << "Image reads evaluate fluxes fused, not split" << std::endl;
+        }
+        flux_mode = FLUX_FUSED;
+        return;
+    }
+    if (flux_mode != FLUX_AUTO) {
+        return;
+    }
+    
+    // A few evaluations of either kind on the first band, after one to warm up
+    const size_t runs = 8;
+    const Band& band = stream_rows > 0 ? slots[0].band : bands[0];
+    double elapsed[2];
+    reconstruct(band, 0);
+    for (size_t m = 0; m < 2; m++) {
+        flux_mode = m == 0 ? FLUX_FUSED : FLUX_SPLIT;
+        evaluateFluxes(band, 0);
+        clFinish(context.queue);
+        
+        timer.restart();
+        for (size_t i = 0; i < runs; i++) {
+            evaluateFluxes(band, 0);
+        }
+        clFinish(context.queue);
+        elapsed[m] = timer.elapsed()/runs;
+    }
+    
+    flux_mode = elapsed[1] < elapsed[0] ? FLUX_SPLIT : FLUX_FUSED;
+    std::cout << "Fluxes " << (flux_mode == FLUX_SPLIT ? "split per direction" : "fused")
+              << ", " << elapsed[0]*1e3 << " ms fused against " << elapsed[1]*1e3 << " ms split" << std::endl;
+}
+
+void SimulatorCLEuler::planReadPath(){
+    if (read_path == READ_BUFFERS) {
+        return;
+    }
+    
+    // The image kernels run one cell per work-item
+    if (coarsening > 1) {
+        if (read_path == READ_IMAGES) {
+            std::cout << "Coarsened stencils read buffers, not images" << std::endl;
+        }
+        read_path = READ_BUFFERS;
+        return;
+    }
+    
+    cl_bool images = CL_FALSE;
+    size_t max_width = 0;
+    size_t max_height = 0;
+    clGetDeviceInfo(context.device, CL_DEVICE_IMAGE_SUPPORT, sizeof(cl_bool), &images, NULL);
+    clGetDeviceInfo(context.device, CL_DEVICE_IMAGE2D_MAX_WIDTH, sizeof(size_t), &max_width, NULL);
+    clGetDeviceInfo(context.device, CL_DEVICE_IMAGE2D_MAX_HEIGHT, sizeof(size_t), &max_height, NULL);
+    
+    // The tallest band, or a streamed strip with its halos
+    size_t rows = stream_rows > 0 ? stream_rows + 2*stream_halo : bands[0].rows;
+    if (!images || Nx+4 > max_width || rows+4 > max_height) {
+        if (read_path == READ_IMAGES) {
+            std::cout << "Bands do not fit in device images, stencils read buffers" << std::endl;
+        }
+        read_path = READ_BUFFERS;
+    }
+}
+
+void SimulatorCLEuler::pickReadPath(){
+    if (read_path != READ_AUTO) {
+        return;
+    }
+    
+    // A few reconstructions and fused flux evaluations of the first band
+    // either way, after one to warm up. Image reads include their copy.
+    const size_t runs = 8;
+    const Band& band = stream_rows > 0 ? slots[0].band : bands[0];
+    FluxMode flux = flux_mode;
+    flux_mode = flux == FLUX_SPLIT ? FLUX_SPLIT : FLUX_FUSED;
+    double elapsed[2];
+    for (size_t m = 0; m < 2; m++) {
+        read_path = m == 0 ? READ_BUFFERS : READ_IMAGES;
+        reconstruct(band, 0);
+        evaluateFluxes(band, 0);
+        finish();
+        
+        timer.restart();
+        for (size_t i = 0; i < runs; i++) {
+            reconstruct(band, 0);
+            evaluateFluxes(band, 0);
+        }
+        finish();
+        elapsed[m] = timer.elapsed()/runs;
+    }
+    flux_mode = flux;
+    
+    read_path = elapsed[1] < elapsed[0] ? READ_IMAGES : READ_BUFFERS;
+    std::cout << "Stencils read " << (read_path == READ_IMAGES ? "images" : "buffers")
+              << ", " << elapsed[0]*1e3 << " ms through buffers against " << elapsed[1]*1e3 << " ms through images"
+              << std::endl;
+}
+
+void SimulatorCLEuler::computeRK(size_t n){
+    for (size_t b = 0; b < bands.size(); b++) {
+        computeRK(bands[b], n);
+    }
+}
+
+void SimulatorCLEuler::computeRK(const Band& band, size_t n){
+    size_t global[] = {(Nx+coarsening-1)/coarsening,band.rows};
+    cl_int err = launch(band.queue, band.rk[n-1], 2, NULL, global, "computeRK");
+    
+    if(err != CL_SUCCESS) {
+        std::stringstream ss;
+        ss << "Failed to run rk kernel! Error: " << err;
+        THROW_EXCEPTION(ss.str().c_str());
+    }
+}
+
+void SimulatorCLEuler::copy(){
+    for (size_t b = 0; b < bands.size(); b++) {
+        copy(bands[b]);
+    }
+}
+
+void SimulatorCLEuler::copy(const Band& band){
+    size_t global[] = {Nx+4,band.rows+4};
+    cl_int err = launch(band.queue, band.copy, 2, NULL, global, "copy");
+    
+    if(err != CL_SUCCESS) {
+        std::stringstream ss;
+        ss << "Failed to copy domain! Error: " << err;
+        THROW_EXCEPTION(ss.str().c_str());
+    }
+}
+
+cl_int SimulatorCLEuler::launch(cl_command_queue queue, cl_kernel kernel, cl_uint dims, const size_t* offset,
+                                const size_t* global, const char* name){
+    if (recording != NULL) {
+        return recording->kernel(kernel, dims, offset, global);
+    }
+    return clEnqueueNDRangeKernel(queue, kernel, dims, offset, global, NULL, 0, NULL,
+                                  Trace::command(name, queue));
+}
+
+void SimulatorCLEuler::joinBands(){
+    if (!numa_bands) {
+        return;
+    }
+    
+    cl_int err = CL_SUCCESS;
+    std::vector<cl_event> done(bands.size());
+    for (size_t b = 0; b < bands.size(); b++) {
+        err |= clEnqueueMarkerWithWaitList(bands[b].queue, 0, NULL, &done[b]);
+        err |= clFlush(bands[b].queue);
+    }
+    err |= clEnqueueBarrierWithWaitList(context.queue, (cl_uint)done.size(), done.data(), NULL);
+    for (size_t b = 0; b < done.size(); b++) {
+        clReleaseEvent(done[b]);
+    }
+    
+    if(err != CL_SUCCESS) {
+        std::stringstream ss;
+        ss << "Failed to join band queues! Error: " << err;
+        THROW_EXCEPTION(ss.str().c_str());
+    }
+}
+
+void SimulatorCLEuler::forkBands(){
+    if (!numa_bands) {
+        return;
+    }
+    
+    cl_int err = CL_SUCCESS;
+    cl_event ready;
+    err |= clEnqueueMarkerWithWaitList(context.queue, 0, NULL, &ready);
+    err |= clFlush(context.queue);
+    for (size_t b = 0; b < bands.size(); b++) {
+        err |= clEnqueueBarrierWithWaitList(bands[b].queue, 1, &ready, NULL);
+    }
+    clReleaseEvent(ready);
+    
+    if(err != CL_SUCCESS) {
+        std::stringstream ss;
+        ss << "Failed to fork band queues! Error: " << err;
+        THROW_EXCEPTION(ss.str().c_str());
+    }
+}
+
+void SimulatorCLEuler::finish(){
+    joinBands();
+    clFinish(context.queue);
+}
+
+void SimulatorCLEuler::recordStep(){
+    // Seams are buffer copies, so only grids of one band are recorded. Those
+    // are the small grids, where launches cost the most.
+    if (stream_rows > 0 || bands.size() != 1 || !CLUtils::CommandBuffer::supported(context)) {
+        return;
+    }
+    
+    step_prepare = recording = new CLUtils::CommandBuffer(context);
+    setBoundary(N_RK);
+    copy();
+    computeEigenvalues(bands[0], 0, bands[0].rows);
+    step_prepare->finalize();
+    
+    size_t kernels = step_prepare->size();
+    for (size_t n = 1; n <= N_RK; n++) {
+        step_bounds[n-1] = recording = new CLUtils::CommandBuffer(context);
+        setBoundary(n-1);
+        step_bounds[n-1]->finalize();
+        
+        step_stages[n-1] = recording = new CLUtils::CommandBuffer(context);
+        reconstruct(n-1);
+        evaluateFluxes(n-1);
+        computeRK(n);
+        step_stages[n-1]->finalize();
+        
+        kernels += step_bounds[n-1]->size() + step_stages[n-1]->size();
+    }
+    recording = NULL;
+    
+    std::cout << "Steps replayed from command buffers, " << kernels << " kernels" << std::endl;
+}
+
+SimDetail SimulatorCLEuler::replayStep(){
+    SimDetail detail;
+    
+    step_prepare->enqueue();
+    float dt = readDt();
+    setTimestep(dt);
+    
+    device_timer->begin();
+    detail.sim_time = 0.0f;
+    
+    // Timed like simulate(), from after the boundaries are enqueued
+    for (size_t n = 0; n < N_RK; n++) {
+        step_bounds[n]->enqueue();
+        
+        timer.restart();
+        step_stages[n]->enqueue();
+        clFinish(context.queue);
+        detail.sim_time += timer.elapsed();
+    }
+    
+    device_timer->end();
+    clFinish(context.queue);
+    
+    detail.dt = dt;
+    detail.steps = 1;
+    time+=dt;
+    detail.time = time;
+    
+    return detail;
+}
+
+SimDetail SimulatorCLEuler::streamStep(){
+    SimDetail detail;
+    float dt = stream_dt;
+    
+    timer.restart();
+    device_timer->begin();
+    
+    float eig;
+    {
+        PERF_PHASE("streamSweep", context.queue);
+        eig = streamSweep(stream_steps, dt);
+    }
+    
+    device_timer->end();
+    
+    detail.sim_time = timer.elapsed();
+    detail.dt = dt;
+    detail.steps = stream_steps;
+    time += stream_steps*dt;
+    detail.time = time;
+    
+    // The next block runs with the dt of the state it starts from
+    stream_dt = dtFromEigenvalue(eig);
+    
+    return detail;
+}
+
+float SimulatorCLEuler::streamSweep(size_t steps, float dt){
+    float eig = -std::numeric_limits<float>().max();
+    
+    const float* src = host_state[host_current];
+    float* dst = host_state[steps > 0 ? 1-host_current : host_current];
+    if (steps > 0) {
+        setTimestep(dt);
+    }
+    
+    size_t strips = (Ny+stream_rows-1)/stream_rows;
+    for (size_t i = 0; i < strips; i++) {
+        Slot& slot = slots[i % slots.size()];
+        eig = glm::max(eig, retireSlot(slot));
+        
+        // The strip and as much of its halo as the domain has
+        size_t y0   = i*stream_rows;
+        size_t rows = glm::min(stream_rows, Ny-y0);
+        size_t halo = steps > 0 ? stream_halo : 0;
+        size_t lo   = y0 > halo ? y0-halo : 0;
+        size_t hi   = glm::min(y0+rows+halo, Ny);
+        
+        Band& band  = slot.band;
+        band.y0     = lo;
+        band.rows   = hi-lo;
+        slot.rows   = rows;
+        bindRows(band);
+        
+        cl_int err = CL_SUCCESS;
+        size_t host_origin[] = {0, lo, 0};
+        
+        if (steps == 0) {
+            applyInitial(band);
+        } else {
+            size_t buffer_origin[]  = {2*sizeof(cl_float4), 2, 0};
+            size_t region[]         = {Nx*sizeof(cl_float4), band.rows, 1};
+            
+            cl_event uploaded = NULL;
+            err |= clEnqueueWriteBufferRect(upload_queue, band.Q[N_RK]->getRef(), CL_FALSE,
+                                            buffer_origin, host_origin, region,
+                                            (Nx+4)*sizeof(cl_float4), 0, Nx*sizeof(cl_float4), 0,
+                                            src, 0, NULL, &uploaded);
+            if(err != CL_SUCCESS) {
+                std::stringstream ss;
+                ss << "Failed to upload strip! Error: " << err;
+                THROW_EXCEPTION(ss.str().c_str());
+            }
+            clFlush(upload_queue);
+            Trace::retain("upload", upload_queue, uploaded);
+            
+            err |= clEnqueueBarrierWithWaitList(context.queue, 1, &uploaded, NULL);
+            clReleaseEvent(uploaded);
+            
+            // Ghost rows are extrapolated on both sides. At the domain edge
+            // that is the boundary condition, elsewhere the halo soaks up
+            // the error, two rows per stage.
+            for (size_t k = 0; k < steps; k++) {
+                setBoundary(band, N_RK);
+                copy(band);
+                
+                for (size_t n = 1; n <= N_RK; n++) {
+                    setBoundary(band, n-1);
+                    reconstruct(band, n-1);
+                    evaluateFluxes(band, n-1);
+                    computeRK(band, n);
+                }
+            }
+        }
+        
+        // Only the strip rows go back, the halo belongs to the neighbours
+        computeEigenvalues(band, y0-lo, rows);
+        
+        cl_event computed = NULL;
+        err |= clEnqueueMarkerWithWaitList(context.queue, 0, NULL, &computed);
+        clFlush(context.queue);
+        
+        size_t zero[]           = {0, 0, 0};
+        size_t e_origin[]       = {2*sizeof(cl_float), y0-lo+2, 0};
+        size_t e_region[]       = {Nx*sizeof(cl_float), rows, 1};
+        size_t q_origin[]       = {2*sizeof(cl_float4), y0-lo+2, 0};
+        size_t strip_origin[]   = {0, y0, 0};
+        size_t q_region[]       = {Nx*sizeof(cl_float4), rows, 1};
+        
+        err |= clEnqueueReadBufferRect(download_queue, band.E->getRef(), CL_FALSE,
+                                       e_origin, zero, e_region,
+                                       (Nx+4)*sizeof(cl_float), 0, Nx*sizeof(cl_float), 0,
+                                       slot.eig.data(), 1, &computed, Trace::command("read eigenvalues", download_queue));
+        err |= clEnqueueReadBufferRect(download_queue, band.Q[N_RK]->getRef(), CL_FALSE,
+                                       q_origin, strip_origin, q_region,
+                                       (Nx+4)*sizeof(cl_float4), 0, Nx*sizeof(cl_float4), 0,
+                                       dst, 0, NULL, &slot.done);
+        clFlush(download_queue);
+        Trace::retain("download", download_queue, slot.done);
+        if (computed != NULL) {
+            clReleaseEvent(computed);
+        }
+        
+        if(err != CL_SUCCESS) {
+            std::stringstream ss;
+            ss << "Failed to stream strip! Error: " << err;
+            THROW_EXCEPTION(ss.str().c_str());
+        }
+    }
+    
+    for (size_t i = 0; i < slots.size(); i++) {
+        eig = glm::max(eig, retireSlot(slots[i]));
+    }
+    if (steps > 0) {
+        host_current = 1-host_current;
+    }
+    
+    return eig;
+}
+
+float SimulatorCLEuler::retireSlot(Slot& slot){
+    float eig = -std::numeric_limits<float>().max();
+    if (slot.done == NULL) {
+        return eig;
+    }
+    
+    cl_int err = clWaitForEvents(1, &slot.done);
+    clReleaseEvent(slot.done);
+    slot.done = NULL;
+    if(err != CL_SUCCESS) {
+        std::stringstream ss;
+        ss << "Streaming a strip failed! Error: " << err;
+        THROW_EXCEPTION(ss.str().c_str());
+    }
+    
+    for (size_t i = 0; i < slot.rows*Nx; i++) {
+        eig = glm::max(eig, slot.eig[i]);
+    }
+    return eig;
+}
@@ -13,13 +13,16 @@
 #include "CLUtils.hpp"
 #include "SimulatorBase.h"
 #include "Timer.hpp"
+#include "CLTimer.hpp"
 
 class SimulatorCLEuler : public SimulatorBase{
 public:
     /**
-	 * Constructor
+	 * Constructor. With numa set, CPU devices on machines with several
+	 * NUMA nodes are split into a sub-device per node, each running the
+	 * bands of rows whose memory it first touched.
 	 */
-	SimulatorCLEuler(cl_device_type device);
+	SimulatorCLEuler(cl_device_type device, bool numa = false);
     
 	/**
 	 * Destructor
@@ -46,6 +49,12 @@ public:
      */
     virtual std::vector<float> getData();
     
+    /**
+     * Read back a decimated subregion with selected components
+     */
+    virtual std::vector<float> getRegion(size_t x0, size_t y0, size_t w, size_t h,
+                                         size_t stride = 1, unsigned int fields = FIELD_ALL);
+    
     /**
      * Return the size of the grid
      */
@@ -60,7 +69,207 @@ public:
      * Returns time
      */
     virtual float getTime(){return time;}
+    
+    /**
+     * Allocate pinned host staging slots
+     */
+    virtual void createStaging(size_t slots);
+    
+    /**
+     * Start a non-blocking download into a staging slot
+     */
+    virtual void beginDownload(size_t slot);
+    
+    /**
+     * Returns slot data once the download has completed
+     */
+    virtual const float* pollDownload(size_t slot);
+    
+    /**
+     * Release a staging slot
+     */
+    virtual void endDownload(size_t slot);
+    
+    /**
+     * Device side conservation and range diagnostics
+     */
+    virtual SimDiagnostics getDiagnostics();
+    
+    /**
+     * Average device time of a step, a strip visit advances several
+     */
+    virtual double getDeviceTime(){return device_timer->average()/(stream_rows > 0 ? stream_steps : 1);}
+    
+    /**
+     * Modelled cost and measured time of the step kernels
+     */
+    virtual std::vector<KernelProfile> getKernelProfile();
+    
+    /**
+     * Triad bandwidth of the device
+     */
+    virtual double measureBandwidth();
+    
+    /**
+     * Allocate the probe cells and their device ring buffer
+     */
+    virtual void createProbes(const std::vector<glm::ivec2>& cells, size_t capacity);
+    
+    /**
+     * Sample every probe into a ring slot on the device
+     */
+    virtual void sampleProbes(size_t slot);
+    
+    /**
+     * Read a run of ring slots back to the host
+     */
+    virtual void readProbes(size_t first, size_t count, float* out);
+    
+    /**
+     * Keep the state on the host and stream it through the device in strips
+     * of rows rows, taking steps time steps per visit of a strip. With rows
+     * 0 the strip height is picked, and only if the grid does not fit on the
+     * device. Has to be called before init. With steps above one, each call
+     * of simulate() advances that many steps, all with the same dt.
+     */
+    void setStreaming(size_t rows, size_t steps){stream_rows = rows; stream_steps = steps;}
+    
+    /**
+     * Fused or per direction flux kernels, auto times both at init. Has to
+     * be called before init.
+     */
+    void setFluxMode(FluxMode mode){flux_mode = mode;}
+    virtual FluxMode getFluxMode(){return flux_mode;}
+    
+    /**
+     * Read the state and slopes through buffers or images, auto times both
+     * at init. Image reads come with their own fused flux kernel. Has to be
+     * called before init.
+     */
+    void setReadPath(ReadPath path){read_path = path;}
+    virtual ReadPath getReadPath(){return read_path;}
+    
+    /**
+     * Compute the primitive variables of every state once and share them
+     * between its flux and wave speeds, or recompute them where they are
+     * used, the default. Compiled into the kernels, has to be called before
+     * init.
+     */
+    void setSharedPrimitives(bool shared){shared_primitives = shared;}
+    
+    /**
+     * Face quadrature of the fluxes. Compiled into the kernels, has to be
+     * called before init.
+     */
+    void setQuadrature(FluxQuadrature rule){quadrature = rule;}
+    
+    /**
+     * Cells each work-item of the buffer reconstruction, flux and RK
+     * kernels walks along x, 1, 2, 4 or 8. Compiled into the kernels, has
+     * to be called before init.
+     */
+    void setCoarsening(size_t cells){
+        if (cells != 1 && cells != 2 && cells != 4 && cells != 8) {
+            THROW_EXCEPTION("Coarsening has to be 1, 2, 4 or 8 cells");
+        }
+        coarsening = cells;
+    }
+    
+    /**
+     * Order of the cells in the device buffers, the host always sees rows.
+     * Compiled into the kernels, has to be called before init.
+     */
+    void setLayout(MemoryLayout order){layout = order;}
+    
+    /**
+     * Back the band buffers with transparent huge pages on devices sharing
+     * host memory. Has to be called before init.
+     */
+    void setHugePages(bool huge){huge_pages = huge;}
 private:
+    static const unsigned int N_RK  = 3;
+    static const unsigned int TILE  = 32;   // cells along a side of a tile
+    
+    /**
+     * Rows y0 to y0+rows of the domain in buffers of their own, with two
+     * ghost rows on each side. Ghost rows at a seam hold copies of the
+     * neighbouring band.
+     */
+    struct Band{
+        size_t y0;
+        size_t rows;
+        
+        CLUtils::MO<CL_MEM_READ_WRITE>*         Q[N_RK+1];
+        CLUtils::MO<CL_MEM_READ_WRITE>*         Sx;
+        CLUtils::MO<CL_MEM_READ_WRITE>*         Sy;
+        CLUtils::MO<CL_MEM_READ_WRITE>*         F;
+        CLUtils::MO<CL_MEM_READ_WRITE>*         G;
+        CLUtils::MO<CL_MEM_WRITE_ONLY>*         E;      // aliases the slopes
+        CLUtils::Arena*                         arena;  // the buffers above are carved from it
+        
+        cl_uint sides;      // domain edges the band touches, bottom (1) and top (2)
+        
+        int node;                   // NUMA node owning the band, -1 for none
+        cl_command_queue queue;     // on the node's sub-device, or the context queue
+        
+        // Step kernels of the band with their arguments bound once, indexed
+        // by the state they read
+        cl_kernel bounds_x[N_RK+1];
+        cl_kernel bounds_y[N_RK+1];
+        cl_kernel reconstruct[N_RK];
+        cl_kernel flux[N_RK];
+        cl_kernel flux_x[N_RK];     // the directions of flux on their own
+        cl_kernel flux_y[N_RK];
+        cl_kernel rk[N_RK];         // writes the next state
+        cl_kernel copy;             // last state into the first
+        cl_kernel eigenvalues;      // of the last state
+        
+        // State and slopes as images, NULL when the stencils read buffers
+        CLUtils::ImageBuffer<CL_MEM_READ_WRITE>*    IQ;     // copy of the stage state
+        CLUtils::ImageBuffer<CL_MEM_READ_WRITE>*    ISx;
+        CLUtils::ImageBuffer<CL_MEM_READ_WRITE>*    ISy;
+        cl_kernel to_image[N_RK];
+        cl_kernel reconstruct_image;
+        cl_kernel flux_image;
+        
+        size_t probe_first; // probe cells are grouped by band
+        size_t probe_count;
+    };
+    
+    /**
+     * Device buffers a strip is streamed through, the band covers the strip
+     * and its halo. Uploads and downloads run on queues of their own, so
+     * with three slots they overlap the compute of another strip.
+     */
+    struct Slot{
+        Band                    band;
+        cl_event                done;   // strip downloaded
+        size_t                  rows;   // strip rows in flight
+        std::vector<cl_float>   eig;    // eigenvalues of the strip rows
+    };
+    
+    /**
+     * Split the rows into bands that each fit in one allocation
+     */
+    void planBands();
+    
+    /**
+     * Decide whether to stream and how high the strips are
+     */
+    void planStreaming();
+    
+    /**
+     * Elements in a buffer of a band of rows interior rows, ghost cells and
+     * the padding of partial tiles included
+     */
+    size_t layoutCells(size_t rows) const;
+    
+    /**
+     * Element of cell (x,y) of a band buffer, ghost cells counted, as the
+     * kernels lay them out
+     */
+    size_t cellIndex(size_t x, size_t y) const;
+    
     /**
      * Sets up the buffers for us
      */
@@ -75,37 +284,152 @@ private:
 	 * Function that applies initial simulation state
 	 */
     void applyInitial();
+    void applyInitial(const Band& band);
     
     /**
      * Function that enforces boundary condition
      */
-    void setBoundary(CLUtils::MO<CL_MEM_READ_WRITE>* Qn);
+    void setBoundary(size_t n);
+    void setBoundary(const Band& band, size_t n);
+    
+    /**
+     * Copy the rows next to each seam into the ghost rows across it
+     */
+    void exchangeHalos(size_t n);
+    
+    /**
+     * Gather every stride'th cell of the w*h region of a band at (x0,y0)
+     * into X_set, packed as getRegion returns it
+     */
+    cl_int extractRegion(const Band& band, size_t x0, size_t y0, size_t w, size_t h,
+                         size_t stride, unsigned int fields);
     
     /**
      * Computes timestep based on CFL
      */
-    float computeDt(CLUtils::MO<CL_MEM_READ_WRITE>* Qn);
+    float computeDt();
+    
+    /**
+     * Timestep from the eigenvalues already computed for every band
+     */
+    float readDt();
+    
+    /**
+     * Hand the timestep to the RK kernels
+     */
+    void setTimestep(float dt);
+    
+    /**
+     * Timestep for a largest eigenvalue
+     */
+    float dtFromEigenvalue(float eig);
+    
+    /**
+     * Eigenvalues of rows first to first+rows of a band
+     */
+    void computeEigenvalues(const Band& band, size_t first, size_t rows);
     
     /**
 	 * Simulation step
 	 */
-    void reconstruct(CLUtils::MO<CL_MEM_READ_WRITE>* Qn);
+    void reconstruct(size_t n);
+    void reconstruct(const Band& band, size_t n);
     
     /**
 	 * Simulation step
 	 */
-    void evaluateFluxes(CLUtils::MO<CL_MEM_READ_WRITE>* Qn);
+    void evaluateFluxes(size_t n);
+    void evaluateFluxes(const Band& band, size_t n);
+    
+    /**
+     * Both flux directions at once on the flux queue, the main queue waits
+     * for them before going on
+     */
+    void evaluateSplitFluxes(const Band& band, size_t n);
+    
+    /**
+     * Time fused and split fluxes on the device and keep the faster
+     */
+    void pickFluxMode();
+    
+    /**
+     * Fall back to buffer reads where bands do not fit in device images
+     */
+    void planReadPath();
+    
+    /**
+     * Time buffer and image reads on the device and keep the faster
+     */
+    void pickReadPath();
     
     /**
 	 * Simulation step
 	 */
-    void computeRK(size_t n, float dt);
+    void computeRK(size_t n);
+    void computeRK(const Band& band, size_t n);
     
     /**
-	 * Copy texture to framebuffer texture
+	 * Copy the last RK stage into the first
 	 */
-    void copy(CLUtils::MO<CL_MEM_READ_WRITE>* src,
-              CLUtils::MO<CL_MEM_READ_WRITE>* dest);
+    void copy();
+    void copy(const Band& band);
+    
+    /**
+     * Device buffers and bound kernels of a band
+     */
+    void createBand(Band& band);
+    void releaseBand(Band& band);
+    
+    /**
+     * Rebind the row count after a band was resized
+     */
+    void bindRows(Band& band);
+    
+    /**
+     * Run a kernel on the queue, or record it while a step is recorded
+     */
+    cl_int launch(cl_command_queue queue, cl_kernel kernel, cl_uint dims, const size_t* offset,
+                  const size_t* global, const char* name);
+    
+    /**
+     * Make the context queue wait for the work enqueued on the band queues,
+     * and the band queues for the context queue. Nothing to do when the
+     * bands run on the context queue.
+     */
+    void joinBands();
+    void forkBands();
+    
+    /**
+     * Wait for the work of every queue a step runs on
+     */
+    void finish();
+    
+    /**
+     * Record a step into command buffers where the device supports them
+     */
+    void recordStep();
+    
+    /**
+     * Step replayed from the recorded command buffers
+     */
+    SimDetail replayStep();
+    
+    /**
+     * Steps of the streamed solver
+     */
+    SimDetail streamStep();
+    
+    /**
+     * Pass every strip through the device slots, returns the largest
+     * eigenvalue of the new state. With steps 0 the strips are set to the
+     * initial condition instead of being uploaded and stepped.
+     */
+    float streamSweep(size_t steps, float dt);
+    
+    /**
+     * Wait for the strip in a slot to finish, returns its largest eigenvalue
+     */
+    float retireSlot(Slot& slot);
     
 private:
     CLUtils::CLcontext context;
@@ -113,32 +437,87 @@ private:
     size_t Nx;
     size_t Ny;
     
-    static const unsigned int N_RK  = 3;
     float gamma;
     float time;
     
     GLuint tex;
     
-    cl_kernel           compute_reconstruct;
-    cl_kernel           evaluate_flux;
-    cl_kernel           compute_RK;
-    cl_kernel           compute_eigenvalues;
-    cl_kernel           copy_domain;
+    // Step kernels are created per band from these
+    CLUtils::Program*   common_program;
+    CLUtils::Program*   boundary_program;
+    CLUtils::Program*   euler_program;
+    
     cl_kernel           prepare_render;
     cl_kernel           set_initial;
-    cl_kernel           set_boundary_x;
-    cl_kernel           set_boundary_y;
+    cl_kernel           reduce_diagnostics;
+    cl_kernel           extract_region;
+    cl_kernel           copy_rows;
+    cl_kernel           sample_probes;
+    
+    size_t              reduce_local;
+    size_t              reduce_groups;
     
-    CLUtils::MO<CL_MEM_READ_WRITE>*             Q_set[N_RK+1];
-    CLUtils::MO<CL_MEM_READ_WRITE>*             Sx_set;
-    CLUtils::MO<CL_MEM_READ_WRITE>*             Sy_set;
-    CLUtils::MO<CL_MEM_READ_WRITE>*             F_set;
-    CLUtils::MO<CL_MEM_READ_WRITE>*             G_set;
-    CLUtils::MO<CL_MEM_WRITE_ONLY>*             E_set;
+    std::vector<Band>   bands;
+    bool                large_indices;  // buffers past 32 bit element indices
+    bool                numa_bands;     // bands run on the sub-devices of their nodes
+    bool                huge_pages;
     
+    // Out-of-core mode, the state lives in mapped host memory, Nx*Ny float4
+    // without ghost cells, and is double buffered across a sweep
+    size_t              stream_rows;    // 0 when everything stays on the device
+    size_t              stream_steps;   // steps per strip visit
+    size_t              stream_halo;    // rows recomputed on both sides of a strip
+    float               stream_dt;
+    float*              host_state[2];
+    size_t              host_current;
+    std::vector<Slot>   slots;
+    cl_command_queue    upload_queue;
+    cl_command_queue    download_queue;
+    
+    // Split fluxes run on an out-of-order queue where the device has one
+    FluxMode            flux_mode;
+    cl_command_queue    flux_queue;
+    
+    ReadPath            read_path;
+    bool                shared_primitives;
+    FluxQuadrature      quadrature;
+    size_t              coarsening;
+    MemoryLayout        layout;
+    
+    // Host side probes when streaming
+    std::vector<glm::ivec2> probe_cells;
+    std::vector<glm::vec4>  probe_ring;
+    
+    // A step recorded up to the eigenvalues, then the boundaries and the
+    // kernels of every stage after dt is known. Apart so replays time the
+    // same kernels simulate() does. NULL without command buffers.
+    CLUtils::CommandBuffer*                     step_prepare;
+    CLUtils::CommandBuffer*                     step_bounds[N_RK];
+    CLUtils::CommandBuffer*                     step_stages[N_RK];
+    CLUtils::CommandBuffer*                     recording;
+    
+    cl_float                                    step_dt;
+    CLUtils::MO<CL_MEM_READ_ONLY>*              T_set;  // dt of the step
+    CLUtils::MO<CL_MEM_READ_WRITE>*             D_set;
+    CLUtils::MO<CL_MEM_READ_WRITE>*             X_set;  // packed region of one band, grown on demand
+    CLUtils::MO<CL_MEM_READ_ONLY>*              P_cells;
+    CLUtils::MO<CL_MEM_READ_WRITE>*             P_ring; // probes*capacity float4
+    
+    size_t              probes;
+    
+    // Every render_stride'th cell is shown when the grid exceeds the texture limit
     CLUtils::ImageBuffer<CL_MEM_READ_WRITE>*    R_tex;
+    size_t              render_stride;
+    
+    // Pinned host memory for readbacks, reused across steps
+    CLUtils::StagingPool*   pool;
+    
+    // Pool buffers for asynchronous downloads, borrowed for their lifetime
+    std::vector<float*>     staging_ptr;
+    std::vector<cl_event>   staging_event;
     
     Timer timer;
+    CLTimer* device_timer;
 };
 
 #endif
@@ -7,40 +7,112 @@
 //
 
 #include "SimulatorCLSW.h"
+#include "Trace.h"
+#include "Roofline.h"
+#include "Perf.h"
 #include <vector>
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtx/transform2.hpp>
 
+namespace {
+    /**
+     * First of the rows y0, y0+stride, ... at or past row
+     */
+    size_t firstRow(size_t y0, size_t stride, size_t row){
+        return row <= y0 ? 0 : (row - y0 + stride - 1)/stride;
+    }
+}
+
 SimulatorCLSW::SimulatorCLSW(cl_device_type device){
     this->gravity = 9.81f;
     this->time = 0;
     
+    this->X_set = NULL;
+    this->P_cells = NULL;
+    this->P_ring = NULL;
+    this->probes = 0;
+    this->large_indices = false;
+    this->render_stride = 1;
+    this->flux_mode = FLUX_AUTO;
+    this->flux_queue = NULL;
+    
+    this->common_program = NULL;
+    this->boundary_program = NULL;
+    this->SW_program = NULL;
+    this->step_prepare = NULL;
+    for (size_t n = 0; n < N_RK; n++) {
+        this->step_bounds[n] = NULL;
+        this->step_stages[n] = NULL;
+    }
+    this->recording = NULL;
+    this->step_dt = 0.0f;
+    this->T_set = NULL;
+    
     CLUtils::createContext(context,device);
+    
+    pool = new CLUtils::StagingPool(context);
+    device_timer = new CLTimer(context.queue);
 }
 
 SimulatorCLSW::~SimulatorCLSW(){
-    clReleaseKernel(compute_reconstruct);
-    clReleaseKernel(evaluate_flux);
-    clReleaseKernel(compute_RK);
-    clReleaseKernel(compute_eigenvalues);
-    clReleaseKernel(copy_domain);
     clReleaseKernel(prepare_render);
     clReleaseKernel(set_initial);
-    clReleaseKernel(set_boundary_x);
-    clReleaseKernel(set_boundary_y);
-    
-    delete Sx_set;
-    delete Sy_set;
-    delete F_set;
-    delete G_set;
-    delete E_set;
+    clReleaseKernel(reduce_diagnostics);
+    clReleaseKernel(extract_region);
+    clReleaseKernel(sample_probes);
+    
+    for (size_t b = 0; b < bands.size(); b++) {
+        for (size_t i = 0; i <= N_RK; i++) {
+            delete bands[b].Q[i];
+            clReleaseKernel(bands[b].bounds_x[i]);
+            clReleaseKernel(bands[b].bounds_y[i]);
+        }
+        for (size_t i = 0; i < N_RK; i++) {
+            clReleaseKernel(bands[b].reconstruct[i]);
+            clReleaseKernel(bands[b].flux[i]);
+            clReleaseKernel(bands[b].flux_x[i]);
+            clReleaseKernel(bands[b].flux_y[i]);
+            clReleaseKernel(bands[b].rk[i]);
+        }
+        clReleaseKernel(bands[b].copy);
+        clReleaseKernel(bands[b].eigenvalues);
+        delete bands[b].Sx;
+        delete bands[b].Sy;
+        delete bands[b].F;
+        delete bands[b].G;
+        delete bands[b].E;
+        delete bands[b].arena;
+    }
+    if (flux_queue != NULL) {
+        clReleaseCommandQueue(flux_queue);
+    }
+    delete step_prepare;
+    for (size_t n = 0; n < N_RK; n++) {
+        delete step_bounds[n];
+        delete step_stages[n];
+    }
+    delete common_program;
+    delete boundary_program;
+    delete SW_program;
+    
+    delete T_set;
+    delete D_set;
+    delete X_set;
+    delete P_cells;
+    delete P_ring;
     delete R_tex;
-    for (size_t i = 0; i <= N_RK; i++) {
-        delete Q_set[i];
+    for (size_t i = 0; i < staging_ptr.size(); i++) {
+        if (staging_event[i] != NULL) {
+            clWaitForEvents(1, &staging_event[i]);
+            clReleaseEvent(staging_event[i]);
+        }
     }
+    delete pool;
 
+    delete device_timer;
+    
     CLUtils::releaseContext(context);
 }
 
@@ -51,52 +123,90 @@ void SimulatorCLSW::init(size_t Nx, size_t Ny, std::string initialKernel){
     
     std::cout << "Simulating SW using OpenCL kernels on device: ";
     CLUtils::printDeviceInfo(context.device);
+    if (context.unified) {
+        std::cout << "Device shares host memory, buffers are mapped in place" << std::endl;
+    }
     
+    planBands();
     createKernels("dambreak");
     createBuffers();
     
     applyInitial();
+    pickFluxMode();
+    recordStep();
 }
 
 SimDetail SimulatorCLSW::simulate(){
-    setBoundary(Q_set[N_RK]);
-    copy(Q_set[N_RK], Q_set[0]);
+    // Replays leave no events per kernel, so not while those are wanted
+    if (step_prepare != NULL && !Trace::enabled() && !Trace::counting() && !Perf::enabled()) {
+        return replayStep();
+    }
+    
+    // Phases only split the step when hardware counters are read
+    {
+        PERF_PHASE("setBounds", context.queue);
+        setBoundary(N_RK);
+    }
+    {
+        PERF_PHASE("copy", context.queue);
+        copy();
+    }
 
-    float dt = computeDt(Q_set[0]);
+    float dt;
+    {
+        PERF_PHASE("computeDt", context.queue);
+        dt = computeDt();
+        setTimestep(dt);
+    }
     
     timer.restart();
+    device_timer->begin();
     SimDetail detail;
     detail.sim_time = 0.0f;
     
     for (size_t n = 1; n <= N_RK; n++) {
         // apply boundary condition
-        setBoundary(Q_set[n-1]);
+        {
+            PERF_PHASE("setBounds", context.queue);
+            setBoundary(n-1);
+        }
         
         timer.restart();
         
         // reconstruct point values
-        reconstruct(Q_set[n-1]);
-        clFinish(context.queue);
+        {
+            PERF_PHASE("piecewiseReconstruction", context.queue);
+            reconstruct(n-1);
+            clFinish(context.queue);
+        }
         
         detail.sim_time += timer.elapsedAndRestart();
         
         // evaluate fluxes
-        evaluateFluxes(Q_set[n-1]);
-        clFinish(context.queue);
+        {
+            PERF_PHASE("computeNumericalFlux", context.queue);
+            evaluateFluxes(n-1);
+            clFinish(context.queue);
+        }
         
         detail.sim_time += timer.elapsedAndRestart();
         
         // compute RK
-        computeRK(n, dt);
-        clFinish(context.queue);
+        {
+            PERF_PHASE("computeRK", context.queue);
+            computeRK(n);
+            clFinish(context.queue);
+        }
         
         detail.sim_time += timer.elapsed();
     }
     
+    device_timer->end();
     clFinish(context.queue);
     
     //detail.sim_time = timer.elapsed();
     detail.dt = dt;
+    detail.steps = 1;
     time+=dt;
     detail.time = time;
     
@@ -106,11 +216,31 @@ SimDetail SimulatorCLSW::simulate(){
 size_t SimulatorCLSW::getTexture(){
     cl_int err = CL_SUCCESS;
     
-    err |= clSetKernelArg(prepare_render, 0, sizeof(cl_mem), &Q_set[N_RK]->getRef());
+    cl_uint stride = render_stride;
+    size_t width = (Nx+render_stride-1)/render_stride;
+    
     err |= clSetKernelArg(prepare_render, 1, sizeof(cl_image), &(R_tex->getRef()));
+    err |= clSetKernelArg(prepare_render, 2, sizeof(cl_uint), &stride);
     
-    size_t global[] = {Nx,Ny};
-    err |= clEnqueueNDRangeKernel(context.queue, prepare_render, 2, NULL, global, NULL, 0, NULL, NULL);
+    for (size_t b = 0; b < bands.size(); b++) {
+        // Texel rows whose source row lies in this band
+        size_t first = firstRow(0, render_stride, bands[b].y0);
+        size_t last  = firstRow(0, render_stride, bands[b].y0+bands[b].rows);
+        if (first == last) {
+            continue;
+        }
+        
+        cl_uint src_row = first*render_stride - bands[b].y0;
+        cl_uint tex_row = first;
+        
+        err |= clSetKernelArg(prepare_render, 0, sizeof(cl_mem), &(bands[b].Q[N_RK]->getRef()));
+        err |= clSetKernelArg(prepare_render, 3, sizeof(cl_uint), &src_row);
+        err |= clSetKernelArg(prepare_render, 4, sizeof(cl_uint), &tex_row);
+        
+        size_t global[] = {width, last-first};
+        err |= clEnqueueNDRangeKernel(context.queue, prepare_render, 2, NULL, global, NULL, 0, NULL,
+                                      Trace::command("copyToTexture", context.queue));
+    }
     if(err != CL_SUCCESS) {
         std::stringstream ss;
         ss << "Failed to prepare render! Error: " << err;
@@ -121,114 +251,649 @@ size_t SimulatorCLSW::getTexture(){
 }
 
 std::vector<float> SimulatorCLSW::getData(){
-    THROW_EXCEPTION("Not implemented");
+    return getRegion(0, 0, Nx, Ny);
+}
+
+std::vector<float> SimulatorCLSW::getRegion(size_t x0, size_t y0, size_t w, size_t h,
+                                        size_t stride, unsigned int fields){
+    glm::ivec2 size = regionSize(x0, y0, w, h, stride, fields);
+    size_t n = fieldCount(fields);
+    std::vector<float> data((size_t)size.x*size.y*n);
+    
+    cl_int err = CL_SUCCESS;
+    
+    for (size_t b = 0; b < bands.size(); b++) {
+        const Band& band = bands[b];
+        
+        // Output rows taken from this band
+        size_t first = firstRow(y0, stride, band.y0);
+        size_t last  = glm::min(firstRow(y0, stride, band.y0+band.rows), (size_t)size.y);
+        if (first >= last) {
+            continue;
+        }
+        float* out = data.data() + first*size.x*n;
+        
+        if (stride == 1 && fields == FIELD_ALL) {
+            // Plain subrectangle, copied straight out of the ghost-padded buffer
+            size_t buffer_origin[]  = {(x0+2)*sizeof(cl_float4), y0+first-band.y0+2, 0};
+            size_t host_origin[]    = {0, 0, 0};
+            size_t region[]         = {w*sizeof(cl_float4), last-first, 1};
+            
+            err |= clEnqueueReadBufferRect(context.queue, band.Q[N_RK]->getRef(), CL_TRUE,
+                                           buffer_origin, host_origin, region,
+                                           (Nx+4)*sizeof(cl_float4), 0, w*sizeof(cl_float4), 0,
+                                           out, 0, NULL, Trace::command("read region", context.queue));
+        } else {
+            // Gather on the device so only the selected values cross the bus
+            size_t bytes = (last-first)*size.x*n*sizeof(cl_float);
+            if (X_set == NULL || X_set->size() < bytes) {
+                delete X_set;
+                X_set = new CLUtils::MO<CL_MEM_READ_WRITE>(context, bytes, NULL, "region");
+            }
+            
+            cl_uint origin_x = x0;
+            cl_uint origin_y = y0 + first*stride - band.y0;
+            cl_uint step = stride;
+            cl_uint mask = fields;
+            
+            err |= clSetKernelArg(extract_region, 0, sizeof(cl_mem), &(band.Q[N_RK]->getRef()));
+            err |= clSetKernelArg(extract_region, 1, sizeof(cl_mem), &(X_set->getRef()));
+            err |= clSetKernelArg(extract_region, 2, sizeof(cl_uint), &origin_x);
+            err |= clSetKernelArg(extract_region, 3, sizeof(cl_uint), &origin_y);
+            err |= clSetKernelArg(extract_region, 4, sizeof(cl_uint), &step);
+            err |= clSetKernelArg(extract_region, 5, sizeof(cl_uint), &mask);
+            
+            size_t global[] = {(size_t)size.x, last-first};
+            err |= clEnqueueNDRangeKernel(context.queue, extract_region, 2,
+                                          NULL, global, NULL, 0, NULL, Trace::command("extractRegion", context.queue));
+            err |= clEnqueueReadBuffer(context.queue, X_set->getRef(), CL_TRUE, 0,
+                                       bytes, out, 0, NULL, Trace::command("read region", context.queue));
+        }
+    }
+    
+    if(err != CL_SUCCESS) {
+        std::stringstream ss;
+        ss << "Failed to read region! Error: " << err;
+        THROW_EXCEPTION(ss.str().c_str());
+    }
+    
+    return data;
+}
+
+void SimulatorCLSW::createStaging(size_t slots){
+    for (size_t i = 0; i < slots; i++) {
+        staging_ptr.push_back((float*)pool->borrow(Nx*Ny*sizeof(cl_float4)));
+        staging_event.push_back(NULL);
+    }
+}
+
+void SimulatorCLSW::beginDownload(size_t slot){
+    cl_int err = CL_SUCCESS;
+    
+    // Strip the ghost cells while copying into the pinned slot. The queue is
+    // in order, so the last band's event covers all of them.
+    for (size_t b = 0; b < bands.size(); b++) {
+        size_t buffer_origin[]  = {2*sizeof(cl_float4), 2, 0};
+        size_t host_origin[]    = {0, 0, 0};
+        size_t region[]         = {Nx*sizeof(cl_float4), bands[b].rows, 1};
+        
+        bool last = b+1 == bands.size();
+        err |= clEnqueueReadBufferRect(context.queue, bands[b].Q[N_RK]->getRef(), CL_FALSE,
+                                       buffer_origin, host_origin, region,
+                                       (Nx+4)*sizeof(cl_float4), 0, Nx*sizeof(cl_float4), 0,
+                                       staging_ptr[slot] + bands[b].y0*Nx*4, 0, NULL,
+                                       last ? &staging_event[slot] : NULL);
+    }
+    clFlush(context.queue);
+    Trace::retain("download", context.queue, staging_event[slot]);
+    
+    if(err != CL_SUCCESS) {
+        std::stringstream ss;
+        ss << "Failed to start download! Error: " << err;
+        THROW_EXCEPTION(ss.str().c_str());
+    }
+}
+
+const float* SimulatorCLSW::pollDownload(size_t slot){
+    cl_int status;
+    cl_int err = clGetEventInfo(staging_event[slot], CL_EVENT_COMMAND_EXECUTION_STATUS,
+                                sizeof(cl_int), &status, NULL);
+    
+    if(err != CL_SUCCESS || status < 0) {
+        std::stringstream ss;
+        ss << "Download failed! Error: " << (err != CL_SUCCESS ? err : status);
+        THROW_EXCEPTION(ss.str().c_str());
+    }
+    
+    if (status != CL_COMPLETE) {
+        return NULL;
+    }
+    
+    clReleaseEvent(staging_event[slot]);
+    staging_event[slot] = NULL;
+    
+    return staging_ptr[slot];
+}
+
+void SimulatorCLSW::endDownload(size_t slot){
+    // Slot stays mapped, nothing to hand back to the driver
+}
+
+SimDiagnostics SimulatorCLSW::getDiagnostics(){
+    cl_int err = CL_SUCCESS;
+    
+    err |= clSetKernelArg(reduce_diagnostics, 1, sizeof(cl_mem), &(D_set->getRef()));
+    err |= clSetKernelArg(reduce_diagnostics, 2, reduce_local*sizeof(cl_float4), NULL);
+    err |= clSetKernelArg(reduce_diagnostics, 3, reduce_local*sizeof(cl_float4), NULL);
+    err |= clSetKernelArg(reduce_diagnostics, 4, reduce_local*sizeof(cl_float4), NULL);
+    
+    // Every band fills its own run of groups
+    for (size_t b = 0; b < bands.size(); b++) {
+        cl_uint rows = bands[b].rows;
+        cl_uint first_group = b*reduce_groups;
+        
+        err |= clSetKernelArg(reduce_diagnostics, 0, sizeof(cl_mem), &(bands[b].Q[N_RK]->getRef()));
+        err |= clSetKernelArg(reduce_diagnostics, 5, sizeof(cl_uint), &rows);
+        err |= clSetKernelArg(reduce_diagnostics, 6, sizeof(cl_uint), &first_group);
+        
+        size_t global[] = {reduce_groups*reduce_local};
+        size_t local[]  = {reduce_local};
+        err |= clEnqueueNDRangeKernel(context.queue, reduce_diagnostics, 1,
+                                      NULL, global, local, 0, NULL, Trace::command("reduceDiagnostics", context.queue));
+    }
+    
+    size_t groups = reduce_groups*bands.size();
+    std::vector<glm::vec4> partial(3*groups);
+    err |= clEnqueueReadBuffer(context.queue, D_set->getRef(), CL_TRUE, 0,
+                               3*groups*sizeof(cl_float4), partial.data(), 0, NULL, Trace::command("read diagnostics", context.queue));
+    
+    if(err != CL_SUCCESS) {
+        std::stringstream ss;
+        ss << "Failed to reduce diagnostics! Error: " << err;
+        THROW_EXCEPTION(ss.str().c_str());
+    }
+    
+    SimDiagnostics diag;
+    diag.sum = glm::vec4(0.0f);
+    diag.min = glm::vec4( std::numeric_limits<float>().max());
+    diag.max = glm::vec4(-std::numeric_limits<float>().max());
+    for (size_t g = 0; g < groups; g++) {
+        diag.sum += partial[3*g+0];
+        diag.min = glm::min(diag.min, partial[3*g+1]);
+        diag.max = glm::max(diag.max, partial[3*g+2]);
+    }
+    
+    return diag;
+}
+
+std::vector<KernelProfile> SimulatorCLSW::getKernelProfile(){
+    // Per work-item bytes and flops, boundary items fix a ghost cell pair
+    // on both sides. Items are per launch, a launch covers one band of R
+    // rows on average.
+    size_t L = bands.size();
+    size_t R = Ny/L;
+    size_t T = ((Nx+render_stride-1)/render_stride)*((Ny+render_stride-1)/render_stride);
+    KernelProfile kernels[] = {
+        {"setBoundsX",              Nx,                 96.0,   0.0,  0, 0.0},
+        {"setBoundsY",              R,                  96.0,   0.0,  0, 0.0},
+        {"copy",                    (Nx+4)*(R+4),       32.0,   0.0,  0, 0.0},
+        {"eigenvalue",              Nx*R,               20.0,  12.0,  0, 0.0},
+        {"piecewiseReconstruction", (Nx+2)*(R+2),       48.0,  48.0,  0, 0.0},
+        {"computeNumericalFlux",    (Nx+1)*(R+1),       80.0, 350.0,  0, 0.0},
+        {"computeNumericalFluxX",   (Nx+1)*R,           64.0, 175.0,  0, 0.0},
+        {"computeNumericalFluxY",   Nx*(R+1),           64.0, 175.0,  0, 0.0},
+        {"computeRK",               Nx*R,               80.0,  44.0,  0, 0.0},
+        {"copyToTexture",           T/L,                32.0,   0.0,  0, 0.0}
+    };
+    
+    std::vector<KernelProfile> profile;
+    for (size_t i = 0; i < sizeof(kernels)/sizeof(kernels[0]); i++) {
+        // Only the flux kernels of the mode in use
+        bool split = kernels[i].name.size() > 20 && kernels[i].name.compare(0, 20, "computeNumericalFlux") == 0;
+        if (kernels[i].name.compare(0, 20, "computeNumericalFlux") != 0 || split == (flux_mode == FLUX_SPLIT)) {
+            profile.push_back(kernels[i]);
+        }
+    }
+    Roofline::attachStats(profile);
+    return profile;
+}
+
+double SimulatorCLSW::measureBandwidth(){
+    return Roofline::streamCL(context);
+}
+
+void SimulatorCLSW::createProbes(const std::vector<glm::ivec2>& cells, size_t capacity){
+    glm::ivec2 size = getGridSize();
+    for (size_t i = 0; i < cells.size(); i++) {
+        if (cells[i].x < 0 || cells[i].y < 0 || cells[i].x >= size.x || cells[i].y >= size.y) {
+            THROW_EXCEPTION("Probe outside of domain");
+        }
+    }
+    
+    delete P_cells;
+    delete P_ring;
+    P_cells = NULL;
+    P_ring = NULL;
+    
+    probes = cells.size();
+    if (probes == 0 || capacity == 0) {
+        return;
+    }
+    
+    // Cells grouped by band, each keeps its probe number for the ring slot
+    std::vector<cl_int4> data;
+    for (size_t b = 0; b < bands.size(); b++) {
+        bands[b].probe_first = data.size();
+        for (size_t i = 0; i < probes; i++) {
+            size_t y = cells[i].y;
+            if (y >= bands[b].y0 && y < bands[b].y0+bands[b].rows) {
+                cl_int4 cell;
+                cell.s[0] = cells[i].x;
+                cell.s[1] = y - bands[b].y0;
+                cell.s[2] = i;
+                cell.s[3] = 0;
+                data.push_back(cell);
+            }
+        }
+        bands[b].probe_count = data.size() - bands[b].probe_first;
+    }
+    
+    P_cells = new CLUtils::MO<CL_MEM_READ_ONLY>(context, probes*sizeof(cl_int4), NULL, "probes");
+    P_cells->upload(data.data());
+    P_ring  = new CLUtils::MO<CL_MEM_READ_WRITE>(context, probes*capacity*sizeof(cl_float4), NULL, "probes");
+}
+
+void SimulatorCLSW::sampleProbes(size_t slot){
+    cl_int err = CL_SUCCESS;
+    cl_uint ring_slot = slot;
+    cl_uint count = probes;
+    
+    err |= clSetKernelArg(sample_probes, 1, sizeof(cl_mem), &(P_cells->getRef()));
+    err |= clSetKernelArg(sample_probes, 2, sizeof(cl_mem), &(P_ring->getRef()));
+    err |= clSetKernelArg(sample_probes, 3, sizeof(cl_uint), &ring_slot);
+    err |= clSetKernelArg(sample_probes, 4, sizeof(cl_uint), &count);
+    
+    for (size_t b = 0; b < bands.size(); b++) {
+        if (bands[b].probe_count == 0) {
+            continue;
+        }
+        cl_uint first = bands[b].probe_first;
+        
+        err |= clSetKernelArg(sample_probes, 0, sizeof(cl_mem), &(bands[b].Q[N_RK]->getRef()));
+        err |= clSetKernelArg(sample_probes, 5, sizeof(cl_uint), &first);
+        
+        size_t global[] = {bands[b].probe_count};
+        err |= clEnqueueNDRangeKernel(context.queue, sample_probes, 1,
+                                      NULL, global, NULL, 0, NULL, Trace::command("sampleProbes", context.queue));
+    }
+    
+    if(err != CL_SUCCESS) {
+        std::stringstream ss;
+        ss << "Failed to sample probes! Error: " << err;
+        THROW_EXCEPTION(ss.str().c_str());
+    }
+}
+
+void SimulatorCLSW::readProbes(size_t first, size_t count, float* out){
+    // Slots are contiguous, so a run of them is a single read
+    cl_int err = clEnqueueReadBuffer(context.queue, P_ring->getRef(), CL_TRUE,
+                                     first*probes*sizeof(cl_float4), count*probes*sizeof(cl_float4),
+                                     out, 0, NULL, Trace::command("read probes", context.queue));
+    
+    if(err != CL_SUCCESS) {
+        std::stringstream ss;
+        ss << "Failed to read probes! Error: " << err;
+        THROW_EXCEPTION(ss.str().c_str());
+    }
+}
+
+void SimulatorCLSW::planBands(){
+    // Rows of Nx+4 float4 that fit in one allocation, less the ghost rows
+    cl_ulong max_alloc = 0;
+    clGetDeviceInfo(context.device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(cl_ulong), &max_alloc, NULL);
+    size_t row_bytes = (Nx+4)*sizeof(cl_float4);
+    size_t max_rows = max_alloc/row_bytes > 4 ? max_alloc/row_bytes - 4 : 0;
+    
+    // Seams copy two rows each way, so every band needs at least two
+    size_t count = max_rows > 0 ? (Ny+max_rows-1)/max_rows : 0;
+    if (count == 0 || Ny/count < 2) {
+        THROW_EXCEPTION("Grid rows do not fit in device allocations");
+    }
+    
+    // Rows spread evenly, the first Ny%count bands get one more
+    bands.resize(count);
+    size_t y0 = 0;
+    for (size_t b = 0; b < count; b++) {
+        bands[b].y0     = y0;
+        bands[b].rows   = Ny/count + (b < Ny%count ? 1 : 0);
+        bands[b].sides  = (b == 0 ? 1 : 0) | (b+1 == count ? 2 : 0);
+        bands[b].probe_first = 0;
+        bands[b].probe_count = 0;
+        y0 += bands[b].rows;
+    }
+    
+    // Float indices into the widest band, the gather buffer included
+    size_t elements = (Nx+4)*(bands[0].rows+4)*4;
+    large_indices = elements > 0xFFFFFFFFul;
+    
+    if (count > 1 || large_indices) {
+        std::cout << "Large grid: " << count << " band(s) of up to " << bands[0].rows << " rows"
+                  << (large_indices ? ", 64 bit indices" : "") << std::endl;
+    }
 }
 
 void SimulatorCLSW::createBuffers(){
-    // Initialize all buffers with 2 ghost cell on each edge
-    for (size_t i = 0; i <= N_RK; i++) {
-        Q_set[i] = new CLUtils::MO<CL_MEM_READ_WRITE>(context, (Nx+4)*(Ny+4)*sizeof(cl_float4), NULL);
+    // Bound to the RK kernels of every band
+    T_set = new CLUtils::MO<CL_MEM_READ_ONLY>(context, sizeof(cl_float), NULL, "timestep");
+    
+    if (flux_mode != FLUX_FUSED) {
+        // Without out-of-order execution the split kernels still run, one
+        // after the other
+        cl_command_queue_properties props = 0;
+        clGetDeviceInfo(context.device, CL_DEVICE_QUEUE_PROPERTIES, sizeof(props), &props, NULL);
+        props &= CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE;
+        
+        cl_int err;
+        flux_queue = clCreateCommandQueue(context.context, context.device, props | CL_QUEUE_PROFILING_ENABLE, &err);
+        if(err != CL_SUCCESS){
+            THROW_EXCEPTION("Failed to initialize flux queue");
+        }
+    }
+    
+    // Initialize all buffers with 2 ghost cell on each edge, carved out of
+    // one allocation per band where the device allows it
+    for (size_t b = 0; b < bands.size(); b++) {
+        Band& band = bands[b];
+        size_t cells = (Nx+4)*(band.rows+4);
+        band.arena = new CLUtils::Arena(context, 0);
+        band.arena->reserve(N_RK+5, cells*sizeof(cl_float4));
+        for (size_t i = 0; i <= N_RK; i++) {
+            band.Q[i] = new CLUtils::MO<CL_MEM_READ_WRITE>(*band.arena, cells*sizeof(cl_float4), "state");
+        }
+        band.F  = new CLUtils::MO<CL_MEM_READ_WRITE>(*band.arena, cells*sizeof(cl_float4), "fluxes");
+        band.G  = new CLUtils::MO<CL_MEM_READ_WRITE>(*band.arena, cells*sizeof(cl_float4), "fluxes");
+        
+        // Eigenvalues are read back before the stages reconstruct, so they
+        // share the slopes' memory
+        CLUtils::Arena::Mark slopes = band.arena->mark();
+        band.Sx = new CLUtils::MO<CL_MEM_READ_WRITE>(*band.arena, cells*sizeof(cl_float4), "slopes");
+        band.Sy = new CLUtils::MO<CL_MEM_READ_WRITE>(*band.arena, cells*sizeof(cl_float4), "slopes");
+        band.arena->rewind(slopes);
+        band.E  = new CLUtils::MO<CL_MEM_WRITE_ONLY>(*band.arena, cells*sizeof(cl_float), NULL);
+        
+        bindKernels(band);
     }
-    Sx_set = new CLUtils::MO<CL_MEM_READ_WRITE>(context, (Nx+4)*(Ny+4)*sizeof(cl_float4), NULL);
-    Sy_set = new CLUtils::MO<CL_MEM_READ_WRITE>(context, (Nx+4)*(Ny+4)*sizeof(cl_float4), NULL);
-    F_set  = new CLUtils::MO<CL_MEM_READ_WRITE>(context, (Nx+4)*(Ny+4)*sizeof(cl_float4), NULL);
-    G_set  = new CLUtils::MO<CL_MEM_READ_WRITE>(context, (Nx+4)*(Ny+4)*sizeof(cl_float4), NULL);
-    E_set  = new CLUtils::MO<CL_MEM_WRITE_ONLY>(context, (Nx+4)*(Ny+4)*sizeof(cl_float), NULL);
     
-    // We dont need to visualize ghost cells
-    R_tex  = new CLUtils::ImageBuffer<CL_MEM_READ_WRITE>(context, tex, (Nx), (Ny), NULL);
+    // Sum, min and max per reduction work-group
+    D_set  = new CLUtils::MO<CL_MEM_READ_WRITE>(context, 3*reduce_groups*bands.size()*sizeof(cl_float4), NULL, "diagnostics");
+    
+    // We dont need to visualize ghost cells, and show every few cells of
+    // grids larger than a texture
+    GLint max_tex = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_tex);
+    render_stride = 1;
+    if (max_tex > 0) {
+        render_stride = glm::max((Nx+max_tex-1)/max_tex, (Ny+max_tex-1)/max_tex);
+        render_stride = glm::max(render_stride, (size_t)1);
+    }
+    R_tex  = new CLUtils::ImageBuffer<CL_MEM_READ_WRITE>(context, tex, (Nx+render_stride-1)/render_stride,
+                                                         (Ny+render_stride-1)/render_stride, NULL, "render texture");
 }
 
 void SimulatorCLSW::createKernels(std::string initial){
     std::stringstream ss;
     ss << "-D Nx=" << Nx << " -D Ny=" << Ny;
+    if (large_indices) {
+        ss << " -D LARGE_GRID";
+    }
     std::string options = ss.str();
     
-    CLUtils::Program* common    = new CLUtils::Program(context, "res/kernels/common.cl", &options);
-    CLUtils::Program* boundary  = new CLUtils::Program(context, "res/kernels/boundary.cl", &options);
+    common_program      = new CLUtils::Program(context, "res/kernels/common.cl", &options);
+    boundary_program    = new CLUtils::Program(context, "res/kernels/boundary.cl", &options);
+    SW_program          = new CLUtils::Program(context, "res/kernels/SW.cl", &options);
     CLUtils::Program* initialp  = new CLUtils::Program(context, "res/kernels/initial.cl", &options);
-    CLUtils::Program* SW        = new CLUtils::Program(context, "res/kernels/SW.cl", &options);
+    CLUtils::Program* reduce    = new CLUtils::Program(context, "res/kernels/reduce.cl", &options);
     
     
-    compute_reconstruct = common->createKernel("piecewiseReconstruction");
-    evaluate_flux       = SW->createKernel("computeNumericalFlux");
-    compute_RK          = common->createKernel("computeRK");
-    compute_eigenvalues = SW->createKernel("eigenvalue");
-    copy_domain         = common->createKernel("copy");
-    prepare_render      = common->createKernel("copyToTexture");
+    prepare_render      = common_program->createKernel("copyToTexture");
+    extract_region      = common_program->createKernel("extractRegion");
+    sample_probes       = common_program->createKernel("sampleProbes");
     set_initial         = initialp->createKernel(initial);
-    set_boundary_x      = boundary->createKernel("setBoundsX");
-    set_boundary_y      = boundary->createKernel("setBoundsY");
-}
-
-void SimulatorCLSW::applyInitial(){
-    cl_int err = CL_SUCCESS;
+    reduce_diagnostics  = reduce->createKernel("reduceDiagnostics");
     
+    // Arguments that stay the same for the whole run
+    cl_int err = CL_SUCCESS;
     err |= clSetKernelArg(set_initial, 0, sizeof(cl_float), &gravity);
     err |= clSetKernelArg(set_initial, 1, sizeof(cl_float2),
                           glm::value_ptr(glm::vec2((1.0f/(float)Nx),(1.0f/(float)Ny))));
-    err |= clSetKernelArg(set_initial, 2, sizeof(cl_mem), &(Q_set[N_RK]->getRef()));
+    if(err != CL_SUCCESS) {
+        std::stringstream ss;
+        ss << "Failed to bind kernels! Error: " << err;
+        THROW_EXCEPTION(ss.str().c_str());
+    }
     
-    size_t global[] = {Nx,Ny};
-    err |= clEnqueueNDRangeKernel(context.queue, set_initial, 2, NULL, global, NULL, 0, NULL, NULL);
+    // Largest power of two work-group the reduction can run with, capped at 256
+    size_t max_local = 1;
+    clGetKernelWorkGroupInfo(reduce_diagnostics, context.device, CL_KERNEL_WORK_GROUP_SIZE,
+                             sizeof(size_t), &max_local, NULL);
+    reduce_local = 1;
+    while (reduce_local*2 <= glm::min(max_local, (size_t)256)) {
+        reduce_local *= 2;
+    }
+    reduce_groups = 64;
+}
+
+void SimulatorCLSW::bindKernels(Band& band){
+    static const glm::vec2 c[3][3] =
+    {
+        {glm::vec2(0.0f,1.0f),
+            glm::vec2(0.0f,0.0f),
+            glm::vec2(0.0f,0.0f)},
+        
+        {glm::vec2(0.0f,1.0f),
+            glm::vec2(0.5f,0.5f),
+            glm::vec2(0.0f,0.0f)},
+        
+        {glm::vec2(0.0f,1.0f),
+            glm::vec2(0.75f,0.25f),
+            glm::vec2(0.333f,0.666f)}
+    };
+    glm::vec2 dXY = glm::vec2((1.0f/(float)Nx),(1.0f/(float)Ny));
+    cl_uint rows = band.rows;
+    
+    // One kernel object per stage, so a step only has to enqueue them
+    cl_int err = CL_SUCCESS;
+    for (size_t n = 0; n <= N_RK; n++) {
+        band.bounds_x[n] = boundary_program->createKernel("setBoundsX");
+        err |= clSetKernelArg(band.bounds_x[n], 0, sizeof(cl_mem), &(band.Q[n]->getRef()));
+        err |= clSetKernelArg(band.bounds_x[n], 1, sizeof(cl_uint), &rows);
+        err |= clSetKernelArg(band.bounds_x[n], 2, sizeof(cl_uint), &band.sides);
+        
+        band.bounds_y[n] = boundary_program->createKernel("setBoundsY");
+        err |= clSetKernelArg(band.bounds_y[n], 0, sizeof(cl_mem), &(band.Q[n]->getRef()));
+    }
+    
+    for (size_t n = 0; n < N_RK; n++) {
+        band.reconstruct[n] = common_program->createKernel("piecewiseReconstruction");
+        err |= clSetKernelArg(band.reconstruct[n], 0, sizeof(cl_mem), &(band.Q[n]->getRef()));
+        err |= clSetKernelArg(band.reconstruct[n], 1, sizeof(cl_mem), &(band.Sx->getRef()));
+        err |= clSetKernelArg(band.reconstruct[n], 2, sizeof(cl_mem), &(band.Sy->getRef()));
+        
+        band.flux[n] = SW_program->createKernel("computeNumericalFlux");
+        err |= clSetKernelArg(band.flux[n], 0, sizeof(cl_mem), &(band.Q[n]->getRef()));
+        err |= clSetKernelArg(band.flux[n], 1, sizeof(cl_mem), &(band.Sx->getRef()));
+        err |= clSetKernelArg(band.flux[n], 2, sizeof(cl_mem), &(band.Sy->getRef()));
+        err |= clSetKernelArg(band.flux[n], 3, sizeof(cl_float), &gravity);
+        err |= clSetKernelArg(band.flux[n], 4, sizeof(cl_mem), &(band.F->getRef()));
+        err |= clSetKernelArg(band.flux[n], 5, sizeof(cl_mem), &(band.G->getRef()));
+        
+        band.flux_x[n] = SW_program->createKernel("computeNumericalFluxX");
+        band.flux_y[n] = SW_program->createKernel("computeNumericalFluxY");
+        cl_kernel split[] = {band.flux_x[n], band.flux_y[n]};
+        CLUtils::MO<CL_MEM_READ_WRITE>* out[] = {band.F, band.G};
+        for (size_t d = 0; d < 2; d++) {
+            err |= clSetKernelArg(split[d], 0, sizeof(cl_mem), &(band.Q[n]->getRef()));
+            err |= clSetKernelArg(split[d], 1, sizeof(cl_mem), &(band.Sx->getRef()));
+            err |= clSetKernelArg(split[d], 2, sizeof(cl_mem), &(band.Sy->getRef()));
+            err |= clSetKernelArg(split[d], 3, sizeof(cl_float), &gravity);
+            err |= clSetKernelArg(split[d], 4, sizeof(cl_mem), &(out[d]->getRef()));
+        }
+        
+        band.rk[n] = common_program->createKernel("computeRK");
+        err |= clSetKernelArg(band.rk[n], 0, sizeof(cl_mem), &(band.Q[0]->getRef()));
+        err |= clSetKernelArg(band.rk[n], 1, sizeof(cl_mem), &(band.Q[n]->getRef()));
+        err |= clSetKernelArg(band.rk[n], 2, sizeof(cl_mem), &(band.F->getRef()));
+        err |= clSetKernelArg(band.rk[n], 3, sizeof(cl_mem), &(band.G->getRef()));
+        err |= clSetKernelArg(band.rk[n], 4, sizeof(cl_float2), glm::value_ptr(c[N_RK-1][n]));
+        err |= clSetKernelArg(band.rk[n], 5, sizeof(cl_float2), glm::value_ptr(dXY));
+        err |= clSetKernelArg(band.rk[n], 6, sizeof(cl_mem), &(T_set->getRef()));
+        err |= clSetKernelArg(band.rk[n], 7, sizeof(cl_mem), &(band.Q[n+1]->getRef()));
+    }
+    
+    band.copy = common_program->createKernel("copy");
+    err |= clSetKernelArg(band.copy, 0, sizeof(cl_mem), &(band.Q[N_RK]->getRef()));
+    err |= clSetKernelArg(band.copy, 1, sizeof(cl_mem), &(band.Q[0]->getRef()));
+    
+    band.eigenvalues = SW_program->createKernel("eigenvalue");
+    err |= clSetKernelArg(band.eigenvalues, 0, sizeof(cl_mem), &(band.Q[N_RK]->getRef()));
+    err |= clSetKernelArg(band.eigenvalues, 1, sizeof(cl_float), &gravity);
+    err |= clSetKernelArg(band.eigenvalues, 2, sizeof(cl_mem), &(band.E->getRef()));
     
     if(err != CL_SUCCESS) {
         std::stringstream ss;
-        ss << "Failed to apply initial condition! Error: " << err;
+        ss << "Failed to bind kernels! Error: " << err;
         THROW_EXCEPTION(ss.str().c_str());
     }
 }
 
-void SimulatorCLSW::setBoundary(CLUtils::MO<CL_MEM_READ_WRITE>* Qn){
+void SimulatorCLSW::applyInitial(){
     cl_int err = CL_SUCCESS;
     
-    err |= clSetKernelArg(set_boundary_x, 0, sizeof(cl_mem), &(Qn->getRef()));
-    size_t globalx[] = {Nx};
-    err |= clEnqueueNDRangeKernel(context.queue, set_boundary_x,
-                                  1, NULL, globalx, NULL, 0, NULL, NULL);
+    for (size_t b = 0; b < bands.size(); b++) {
+        cl_uint y_offset = bands[b].y0;
+        err |= clSetKernelArg(set_initial, 2, sizeof(cl_mem), &(bands[b].Q[N_RK]->getRef()));
+        err |= clSetKernelArg(set_initial, 3, sizeof(cl_uint), &y_offset);
+        
+        size_t global[] = {Nx,bands[b].rows};
+        err |= clEnqueueNDRangeKernel(context.queue, set_initial, 2, NULL, global, NULL, 0, NULL,
+                                      Trace::command("initial", context.queue));
+    }
+    
+    if(err != CL_SUCCESS) {
+        std::stringstream ss;
+        ss << "Failed to apply initial condition! Error: " << err;
+        THROW_EXCEPTION(ss.str().c_str());
+    }
+}
+
+void SimulatorCLSW::setBoundary(size_t n){
+    cl_int err = CL_SUCCESS;
     
-    err |= clSetKernelArg(set_boundary_y, 0, sizeof(cl_mem), &(Qn->getRef()));
-    size_t globaly[] = {Ny};
-    err |= clEnqueueNDRangeKernel(context.queue, set_boundary_y,
-                                  1, NULL, globaly, NULL, 0, NULL, NULL);
+    for (size_t b = 0; b < bands.size(); b++) {
+        if (bands[b].sides != 0) {
+            size_t globalx[] = {Nx};
+            err |= launch(bands[b].bounds_x[n], 1, NULL, globalx, "setBoundsX");
+        }
+        
+        size_t globaly[] = {bands[b].rows};
+        err |= launch(bands[b].bounds_y[n], 1, NULL, globaly, "setBoundsY");
+    }
     
     if(err != CL_SUCCESS) {
         std::stringstream ss;
         ss << "Failed to set boundary! Error: " << err;
         THROW_EXCEPTION(ss.str().c_str());
     }
+    
+    exchangeHalos(n);
 }
 
-float SimulatorCLSW::computeDt(CLUtils::MO<CL_MEM_READ_WRITE>* Qn){
+void SimulatorCLSW::exchangeHalos(size_t n){
     cl_int err = CL_SUCCESS;
-    static const float CFL = 0.8f;
     
-    err |= clSetKernelArg(compute_eigenvalues, 0, sizeof(cl_mem), &(Qn->getRef()));
-    err |= clSetKernelArg(compute_eigenvalues, 1, sizeof(cl_float), &gravity);
-    err |= clSetKernelArg(compute_eigenvalues, 2, sizeof(cl_mem), &(E_set->getRef()));
+    // Whole rows, so the ghost columns set above come along
+    size_t row = (Nx+4)*sizeof(cl_float4);
+    for (size_t b = 0; b+1 < bands.size(); b++) {
+        Band& lo = bands[b];
+        Band& hi = bands[b+1];
+        
+        err |= clEnqueueCopyBuffer(context.queue, lo.Q[n]->getRef(), hi.Q[n]->getRef(),
+                                   lo.rows*row, 0, 2*row, 0, NULL,
+                                   Trace::command("exchangeHalos", context.queue));
+        err |= clEnqueueCopyBuffer(context.queue, hi.Q[n]->getRef(), lo.Q[n]->getRef(),
+                                   2*row, (lo.rows+2)*row, 2*row, 0, NULL,
+                                   Trace::command("exchangeHalos", context.queue));
+    }
     
-    size_t global[] = {Nx,Ny};
-    err |= clEnqueueNDRangeKernel(context.queue, compute_eigenvalues,
-                                  2, NULL, global, NULL, 0, NULL, NULL);
+    if(err != CL_SUCCESS) {
+        std::stringstream ss;
+        ss << "Failed to exchange halos! Error: " << err;
+        THROW_EXCEPTION(ss.str().c_str());
+    }
+}
+
+float SimulatorCLSW::computeDt(){
+    cl_int err = CL_SUCCESS;
     
-    std::vector<cl_float> data((Nx+4)*(Ny+4));
-    err |= clEnqueueReadBuffer(context.queue, E_set->getRef(), CL_TRUE, 0,
-                               (Nx+4)*(Ny+4)*sizeof(cl_float), data.data(), 0, NULL, NULL);
+    for (size_t b = 0; b < bands.size(); b++) {
+        size_t global[] = {Nx,bands[b].rows};
+        err |= launch(bands[b].eigenvalues, 2, NULL, global, "eigenvalue");
+    }
     
     if(err != CL_SUCCESS) {
         std::stringstream ss;
-        ss << "Failed to compute dt! Error: " << err;
+        ss << "Failed to compute eigenvalues! Error: " << err;
         THROW_EXCEPTION(ss.str().c_str());
     }
     
+    return readDt();
+}
+
+float SimulatorCLSW::readDt(){
+    cl_int err = CL_SUCCESS;
+    static const float CFL = 0.8f;
+    
     float eig = -std::numeric_limits<float>().max();
     
-    for (size_t x = 2; x < Nx+2; x++) {
-        for (size_t y = 2; y < Ny+2; y++) {
-            size_t k = ((Nx+4) * y + x);
-            eig = glm::max(eig, data[k]);
+    // Pinned and the same every step, the first band is the widest
+    cl_float* data = NULL;
+    if (!context.unified) {
+        data = (cl_float*)pool->borrow((Nx+4)*(bands[0].rows+4)*sizeof(cl_float));
+    }
+    
+    for (size_t b = 0; b < bands.size() && err == CL_SUCCESS; b++) {
+        const Band& band = bands[b];
+        
+        const cl_float* E = NULL;
+        if (context.unified) {
+            // Memory is shared with the host, read the eigenvalues in place
+            E = (const cl_float*)band.E->map(CL_MAP_READ);
+        } else {
+            err |= clEnqueueReadBuffer(context.queue, band.E->getRef(), CL_TRUE, 0,
+                                       (Nx+4)*(band.rows+4)*sizeof(cl_float), data, 0, NULL, Trace::command("read eigenvalues", context.queue));
+            E = data;
+        }
+        
+        for (size_t y = 2; y < band.rows+2 && err == CL_SUCCESS; y++) {
+            for (size_t x = 2; x < Nx+2; x++) {
+                size_t k = ((Nx+4) * y + x);
+                eig = glm::max(eig, E[k]);
+            }
+        }
+        
+        if (context.unified) {
+            band.E->unmap((void*)E);
         }
     }
+    if (data != NULL) {
+        pool->giveBack(data);
+    }
+    
+    if(err != CL_SUCCESS) {
+        std::stringstream ss;
+        ss << "Failed to compute dt! Error: " << err;
+        THROW_EXCEPTION(ss.str().c_str());
+    }
     
     float dx = 1.0f/(float)Nx;
     float dy = 1.0f/(float)Ny;
@@ -239,16 +904,26 @@ float SimulatorCLSW::computeDt(CLUtils::MO<CL_MEM_READ_WRITE>* Qn){
     return dt;
 }
 
-void SimulatorCLSW::reconstruct(CLUtils::MO<CL_MEM_READ_WRITE>* Qn){
-    cl_int err = CL_SUCCESS;
+void SimulatorCLSW::setTimestep(float dt){
+    // Not blocking, step_dt only changes again once the queue has drained
+    step_dt = dt;
+    cl_int err = clEnqueueWriteBuffer(context.queue, T_set->getRef(), CL_FALSE, 0, sizeof(cl_float), &step_dt,
+                                      0, NULL, Trace::command("write dt", context.queue));
     
-    err |= clSetKernelArg(compute_reconstruct, 0, sizeof(cl_mem), &(Qn->getRef()));
-    err |= clSetKernelArg(compute_reconstruct, 1, sizeof(cl_mem), &(Sx_set->getRef()));
-    err |= clSetKernelArg(compute_reconstruct, 2, sizeof(cl_mem), &(Sy_set->getRef()));
+    if(err != CL_SUCCESS) {
+        std::stringstream ss;
+        ss << "Failed to set timestep! Error: " << err;
+        THROW_EXCEPTION(ss.str().c_str());
+    }
+}
+
+void SimulatorCLSW::reconstruct(size_t n){
+    cl_int err = CL_SUCCESS;
     
-    size_t global[] = {Nx+2,Ny+2};
-    err |= clEnqueueNDRangeKernel(context.queue, compute_reconstruct, 2,
-                                  NULL, global, NULL, 0, NULL, NULL);
+    for (size_t b = 0; b < bands.size(); b++) {
+        size_t global[] = {Nx+2,bands[b].rows+2};
+        err |= launch(bands[b].reconstruct[n], 2, NULL, global, "piecewiseReconstruction");
+    }
     
     if(err != CL_SUCCESS) {
         std::stringstream ss;
@@ -257,19 +932,18 @@ void SimulatorCLSW::reconstruct(CLUtils::MO<CL_MEM_READ_WRITE>* Qn){
     }
 }
 
-void SimulatorCLSW::evaluateFluxes(CLUtils::MO<CL_MEM_READ_WRITE>* Qn){
-    cl_int err = CL_SUCCESS;
+void SimulatorCLSW::evaluateFluxes(size_t n){
+    if (flux_mode == FLUX_SPLIT) {
+        evaluateSplitFluxes(n);
+        return;
+    }
     
-    err |= clSetKernelArg(evaluate_flux, 0, sizeof(cl_mem), &(Qn->getRef()));
-    err |= clSetKernelArg(evaluate_flux, 1, sizeof(cl_mem), &(Sx_set->getRef()));
-    err |= clSetKernelArg(evaluate_flux, 2, sizeof(cl_mem), &(Sy_set->getRef()));
-    err |= clSetKernelArg(evaluate_flux, 3, sizeof(cl_float), &gravity);
-    err |= clSetKernelArg(evaluate_flux, 4, sizeof(cl_mem), &(F_set->getRef()));
-    err |= clSetKernelArg(evaluate_flux, 5, sizeof(cl_mem), &(G_set->getRef()));
+    cl_int err = CL_SUCCESS;
     
-    size_t global[] = {Nx+1,Ny+1};
-    err |= clEnqueueNDRangeKernel(context.queue, evaluate_flux, 2,
-                                  NULL, global, NULL, 0, NULL, NULL);
+    for (size_t b = 0; b < bands.size(); b++) {
+        size_t global[] = {Nx+1,bands[b].rows+1};
+        err |= launch(bands[b].flux[n], 2, NULL, global, "computeNumericalFlux");
+    }
     
     if(err != CL_SUCCESS) {
         std::stringstream ss;
@@ -278,37 +952,87 @@ void SimulatorCLSW::evaluateFluxes(CLUtils::MO<CL_MEM_READ_WRITE>* Qn){
     }
 }
 
-void SimulatorCLSW::computeRK(size_t n, float dt){
+void SimulatorCLSW::evaluateSplitFluxes(size_t n){
     cl_int err = CL_SUCCESS;
     
-    static const glm::vec2 c[3][3] =
-    {
-        {glm::vec2(0.0f,1.0f),
-            glm::vec2(0.0f,0.0f),
-            glm::vec2(0.0f,0.0f)},
+    // Past the zero row of F and zero column of G, which RK never reads
+    size_t offset_x[] = {0,1};
+    size_t offset_y[] = {1,0};
+    
+    if (recording != NULL) {
+        // Recorded commands run in order anyway
+        for (size_t b = 0; b < bands.size(); b++) {
+            size_t global_x[] = {Nx+1,bands[b].rows};
+            size_t global_y[] = {Nx,bands[b].rows+1};
+            err |= launch(bands[b].flux_x[n], 2, offset_x, global_x, "computeNumericalFluxX");
+            err |= launch(bands[b].flux_y[n], 2, offset_y, global_y, "computeNumericalFluxY");
+        }
+    } else {
+        // Every band and direction waits on the reconstruction through a
+        // marker and the main queue waits on all of them through a barrier
+        cl_event ready = NULL;
+        std::vector<cl_event> done(2*bands.size(), (cl_event)NULL);
+        err |= clEnqueueMarkerWithWaitList(context.queue, 0, NULL, &ready);
+        err |= clFlush(context.queue);
+        for (size_t b = 0; b < bands.size(); b++) {
+            size_t global_x[] = {Nx+1,bands[b].rows};
+            size_t global_y[] = {Nx,bands[b].rows+1};
+            err |= clEnqueueNDRangeKernel(flux_queue, bands[b].flux_x[n], 2, offset_x, global_x, NULL,
+                                          1, &ready, &done[2*b]);
+            err |= clEnqueueNDRangeKernel(flux_queue, bands[b].flux_y[n], 2, offset_y, global_y, NULL,
+                                          1, &ready, &done[2*b+1]);
+        }
+        err |= clFlush(flux_queue);
+        err |= clEnqueueBarrierWithWaitList(context.queue, done.size(), done.data(), NULL);
         
-        {glm::vec2(0.0f,1.0f),
-            glm::vec2(0.5f,0.5f),
-            glm::vec2(0.0f,0.0f)},
+        for (size_t i = 0; i < done.size(); i++) {
+            Trace::retain(i % 2 == 0 ? "computeNumericalFluxX" : "computeNumericalFluxY", flux_queue, done[i]);
+            clReleaseEvent(done[i]);
+        }
+        clReleaseEvent(ready);
+    }
+    
+    if(err != CL_SUCCESS) {
+        std::stringstream ss;
+        ss << "Failed to evalute split fluxes! Error: " << err;
+        THROW_EXCEPTION(ss.str().c_str());
+    }
+}
+
+void SimulatorCLSW::pickFluxMode(){
+    if (flux_mode != FLUX_AUTO) {
+        return;
+    }
+    
+    // A few evaluations of either kind, after one to warm up
+    const size_t runs = 8;
+    double elapsed[2];
+    reconstruct(0);
+    for (size_t m = 0; m < 2; m++) {
+        flux_mode = m == 0 ? FLUX_FUSED : FLUX_SPLIT;
+        evaluateFluxes(0);
+        clFinish(context.queue);
         
-        {glm::vec2(0.0f,1.0f),
-            glm::vec2(0.75f,0.25f),
-            glm::vec2(0.333f,0.666f)}
-    };
+        timer.restart();
+        for (size_t i = 0; i < runs; i++) {
+            evaluateFluxes(0);
+        }
+        clFinish(context.queue);
+        elapsed[m] = timer.elapsed()/runs;
+    }
     
-    err |= clSetKernelArg(compute_RK, 0, sizeof(cl_mem), &(Q_set[0]->getRef()));
-    err |= clSetKernelArg(compute_RK, 1, sizeof(cl_mem), &(Q_set[n-1]->getRef()));
-    err |= clSetKernelArg(compute_RK, 2, sizeof(cl_mem), &(F_set->getRef()));
-    err |= clSetKernelArg(compute_RK, 3, sizeof(cl_mem), &(G_set->getRef()));
-    err |= clSetKernelArg(compute_RK, 4, sizeof(cl_float2), glm::value_ptr(c[N_RK-1][n-1]));
-    err |= clSetKernelArg(compute_RK, 5, sizeof(cl_float2),
-                          glm::value_ptr(glm::vec2((1.0f/(float)Nx),(1.0f/(float)Ny))));
-    err |= clSetKernelArg(compute_RK, 6, sizeof(cl_float), &dt);
-    err |= clSetKernelArg(compute_RK, 7, sizeof(cl_mem), &(Q_set[n]->getRef()));
+    flux_mode = elapsed[1] < elapsed[0] ? FLUX_SPLIT : FLUX_FUSED;
+    std::cout << "Fluxes " << (flux_mode == FLUX_SPLIT ? "split per direction" : "fused")
+              << ", " << elapsed[0]*1e3 << " ms fused against " << elapsed[1]*1e3 << " ms split" << std::endl;
+}
+
+void SimulatorCLSW::computeRK(size_t n){
+    cl_int err = CL_SUCCESS;
     
-    size_t global[] = {Nx,Ny};
-    err |= clEnqueueNDRangeKernel(context.queue, compute_RK, 2,
-                                  NULL, global, NULL, 0, NULL, NULL);
+    for (size_t b = 0; b < bands.size(); b++) {
+        size_t global[] = {Nx,bands[b].rows};
+        err |= launch(bands[b].rk[n-1], 2, NULL, global, "computeRK");
+    }
     
     if(err != CL_SUCCESS) {
         std::stringstream ss;
@@ -317,15 +1041,13 @@ void SimulatorCLSW::computeRK(size_t n, float dt){
     }
 }
 
-void SimulatorCLSW::copy(CLUtils::MO<CL_MEM_READ_WRITE>* src,
-                         CLUtils::MO<CL_MEM_READ_WRITE>* dest){
+void SimulatorCLSW::copy(){
     cl_int err = CL_SUCCESS;
     
-    err |= clSetKernelArg(copy_domain, 0, sizeof(cl_mem), &(src->getRef()));
-    err |= clSetKernelArg(copy_domain, 1, sizeof(cl_mem), &(dest->getRef()));
-    
-    size_t global[] = {Nx+4,Ny+4};
-    err |= clEnqueueNDRangeKernel(context.queue, copy_domain, 2, NULL, global, NULL, 0, NULL, NULL);
+    for (size_t b = 0; b < bands.size(); b++) {
+        size_t global[] = {Nx+4,bands[b].rows+4};
+        err |= launch(bands[b].copy, 2, NULL, global, "copy");
+    }
     
     if(err != CL_SUCCESS) {
         std::stringstream ss;
@@ -333,3 +1055,78 @@ void SimulatorCLSW::copy(CLUtils::MO<CL_MEM_READ_WRITE>* src,
         THROW_EXCEPTION(ss.str().c_str());
     }
 }
+
+cl_int SimulatorCLSW::launch(cl_kernel kernel, cl_uint dims, const size_t* offset, const size_t* global,
+                             const char* name){
+    if (recording != NULL) {
+        return recording->kernel(kernel, dims, offset, global);
+    }
+    return clEnqueueNDRangeKernel(context.queue, kernel, dims, offset, global, NULL, 0, NULL,
+                                  Trace::command(name, context.queue));
+}
+
+void SimulatorCLSW::recordStep(){
+    // Seams are buffer copies, so only grids of one band are recorded. Those
+    // are the small grids, where launches cost the most.
+    if (bands.size() != 1 || !CLUtils::CommandBuffer::supported(context)) {
+        return;
+    }
+    
+    step_prepare = recording = new CLUtils::CommandBuffer(context);
+    setBoundary(N_RK);
+    copy();
+    size_t global[] = {Nx,bands[0].rows};
+    if (launch(bands[0].eigenvalues, 2, NULL, global, "eigenvalue") != CL_SUCCESS) {
+        THROW_EXCEPTION("Failed to record eigenvalues");
+    }
+    step_prepare->finalize();
+    
+    size_t kernels = step_prepare->size();
+    for (size_t n = 1; n <= N_RK; n++) {
+        step_bounds[n-1] = recording = new CLUtils::CommandBuffer(context);
+        setBoundary(n-1);
+        step_bounds[n-1]->finalize();
+        
+        step_stages[n-1] = recording = new CLUtils::CommandBuffer(context);
+        reconstruct(n-1);
+        evaluateFluxes(n-1);
+        computeRK(n);
+        step_stages[n-1]->finalize();
+        
+        kernels += step_bounds[n-1]->size() + step_stages[n-1]->size();
+    }
+    recording = NULL;
+    
+    std::cout << "Steps replayed from command buffers, " << kernels << " kernels" << std::endl;
+}
+
+SimDetail SimulatorCLSW::replayStep(){
+    SimDetail detail;
+    
+    step_prepare->enqueue();
+    float dt = readDt();
+    setTimestep(dt);
+    
+    device_timer->begin();
+    detail.sim_time = 0.0f;
+    
+    // Timed like simulate(), from after the boundaries are enqueued
+    for (size_t n = 0; n < N_RK; n++) {
+        step_bounds[n]->enqueue();
+        
+        timer.restart();
+        step_stages[n]->enqueue();
+        clFinish(context.queue);
+        detail.sim_time += timer.elapsed();
+    }
+    
+    device_timer->end();
+    clFinish(context.queue);
+    
+    detail.dt = dt;
+    detail.steps = 1;
+    time+=dt;
+    detail.time = time;
+    
+    return detail;
+}
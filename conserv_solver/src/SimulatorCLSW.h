@@ -13,6 +13,7 @@
 #include "CLUtils.hpp"
 #include "SimulatorBase.h"
 #include "Timer.hpp"
+#include "CLTimer.hpp"
 
 class SimulatorCLSW : public SimulatorBase{
 public:
@@ -46,6 +47,12 @@ public:
      */
     virtual std::vector<float> getData();
     
+    /**
+     * Read back a decimated subregion with selected components
+     */
+    virtual std::vector<float> getRegion(size_t x0, size_t y0, size_t w, size_t h,
+                                         size_t stride = 1, unsigned int fields = FIELD_ALL);
+    
     /**
      * Return the size of the grid
      */
@@ -56,12 +63,124 @@ public:
      */
     virtual glm::vec2 getDeltaXY(){return glm::vec2(1.0f/(float)Nx,1.0f/(float)Ny);}
     
+    /**
+     * Water depth and discharges, the last component is unused
+     */
+    virtual const char* getFieldName(size_t c){
+        static const char* names[] = {"h", "hu", "hv", "unused"};
+        return names[c];
+    }
+    
     /**
      * Returns time
      */
     virtual float getTime(){return time;}
     
+    /**
+     * Allocate pinned host staging slots
+     */
+    virtual void createStaging(size_t slots);
+    
+    /**
+     * Start a non-blocking download into a staging slot
+     */
+    virtual void beginDownload(size_t slot);
+    
+    /**
+     * Returns slot data once the download has completed
+     */
+    virtual const float* pollDownload(size_t slot);
+    
+    /**
+     * Release a staging slot
+     */
+    virtual void endDownload(size_t slot);
+    
+    /**
+     * Device side conservation and range diagnostics
+     */
+    virtual SimDiagnostics getDiagnostics();
+    
+    /**
+     * Average device time of a step
+     */
+    virtual double getDeviceTime(){return device_timer->average();}
+    
+    /**
+     * Modelled cost and measured time of the step kernels
+     */
+    virtual std::vector<KernelProfile> getKernelProfile();
+    
+    /**
+     * Triad bandwidth of the device
+     */
+    virtual double measureBandwidth();
+    
+    /**
+     * Allocate the probe cells and their device ring buffer
+     */
+    virtual void createProbes(const std::vector<glm::ivec2>& cells, size_t capacity);
+    
+    /**
+     * Sample every probe into a ring slot on the device
+     */
+    virtual void sampleProbes(size_t slot);
+    
+    /**
+     * Read a run of ring slots back to the host
+     */
+    virtual void readProbes(size_t first, size_t count, float* out);
+    
+    /**
+     * Fused or per direction flux kernels, auto times both at init. Has to
+     * be called before init.
+     */
+    void setFluxMode(FluxMode mode){flux_mode = mode;}
+    virtual FluxMode getFluxMode(){return flux_mode;}
+    
 private:
+    static const unsigned int N_RK  = 3;
+    
+    /**
+     * Rows y0 to y0+rows of the domain in buffers of their own, with two
+     * ghost rows on each side. Ghost rows at a seam hold copies of the
+     * neighbouring band.
+     */
+    struct Band{
+        size_t y0;
+        size_t rows;
+        
+        CLUtils::MO<CL_MEM_READ_WRITE>*         Q[N_RK+1];
+        CLUtils::MO<CL_MEM_READ_WRITE>*         Sx;
+        CLUtils::MO<CL_MEM_READ_WRITE>*         Sy;
+        CLUtils::MO<CL_MEM_READ_WRITE>*         F;
+        CLUtils::MO<CL_MEM_READ_WRITE>*         G;
+        CLUtils::MO<CL_MEM_WRITE_ONLY>*         E;      // aliases the slopes
+        CLUtils::Arena*                         arena;  // the buffers above are carved from it
+        
+        cl_uint sides;      // domain edges the band touches, bottom (1) and top (2)
+        
+        // Step kernels of the band with their arguments bound once, indexed
+        // by the state they read
+        cl_kernel bounds_x[N_RK+1];
+        cl_kernel bounds_y[N_RK+1];
+        cl_kernel reconstruct[N_RK];
+        cl_kernel flux[N_RK];
+        cl_kernel flux_x[N_RK];     // the directions of flux on their own
+        cl_kernel flux_y[N_RK];
+        cl_kernel rk[N_RK];         // writes the next state
+        cl_kernel copy;             // last state into the first
+        cl_kernel eigenvalues;      // of the last state
+        
+        size_t probe_first; // probe cells are grouped by band
+        size_t probe_count;
+    };
+    
+    /**
+     * Split the rows into bands that each fit in one allocation
+     */
+    void planBands();
+    
     /**
      * Sets up the buffers for us
      */
@@ -80,33 +199,79 @@ private:
     /**
      * Function that enforces boundary condition
      */
-    void setBoundary(CLUtils::MO<CL_MEM_READ_WRITE>* Qn);
+    void setBoundary(size_t n);
+    
+    /**
+     * Copy the rows next to each seam into the ghost rows across it
+     */
+    void exchangeHalos(size_t n);
     
     /**
      * Computes timestep based on CFL
      */
-    float computeDt(CLUtils::MO<CL_MEM_READ_WRITE>* Qn);
+    float computeDt();
+    
+    /**
+     * Timestep from the eigenvalues already computed for every band
+     */
+    float readDt();
+    
+    /**
+     * Hand the timestep to the RK kernels
+     */
+    void setTimestep(float dt);
     
     /**
 	 * Simulation step
 	 */
-    void reconstruct(CLUtils::MO<CL_MEM_READ_WRITE>* Qn);
+    void reconstruct(size_t n);
     
     /**
 	 * Simulation step
 	 */
-    void evaluateFluxes(CLUtils::MO<CL_MEM_READ_WRITE>* Qn);
+    void evaluateFluxes(size_t n);
+    
+    /**
+     * Both flux directions of every band at once on the flux queue, the
+     * main queue waits for them before going on
+     */
+    void evaluateSplitFluxes(size_t n);
+    
+    /**
+     * Time fused and split fluxes on the device and keep the faster
+     */
+    void pickFluxMode();
     
     /**
 	 * Simulation step
 	 */
-    void computeRK(size_t n, float dt);
+    void computeRK(size_t n);
     
     /**
-	 * Copy texture to framebuffer texture
+	 * Copy the last RK stage into the first
 	 */
-    void copy(CLUtils::MO<CL_MEM_READ_WRITE>* src,
-              CLUtils::MO<CL_MEM_READ_WRITE>* dest);
+    void copy();
+    
+    /**
+     * Create the step kernels of a band and bind their arguments
+     */
+    void bindKernels(Band& band);
+    
+    /**
+     * Run a kernel on the queue, or record it while a step is recorded
+     */
+    cl_int launch(cl_kernel kernel, cl_uint dims, const size_t* offset, const size_t* global,
+                  const char* name);
+    
+    /**
+     * Record a step into command buffers where the device supports them
+     */
+    void recordStep();
+    
+    /**
+     * Step replayed from the recorded command buffers
+     */
+    SimDetail replayStep();
     
 private:
     CLUtils::CLcontext context;
@@ -114,32 +279,62 @@ private:
     size_t Nx;
     size_t Ny;
     
-    static const unsigned int N_RK  = 3;
     float gravity;
     float time;
     
     GLuint tex;
     
-    cl_kernel           compute_reconstruct;
-    cl_kernel           evaluate_flux;
-    cl_kernel           compute_RK;
-    cl_kernel           compute_eigenvalues;
-    cl_kernel           copy_domain;
+    // Step kernels are created per band from these
+    CLUtils::Program*   common_program;
+    CLUtils::Program*   boundary_program;
+    CLUtils::Program*   SW_program;
+    
     cl_kernel           prepare_render;
     cl_kernel           set_initial;
-    cl_kernel           set_boundary_x;
-    cl_kernel           set_boundary_y;
+    cl_kernel           reduce_diagnostics;
+    cl_kernel           extract_region;
+    cl_kernel           sample_probes;
+    
+    size_t              reduce_local;
+    size_t              reduce_groups;
+    
+    std::vector<Band>   bands;
+    bool                large_indices;  // buffers past 32 bit element indices
     
-    CLUtils::MO<CL_MEM_READ_WRITE>*             Q_set[N_RK+1];
-    CLUtils::MO<CL_MEM_READ_WRITE>*             Sx_set;
-    CLUtils::MO<CL_MEM_READ_WRITE>*             Sy_set;
-    CLUtils::MO<CL_MEM_READ_WRITE>*             F_set;
-    CLUtils::MO<CL_MEM_READ_WRITE>*             G_set;
-    CLUtils::MO<CL_MEM_WRITE_ONLY>*             E_set;
+    // Split fluxes run on an out-of-order queue where the device has one
+    FluxMode            flux_mode;
+    cl_command_queue    flux_queue;
     
+    // A step recorded up to the eigenvalues, then the boundaries and the
+    // kernels of every stage after dt is known. Apart so replays time the
+    // same kernels simulate() does. NULL without command buffers.
+    CLUtils::CommandBuffer*                     step_prepare;
+    CLUtils::CommandBuffer*                     step_bounds[N_RK];
+    CLUtils::CommandBuffer*                     step_stages[N_RK];
+    CLUtils::CommandBuffer*                     recording;
+    
+    cl_float                                    step_dt;
+    CLUtils::MO<CL_MEM_READ_ONLY>*              T_set;  // dt of the step
+    CLUtils::MO<CL_MEM_READ_WRITE>*             D_set;
+    CLUtils::MO<CL_MEM_READ_WRITE>*             X_set;  // packed region of one band, grown on demand
+    CLUtils::MO<CL_MEM_READ_ONLY>*              P_cells;
+    CLUtils::MO<CL_MEM_READ_WRITE>*             P_ring; // probes*capacity float4
+    
+    size_t              probes;
+    
+    // Every render_stride'th cell is shown when the grid exceeds the texture limit
     CLUtils::ImageBuffer<CL_MEM_READ_WRITE>*    R_tex;
+    size_t              render_stride;
+    
+    // Pinned host memory for readbacks, reused across steps
+    CLUtils::StagingPool*   pool;
+    
+    // Pool buffers for asynchronous downloads, borrowed for their lifetime
+    std::vector<float*>     staging_ptr;
+    std::vector<cl_event>   staging_event;
     
     Timer timer;
+    CLTimer* device_timer;
 };
 
 #endif
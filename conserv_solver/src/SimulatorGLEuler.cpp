@@ -14,7 +14,14 @@
 #include <glm/gtx/transform2.hpp>
 
 SimulatorGLEuler::SimulatorGLEuler(){
-    
+    regionKernel = NULL;
+    device_timer = NULL;
+    probeCells = NULL;
+    probeRing = NULL;
+    for (size_t i = 0; i < PASS_COUNT; i++) {
+        pass_timer[i] = NULL;
+    }
+    pack_pool = new GLUtils::PackPool();
 }
 
 SimulatorGLEuler::~SimulatorGLEuler(){
@@ -26,12 +33,37 @@ SimulatorGLEuler::~SimulatorGLEuler(){
     delete bilinear_recon;
     delete flux_evaluator;
     delete eigen;
+    delete reduce;
+    delete decimate;
+    delete device_timer;
+    delete probe;
+    delete stream;
+    for (size_t i = 0; i < PASS_COUNT; i++) {
+        delete pass_timer[i];
+    }
     
     for (size_t i = 0; i <= N_RK; i++) {
         delete kernelRK[i];
     }
     delete reconstructKernel;
     delete fluxKernel;
+    delete dtKernel;
+    delete regionKernel;
+    delete probeCells;
+    delete probeRing;
+    for (size_t i = 0; i < reduceKernel.size(); i++) {
+        delete reduceKernel[i];
+    }
+    
+    for (size_t i = 0; i < staging.size(); i++) {
+        if (staging_fence[i] != NULL) {
+            glDeleteSync(staging_fence[i]);
+        }
+        if (staging_ptr[i] != NULL) {
+            endDownload(i);
+        }
+    }
+    delete pack_pool;
 }
 
 void SimulatorGLEuler::init(size_t Nx, size_t Ny, std::string initialKernel){
@@ -41,12 +73,29 @@ void SimulatorGLEuler::init(size_t Nx, size_t Ny, std::string initialKernel){
     this->time = 0.0f;
     
     std::cout << "Simulating Euler using OpenGL Shaders on GPU" << std::endl;
-    
+
+    // The state lives in Nx*Ny textures without ghost cells, so the grid
+    // can not be split up
+    GLint max_tex = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_tex);
+    if (Nx > (size_t)max_tex || Ny > (size_t)max_tex) {
+        std::stringstream ss;
+        ss << "Grid exceeds the texture limit of " << max_tex << ", use an OpenCL solver";
+        THROW_EXCEPTION(ss.str().c_str());
+    }
+
     createFBO();
     //createProgram(initialKernel);
     createProgram("initial_shock");
     createVAO();
     
+    device_timer = new GLTimer();
+    
+    // The reconstruct, flux and RK passes run once per stage
+    for (size_t i = 0; i < PASS_COUNT; i++) {
+        pass_timer[i] = new GLTimer(4*N_RK);
+    }
+    
     applyInitial();
 }
 SimDetail SimulatorGLEuler::simulate(){
@@ -55,6 +104,7 @@ SimDetail SimulatorGLEuler::simulate(){
     float dt = computeDt(kernelRK[0]);
     
     timer.restart();
+    device_timer->begin();
     SimDetail detail;
     
     for (size_t n = 1; n <= N_RK; n++) {
@@ -71,10 +121,12 @@ SimDetail SimulatorGLEuler::simulate(){
         computeRK(n, dt);
     }
     
+    device_timer->end();
     glFinish();
     
     detail.sim_time = timer.elapsed();
     detail.dt = dt;
+    detail.steps = 1;
     time+=dt;
     detail.time = time;
     
@@ -87,7 +139,338 @@ size_t SimulatorGLEuler::getTexture(){
     return kernelRK[N_RK]->getTexture();
 }
 std::vector<float> SimulatorGLEuler::getData(){
-    THROW_EXCEPTION("Not Implemented");
+    return getRegion(0, 0, Nx, Ny);
+}
+
+std::vector<float> SimulatorGLEuler::getRegion(size_t x0, size_t y0, size_t w, size_t h,
+                                               size_t stride, unsigned int fields){
+    glm::ivec2 size = regionSize(x0, y0, w, h, stride, fields);
+    size_t n = fieldCount(fields);
+    
+    TextureFBO* source = kernelRK[N_RK];
+    glm::ivec2 origin(x0,y0);
+    
+    if (stride > 1) {
+        // Decimate into a small texture first so only the samples are read
+        if (regionKernel == NULL ||
+            regionKernel->getWidth() != (unsigned int)size.x ||
+            regionKernel->getHeight() != (unsigned int)size.y) {
+            delete regionKernel;
+            regionKernel = new TextureFBO(size.x,size.y,1,TextureFBO::DEPTH_NONE,GL_RGBA32F,"region");
+        }
+        
+        regionKernel->bind();
+        glViewport(0, 0, size.x, size.y);
+        decimate->use();
+        
+        glUniform1i(decimate->getUniform("QTex"),0);
+        glUniform2i(decimate->getUniform("origin"), origin.x, origin.y);
+        glUniform1i(decimate->getUniform("stride"), stride);
+        
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, source->getTexture());
+        
+        glBindVertexArray(vao[0]);
+        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_BYTE, NULL);
+        glBindVertexArray(0);
+        
+        decimate->disuse();
+        regionKernel->unbind();
+        
+        source = regionKernel;
+        origin = glm::ivec2(0,0);
+    }
+    
+    std::vector<float> data(size.x*size.y*n);
+    
+    source->bind();
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    
+    if (n == 4) {
+        glReadPixels(origin.x, origin.y, size.x, size.y, GL_RGBA, GL_FLOAT, data.data());
+    } else if (n == 1) {
+        // A single component can be read on its own
+        static const GLenum format[] = {GL_RED, GL_GREEN, GL_BLUE, GL_ALPHA};
+        size_t c = 0;
+        while (!(fields & (1 << c))) {
+            c++;
+        }
+        glReadPixels(origin.x, origin.y, size.x, size.y, format[c], GL_FLOAT, data.data());
+    } else {
+        std::vector<float> rgba(size.x*size.y*4);
+        glReadPixels(origin.x, origin.y, size.x, size.y, GL_RGBA, GL_FLOAT, rgba.data());
+        
+        size_t k = 0;
+        for (size_t i = 0; i < (size_t)(size.x*size.y); i++) {
+            for (size_t c = 0; c < 4; c++) {
+                if (fields & (1 << c)) {
+                    data[k++] = rgba[i*4+c];
+                }
+            }
+        }
+    }
+    
+    source->unbind();
+    
+    CHECK_GL_ERRORS();
+    
+    return data;
+}
+
+void SimulatorGLEuler::createStaging(size_t slots){
+    for (size_t i = 0; i < slots; i++) {
+        staging.push_back(pack_pool->borrow(Nx*Ny*4*sizeof(GLfloat)));
+        staging_fence.push_back(NULL);
+        staging_ptr.push_back(NULL);
+    }
+    CHECK_GL_ERRORS();
+}
+
+void SimulatorGLEuler::beginDownload(size_t slot){
+    kernelRK[N_RK]->bind();
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    
+    staging[slot]->bind();
+    glReadPixels(0, 0, Nx, Ny, GL_RGBA, GL_FLOAT, BUFFER_OFFSET(0));
+    staging[slot]->unbind();
+    
+    kernelRK[N_RK]->unbind();
+    
+    staging_fence[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    
+    CHECK_GL_ERRORS();
+}
+
+const float* SimulatorGLEuler::pollDownload(size_t slot){
+    GLenum status = glClientWaitSync(staging_fence[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+    if (status == GL_WAIT_FAILED) {
+        THROW_EXCEPTION("Download failed");
+    }
+    if (status == GL_TIMEOUT_EXPIRED) {
+        return NULL;
+    }
+    
+    glDeleteSync(staging_fence[slot]);
+    staging_fence[slot] = NULL;
+    
+    staging[slot]->bind();
+    staging_ptr[slot] = (float*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+                                                 Nx*Ny*4*sizeof(GLfloat), GL_MAP_READ_BIT);
+    staging[slot]->unbind();
+    
+    CHECK_GL_ERRORS();
+    
+    return staging_ptr[slot];
+}
+
+void SimulatorGLEuler::endDownload(size_t slot){
+    staging[slot]->bind();
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    staging[slot]->unbind();
+    staging_ptr[slot] = NULL;
+}
+
+SimDiagnostics SimulatorGLEuler::getDiagnostics(){
+    reduce->use();
+    
+    glUniform1i(reduce->getUniform("SumTex"),0);
+    glUniform1i(reduce->getUniform("MinTex"),1);
+    glUniform1i(reduce->getUniform("MaxTex"),2);
+    
+    glm::ivec2 size(Nx,Ny);
+    for (size_t i = 0; i < reduceKernel.size(); i++) {
+        reduceKernel[i]->bind();
+        glViewport(0, 0, reduceKernel[i]->getWidth(), reduceKernel[i]->getHeight());
+        
+        glUniform2i(reduce->getUniform("size"), size.x, size.y);
+        glUniform1i(reduce->getUniform("first"), i == 0);
+        
+        // The first level reads the state, the others the level above
+        for (size_t t = 0; t < 3; t++) {
+            glActiveTexture(GL_TEXTURE0+t);
+            glBindTexture(GL_TEXTURE_2D, i == 0 ? kernelRK[N_RK]->getTexture() :
+                                                  reduceKernel[i-1]->getTexture(t));
+        }
+        
+        glBindVertexArray(vao[0]);
+        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_BYTE, NULL);
+        glBindVertexArray(0);
+        
+        size = glm::ivec2(reduceKernel[i]->getWidth(), reduceKernel[i]->getHeight());
+    }
+    
+    reduce->disuse();
+    
+    // 1x1 top level, three texels are all that is read back
+    SimDiagnostics diag;
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glReadPixels(0, 0, 1, 1, GL_RGBA, GL_FLOAT, glm::value_ptr(diag.sum));
+    glReadBuffer(GL_COLOR_ATTACHMENT1);
+    glReadPixels(0, 0, 1, 1, GL_RGBA, GL_FLOAT, glm::value_ptr(diag.min));
+    glReadBuffer(GL_COLOR_ATTACHMENT2);
+    glReadPixels(0, 0, 1, 1, GL_RGBA, GL_FLOAT, glm::value_ptr(diag.max));
+    
+    reduceKernel.back()->unbind();
+    
+    for (size_t t = 0; t < 3; t++) {
+        glActiveTexture(GL_TEXTURE0+t);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+    glActiveTexture(GL_TEXTURE0);
+    
+    CHECK_GL_ERRORS();
+    
+    return diag;
+}
+
+std::vector<KernelProfile> SimulatorGLEuler::getKernelProfile(){
+    // Per fragment bytes and flops, same arithmetic as the OpenCL kernels
+    KernelProfile passes[PASS_COUNT] = {
+        {"copy",            Nx*Ny,  32.0,   0.0,  0, 0.0},
+        {"eigenvalue",      Nx*Ny,  32.0,  21.0,  0, 0.0},
+        {"reconstruct",     Nx*Ny,  48.0,  48.0,  0, 0.0},
+        {"flux",            Nx*Ny,  80.0, 430.0,  0, 0.0},
+        {"RK",              Nx*Ny,  80.0,  44.0,  0, 0.0}
+    };
+    
+    std::vector<KernelProfile> profile;
+    for (size_t i = 0; i < PASS_COUNT; i++) {
+        double average = pass_timer[i]->average();
+        passes[i].calls = pass_timer[i]->getSamples();
+        passes[i].time  = average > 0.0 ? average*passes[i].calls : 0.0;
+        profile.push_back(passes[i]);
+    }
+    return profile;
+}
+
+double SimulatorGLEuler::measureBandwidth(){
+    static const size_t RUNS = 6;
+    static const size_t SIZE = 2048;    // 64 MB per RGBA32F texture
+    
+    TextureFBO* A = new TextureFBO(SIZE,SIZE,1,TextureFBO::DEPTH_NONE,GL_RGBA32F,"stream probe");
+    TextureFBO* B = new TextureFBO(SIZE,SIZE,1,TextureFBO::DEPTH_NONE,GL_RGBA32F,"stream probe");
+    TextureFBO* C = new TextureFBO(SIZE,SIZE,1,TextureFBO::DEPTH_NONE,GL_RGBA32F,"stream probe");
+    GLTimer* stream_timer = new GLTimer(RUNS+1);
+    
+    // Contents do not matter, but keep them finite
+    glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
+    B->bind();
+    glClear(GL_COLOR_BUFFER_BIT);
+    C->bind();
+    glClear(GL_COLOR_BUFFER_BIT);
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    
+    A->bind();
+    glViewport(0, 0, SIZE, SIZE);
+    stream->use();
+    
+    glUniform1i(stream->getUniform("BTex"),0);
+    glUniform1i(stream->getUniform("CTex"),1);
+    glUniform1f(stream->getUniform("s"),3.0f);
+    
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, B->getTexture());
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, C->getTexture());
+    
+    glBindVertexArray(vao[0]);
+    
+    // First pass pages everything in and is not counted
+    double best = 0.0;
+    for (size_t i = 0; i <= RUNS; i++) {
+        stream_timer->begin();
+        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_BYTE, NULL);
+        stream_timer->end();
+        glFinish();
+        
+        double t = stream_timer->elapsed();
+        if (i > 0 && t > 0.0) {
+            best = glm::max(best, 3.0*SIZE*SIZE*4*sizeof(GLfloat)/t);
+        }
+    }
+    
+    glBindVertexArray(0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    
+    stream->disuse();
+    A->unbind();
+    
+    delete stream_timer;
+    delete A;
+    delete B;
+    delete C;
+    
+    CHECK_GL_ERRORS();
+    
+    return best;
+}
+
+void SimulatorGLEuler::createProbes(const std::vector<glm::ivec2>& cells, size_t capacity){
+    for (size_t i = 0; i < cells.size(); i++) {
+        if (cells[i].x < 0 || cells[i].y < 0 || cells[i].x >= (int)Nx || cells[i].y >= (int)Ny) {
+            THROW_EXCEPTION("Probe outside of domain");
+        }
+    }
+    
+    delete probeCells;
+    delete probeRing;
+    probeCells = NULL;
+    probeRing = NULL;
+    
+    if (cells.empty() || capacity == 0) {
+        return;
+    }
+    
+    // Cell coordinates are exact in a float texture
+    std::vector<GLfloat> data(cells.size()*4, 0.0f);
+    for (size_t i = 0; i < cells.size(); i++) {
+        data[i*4+0] = cells[i].x;
+        data[i*4+1] = cells[i].y;
+    }
+    
+    probeCells = new TextureFBO(cells.size(),1,1,TextureFBO::DEPTH_NONE,GL_RGBA32F,"probes");
+    glBindTexture(GL_TEXTURE_2D, probeCells->getTexture());
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, cells.size(), 1, GL_RGBA, GL_FLOAT, data.data());
+    glBindTexture(GL_TEXTURE_2D, 0);
+    
+    probeRing = new TextureFBO(cells.size(),capacity,1,TextureFBO::DEPTH_NONE,GL_RGBA32F,"probes");
+    
+    CHECK_GL_ERRORS();
+}
+
+void SimulatorGLEuler::sampleProbes(size_t slot){
+    probeRing->bind();
+    glViewport(0, slot, probeRing->getWidth(), 1);
+    probe->use();
+    
+    glUniform1i(probe->getUniform("QTex"),0);
+    glUniform1i(probe->getUniform("CellTex"),1);
+    
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, kernelRK[N_RK]->getTexture());
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, probeCells->getTexture());
+    
+    glBindVertexArray(vao[0]);
+    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_BYTE, NULL);
+    glBindVertexArray(0);
+    
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE0);
+    
+    probe->disuse();
+    probeRing->unbind();
+}
+
+void SimulatorGLEuler::readProbes(size_t first, size_t count, float* out){
+    probeRing->bind();
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glReadPixels(0, first, probeRing->getWidth(), count, GL_RGBA, GL_FLOAT, out);
+    probeRing->unbind();
+    
+    CHECK_GL_ERRORS();
 }
 
 void SimulatorGLEuler::createProgram(std::string initial){
@@ -96,6 +479,10 @@ void SimulatorGLEuler::createProgram(std::string initial){
     runge_kutta     = new GLUtils::Program("res/shaders/kernel.vert","res/shaders/RK.frag");
     bilinear_recon  = new GLUtils::Program("res/shaders/kernel.vert","res/shaders/bilin_reconstruction.frag");
     eigen           = new GLUtils::Program("res/shaders/kernel.vert","res/shaders/eigenvalue.frag");
+    reduce          = new GLUtils::Program("res/shaders/kernel.vert","res/shaders/reduce.frag");
+    decimate        = new GLUtils::Program("res/shaders/kernel.vert","res/shaders/decimate.frag");
+    probe           = new GLUtils::Program("res/shaders/kernel.vert","res/shaders/probe.frag");
+    stream          = new GLUtils::Program("res/shaders/kernel.vert","res/shaders/stream.frag");
     
     std::stringstream ss;
     ss << "res/shaders/" << initial << ".frag";
@@ -129,13 +516,13 @@ void SimulatorGLEuler::createVAO(){
         -1.0f,          1.0f,
         0.0f+dx,   1.0f-dy,
 	};
-    vert = new GLUtils::BO<GL_ARRAY_BUFFER>(quad_vertices, sizeof(quad_vertices));
+    vert = new GLUtils::BO<GL_ARRAY_BUFFER>(quad_vertices, sizeof(quad_vertices), GL_STATIC_DRAW, "geometry");
     
 	GLubyte quad_indices[] = {
 		0, 1, 2, //triangle 1
 		2, 3, 0, //triangle 2
 	};
-    ind = new GLUtils::BO<GL_ELEMENT_ARRAY_BUFFER>(quad_indices, sizeof(quad_indices));
+    ind = new GLUtils::BO<GL_ELEMENT_ARRAY_BUFFER>(quad_indices, sizeof(quad_indices), GL_STATIC_DRAW, "geometry");
     
     glBindVertexArray(vao[0]);
     copy->use();
@@ -148,11 +535,20 @@ void SimulatorGLEuler::createVAO(){
 
 void SimulatorGLEuler::createFBO(){
     for (size_t i = 0; i <= N_RK; i++) {
-        kernelRK[i] = new TextureFBO(Nx,Ny);
+        kernelRK[i] = new TextureFBO(Nx,Ny,1,TextureFBO::DEPTH_NONE,GL_RGBA32F,"state");
     }
-    reconstructKernel   = new TextureFBO(Nx,Ny,2);
-    fluxKernel          = new TextureFBO(Nx,Ny,2);
-    dtKernel            = new TextureFBO(Nx,Ny);
+    reconstructKernel   = new TextureFBO(Nx,Ny,2,TextureFBO::DEPTH_NONE,GL_RGBA32F,"slopes");
+    fluxKernel          = new TextureFBO(Nx,Ny,2,TextureFBO::DEPTH_NONE,GL_RGBA32F,"fluxes");
+    dtKernel            = new TextureFBO(Nx,Ny,1,TextureFBO::DEPTH_NONE,GL_RGBA32F,"eigenvalues");
+    
+    // Halve until a single texel is left
+    size_t w = Nx;
+    size_t h = Ny;
+    do {
+        w = (w+1)/2;
+        h = (h+1)/2;
+        reduceKernel.push_back(new TextureFBO(w,h,3,TextureFBO::DEPTH_NONE,GL_RGBA32F,"diagnostics"));
+    } while (w > 1 || h > 1);
     
     CHECK_GL_ERRORS();
 }
@@ -181,6 +577,7 @@ void SimulatorGLEuler::setBoundary(TextureFBO* Qn){
 float SimulatorGLEuler::computeDt(TextureFBO* Qn){
     static const float CFL = 0.5f;
     
+    pass_timer[PASS_EIGENVALUE]->begin();
     dtKernel->bind();
     glViewport(0, 0, Nx, Ny);
     eigen->use();
@@ -197,12 +594,21 @@ float SimulatorGLEuler::computeDt(TextureFBO* Qn){
     
     eigen->disuse();
     dtKernel->unbind();
+    pass_timer[PASS_EIGENVALUE]->end();
     
     glBindTexture(GL_TEXTURE_2D, dtKernel->getTexture());
     
-    std::vector<GLfloat> data(Nx*Ny*4);
-    glGetTexImage(GL_TEXTURE_2D,0,GL_RGBA,GL_FLOAT,&data[0]);
+    // Read through a pooled pixel buffer, the same one every step
+    size_t bytes = Nx*Ny*4*sizeof(GLfloat);
+    GLUtils::PackPool::Lease pbo(*pack_pool, bytes);
+    pbo.get()->bind();
+    glGetTexImage(GL_TEXTURE_2D,0,GL_RGBA,GL_FLOAT,BUFFER_OFFSET(0));
     glBindTexture(GL_TEXTURE_2D, 0);
+    const GLfloat* data = (const GLfloat*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, GL_MAP_READ_BIT);
+    if (data == NULL) {
+        pbo.get()->unbind();
+        THROW_EXCEPTION("Failed to map eigenvalues");
+    }
     
     float eig = -std::numeric_limits<float>().max();
     
@@ -212,6 +618,8 @@ float SimulatorGLEuler::computeDt(TextureFBO* Qn){
             eig = glm::max(eig, data[k]);
         }
     }
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    pbo.get()->unbind();
     float dx = 1.0f/(float)Nx;
     float dy = 1.0f/(float)Ny;
     float dt = CFL*glm::min(dx/eig,dy/eig);
@@ -220,6 +628,7 @@ float SimulatorGLEuler::computeDt(TextureFBO* Qn){
 }
 
 void SimulatorGLEuler::reconstruct(TextureFBO* Qn){
+    pass_timer[PASS_RECONSTRUCT]->begin();
     reconstructKernel->bind();
     glViewport(0, 0, Nx, Ny);
     bilinear_recon->use();
@@ -241,9 +650,11 @@ void SimulatorGLEuler::reconstruct(TextureFBO* Qn){
     
     bilinear_recon->disuse();
     reconstructKernel->unbind();
+    pass_timer[PASS_RECONSTRUCT]->end();
 }
 
 void SimulatorGLEuler::evaluateFluxes(TextureFBO* Qn){
+    pass_timer[PASS_FLUX]->begin();
     fluxKernel->bind();
     glViewport(0, 0, Nx, Ny);
     flux_evaluator->use();
@@ -268,6 +679,7 @@ void SimulatorGLEuler::evaluateFluxes(TextureFBO* Qn){
     
     flux_evaluator->disuse();
     fluxKernel->unbind();
+    pass_timer[PASS_FLUX]->end();
 }
 
 void SimulatorGLEuler::computeRK(size_t n, float dt){
@@ -286,6 +698,7 @@ void SimulatorGLEuler::computeRK(size_t n, float dt){
             glm::vec2(0.333f,0.666f)}
     };
     
+    pass_timer[PASS_RK]->begin();
     kernelRK[n]->bind();
     glViewport(0, 0, Nx, Ny);
     runge_kutta->use();
@@ -319,9 +732,11 @@ void SimulatorGLEuler::computeRK(size_t n, float dt){
     
     runge_kutta->disuse();
     kernelRK[n]->unbind();
+    pass_timer[PASS_RK]->end();
 }
 
 void SimulatorGLEuler::copyTexture(GLint source, TextureFBO* dest){
+    pass_timer[PASS_COPY]->begin();
     dest->bind();
     glViewport(0, 0, Nx, Ny);
     
@@ -340,6 +755,7 @@ void SimulatorGLEuler::copyTexture(GLint source, TextureFBO* dest){
     copy->disuse();
     dest->unbind();
     glBindTexture(GL_TEXTURE_2D, 0);
+    pass_timer[PASS_COPY]->end();
     
     CHECK_GL_ERRORS();
 }
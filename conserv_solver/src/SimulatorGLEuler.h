@@ -12,6 +12,7 @@
 #include "GLUtils.hpp"
 #include "SimulatorBase.h"
 #include "Timer.hpp"
+#include "GPUTimer.hpp"
 
 #include "glm/glm.hpp"
 #include "TextureFBO.h"
@@ -51,6 +52,12 @@ public:
      */
     virtual std::vector<float> getData();
     
+    /**
+     * Read back a decimated subregion with selected components
+     */
+    virtual std::vector<float> getRegion(size_t x0, size_t y0, size_t w, size_t h,
+                                         size_t stride = 1, unsigned int fields = FIELD_ALL);
+    
     /**
      * Return the size of the grid
      */
@@ -65,6 +72,61 @@ public:
      * Returns time
      */
     virtual float getTime(){return time;}
+    
+    /**
+     * Allocate pixel buffer objects used as staging slots
+     */
+    virtual void createStaging(size_t slots);
+    
+    /**
+     * Start a non-blocking download into a staging slot
+     */
+    virtual void beginDownload(size_t slot);
+    
+    /**
+     * Returns slot data once the download has completed
+     */
+    virtual const float* pollDownload(size_t slot);
+    
+    /**
+     * Release a staging slot
+     */
+    virtual void endDownload(size_t slot);
+    
+    /**
+     * Device side conservation and range diagnostics
+     */
+    virtual SimDiagnostics getDiagnostics();
+    
+    /**
+     * Average device time of a step
+     */
+    virtual double getDeviceTime(){return device_timer->average();}
+    
+    /**
+     * Modelled cost and measured time of the step passes
+     */
+    virtual std::vector<KernelProfile> getKernelProfile();
+    
+    /**
+     * Triad bandwidth measured with a fragment pass
+     */
+    virtual double measureBandwidth();
+    
+    /**
+     * Create the probe cell texture and the ring buffer texture
+     */
+    virtual void createProbes(const std::vector<glm::ivec2>& cells, size_t capacity);
+    
+    /**
+     * Render every probe into one row of the ring texture
+     */
+    virtual void sampleProbes(size_t slot);
+    
+    /**
+     * Read a run of ring rows back to the host
+     */
+    virtual void readProbes(size_t first, size_t count, float* out);
 private:
     /**
 	 * Compiles, attaches, links, and sets uniforms for
@@ -129,6 +191,11 @@ private:
     
     // Timer
     Timer   timer;
+    GLTimer* device_timer;
+    
+    // Timers of the individual passes, for the roofline profile
+    enum Pass{PASS_COPY, PASS_EIGENVALUE, PASS_RECONSTRUCT, PASS_FLUX, PASS_RK, PASS_COUNT};
+    GLTimer* pass_timer[PASS_COUNT];
     
     GLUtils::Program* runge_kutta;
     GLUtils::Program* bilinear_recon;
@@ -136,6 +203,10 @@ private:
     GLUtils::Program* copy;
     GLUtils::Program* eigen;
     GLUtils::Program* initialK;
+    GLUtils::Program* reduce;
+    GLUtils::Program* decimate;
+    GLUtils::Program* probe;
+    GLUtils::Program* stream;
     
     GLUtils::BO<GL_ARRAY_BUFFER>* vert;
     GLUtils::BO<GL_ELEMENT_ARRAY_BUFFER>* ind;
@@ -145,7 +216,25 @@ private:
     TextureFBO* fluxKernel;
     TextureFBO* dtKernel;
     
+    // Diagnostics pyramid, each level halves the one above (sum, min, max)
+    std::vector<TextureFBO*> reduceKernel;
+    
+    // Decimated region, recreated when the requested size changes
+    TextureFBO* regionKernel;
+    
+    // Probe cells (probes x 1) and the ring they are sampled into (probes x capacity)
+    TextureFBO* probeCells;
+    TextureFBO* probeRing;
+    
     GLuint vao[2];
+    
+    // Pixel buffers for readback, reused across steps
+    GLUtils::PackPool*                              pack_pool;
+    
+    // Pool buffers for asynchronous readback, mapped while the host reads them
+    std::vector<GLUtils::BO<GL_PIXEL_PACK_BUFFER>*> staging;
+    std::vector<GLsync>                             staging_fence;
+    std::vector<float*>                             staging_ptr;
 
 };
 
@@ -0,0 +1,452 @@
+//
+//  SnapshotFile
+//  GLAppNative
+//
+//  Created by Jens Kristoffer Reitan Markussen on 28.12.13.
+//  Copyright (c) 2013 Jens Kristoffer Reitan Markussen. All rights reserved.
+//
+
+#include "SnapshotFile.h"
+#include "SimException.h"
+#include "Timer.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+SnapshotFileWriter::SnapshotFileWriter(std::string file, size_t Nx, size_t Ny, size_t tile, bool append,
+                                       const SnapshotCompression& compression){
+    memset(&header, 0, sizeof(SnapshotFileHeader));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header.version      = SNAPSHOT_VERSION;
+    header.Nx           = Nx;
+    header.Ny           = Ny;
+    header.components   = 4;
+    header.tile_width   = tile;
+    header.tile_height  = tile;
+    header.tiles_x      = (Nx+tile-1)/tile;
+    header.tiles_y      = (Ny+tile-1)/tile;
+    header.keyframe_interval = std::max<size_t>(1, compression.keyframe_interval);
+    for (size_t i = 0; i < 4; i++) {
+        header.error_bound[i] = compression.error_bound[i];
+    }
+
+    this->compression = compression;
+    pool = NULL;
+    frames_since_key = 0;
+
+    bytes_written = 0;
+    raw_bytes = 0;
+    compress_time = 0.0;
+
+    fd = open(file.c_str(), O_RDWR | O_CREAT | (append ? 0 : O_TRUNC), 0644);
+    if (fd < 0) {
+        std::stringstream ss;
+        ss << "Could not open " << file << ": " << strerror(errno);
+        THROW_EXCEPTION(ss.str());
+    }
+
+    SnapshotFileHeader existing;
+    if (append && pread(fd, &existing, sizeof(SnapshotFileHeader), 0) == sizeof(SnapshotFileHeader)) {
+        reopen(existing);
+    } else {
+        writeAll(&header, sizeof(SnapshotFileHeader));
+        end = sizeof(SnapshotFileHeader);
+    }
+
+    pool = new ThreadPool(compression.threads);
+}
+
+SnapshotFileWriter::~SnapshotFileWriter(){
+    close();
+    delete pool;
+}
+
+void SnapshotFileWriter::reopen(const SnapshotFileHeader& existing){
+    if (memcmp(existing.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0 ||
+        existing.version < SNAPSHOT_VERSION_RAW || existing.version > SNAPSHOT_VERSION) {
+        THROW_EXCEPTION("Not a snapshot file");
+    }
+    if (existing.Nx != header.Nx || existing.Ny != header.Ny ||
+        existing.tile_width != header.tile_width || existing.tile_height != header.tile_height) {
+        THROW_EXCEPTION("Snapshot file geometry does not match the simulation");
+    }
+
+    if (existing.version == SNAPSHOT_VERSION_RAW) {
+        // Raw chunks do not depend on the bounds, new frames may be
+        // compressed so older readers must no longer accept the file
+        if (pwrite(fd, &header, sizeof(SnapshotFileHeader), 0) != sizeof(SnapshotFileHeader)) {
+            THROW_EXCEPTION("Failed to upgrade snapshot file header");
+        }
+    } else {
+        // Chunks already in the file were written with these bounds
+        header.keyframe_interval = existing.keyframe_interval;
+        for (size_t i = 0; i < 4; i++) {
+            header.error_bound[i] = existing.error_bound[i];
+        }
+    }
+
+    struct stat st;
+    fstat(fd, &st);
+    uint64_t length = st.st_size;
+
+    SnapshotFileTrailer trailer;
+    bool indexed = false;
+    if (length >= sizeof(SnapshotFileHeader) + sizeof(SnapshotFileTrailer) &&
+        pread(fd, &trailer, sizeof(SnapshotFileTrailer), length-sizeof(SnapshotFileTrailer)) == sizeof(SnapshotFileTrailer) &&
+        memcmp(trailer.magic, SNAPSHOT_END_MAGIC, sizeof(SNAPSHOT_END_MAGIC)) == 0 &&
+        trailer.index_offset + trailer.frames*sizeof(SnapshotIndexEntry) + sizeof(SnapshotFileTrailer) == length) {
+        index.resize(trailer.frames);
+        size_t bytes = trailer.frames*sizeof(SnapshotIndexEntry);
+        indexed = (bytes == 0 || pread(fd, &index[0], bytes, trailer.index_offset) == (ssize_t)bytes);
+        end = trailer.index_offset;
+    }
+
+    if (!indexed) {
+        // No usable trailer, walk the frames and keep every complete one
+        index.clear();
+        end = sizeof(SnapshotFileHeader);
+
+        SnapshotFrameHeader frame;
+        while (end + sizeof(SnapshotFrameHeader) <= length &&
+               pread(fd, &frame, sizeof(SnapshotFrameHeader), end) == sizeof(SnapshotFrameHeader) &&
+               memcmp(frame.magic, SNAPSHOT_FRAME_MAGIC, sizeof(SNAPSHOT_FRAME_MAGIC)) == 0 &&
+               end + frame.bytes <= length) {
+            SnapshotIndexEntry entry = {frame.step, frame.time, frame.dt, 0, end, frame.bytes};
+            index.push_back(entry);
+            end += frame.bytes;
+        }
+    }
+
+    // Drop the old index, it is rewritten on close
+    if (ftruncate(fd, end) != 0) {
+        THROW_EXCEPTION("Failed to truncate snapshot file");
+    }
+    lseek(fd, end, SEEK_SET);
+}
+
+void SnapshotFileWriter::append(uint64_t step, double time, float dt, const float* data){
+    size_t Nx = header.Nx;
+    size_t Ny = header.Ny;
+    size_t tw = header.tile_width;
+    size_t th = header.tile_height;
+    size_t tile = tw*th;
+    size_t tiles = header.tiles_x*header.tiles_y;
+    size_t chunks = header.components*tiles;
+
+    planar.resize(chunks*tile);
+    prev.resize(chunks*tile);
+    recon.resize(chunks*tile);
+    chunk_data.resize(chunks);
+    chunk_codec.resize(chunks);
+
+    bool key = !compression.delta || frames_since_key == 0;
+    frames_since_key = (frames_since_key+1) % header.keyframe_interval;
+
+    Timer timer;
+
+    // Transpose interleaved float4 into planar tiles and encode them, one tile per task
+    pool->parallelFor(tiles, [&](size_t t){
+        size_t tx = t % header.tiles_x;
+        size_t ty = t / header.tiles_x;
+
+        size_t chunk[4];
+        float* dst[4];
+        for (size_t c = 0; c < 4; c++) {
+            chunk[c] = (c*header.tiles_y + ty)*header.tiles_x + tx;
+            dst[c] = &planar[chunk[c]*tile];
+        }
+
+        size_t w = std::min(tw, Nx-tx*tw);
+        size_t h = std::min(th, Ny-ty*th);
+        if (w < tw || h < th) {
+            for (size_t c = 0; c < 4; c++) {
+                std::fill(dst[c], dst[c]+tile, 0.0f);
+            }
+        }
+
+        for (size_t y = 0; y < h; y++) {
+            const float* src = data + ((ty*th+y)*Nx + tx*tw)*4;
+            for (size_t x = 0; x < w; x++) {
+                dst[0][y*tw+x] = src[x*4+0];
+                dst[1][y*tw+x] = src[x*4+1];
+                dst[2][y*tw+x] = src[x*4+2];
+                dst[3][y*tw+x] = src[x*4+3];
+            }
+        }
+
+        for (size_t c = 0; c < 4; c++) {
+            size_t i = chunk[c];
+            chunk_codec[i] = encodeTile(dst[c], key ? NULL : &prev[i*tile], tile,
+                                        header.error_bound[c], compression.entropy,
+                                        chunk_data[i], &recon[i*tile]);
+        }
+    });
+
+    // The next frame is a delta against what a reader will reconstruct
+    std::swap(prev, recon);
+
+    compress_time += timer.elapsed();
+    raw_bytes += Nx*Ny*header.components*sizeof(float);
+
+    size_t table = sizeof(SnapshotFrameHeader) + chunks*sizeof(SnapshotChunk);
+    size_t bytes = table;
+    for (size_t i = 0; i < chunks; i++) {
+        bytes += chunk_data[i].size();
+    }
+
+    frame.resize(bytes);
+
+    SnapshotFrameHeader* fh = (SnapshotFrameHeader*)&frame[0];
+    memcpy(fh->magic, SNAPSHOT_FRAME_MAGIC, sizeof(SNAPSHOT_FRAME_MAGIC));
+    fh->chunks      = chunks;
+    fh->step        = step;
+    fh->time        = time;
+    fh->dt          = dt;
+    fh->reserved    = 0;
+    fh->bytes       = bytes;
+
+    SnapshotChunk* chunk = (SnapshotChunk*)(fh+1);
+    size_t offset = table;
+    for (size_t i = 0; i < chunks; i++) {
+        chunk[i].offset = offset;
+        chunk[i].bytes  = chunk_data[i].size();
+        chunk[i].codec  = chunk_codec[i];
+        memcpy(&frame[offset], chunk_data[i].data(), chunk_data[i].size());
+        offset += chunk_data[i].size();
+    }
+
+    writeAll(&frame[0], bytes);
+
+    SnapshotIndexEntry entry = {step, time, dt, 0, end, bytes};
+    index.push_back(entry);
+    end += bytes;
+}
+
+void SnapshotFileWriter::close(){
+    if (fd < 0) {
+        return;
+    }
+
+    SnapshotFileTrailer trailer;
+    trailer.index_offset = end;
+    trailer.frames = index.size();
+    memcpy(trailer.magic, SNAPSHOT_END_MAGIC, sizeof(SNAPSHOT_END_MAGIC));
+
+    if (!index.empty()) {
+        writeAll(&index[0], index.size()*sizeof(SnapshotIndexEntry));
+    }
+    writeAll(&trailer, sizeof(SnapshotFileTrailer));
+
+    ::close(fd);
+    fd = -1;
+}
+
+void SnapshotFileWriter::writeAll(const void* data, size_t bytes){
+    const char* ptr = (const char*)data;
+    bytes_written += bytes;
+    while (bytes > 0) {
+        ssize_t n = write(fd, ptr, bytes);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::stringstream ss;
+            ss << "Snapshot write failed: " << strerror(errno);
+            THROW_EXCEPTION(ss.str());
+        }
+        ptr += n;
+        bytes -= n;
+    }
+}
+
+SnapshotFileReader::SnapshotFileReader(std::string file){
+    fd = open(file.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::stringstream ss;
+        ss << "Could not open " << file << ": " << strerror(errno);
+        THROW_EXCEPTION(ss.str());
+    }
+
+    struct stat st;
+    fstat(fd, &st);
+    length = st.st_size;
+
+    if (length < sizeof(SnapshotFileHeader)) {
+        ::close(fd);
+        THROW_EXCEPTION("Not a snapshot file");
+    }
+
+    void* ptr = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+    if (ptr == MAP_FAILED) {
+        ::close(fd);
+        THROW_EXCEPTION("Failed to map snapshot file");
+    }
+    base = (const char*)ptr;
+
+    // Records in the file are packed, copy them out rather than casting
+    memcpy(&header, base, sizeof(SnapshotFileHeader));
+
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0 ||
+        header.version < SNAPSHOT_VERSION_RAW || header.version > SNAPSHOT_VERSION) {
+        munmap((void*)base, length);
+        ::close(fd);
+        THROW_EXCEPTION("Not a snapshot file");
+    }
+    if (header.version == SNAPSHOT_VERSION_RAW) {
+        // Raw frames only, each one stands on its own
+        header.keyframe_interval = 1;
+        for (size_t i = 0; i < 4; i++) {
+            header.error_bound[i] = 0.0f;
+        }
+    }
+
+    SnapshotFileTrailer trailer;
+    memset(&trailer, 0, sizeof(SnapshotFileTrailer));
+    if (length >= sizeof(SnapshotFileHeader) + sizeof(SnapshotFileTrailer)) {
+        memcpy(&trailer, base + length - sizeof(SnapshotFileTrailer), sizeof(SnapshotFileTrailer));
+    }
+
+    if (memcmp(trailer.magic, SNAPSHOT_END_MAGIC, sizeof(SNAPSHOT_END_MAGIC)) == 0 &&
+        trailer.index_offset + trailer.frames*sizeof(SnapshotIndexEntry) + sizeof(SnapshotFileTrailer) == length) {
+        index.resize(trailer.frames);
+        if (trailer.frames > 0) {
+            memcpy(&index[0], base + trailer.index_offset, trailer.frames*sizeof(SnapshotIndexEntry));
+        }
+    } else {
+        recoverIndex();
+    }
+
+    size_t chunks = header.components*header.tiles_x*header.tiles_y;
+    cached_frame.assign(chunks, (size_t)-1);
+    cache.resize(chunks);
+}
+
+SnapshotFileReader::~SnapshotFileReader(){
+    munmap((void*)base, length);
+    ::close(fd);
+}
+
+void SnapshotFileReader::recoverIndex(){
+    uint64_t offset = sizeof(SnapshotFileHeader);
+
+    while (offset + sizeof(SnapshotFrameHeader) <= length) {
+        SnapshotFrameHeader frame;
+        memcpy(&frame, base + offset, sizeof(SnapshotFrameHeader));
+        if (memcmp(frame.magic, SNAPSHOT_FRAME_MAGIC, sizeof(SNAPSHOT_FRAME_MAGIC)) != 0 ||
+            offset + frame.bytes > length) {
+            break;
+        }
+
+        SnapshotIndexEntry entry = {frame.step, frame.time, frame.dt, 0, offset, frame.bytes};
+        index.push_back(entry);
+        offset += frame.bytes;
+    }
+}
+
+SnapshotFrameHeader SnapshotFileReader::frameAt(uint64_t offset){
+    if (offset + sizeof(SnapshotFrameHeader) > length) {
+        THROW_EXCEPTION("Frame offset outside of file");
+    }
+
+    SnapshotFrameHeader frame;
+    memcpy(&frame, base + offset, sizeof(SnapshotFrameHeader));
+    if (memcmp(frame.magic, SNAPSHOT_FRAME_MAGIC, sizeof(SNAPSHOT_FRAME_MAGIC)) != 0 ||
+        offset + frame.bytes > length) {
+        THROW_EXCEPTION("Corrupt frame");
+    }
+
+    return frame;
+}
+
+SnapshotChunk SnapshotFileReader::chunkAt(size_t frame, size_t chunk){
+    uint64_t offset = index.at(frame).offset;
+    SnapshotFrameHeader fh = frameAt(offset);
+    if (chunk >= fh.chunks ||
+        sizeof(SnapshotFrameHeader) + fh.chunks*sizeof(SnapshotChunk) > fh.bytes) {
+        THROW_EXCEPTION("Corrupt frame");
+    }
+
+    SnapshotChunk c;
+    memcpy(&c, base + offset + sizeof(SnapshotFrameHeader) + chunk*sizeof(SnapshotChunk), sizeof(SnapshotChunk));
+    if (c.offset + c.bytes > fh.bytes) {
+        THROW_EXCEPTION("Corrupt frame");
+    }
+    return c;
+}
+
+const float* SnapshotFileReader::getTile(size_t frame, size_t field, size_t tx, size_t ty){
+    if (field >= header.components || tx >= header.tiles_x || ty >= header.tiles_y) {
+        THROW_EXCEPTION("Tile out of range");
+    }
+
+    size_t chunk = (field*header.tiles_y + ty)*header.tiles_x + tx;
+    size_t tile = header.tile_width*header.tile_height;
+
+    // Raw tiles are used in place when they happen to be float aligned
+    SnapshotChunk c = chunkAt(frame, chunk);
+    const char* data = base + index[frame].offset + c.offset;
+    if (c.codec == CODEC_RAW && c.bytes == tile*sizeof(float) && (uintptr_t)data % sizeof(float) == 0) {
+        return (const float*)data;
+    }
+
+    if (cached_frame[chunk] == frame) {
+        return cache[chunk].data();
+    }
+
+    // Walk back to the key frame of the delta chain, or to the cached frame
+    size_t first = frame;
+    while (chunkAt(first, chunk).codec & CODEC_DELTA) {
+        if (first == 0) {
+            THROW_EXCEPTION("Delta chain without a key frame");
+        }
+        if (cached_frame[chunk] == first-1) {
+            break;
+        }
+        first--;
+    }
+
+    cache[chunk].resize(tile);
+    scratch.resize(tile);
+    for (size_t f = first; f <= frame; f++) {
+        SnapshotChunk fc = chunkAt(f, chunk);
+        decodeTile(base + index[f].offset + fc.offset, fc.bytes, fc.codec,
+                   cache[chunk].data(), tile, header.error_bound[field], scratch.data());
+        cache[chunk].swap(scratch);
+        cached_frame[chunk] = f;
+    }
+
+    return cache[chunk].data();
+}
+
+void SnapshotFileReader::readRegion(size_t frame, size_t field, size_t x0, size_t y0,
+                                    size_t w, size_t h, float* out){
+    if (x0 + w > header.Nx || y0 + h > header.Ny) {
+        THROW_EXCEPTION("Region outside of domain");
+    }
+
+    size_t tw = header.tile_width;
+    size_t th = header.tile_height;
+
+    for (size_t ty = y0/th; ty*th < y0+h; ty++) {
+        for (size_t tx = x0/tw; tx*tw < x0+w; tx++) {
+            const float* tile = getTile(frame, field, tx, ty);
+
+            // Overlap of this tile with the region, in global coordinates
+            size_t xb = std::max(x0, tx*tw);
+            size_t xe = std::min(x0+w, (tx+1)*tw);
+            size_t yb = std::max(y0, ty*th);
+            size_t ye = std::min(y0+h, (ty+1)*th);
+
+            for (size_t y = yb; y < ye; y++) {
+                memcpy(out + (y-y0)*w + (xb-x0),
+                       tile + (y-ty*th)*tw + (xb-tx*tw),
+                       (xe-xb)*sizeof(float));
+            }
+        }
+    }
+}
@@ -0,0 +1,230 @@
+//
+//  SnapshotFile
+//  GLAppNative
+//
+//  Created by Jens Kristoffer Reitan Markussen on 28.12.13.
+//  Copyright (c) 2013 Jens Kristoffer Reitan Markussen. All rights reserved.
+//
+
+#ifndef GLAppNative_SnapshotFile_h
+#define GLAppNative_SnapshotFile_h
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "TileCodec.h"
+#include "ThreadPool.hpp"
+
+/**
+ *  Append-only time-series container for simulation output.
+ *
+ *  [file header][frame 0][frame 1]...[index entries][trailer]
+ *
+ *  Every frame holds a frame header, a chunk table and one chunk per
+ *  (field, tile). Fields are stored planar in fixed-size tiles, edge tiles
+ *  are zero padded, so any subregion can be read without touching the rest
+ *  of the frame. The trailer points at the frame index; if it is missing
+ *  (the run was killed) readers recover the index by walking the frames.
+ *  All values are stored in host (little-endian) byte order.
+ *
+ *  Chunks can be compressed independently (see TileCodec). Temporal deltas
+ *  chain a chunk to the same chunk of the previous frame, a key frame
+ *  without deltas is written every keyframe_interval frames to bound the
+ *  work of random access.
+ */
+
+static const char SNAPSHOT_MAGIC[8]         = {'C','S','N','A','P','0','1','\0'};
+static const char SNAPSHOT_FRAME_MAGIC[4]   = {'F','R','M','E'};
+static const char SNAPSHOT_END_MAGIC[8]     = {'C','S','N','A','P','E','N','D'};
+static const uint32_t SNAPSHOT_VERSION      = 2;
+
+// Version 1 files predate compression, every chunk is raw and the header
+// fields from keyframe_interval on were reserved and zero
+static const uint32_t SNAPSHOT_VERSION_RAW  = 1;
+
+struct SnapshotFileHeader{
+    char magic[8];
+    uint32_t version;
+    uint32_t Nx;
+    uint32_t Ny;
+    uint32_t components;
+    uint32_t tile_width;
+    uint32_t tile_height;
+    uint32_t tiles_x;
+    uint32_t tiles_y;
+    uint32_t keyframe_interval;
+    float error_bound[4];   // per field, 0 is lossless
+};
+
+struct SnapshotFrameHeader{
+    char magic[4];
+    uint32_t chunks;
+    uint64_t step;
+    double time;
+    float dt;
+    uint32_t reserved;
+    uint64_t bytes;
+};
+
+struct SnapshotChunk{
+    uint64_t offset;    // relative to the start of the frame
+    uint32_t bytes;
+    uint32_t codec;
+};
+
+struct SnapshotIndexEntry{
+    uint64_t step;
+    double time;
+    float dt;
+    uint32_t reserved;
+    uint64_t offset;
+    uint64_t bytes;
+};
+
+struct SnapshotFileTrailer{
+    uint64_t index_offset;
+    uint64_t frames;
+    char magic[8];
+};
+
+struct SnapshotCompression{
+    SnapshotCompression() : entropy(false), delta(false), keyframe_interval(16), threads(0) {
+        for (size_t i = 0; i < 4; i++) {
+            error_bound[i] = 0.0f;
+        }
+    }
+
+    bool entropy;               // byte shuffle and rANS
+    bool delta;                 // temporal delta against the previous frame
+    size_t keyframe_interval;
+    float error_bound[4];       // per field, 0 is lossless
+    size_t threads;             // compression threads, 0 uses every core
+};
+
+class SnapshotFileWriter{
+public:
+    /**
+	 * Creates the file. With append set, an existing file of the same
+     * geometry is reopened and new frames are added after its last frame.
+     * Error bounds of a reopened file take precedence over compression
+	 */
+	SnapshotFileWriter(std::string file, size_t Nx, size_t Ny, size_t tile = 64, bool append = false,
+                       const SnapshotCompression& compression = SnapshotCompression());
+
+	/**
+	 * Destructor, writes the index if close() was not called
+	 */
+	~SnapshotFileWriter();
+
+    /**
+     * Append one frame of Nx*Ny interleaved float4 values
+     */
+    void append(uint64_t step, double time, float dt, const float* data);
+
+    /**
+     * Write the frame index and trailer
+     */
+    void close();
+
+    uint64_t getBytesWritten(){return bytes_written;}
+    uint64_t getRawBytes(){return raw_bytes;}
+    double getCompressTime(){return compress_time;}
+
+private:
+    /**
+     * Loads the index of an existing file and truncates it before the index
+     */
+    void reopen(const SnapshotFileHeader& existing);
+
+    /**
+     * Write the whole buffer, retrying on short writes
+     */
+    void writeAll(const void* data, size_t bytes);
+
+private:
+    int fd;
+    uint64_t end;
+    uint64_t bytes_written;
+
+    SnapshotFileHeader header;
+    std::vector<SnapshotIndexEntry> index;
+
+    SnapshotCompression compression;
+    ThreadPool* pool;
+    size_t frames_since_key;
+
+    uint64_t raw_bytes;
+    double compress_time;
+
+    // Planar tiles of the current frame and the reconstruction of the last
+    std::vector<float> planar;
+    std::vector<float> prev;
+    std::vector<float> recon;
+
+    // Encoded chunks and the assembled frame
+    std::vector<std::vector<char> > chunk_data;
+    std::vector<uint32_t> chunk_codec;
+    std::vector<char> frame;
+};
+
+class SnapshotFileReader{
+public:
+    /**
+	 * Maps the file read-only
+	 */
+	SnapshotFileReader(std::string file);
+
+	/**
+	 * Destructor
+	 */
+	~SnapshotFileReader();
+
+    size_t getFrameCount(){return index.size();}
+    const SnapshotIndexEntry& getFrame(size_t i){return index.at(i);}
+    const SnapshotFileHeader& getHeader(){return header;}
+
+    /**
+     * Returns a tile of one field, tile_width*tile_height floats. Compressed
+     * tiles are decoded into a cache, valid until the same tile is requested
+     * for another frame
+     */
+    const float* getTile(size_t frame, size_t field, size_t tx, size_t ty);
+
+    /**
+     * Copies a w*h region of one field into out, row by row
+     */
+    void readRegion(size_t frame, size_t field, size_t x0, size_t y0,
+                    size_t w, size_t h, float* out);
+
+private:
+    /**
+     * Rebuilds the index by walking the frames when the trailer is missing
+     */
+    void recoverIndex();
+
+    /**
+     * Returns a copy of the frame header after validating it lies within the file
+     */
+    SnapshotFrameHeader frameAt(uint64_t offset);
+
+    /**
+     * Chunk table entry of a chunk in a frame
+     */
+    SnapshotChunk chunkAt(size_t frame, size_t chunk);
+
+private:
+    int fd;
+    const char* base;
+    size_t length;
+
+    SnapshotFileHeader header;
+    std::vector<SnapshotIndexEntry> index;
+
+    // Last decoded frame of every chunk, delta chains continue from here
+    std::vector<size_t> cached_frame;
+    std::vector<std::vector<float> > cache;
+    std::vector<float> scratch;
+};
+
+#endif
@@ -0,0 +1,152 @@
+//
+//  SnapshotWriter
+//  GLAppNative
+//
+//  Created by Jens Kristoffer Reitan Markussen on 28.12.13.
+//  Copyright (c) 2013 Jens Kristoffer Reitan Markussen. All rights reserved.
+//
+
+#include "SnapshotWriter.h"
+#include "SimException.h"
+#include "Timer.hpp"
+#include "Trace.h"
+
+#include <chrono>
+
+SnapshotWriter::SnapshotWriter(SimulatorBase* sim, std::string file, size_t interval,
+                               const SnapshotCompression& compression, size_t slots) :
+    written(slots), queued(slots){
+    this->sim = sim;
+    this->interval = interval;
+
+    frames_written = 0;
+    frames_dropped = 0;
+    failed = false;
+    write_time = 0.0;
+
+    // Staging belongs to the simulator, so create it before anything that
+    // would leak if it throws
+    sim->createStaging(slots);
+
+    glm::ivec2 size = sim->getGridSize();
+    this->file = new SnapshotFileWriter(file, size.x, size.y, 64, false, compression);
+
+    this->slots.resize(slots);
+    for (size_t i = 0; i < slots; i++) {
+        free_slots.push_back(i);
+    }
+
+    running = true;
+    writer = std::thread(&SnapshotWriter::run, this);
+}
+
+SnapshotWriter::~SnapshotWriter(){
+    finish();
+    delete file;
+}
+
+void SnapshotWriter::update(size_t step, const SimDetail& detail){
+    if (failed) {
+        THROW_EXCEPTION(error);
+    }
+
+    collect();
+
+    // Snapshot whenever the call crossed a multiple of the interval
+    if (step/interval == (step-detail.steps)/interval) {
+        return;
+    }
+
+    if (free_slots.empty()) {
+        frames_dropped++;
+        return;
+    }
+
+    size_t slot = free_slots.back();
+    free_slots.pop_back();
+
+    Frame& frame = slots[slot];
+    frame.slot = slot;
+    frame.step = step;
+    frame.time = detail.time;
+    frame.dt = detail.dt;
+    frame.data = NULL;
+
+    {
+        TRACE_ZONE("begin download");
+        sim->beginDownload(slot);
+    }
+    pending.push_back(slot);
+}
+
+void SnapshotWriter::finish(){
+    if (!writer.joinable()) {
+        return;
+    }
+
+    while (!failed && free_slots.size() < slots.size()) {
+        collect();
+        std::this_thread::yield();
+    }
+
+    running = false;
+    writer.join();
+
+    file->close();
+}
+
+void SnapshotWriter::collect(){
+    Frame frame;
+    while (written.pop(frame)) {
+        sim->endDownload(frame.slot);
+        free_slots.push_back(frame.slot);
+    }
+
+    // Downloads complete in issue order, so only the oldest needs polling
+    while (!pending.empty()) {
+        Frame& next = slots[pending.front()];
+        next.data = sim->pollDownload(next.slot);
+        if (next.data == NULL) {
+            break;
+        }
+        queued.push(next);
+        pending.pop_front();
+    }
+}
+
+void SnapshotWriter::run(){
+    Trace::setThreadName("snapshot writer");
+    try {
+        writeFrames();
+    } catch (std::exception& e) {
+        // Reported on the simulation thread by the next update()
+        error = e.what();
+        failed = true;
+    }
+}
+
+void SnapshotWriter::writeFrames(){
+    Timer timer;
+    Frame frame;
+
+    while (true) {
+        if (!queued.pop(frame)) {
+            if (!running) {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+
+        timer.restart();
+        {
+            TRACE_ZONE("write snapshot");
+            file->append(frame.step, frame.time, frame.dt, frame.data);
+        }
+        write_time += timer.elapsed();
+
+        frames_written++;
+
+        written.push(frame);
+    }
+}
@@ -0,0 +1,107 @@
+//
+//  SnapshotWriter
+//  GLAppNative
+//
+//  Created by Jens Kristoffer Reitan Markussen on 28.12.13.
+//  Copyright (c) 2013 Jens Kristoffer Reitan Markussen. All rights reserved.
+//
+
+#ifndef GLAppNative_SnapshotWriter_h
+#define GLAppNative_SnapshotWriter_h
+
+#include "SimulatorBase.h"
+#include "SPSCQueue.hpp"
+#include "SnapshotFile.h"
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <atomic>
+
+/**
+ *  Periodic field output that never blocks the simulation. Downloads are
+ *  issued into a ring of staging slots owned by the simulator, finished
+ *  frames are handed to a writer thread through a lock-free queue, and the
+ *  writer hands the slots back the same way. If every slot is busy the
+ *  frame is dropped rather than stalling the step. Frames are stored in a
+ *  SnapshotFile container.
+ */
+class SnapshotWriter{
+public:
+    /**
+	 * Constructor
+	 */
+	SnapshotWriter(SimulatorBase* sim, std::string file, size_t interval,
+                   const SnapshotCompression& compression = SnapshotCompression(), size_t slots = 3);
+
+	/**
+	 * Destructor, flushes outstanding frames
+	 */
+	~SnapshotWriter();
+
+    /**
+     * Called once per step from the simulation thread
+     */
+    void update(size_t step, const SimDetail& detail);
+
+    /**
+     * Waits for all outstanding frames and stops the writer thread
+     */
+    void finish();
+
+    size_t getFramesWritten(){return frames_written;}
+    size_t getFramesDropped(){return frames_dropped;}
+    size_t getBytesWritten(){return file->getBytesWritten();}
+    size_t getRawBytes(){return file->getRawBytes();}
+    double getCompressTime(){return file->getCompressTime();}
+    double getWriteTime(){return write_time;}
+
+private:
+    struct Frame{
+        size_t slot;
+        size_t step;
+        float time;
+        float dt;
+        const float* data;
+    };
+
+    /**
+     * Hands written slots back and queues completed downloads
+     */
+    void collect();
+
+    /**
+     * Writer thread entry point
+     */
+    void run();
+
+    /**
+     * Drains the queue until the writer is stopped
+     */
+    void writeFrames();
+
+private:
+    SimulatorBase* sim;
+    size_t interval;
+
+    SnapshotFileWriter* file;
+
+    std::vector<Frame>  slots;
+    std::vector<size_t> free_slots;
+    std::deque<size_t>  pending;
+
+    SPSCQueue<Frame>    written;
+    SPSCQueue<Frame>    queued;
+
+    std::thread         writer;
+    std::atomic<bool>   running;
+    std::atomic<bool>   failed;
+    std::string         error;
+
+    size_t              frames_written;
+    size_t              frames_dropped;
+    double              write_time;
+};
+
+#endif
@@ -0,0 +1,111 @@
+#ifndef _STAGING_POOL_HPP__
+#define _STAGING_POOL_HPP__
+
+#include <vector>
+
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#else
+#include <cl.h>
+#endif
+
+namespace CLUtils {
+    
+    /**
+     * Pinned host buffers for transfers, mapped once and handed out again
+     * after they are given back, so hot paths neither allocate nor fault
+     * pages in. Sizes are rounded up to whole pages and a request gets the
+     * smallest free buffer that fits.
+     */
+    class StagingPool {
+    public:
+        typedef MO<CL_MEM_READ_WRITE|CL_MEM_ALLOC_HOST_PTR> Pinned;
+        
+        /**
+         * Buffer borrowed for a scope
+         */
+        class Lease {
+        public:
+            Lease(StagingPool& pool, size_t bytes) : pool(pool) {
+                ptr = pool.borrow(bytes);
+            }
+            
+            ~Lease(){
+                pool.giveBack(ptr);
+            }
+            
+            template <typename T>
+            T* get(){
+                return (T*)ptr;
+            }
+            
+        private:
+            Lease(const Lease&);
+            Lease& operator=(const Lease&);
+            
+            StagingPool& pool;
+            void* ptr;
+        };
+        
+        StagingPool(CLcontext& context){
+            this->context = &context;
+        }
+        
+        ~StagingPool(){
+            for (size_t i = 0; i < entries.size(); i++) {
+                entries[i].buffer->unmap(entries[i].ptr);
+                delete entries[i].buffer;
+            }
+        }
+        
+        void* borrow(size_t bytes){
+            static const size_t PAGE = 4096;
+            
+            size_t best = entries.size();
+            for (size_t i = 0; i < entries.size(); i++) {
+                if (!entries[i].used && entries[i].bytes >= bytes &&
+                    (best == entries.size() || entries[i].bytes < entries[best].bytes)) {
+                    best = i;
+                }
+            }
+            
+            if (best == entries.size()) {
+                Entry e;
+                e.bytes = (bytes + PAGE-1)/PAGE*PAGE;
+                e.buffer = new Pinned(*context, e.bytes, NULL, "staging");
+                e.ptr = e.buffer->map(CL_MAP_READ|CL_MAP_WRITE);
+                entries.push_back(e);
+            }
+            
+            entries[best].used = true;
+            return entries[best].ptr;
+        }
+        
+        void giveBack(void* ptr){
+            for (size_t i = 0; i < entries.size(); i++) {
+                if (entries[i].ptr == ptr) {
+                    entries[i].used = false;
+                    return;
+                }
+            }
+            THROW_EXCEPTION("Staging buffer is not from this pool");
+        }
+        
+    private:
+        StagingPool(const StagingPool&);
+        StagingPool& operator=(const StagingPool&);
+        
+        struct Entry{
+            Pinned* buffer;
+            void*   ptr;    // mapped for the lifetime of the pool
+            size_t  bytes;
+            bool    used;
+        };
+        
+        CLcontext* context;
+        std::vector<Entry> entries;
+    };
+    
+};//namespace CLUtils
+
+#endif
@@ -1,10 +1,26 @@
 #include "TextureFBO.h"
 #include "GLUtils.hpp"
+#include "DeviceMemory.hpp"
 
+namespace {
+    // Bytes per texel of the color formats in use, 4 bytes per channel otherwise
+    size_t texelSize(int format){
+        switch (format) {
+            case GL_RGBA8:      return 4;
+            case GL_RGBA16F:    return 8;
+            case GL_R32F:       return 4;
+            case GL_RG32F:      return 8;
+            default:            return 16;
+        }
+    }
+}
 
-TextureFBO::TextureFBO(unsigned int width, unsigned int height, int targets, bool storeDepth, int format) {
+TextureFBO::TextureFBO(unsigned int width, unsigned int height, int targets, Depth depthMode, int format, const char* tag) {
 	this->width = width;
 	this->height = height;
+    this->depth = 0;
+    this->depth_mode = depthMode;
+    this->tag = tag;
     texture.resize(targets);
     
 	// Initialize Texture
@@ -18,13 +34,13 @@ TextureFBO::TextureFBO(unsigned int width, unsigned int height, int targets, boo
         glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, GL_RGBA, GL_FLOAT, NULL);
     }
     
-    if(!storeDepth){
+    if(depth_mode == DEPTH_RENDERBUFFER){
         //Create depth bufferGLuint rboId;
         glGenRenderbuffers(1, &depth);
         glBindRenderbuffer(GL_RENDERBUFFER_EXT, depth);
         glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
         glBindRenderbuffer(GL_RENDERBUFFER, 0);
-    }else{
+    }else if(depth_mode == DEPTH_TEXTURE){
         glGenTextures(1, &depth);
         glBindTexture(GL_TEXTURE_2D, depth);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -47,9 +63,9 @@ TextureFBO::TextureFBO(unsigned int width, unsigned int height, int targets, boo
     }
     glDrawBuffers(targets, attachments.data());
     
-    if (!storeDepth) {
+    if (depth_mode == DEPTH_RENDERBUFFER) {
         glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
-    }else{
+    }else if (depth_mode == DEPTH_TEXTURE){
         glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth, 0);
     }
     
@@ -59,10 +75,21 @@ TextureFBO::TextureFBO(unsigned int width, unsigned int height, int targets, boo
     
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    
+    // 24 bit depth is stored in 32 bits
+    bytes = (size_t)width*height*(targets*texelSize(format) + (depth_mode != DEPTH_NONE ? 4 : 0));
+    DeviceMemory::allocate(this->tag, bytes);
 }
 
 TextureFBO::~TextureFBO() {
 	glDeleteFramebuffersEXT(1, &fbo);
+    glDeleteTextures((GLsizei)texture.size(), &texture[0]);
+    if (depth_mode == DEPTH_RENDERBUFFER) {
+        glDeleteRenderbuffers(1, &depth);
+    } else if (depth_mode == DEPTH_TEXTURE) {
+        glDeleteTextures(1, &depth);
+    }
+    DeviceMemory::release(tag, bytes);
 }
 
 void TextureFBO::bind() {
@@ -6,7 +6,15 @@
 
 class TextureFBO {
 public:
-	TextureFBO(unsigned int width, unsigned int height, int targets = 1, bool storeDepth = false, int format = GL_RGBA32F);
+    // Depth attachment, none for render targets that never depth test
+    enum Depth{
+        DEPTH_RENDERBUFFER,
+        DEPTH_TEXTURE,
+        DEPTH_NONE
+    };
+    
+	TextureFBO(unsigned int width, unsigned int height, int targets = 1, Depth depthMode = DEPTH_RENDERBUFFER,
+               int format = GL_RGBA32F, const char* tag = "texture");
 	~TextureFBO();
     
 	void bind();
@@ -21,6 +29,9 @@ public:
 private:
 	GLuint fbo;
 	GLuint depth;
+    Depth depth_mode;
+    size_t bytes;
+    std::string tag;
     std::vector<GLuint> texture;
 	unsigned int width, height;
 };
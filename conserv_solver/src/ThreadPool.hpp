@@ -0,0 +1,144 @@
+//
+//  ThreadPool.hpp
+//  GLAppNative
+//
+//  Created by Jens Kristoffer Reitan Markussen on 28.12.13.
+//  Copyright (c) 2013 Jens Kristoffer Reitan Markussen. All rights reserved.
+//
+
+#ifndef GLAppNative_ThreadPool_hpp
+#define GLAppNative_ThreadPool_hpp
+
+#include <atomic>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <algorithm>
+
+/**
+ *  Fixed set of worker threads running parallel loops. The calling thread
+ *  takes part in the loop, so a pool of one thread spawns no workers.
+ */
+class ThreadPool {
+public:
+    /**
+     * Creates a pool using threads threads, 0 uses every hardware thread
+     */
+    ThreadPool(size_t threads = 0) : task(NULL), count(0), next(0),
+        active(0), generation(0), stop(false) {
+        if (threads == 0) {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        for (size_t i = 1; i < threads; i++) {
+            workers.push_back(std::thread(&ThreadPool::work, this));
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            stop = true;
+        }
+        wake.notify_all();
+        for (size_t i = 0; i < workers.size(); i++) {
+            workers[i].join();
+        }
+    }
+
+    /**
+     * Calls fn(i) for every i in [0, n) and returns when all calls are done.
+     * The first exception thrown by fn is rethrown here.
+     */
+    void parallelFor(size_t n, const std::function<void(size_t)>& fn) {
+        if (workers.empty() || n < 2) {
+            for (size_t i = 0; i < n; i++) {
+                fn(i);
+            }
+            return;
+        }
+
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            task = &fn;
+            count = n;
+            next = 0;
+            error = std::exception_ptr();
+            active = workers.size();
+            generation++;
+        }
+        wake.notify_all();
+
+        run();
+
+        std::unique_lock<std::mutex> guard(lock);
+        while (active > 0) {
+            done.wait(guard);
+        }
+        task = NULL;
+
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    size_t getThreadCount() { return workers.size()+1; }
+
+private:
+    ThreadPool(const ThreadPool&);
+    ThreadPool& operator=(const ThreadPool&);
+
+    void work() {
+        size_t seen = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                while (!stop && generation == seen) {
+                    wake.wait(guard);
+                }
+                if (stop) {
+                    return;
+                }
+                seen = generation;
+            }
+
+            run();
+
+            std::unique_lock<std::mutex> guard(lock);
+            if (--active == 0) {
+                done.notify_one();
+            }
+        }
+    }
+
+    void run() {
+        size_t i;
+        while ((i = next++) < count) {
+            try {
+                (*task)(i);
+            } catch (...) {
+                std::unique_lock<std::mutex> guard(lock);
+                if (!error) {
+                    error = std::current_exception();
+                }
+            }
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable done;
+
+    const std::function<void(size_t)>* task;
+    size_t count;
+    std::atomic<size_t> next;
+    size_t active;
+    size_t generation;
+    bool stop;
+    std::exception_ptr error;
+};
+
+#endif
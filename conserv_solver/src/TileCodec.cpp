@@ -0,0 +1,317 @@
+//
+//  TileCodec
+//  GLAppNative
+//
+//  Created by Jens Kristoffer Reitan Markussen on 28.12.13.
+//  Copyright (c) 2013 Jens Kristoffer Reitan Markussen. All rights reserved.
+//
+
+#include "TileCodec.h"
+#include "SimException.h"
+
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+
+// rANS with 32-bit state, byte-wise renormalization and 12-bit frequencies
+static const uint32_t RANS_SCALE_BITS   = 12;
+static const uint32_t RANS_SCALE        = 1 << RANS_SCALE_BITS;
+static const uint32_t RANS_L            = 1 << 23;
+
+// Quantized values and their differences are kept inside the int32 range
+static const double QUANT_LIMIT         = (double)(1 << 29);
+
+/**
+ * Scales symbol counts to frequencies summing to RANS_SCALE, keeping every
+ * present symbol at least 1
+ */
+static void normalizeFrequencies(const uint32_t* count, size_t n, uint32_t* freq){
+    uint32_t sum = 0;
+    for (size_t s = 0; s < 256; s++) {
+        freq[s] = 0;
+        if (count[s] > 0) {
+            freq[s] = std::max<uint64_t>(1, (uint64_t)count[s]*RANS_SCALE/n);
+            sum += freq[s];
+        }
+    }
+
+    // Rounding leaves the sum slightly off, settle it on the largest symbols
+    while (sum != RANS_SCALE) {
+        size_t largest = 0;
+        for (size_t s = 1; s < 256; s++) {
+            if (freq[s] > freq[largest]) {
+                largest = s;
+            }
+        }
+        if (sum < RANS_SCALE) {
+            freq[largest] += RANS_SCALE - sum;
+            sum = RANS_SCALE;
+        } else {
+            uint32_t excess = std::min(sum - RANS_SCALE, freq[largest] - 1);
+            freq[largest] -= excess;
+            sum -= excess;
+        }
+    }
+}
+
+static void putVarint(std::vector<char>& out, uint32_t v){
+    while (v >= 0x80) {
+        out.push_back((char)(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back((char)v);
+}
+
+static uint32_t getVarint(const uint8_t*& ptr, const uint8_t* end){
+    uint32_t v = 0;
+    for (uint32_t shift = 0; ptr < end && shift < 32; shift += 7) {
+        uint8_t b = *ptr++;
+        v |= (uint32_t)(b & 0x7f) << shift;
+        if ((b & 0x80) == 0) {
+            return v;
+        }
+    }
+    THROW_EXCEPTION("Corrupt frequency table");
+}
+
+/**
+ * Appends one byte plane: stream size, symbol bitmap, frequencies and the
+ * rANS stream
+ */
+static void encodePlane(const uint8_t* sym, size_t n, std::vector<char>& out){
+    uint32_t count[256] = {0};
+    for (size_t i = 0; i < n; i++) {
+        count[sym[i]]++;
+    }
+
+    uint32_t freq[256], start[256];
+    normalizeFrequencies(count, n, freq);
+
+    size_t size_pos = out.size();
+    out.resize(out.size() + sizeof(uint32_t));
+
+    uint8_t bitmap[32] = {0};
+    uint32_t cum = 0;
+    for (size_t s = 0; s < 256; s++) {
+        start[s] = cum;
+        cum += freq[s];
+        if (freq[s] > 0) {
+            bitmap[s >> 3] |= 1 << (s & 7);
+        }
+    }
+    out.insert(out.end(), (char*)bitmap, (char*)bitmap + sizeof(bitmap));
+    for (size_t s = 0; s < 256; s++) {
+        if (freq[s] > 0) {
+            putVarint(out, freq[s]);
+        }
+    }
+
+    // rANS encodes backwards, so fill a scratch buffer from the end
+    std::vector<uint8_t> stream(2*n + 16);
+    uint8_t* ptr = stream.data() + stream.size();
+
+    uint32_t x = RANS_L;
+    for (size_t i = n; i-- > 0;) {
+        uint32_t f = freq[sym[i]];
+        uint32_t x_max = ((RANS_L >> RANS_SCALE_BITS) << 8) * f;
+        while (x >= x_max) {
+            *--ptr = (uint8_t)(x & 0xff);
+            x >>= 8;
+        }
+        x = ((x / f) << RANS_SCALE_BITS) + (x % f) + start[sym[i]];
+    }
+    ptr -= 4;
+    ptr[0] = (uint8_t)(x >> 0);
+    ptr[1] = (uint8_t)(x >> 8);
+    ptr[2] = (uint8_t)(x >> 16);
+    ptr[3] = (uint8_t)(x >> 24);
+
+    uint32_t bytes = (uint32_t)(stream.data() + stream.size() - ptr);
+    memcpy(&out[size_pos], &bytes, sizeof(uint32_t));
+    out.insert(out.end(), (char*)ptr, (char*)ptr + bytes);
+}
+
+/**
+ * Decodes n symbols of one byte plane, returns the position after the plane
+ */
+static const uint8_t* decodePlane(const uint8_t* ptr, const uint8_t* end, size_t n, uint8_t* sym){
+    if (ptr + sizeof(uint32_t) + 32 > end) {
+        THROW_EXCEPTION("Truncated tile");
+    }
+
+    uint32_t bytes;
+    memcpy(&bytes, ptr, sizeof(uint32_t));
+    ptr += sizeof(uint32_t);
+
+    const uint8_t* bitmap = ptr;
+    ptr += 32;
+
+    uint32_t freq[256], start[256];
+    uint32_t cum = 0;
+    for (size_t s = 0; s < 256; s++) {
+        freq[s] = (bitmap[s >> 3] & (1 << (s & 7))) ? getVarint(ptr, end) : 0;
+        start[s] = cum;
+        cum += freq[s];
+    }
+    if (cum != RANS_SCALE || bytes < 4 || ptr + bytes > end) {
+        THROW_EXCEPTION("Corrupt tile");
+    }
+
+    uint8_t lookup[RANS_SCALE];
+    for (size_t s = 0; s < 256; s++) {
+        memset(lookup + start[s], (int)s, freq[s]);
+    }
+
+    const uint8_t* stream = ptr;
+    const uint8_t* stream_end = ptr + bytes;
+    uint32_t x = stream[0] | (stream[1] << 8) | (stream[2] << 16) | ((uint32_t)stream[3] << 24);
+    stream += 4;
+
+    for (size_t i = 0; i < n; i++) {
+        uint8_t s = lookup[x & (RANS_SCALE-1)];
+        sym[i] = s;
+        x = freq[s] * (x >> RANS_SCALE_BITS) + (x & (RANS_SCALE-1)) - start[s];
+        while (x < RANS_L && stream < stream_end) {
+            x = (x << 8) | *stream++;
+        }
+    }
+
+    return stream_end;
+}
+
+static inline uint32_t floatBits(float v){
+    uint32_t b;
+    memcpy(&b, &v, sizeof(uint32_t));
+    return b;
+}
+
+static inline float bitsFloat(uint32_t b){
+    float v;
+    memcpy(&v, &b, sizeof(float));
+    return v;
+}
+
+static inline uint32_t zigzag(int32_t v){
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t v){
+    return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+/**
+ * Quantizes to steps of 2*error_bound, fails if any value would end up
+ * further than error_bound away (NaN, huge values, bound below float precision)
+ */
+static bool quantize(const float* in, const float* prev, size_t n, float error_bound,
+                     uint32_t* words, float* recon){
+    double step = 2.0*error_bound;
+    for (size_t i = 0; i < n; i++) {
+        double q = floor(in[i]/step + 0.5);
+        if (!(fabs(q) < QUANT_LIMIT)) {
+            return false;
+        }
+        recon[i] = (float)(q*step);
+        if (!(fabs((double)recon[i] - in[i]) <= error_bound)) {
+            return false;
+        }
+
+        if (prev != NULL) {
+            double p = floor(prev[i]/step + 0.5);
+            if (!(fabs(p) < QUANT_LIMIT)) {
+                return false;
+            }
+            q -= p;
+        }
+        words[i] = zigzag((int32_t)q);
+    }
+    return true;
+}
+
+uint32_t encodeTile(const float* in, const float* prev, size_t n, float error_bound,
+                    bool entropy, std::vector<char>& out, float* recon){
+    std::vector<uint32_t> words(n);
+    uint32_t codec = CODEC_RAW;
+
+    if (error_bound > 0.0f && quantize(in, prev, n, error_bound, words.data(), recon)) {
+        codec |= CODEC_QUANTIZED;
+    } else {
+        memcpy(recon, in, n*sizeof(float));
+        for (size_t i = 0; i < n; i++) {
+            words[i] = floatBits(in[i]) ^ (prev != NULL ? floatBits(prev[i]) : 0);
+        }
+    }
+    if (prev != NULL) {
+        codec |= CODEC_DELTA;
+    }
+
+    out.clear();
+    if (entropy) {
+        std::vector<uint8_t> plane(n);
+        for (size_t p = 0; p < 4; p++) {
+            for (size_t i = 0; i < n; i++) {
+                plane[i] = (uint8_t)(words[i] >> (8*p));
+            }
+            encodePlane(plane.data(), n, out);
+        }
+
+        if (out.size() < n*sizeof(uint32_t)) {
+            return codec | CODEC_RANS;
+        }
+    }
+
+    // Incompressible, keep the words as they are
+    out.assign((char*)words.data(), (char*)words.data() + n*sizeof(uint32_t));
+    return codec;
+}
+
+void decodeTile(const char* data, size_t bytes, uint32_t codec, const float* prev,
+                size_t n, float error_bound, float* out){
+    if ((codec & CODEC_DELTA) && prev == NULL) {
+        THROW_EXCEPTION("Delta tile without a previous frame");
+    }
+
+    std::vector<uint32_t> words(n, 0);
+
+    switch (codec & 0xff) {
+        case CODEC_RAW:
+            if (bytes != n*sizeof(uint32_t)) {
+                THROW_EXCEPTION("Corrupt tile");
+            }
+            memcpy(words.data(), data, bytes);
+            break;
+        case CODEC_RANS:
+        {
+            const uint8_t* ptr = (const uint8_t*)data;
+            const uint8_t* end = ptr + bytes;
+            std::vector<uint8_t> plane(n);
+            for (size_t p = 0; p < 4; p++) {
+                ptr = decodePlane(ptr, end, n, plane.data());
+                for (size_t i = 0; i < n; i++) {
+                    words[i] |= (uint32_t)plane[i] << (8*p);
+                }
+            }
+            break;
+        }
+        default:
+            THROW_EXCEPTION("Unsupported tile codec");
+    }
+
+    if (codec & CODEC_QUANTIZED) {
+        if (!(error_bound > 0.0f)) {
+            THROW_EXCEPTION("Quantized tile without an error bound");
+        }
+        double step = 2.0*error_bound;
+        for (size_t i = 0; i < n; i++) {
+            int32_t v = unzigzag(words[i]);
+            if (codec & CODEC_DELTA) {
+                v += (int32_t)floor(prev[i]/step + 0.5);
+            }
+            out[i] = (float)(v*step);
+        }
+    } else {
+        for (size_t i = 0; i < n; i++) {
+            out[i] = bitsFloat(words[i] ^ ((codec & CODEC_DELTA) ? floatBits(prev[i]) : 0));
+        }
+    }
+}
@@ -0,0 +1,50 @@
+//
+//  TileCodec
+//  GLAppNative
+//
+//  Created by Jens Kristoffer Reitan Markussen on 28.12.13.
+//  Copyright (c) 2013 Jens Kristoffer Reitan Markussen. All rights reserved.
+//
+
+#ifndef GLAppNative_TileCodec_h
+#define GLAppNative_TileCodec_h
+
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ *  Compression of single snapshot tiles. A tile is first turned into 32-bit
+ *  words, either the float bits (XORed with the previous frame for temporal
+ *  deltas) or, with an error bound, values quantized to steps of twice the
+ *  bound (zigzag differences against the previous frame for deltas). The
+ *  words are then byte-shuffled into four planes, each coded with a static
+ *  order-0 rANS coder. Smooth fields give mostly constant high-byte planes,
+ *  which is where the savings come from.
+ *
+ *  The low byte of a codec value selects the entropy coder, the upper bits
+ *  are flags describing the word transform.
+ */
+enum SnapshotCodec{
+    CODEC_RAW       = 0,
+    CODEC_RANS      = 1,
+    CODEC_DELTA     = 1 << 8,
+    CODEC_QUANTIZED = 1 << 9
+};
+
+/**
+ * Encodes n values. prev holds the reconstructed previous frame of the same
+ * tile, or NULL for a key frame. recon receives the values a decoder will
+ * see, which is the input itself unless the tile was quantized. Tiles whose
+ * values can not honour error_bound are stored losslessly. Returns the codec.
+ */
+uint32_t encodeTile(const float* in, const float* prev, size_t n, float error_bound,
+                    bool entropy, std::vector<char>& out, float* recon);
+
+/**
+ * Decodes n values written by encodeTile with the given codec
+ */
+void decodeTile(const char* data, size_t bytes, uint32_t codec, const float* prev,
+                size_t n, float error_bound, float* out);
+
+#endif
@@ -9,12 +9,13 @@
 #ifndef GLAppNative_Timer_hpp
 #define GLAppNative_Timer_hpp
 
-#include <sys/time.h>
-#include <unistd.h>
+#include <chrono>
 
 
 /**
- *  A very basic timer class, suitable for FPS counters etc.
+ *  A very basic timer class, suitable for FPS counters etc. Runs on the
+ *  monotonic steady clock, so it is not affected by wall clock adjustments
+ *  and resolves well below a microsecond on common platforms.
  */
 class Timer {
     
@@ -47,13 +48,12 @@ public:
 	};
     
 	/**
-	 * Return the current time as number of elapsed seconds of this day.
+	 * Return the current time in seconds since an arbitrary point,
+	 * only differences between two calls are meaningful.
 	 */
 	double static getCurrentTime() {
-        struct timeval tv;
-        struct timezone tz;
-        gettimeofday(&tv, &tz);
-        return tv.tv_sec+tv.tv_usec*1e-6;
+        std::chrono::duration<double> t = std::chrono::steady_clock::now().time_since_epoch();
+        return t.count();
     };
     
     
@@ -61,4 +61,4 @@ private:
 	double startTime_;
 };
 
-#endif
\ No newline at end of file
+#endif
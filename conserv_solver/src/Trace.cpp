@@ -0,0 +1,322 @@
+//
+//  Trace
+//  GLAppNative
+//
+//  Created by Jens Kristoffer Reitan Markussen on 28.12.13.
+//  Copyright (c) 2013 Jens Kristoffer Reitan Markussen. All rights reserved.
+//
+
+#include "Trace.h"
+#include "SimException.h"
+
+#include <vector>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+
+namespace {
+
+    // Host pid and the pid of the first traced queue, later queues count up
+    const int HOST_PID      = 1;
+    const int DEVICE_PID    = 2;
+
+    struct Event{
+        const char* name;
+        char phase;
+        double ts;      // microseconds on the host clock
+        double dur;
+        int pid;
+        int tid;
+        size_t flow;    // flow arrow id, 0 for none
+    };
+
+    struct Command{
+        const char* name;
+        cl_command_queue queue;
+        cl_event event;
+        int tid;
+    };
+
+    struct Queue{
+        int pid;
+        double offset;  // host microseconds minus device microseconds
+    };
+
+    struct State{
+        std::mutex lock;
+        std::atomic<bool> enabled;
+        std::atomic<bool> counting;
+        std::string file;
+        std::chrono::steady_clock::time_point start;
+
+        std::vector<Event> events;
+        std::deque<Command> commands;
+        std::map<cl_command_queue, Queue> queues;
+        std::map<std::thread::id, int> threads;
+        std::vector<std::string> thread_names;
+        size_t flows;
+        std::map<std::string, Trace::Stat> stats;
+
+        State() : enabled(false), counting(false), flows(0) {}
+    };
+
+    State& state(){
+        static State s;
+        return s;
+    }
+
+    double now(){
+        std::chrono::duration<double, std::micro> t = std::chrono::steady_clock::now() - state().start;
+        return t.count();
+    }
+
+    // Caller holds the lock
+    int threadId(){
+        State& s = state();
+        std::thread::id id = std::this_thread::get_id();
+        std::map<std::thread::id, int>::iterator it = s.threads.find(id);
+        if (it != s.threads.end()) {
+            return it->second;
+        }
+        int tid = (int)s.threads.size() + 1;
+        s.threads[id] = tid;
+        s.thread_names.push_back("");
+        return tid;
+    }
+
+    /**
+     * A marker is timed by the device and completes before clFinish
+     * returns, so host time after the finish minus the device end time
+     * bounds the offset from above. The tightest of a few tries is kept.
+     */
+    double measureOffset(cl_command_queue queue){
+        double best = 0.0;
+        for (size_t i = 0; i < 5; i++) {
+            cl_event marker;
+            if (clEnqueueMarkerWithWaitList(queue, 0, NULL, &marker) != CL_SUCCESS) {
+                THROW_EXCEPTION("Failed to enqueue trace marker");
+            }
+            clFinish(queue);
+            double host = now();
+
+            cl_ulong end = 0;
+            clGetEventProfilingInfo(marker, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, NULL);
+            clReleaseEvent(marker);
+
+            double offset = host - end*1e-3;
+            if (i == 0 || offset < best) {
+                best = offset;
+            }
+        }
+        return best;
+    }
+
+    void writeString(std::ofstream& out, const std::string& str){
+        out << "\"";
+        for (size_t i = 0; i < str.size(); i++) {
+            if (str[i] == '"' || str[i] == '\\') {
+                out << '\\';
+            }
+            out << str[i];
+        }
+        out << "\"";
+    }
+
+    void writeMeta(std::ofstream& out, const char* what, int pid, int tid, const std::string& name){
+        out << "{\"ph\":\"M\",\"name\":\"" << what << "\",\"pid\":" << pid
+            << ",\"tid\":" << tid << ",\"args\":{\"name\":";
+        writeString(out, name);
+        out << "}}," << std::endl;
+    }
+}
+
+namespace Trace {
+
+    void begin(std::string file){
+        State& s = state();
+        std::unique_lock<std::mutex> guard(s.lock);
+        s.file = file;
+        s.start = std::chrono::steady_clock::now();
+        s.events.clear();
+        s.enabled = true;
+    }
+
+    bool enabled(){
+        return state().enabled;
+    }
+
+    void enableStats(){
+        state().counting = true;
+    }
+
+    bool counting(){
+        return state().counting;
+    }
+
+    std::map<std::string, Stat> getStats(){
+        State& s = state();
+        std::unique_lock<std::mutex> guard(s.lock);
+        return s.stats;
+    }
+
+    void setThreadName(const char* name){
+        State& s = state();
+        if (!s.enabled) {
+            return;
+        }
+        std::unique_lock<std::mutex> guard(s.lock);
+        s.thread_names[threadId()-1] = name;
+    }
+
+    cl_event* command(const char* name, cl_command_queue queue){
+        State& s = state();
+        if (!s.enabled && !s.counting) {
+            return NULL;
+        }
+        std::unique_lock<std::mutex> guard(s.lock);
+        Command c = {name, queue, NULL, threadId()};
+        s.commands.push_back(c);
+
+        // Deque elements stay put while more are pushed at the back
+        return &s.commands.back().event;
+    }
+
+    void retain(const char* name, cl_command_queue queue, cl_event event){
+        State& s = state();
+        if ((!s.enabled && !s.counting) || event == NULL) {
+            return;
+        }
+        clRetainEvent(event);
+        std::unique_lock<std::mutex> guard(s.lock);
+        Command c = {name, queue, event, threadId()};
+        s.commands.push_back(c);
+    }
+
+    void collect(){
+        State& s = state();
+        if (!s.enabled && !s.counting) {
+            return;
+        }
+        std::unique_lock<std::mutex> guard(s.lock);
+
+        while (!s.commands.empty()) {
+            Command& c = s.commands.front();
+
+            if (c.event == NULL) {
+                // Enqueue failed, nothing was timed
+                s.commands.pop_front();
+                continue;
+            }
+
+            cl_int status;
+            clGetEventInfo(c.event, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(cl_int), &status, NULL);
+            if (status > CL_COMPLETE) {
+                break;
+            }
+
+            cl_ulong queued = 0, started = 0, ended = 0;
+            cl_int err = CL_SUCCESS;
+            err |= clGetEventProfilingInfo(c.event, CL_PROFILING_COMMAND_QUEUED, sizeof(cl_ulong), &queued, NULL);
+            err |= clGetEventProfilingInfo(c.event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &started, NULL);
+            err |= clGetEventProfilingInfo(c.event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &ended, NULL);
+            clReleaseEvent(c.event);
+
+            if (err == CL_SUCCESS && status == CL_COMPLETE && s.counting) {
+                Trace::Stat& stat = s.stats[c.name];
+                stat.calls++;
+                stat.time += (ended-started)*1e-9;
+            }
+
+            if (err == CL_SUCCESS && status == CL_COMPLETE && s.enabled) {
+                if (s.queues.find(c.queue) == s.queues.end()) {
+                    Queue q;
+                    q.pid = DEVICE_PID + (int)s.queues.size();
+                    q.offset = measureOffset(c.queue);
+                    s.queues[c.queue] = q;
+                }
+                const Queue& q = s.queues[c.queue];
+
+                // Arrow from the enqueue on the host thread to the execution
+                size_t flow = ++s.flows;
+                Event enqueue = {c.name, 's', queued*1e-3 + q.offset, 0.0, HOST_PID, c.tid, flow};
+                Event arrive  = {c.name, 'f', started*1e-3 + q.offset, 0.0, q.pid, 1, flow};
+                Event execute = {c.name, 'X', started*1e-3 + q.offset, (ended-started)*1e-3, q.pid, 1, 0};
+                s.events.push_back(enqueue);
+                s.events.push_back(arrive);
+                s.events.push_back(execute);
+            }
+            s.commands.pop_front();
+        }
+    }
+
+    void end(){
+        State& s = state();
+        if (!s.enabled) {
+            return;
+        }
+        collect();
+
+        std::unique_lock<std::mutex> guard(s.lock);
+        s.enabled = false;
+
+        std::ofstream out(s.file.c_str());
+        if (!out) {
+            THROW_EXCEPTION("Could not open trace file");
+        }
+
+        std::cout << "Saving trace as: " << s.file << std::endl;
+
+        out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" << std::endl;
+
+        writeMeta(out, "process_name", HOST_PID, 0, "Host");
+        for (size_t i = 0; i < s.thread_names.size(); i++) {
+            writeMeta(out, "thread_name", HOST_PID, (int)i+1,
+                      s.thread_names[i].empty() ? "thread" : s.thread_names[i]);
+        }
+        for (std::map<cl_command_queue, Queue>::iterator it = s.queues.begin(); it != s.queues.end(); ++it) {
+            std::stringstream name;
+            name << "OpenCL queue " << it->second.pid - DEVICE_PID;
+            writeMeta(out, "process_name", it->second.pid, 0, name.str());
+            writeMeta(out, "thread_name", it->second.pid, 1, "commands");
+        }
+
+        out.precision(3);
+        out << std::fixed;
+        for (size_t i = 0; i < s.events.size(); i++) {
+            const Event& e = s.events[i];
+            out << "{\"name\":";
+            writeString(out, e.name);
+            out << ",\"cat\":\"" << (e.pid != HOST_PID || e.flow != 0 ? "cl" : "host") << "\",\"ph\":\"" << e.phase
+                << "\",\"ts\":" << e.ts << ",\"pid\":" << e.pid << ",\"tid\":" << e.tid;
+            if (e.phase == 'X') {
+                out << ",\"dur\":" << e.dur;
+            } else {
+                // Flow arrows, the end binds to the slice starting there
+                out << ",\"id\":" << e.flow << (e.phase == 'f' ? ",\"bp\":\"e\"" : "");
+            }
+            out << "}" << (i+1 < s.events.size() ? "," : "") << std::endl;
+        }
+        out << "]}" << std::endl;
+    }
+
+    Zone::Zone(const char* name){
+        this->name = name;
+        this->start = enabled() ? now() : -1.0;
+    }
+
+    Zone::~Zone(){
+        State& s = state();
+        if (!s.enabled || start < 0.0) {
+            return;
+        }
+        double end = now();
+        std::unique_lock<std::mutex> guard(s.lock);
+        Event e = {name, 'X', start, end - start, HOST_PID, threadId(), 0};
+        s.events.push_back(e);
+    }
+}
@@ -0,0 +1,104 @@
+//
+//  Trace
+//  GLAppNative
+//
+//  Created by Jens Kristoffer Reitan Markussen on 28.12.13.
+//  Copyright (c) 2013 Jens Kristoffer Reitan Markussen. All rights reserved.
+//
+
+#ifndef GLAppNative_Trace_h
+#define GLAppNative_Trace_h
+
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#else
+#include <cl.h>
+#endif
+
+#include <string>
+#include <map>
+
+/**
+ *  Timeline of a run in the Chrome trace format, viewable in
+ *  chrome://tracing or Perfetto. Host zones are timed with a steady clock
+ *  on whatever thread they run on. OpenCL commands are timed from their
+ *  profiling info and moved onto the host clock with an offset measured
+ *  per queue, so host and device work line up in one view.
+ *
+ *  Everything is a no-op until begin() or enableStats() is called.
+ */
+namespace Trace {
+
+    /**
+     * Device time of all commands with the same name
+     */
+    struct Stat{
+        size_t calls;
+        double time;    // seconds
+    };
+
+    /**
+     * Start recording, the timeline is written to file by end()
+     */
+    void begin(std::string file);
+
+    /**
+     * Collect outstanding device events and write the trace
+     */
+    void end();
+
+    bool enabled();
+
+    /**
+     * Sum up device time per command name, with or without a timeline
+     */
+    void enableStats();
+    
+    bool counting();
+
+    /**
+     * Totals of the commands collected so far
+     */
+    std::map<std::string, Stat> getStats();
+
+    /**
+     * Name shown for the calling thread
+     */
+    void setThreadName(const char* name);
+
+    /**
+     * Event to pass to a clEnqueue* call on queue, NULL when neither tracing
+     * nor counting.
+     * The queue needs CL_QUEUE_PROFILING_ENABLE.
+     */
+    cl_event* command(const char* name, cl_command_queue queue);
+
+    /**
+     * Trace an event the caller also keeps, it is retained until collected
+     */
+    void retain(const char* name, cl_command_queue queue, cl_event event);
+
+    /**
+     * Record finished device commands. Call where the queues are idle, the
+     * first collect on a queue also measures its clock offset.
+     */
+    void collect();
+
+    /**
+     * Scoped host zone
+     */
+    class Zone {
+    public:
+        Zone(const char* name);
+        ~Zone();
+    private:
+        const char* name;
+        double start;
+    };
+}
+
+#define TRACE_CONCAT_(a,b) a##b
+#define TRACE_CONCAT(a,b) TRACE_CONCAT_(a,b)
+#define TRACE_ZONE(name) Trace::Zone TRACE_CONCAT(trace_zone_,__LINE__)(name)
+
+#endif
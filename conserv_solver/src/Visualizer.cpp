@@ -14,11 +14,13 @@ Visualizer::Visualizer(Technique tech, unsigned int width,unsigned int height){
     this->width = width;
     this->height = height;
     this->technique = tech;
+    this->pack_pool = NULL;
 }
 Visualizer::~Visualizer(){
     delete visualize;
     delete surface_vert;
     delete surface_ind;
+    delete pack_pool;
     
     glfwDestroyWindow(window);
     glfwTerminate();
@@ -45,6 +47,7 @@ void Visualizer::init(){
     setOpenGLStates();
     createProgram();
     createVAO();
+    pack_pool = new GLUtils::PackPool();
     
     takeScreenshot = false;
 }
@@ -215,13 +218,13 @@ void Visualizer::createVAO(){
             -1.0f,          1.0f,
             0.0f,   1.0f,
         };
-        surface_vert = new GLUtils::BO<GL_ARRAY_BUFFER>(quad_vertices, sizeof(quad_vertices));
+        surface_vert = new GLUtils::BO<GL_ARRAY_BUFFER>(quad_vertices, sizeof(quad_vertices), GL_STATIC_DRAW, "geometry");
         
         GLubyte quad_indices[] = {
             0, 1, 2, //triangle 1
             2, 3, 0, //triangle 2
         };
-        surface_ind = new GLUtils::BO<GL_ELEMENT_ARRAY_BUFFER>(quad_indices, sizeof(quad_indices));
+        surface_ind = new GLUtils::BO<GL_ELEMENT_ARRAY_BUFFER>(quad_indices, sizeof(quad_indices), GL_STATIC_DRAW, "geometry");
         
         glGenVertexArrays(1, &vao);
         glBindVertexArray(vao);
@@ -251,7 +254,7 @@ void Visualizer::createTriangleStrip(unsigned int Nx, unsigned int Ny, GLUtils::
 			vertices.push_back(j*dy);	//y
 		}
 	}
-    vert = new GLUtils::BO<GL_ARRAY_BUFFER>(vertices.data(),sizeof(GLfloat)*(GLuint)vertices.size());
+    vert = new GLUtils::BO<GL_ARRAY_BUFFER>(vertices.data(),sizeof(GLfloat)*(GLuint)vertices.size(),GL_STATIC_DRAW,"geometry");
     
 	restart_token = Nx * Ny * 2;
     
@@ -264,17 +267,24 @@ void Visualizer::createTriangleStrip(unsigned int Nx, unsigned int Ny, GLUtils::
 		indices.push_back(restart_token);
 	}
     indices_count = (GLuint)indices.size();
-    ind = new GLUtils::BO<GL_ELEMENT_ARRAY_BUFFER>(indices.data(),sizeof(GLfloat)*(GLuint)indices.size());
+    ind = new GLUtils::BO<GL_ELEMENT_ARRAY_BUFFER>(indices.data(),sizeof(GLfloat)*(GLuint)indices.size(),GL_STATIC_DRAW,"geometry");
 }
 
 void Visualizer::save(){
-    std::vector<GLubyte> pixels;
     int width, height;
     
     glReadBuffer(GL_BACK);
     glfwGetFramebufferSize(window,&width, &height);
-    pixels.resize(width*height*3);
-    glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+    
+    // Read into a pooled pixel buffer, DevIL copies out of the mapping
+    GLUtils::PackPool::Lease pbo(*pack_pool, width*height*3);
+    pbo.get()->bind();
+    glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, BUFFER_OFFSET(0));
+    const GLubyte* pixels = (const GLubyte*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, width*height*3, GL_MAP_READ_BIT);
+    if (pixels == NULL) {
+        pbo.get()->unbind();
+        THROW_EXCEPTION("Failed to map screenshot");
+    }
     
     ILuint      ih; // Image Handle
     ILboolean   res; // Result
@@ -287,7 +297,10 @@ void Visualizer::save(){
     size = width*height*3;
     
     ilTexImage(width, height, 1, 3, IL_RGB,
-			   IL_UNSIGNED_BYTE, pixels.data());
+			   IL_UNSIGNED_BYTE, (void*)pixels);
+    
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    pbo.get()->unbind();
     
     std::stringstream ss;
     ss << "Screenshot_" << sim->getGridSize().x << "x" << sim->getGridSize().x <<
@@ -134,6 +134,9 @@ private:
     GLUtils::BO<GL_ARRAY_BUFFER>* surface_vert;
     GLUtils::BO<GL_ELEMENT_ARRAY_BUFFER>* surface_ind;
     
+    // Pixel buffers for screenshots
+    GLUtils::PackPool* pack_pool;
+    
     
     unsigned int restart_token;
     unsigned int indices_count;
@@ -9,11 +9,15 @@
 #include "AppManager.h"
 
 #include <stdlib.h>
+#include <stdio.h>
 #include "optionparser.h"
 
 enum  optionIndex {UNKNOWN, HELP, TIME,
                 X_SIZE, Y_SIZE, N_SIZE,
-                SOLVER, DEVICE};
+                SOLVER, DEVICE, SNAPSHOT,
+                COMPRESS, ERROR_BOUND, DIAGNOSTICS,
+                PROBES, PROBE_INTERVAL, TRACE, ROOFLINE, PERF,
+                STREAM, STREAM_STEPS, FLUX, READS, PRIMITIVES, QUADRATURE, FINAL, COARSEN, LAYOUT, NUMA, HUGE_PAGES};
 
 const option::Descriptor usage[] =
 {
@@ -24,6 +28,26 @@ const option::Descriptor usage[] =
     {N_SIZE,    0,"", "nt",     option::Arg::Optional,    "  --nt  \tSet the max simulation steps."},
     {SOLVER,    0,"", "type",   option::Arg::Optional,    "  --type  \tSet Solver type [CLSW,GLEULER,CLEULER]. REQUIRED."},
     {DEVICE,    0,"", "device", option::Arg::Optional,    "  --device  \tSet the perferred device [CPU,GPU], ignored if OpenGL solver"},
+    {SNAPSHOT,  0,"", "snapshot", option::Arg::Optional,  "  --snapshot  \tWrite the field to disk every N steps."},
+    {COMPRESS,  0,"", "compress", option::Arg::None,      "  --compress  \tCompress snapshots (byte shuffle, rANS, temporal delta)."},
+    {ERROR_BOUND,0,"", "error",   option::Arg::Optional,  "  --error  \tAllowed absolute error in stored rho and E, 0 is lossless."},
+    {DIAGNOSTICS,0,"", "diagnostics", option::Arg::Optional, "  --diagnostics  \tPrint conservation sums and value ranges every N steps."},
+    {PROBES,    0,"", "probes", option::Arg::Optional,    "  --probes  \tRecord the state at points \"x,y;x,y;...\" in [0,1] domain coordinates."},
+    {PROBE_INTERVAL,0,"", "probe-interval", option::Arg::Optional, "  --probe-interval  \tRead recorded probe samples back every N steps."},
+    {TRACE,     0,"", "trace",  option::Arg::None,        "  --trace  \tWrite a Chrome trace (chrome://tracing, Perfetto) of the run."},
+    {ROOFLINE,  0,"", "roofline", option::Arg::None,      "  --roofline  \tReport bandwidth and FLOP rate per kernel against a STREAM-like probe."},
+    {PERF,      0,"", "perf",   option::Arg::None,        "  --perf  \tRead hardware counters per kernel on OpenCL CPU devices (Linux)."},
+    {STREAM,    0,"", "stream", option::Arg::Optional,    "  --stream  \tStream the state through the device in strips of N rows (CLEULER), automatic if it does not fit."},
+    {STREAM_STEPS,0,"", "stream-steps", option::Arg::Optional, "  --stream-steps  \tTime steps per strip visit when streaming."},
+    {FLUX,      0,"", "flux",   option::Arg::Optional,    "  --flux  \tFlux kernels [FUSED,SPLIT,AUTO] of the OpenCL solvers, AUTO times both on the device."},
+    {READS,     0,"", "reads",  option::Arg::Optional,    "  --reads  \tStencil reads of CLEULER [BUFFERS,IMAGES,AUTO], AUTO times both on the device."},
+    {PRIMITIVES,0,"", "primitives", option::Arg::Optional, "  --primitives  \tPrimitive variables in the CLEULER fluxes [PLAIN,SHARED], SHARED computes them once per state."},
+    {QUADRATURE,0,"", "quadrature", option::Arg::Optional, "  --quadrature  \tFace quadrature of the CLEULER fluxes [GAUSS,MIDPOINT], MIDPOINT halves the flux work."},
+    {FINAL,     0,"", "final",  option::Arg::None,        "  --final  \tWrite the final density as raw float32 next to the results."},
+    {COARSEN,   0,"", "coarsen", option::Arg::Optional,   "  --coarsen  \tCells per work-item along x in the CLEULER stencils [1,2,4,8]."},
+    {LAYOUT,    0,"", "layout", option::Arg::Optional,    "  --layout  \tCell order in the CLEULER buffers [ROWS,TILES,MORTON], TILES and MORTON keep 32x32 blocks together."},
+    {NUMA,      0,"", "numa",   option::Arg::None,        "  --numa  \tSplit a CPU device per NUMA node, each running the rows it first touched (CLEULER)."},
+    {HUGE_PAGES,0,"", "huge-pages", option::Arg::None,    "  --huge-pages  \tBack the CLEULER buffers on CPU devices with transparent huge pages."},
     
     {UNKNOWN, 0,"" ,  ""   ,option::Arg::None, "" },
     {0,0,0,0,0,0}
@@ -39,6 +63,21 @@ T setValue(option::Option* options, optionIndex index, T def)
     }
 }
 
+std::vector<glm::vec2> stringToPoints(const char* str){
+    std::vector<glm::vec2> points;
+    std::stringstream ss(str);
+    std::string point;
+    while (std::getline(ss, point, ';')) {
+        glm::vec2 p;
+        if (sscanf(point.c_str(), "%f,%f", &p.x, &p.y) == 2) {
+            points.push_back(p);
+        } else if (!point.empty()) {
+            std::cout << "Ignoring probe: " << point << std::endl;
+        }
+    }
+    return points;
+}
+
 Solver stringToEnum(const char* str){
     std::string txt(str);
     if (txt.compare("CLSW") == 0) {
@@ -52,6 +91,48 @@ Solver stringToEnum(const char* str){
     }
 }
 
+FluxMode stringToFluxMode(const char* str){
+    if (str == NULL) {
+        return FLUX_AUTO;
+    }
+    std::string txt(str);
+    if (txt.compare("FUSED") == 0) {
+        return FLUX_FUSED;
+    } else if (txt.compare("SPLIT") == 0) {
+        return FLUX_SPLIT;
+    } else {
+        return FLUX_AUTO;
+    }
+}
+
+ReadPath stringToReadPath(const char* str){
+    if (str == NULL) {
+        return READ_AUTO;
+    }
+    std::string txt(str);
+    if (txt.compare("BUFFERS") == 0) {
+        return READ_BUFFERS;
+    } else if (txt.compare("IMAGES") == 0) {
+        return READ_IMAGES;
+    } else {
+        return READ_AUTO;
+    }
+}
+
+MemoryLayout stringToLayout(const char* str){
+    if (str == NULL) {
+        return LAYOUT_ROWS;
+    }
+    std::string txt(str);
+    if (txt.compare("TILES") == 0) {
+        return LAYOUT_TILES;
+    } else if (txt.compare("MORTON") == 0) {
+        return LAYOUT_MORTON;
+    } else {
+        return LAYOUT_ROWS;
+    }
+}
+
 int main(int argc, const char * argv[])
 {
     argc-=(argc>0); argv+=(argc>0); // skip program name argv[0] if present
@@ -79,18 +160,48 @@ int main(int argc, const char * argv[])
     }
     
     float time;
-    size_t Nx, Ny, N;
+    float error_bound;
+    size_t Nx, Ny, N, snapshot, diagnostics, probe_interval, stream_rows, stream_steps, coarsening;
     
     time    = setValue<float>(options,TIME,0.2f);
     Nx      = setValue<size_t>(options,X_SIZE,128);
     Ny      = setValue<size_t>(options,Y_SIZE,128);
     N       = setValue<size_t>(options,N_SIZE,150);
+    snapshot = setValue<size_t>(options,SNAPSHOT,0);
+    error_bound = setValue<float>(options,ERROR_BOUND,0.0f);
+    diagnostics = setValue<size_t>(options,DIAGNOSTICS,0);
+    probe_interval = setValue<size_t>(options,PROBE_INTERVAL,100);
+    stream_rows = setValue<size_t>(options,STREAM,0);
+    stream_steps = setValue<size_t>(options,STREAM_STEPS,1);
+    coarsening = setValue<size_t>(options,COARSEN,1);
     
     
     AppManager* manager = NULL;
     try {
         manager = new AppManager();
+        manager->setPerfCounters(options[PERF] != NULL);
+        manager->setStreaming(stream_rows, stream_steps);
+        manager->setFluxMode(stringToFluxMode(options[FLUX].arg));
+        manager->setReadPath(stringToReadPath(options[READS].arg));
+        manager->setSharedPrimitives(options[PRIMITIVES].arg != NULL &&
+                                     std::string(options[PRIMITIVES].arg).compare("SHARED") == 0);
+        if (options[QUADRATURE].arg != NULL && std::string(options[QUADRATURE].arg).compare("MIDPOINT") == 0) {
+            manager->setQuadrature(QUADRATURE_MIDPOINT);
+        }
+        manager->setCoarsening(coarsening);
+        manager->setLayout(stringToLayout(options[LAYOUT].arg));
+        manager->setNumaPlacement(options[NUMA] != NULL, options[HUGE_PAGES] != NULL);
+        manager->setFinalOutput(options[FINAL] != NULL);
         manager->init(Nx,Ny,stringToEnum(options[SOLVER].arg),options[DEVICE].arg);
+        manager->setSnapshotInterval(snapshot);
+        manager->setSnapshotCompression(options[COMPRESS] != NULL);
+        manager->setSnapshotErrorBound(error_bound);
+        manager->setDiagnosticsInterval(diagnostics);
+        manager->setTrace(options[TRACE] != NULL);
+        manager->setRoofline(options[ROOFLINE] != NULL);
+        if (options[PROBES] != NULL && options[PROBES].arg != NULL) {
+            manager->setProbes(stringToPoints(options[PROBES].arg), probe_interval);
+        }
         manager->begin(N,time);
         
     } catch (std::exception& e) {
@@ -0,0 +1,101 @@
+//
+//  snaptool
+//  GLAppNative
+//
+//  Created by Jens Kristoffer Reitan Markussen on 28.12.13.
+//  Copyright (c) 2013 Jens Kristoffer Reitan Markussen. All rights reserved.
+//
+
+#include "SnapshotFile.h"
+#include "SimException.h"
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <cstdlib>
+
+static const char* field_names[] = {"rho", "rhou", "rhov", "E"};
+
+void usage(){
+    std::cerr << "Usage: snaptool list <file>" << std::endl;
+    std::cerr << "       snaptool extract <file> <frame> <field> <x0> <y0> <w> <h> [output]" << std::endl;
+    std::cerr << std::endl;
+    std::cerr << "Fields: 0 rho, 1 rhou, 2 rhov, 3 E. Without an output file the region" << std::endl;
+    std::cerr << "is printed as text, otherwise it is written as raw float32, row major." << std::endl;
+}
+
+int list(SnapshotFileReader& reader){
+    const SnapshotFileHeader& header = reader.getHeader();
+
+    std::cout << "Domain " << header.Nx << "x" << header.Ny << ", "
+        << header.components << " fields, "
+        << header.tile_width << "x" << header.tile_height << " tiles" << std::endl;
+    std::cout << reader.getFrameCount() << " frames" << std::endl;
+
+    for (size_t i = 0; i < reader.getFrameCount(); i++) {
+        const SnapshotIndexEntry& frame = reader.getFrame(i);
+        std::cout << i << "\tstep " << frame.step << "\ttime " << frame.time
+            << "\tdt " << frame.dt << "\t" << frame.bytes << " bytes" << std::endl;
+    }
+    return EXIT_SUCCESS;
+}
+
+int extract(SnapshotFileReader& reader, int argc, char** argv){
+    if (argc < 9) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    size_t frame = atol(argv[3]);
+    size_t field = atol(argv[4]);
+    size_t x0 = atol(argv[5]);
+    size_t y0 = atol(argv[6]);
+    size_t w = atol(argv[7]);
+    size_t h = atol(argv[8]);
+
+    std::vector<float> region(w*h);
+    reader.readRegion(frame, field, x0, y0, w, h, region.data());
+
+    if (argc > 9) {
+        std::ofstream out(argv[9], std::ios::binary);
+        if (!out) {
+            std::cerr << "Could not open " << argv[9] << std::endl;
+            return EXIT_FAILURE;
+        }
+        out.write((const char*)region.data(), region.size()*sizeof(float));
+        return EXIT_SUCCESS;
+    }
+
+    std::cout << "# " << field_names[field] << " step " << reader.getFrame(frame).step
+        << " region " << x0 << "," << y0 << " " << w << "x" << h << std::endl;
+    for (size_t y = 0; y < h; y++) {
+        for (size_t x = 0; x < w; x++) {
+            std::cout << region[y*w+x] << (x+1 < w ? " " : "");
+        }
+        std::cout << std::endl;
+    }
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char** argv){
+    if (argc < 3) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    std::string cmd = argv[1];
+    try {
+        SnapshotFileReader reader(argv[2]);
+        if (cmd == "list") {
+            return list(reader);
+        } else if (cmd == "extract") {
+            return extract(reader, argc, argv);
+        }
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    usage();
+    return EXIT_FAILURE;
+}
@@ -71,6 +71,10 @@ void AppManager::quit(){
     delete eigen;
     delete gradKernel;
     delete gradient;
+    delete reduce;
+    for (size_t i = 0; i < reduceKernel.size(); i++) {
+        delete reduceKernel[i];
+    }
     
     for (size_t i = 0; i <= N_RK; i++) {
         delete kernelRK[i];
@@ -635,69 +639,82 @@ void AppManager::render(){
     CHECK_GL_ERRORS();
 }
 
-void AppManager::debugDownload(bool texDump){
-    glBindTexture(GL_TEXTURE_2D, kernelRK[N_RK]->getTexture());
+void AppManager::reduceDiagnostics(glm::vec4& sum, glm::vec4& lo, glm::vec4& hi){
+    reduce->use();
     
-    std::vector<GLfloat> data(Nx*Ny*4);
-    glGetTexImage(GL_TEXTURE_2D,0,GL_RGBA,GL_FLOAT,&data[0]);
-    glBindTexture(GL_TEXTURE_2D, 0);
-    
-    float maxrho    = -std::numeric_limits<float>().max();
-    float minrho    = std::numeric_limits<float>().max();
+    glUniform1i(reduce->getUniform("SumTex"),0);
+    glUniform1i(reduce->getUniform("MinTex"),1);
+    glUniform1i(reduce->getUniform("MaxTex"),2);
     
-    float maxu      = maxrho;
-    float maxv      = maxrho;
+    glm::ivec2 size(Nx,Ny);
+    for (size_t i = 0; i < reduceKernel.size(); i++) {
+        reduceKernel[i]->bind();
+        glViewport(0, 0, reduceKernel[i]->getWidth(), reduceKernel[i]->getHeight());
+        
+        glUniform2i(reduce->getUniform("size"), size.x, size.y);
+        glUniform1i(reduce->getUniform("first"), i == 0);
+        
+        // The first level reads the state, the others the level above
+        for (size_t t = 0; t < 3; t++) {
+            glActiveTexture(GL_TEXTURE0+t);
+            glBindTexture(GL_TEXTURE_2D, i == 0 ? kernelRK[N_RK]->getTexture() :
+                                                  reduceKernel[i-1]->getTexture(t));
+        }
+        
+        glBindVertexArray(vao[0]);
+        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_BYTE, NULL);
+        glBindVertexArray(0);
+        
+        size = glm::ivec2(reduceKernel[i]->getWidth(), reduceKernel[i]->getHeight());
+    }
     
-    float minu      = minrho;
-    float minv      = minrho;
+    reduce->disuse();
     
-    float maxE      = maxrho;
-    float minE      = minrho;
+    // 1x1 top level, three texels are all that is read back
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glReadPixels(0, 0, 1, 1, GL_RGBA, GL_FLOAT, glm::value_ptr(sum));
+    glReadBuffer(GL_COLOR_ATTACHMENT1);
+    glReadPixels(0, 0, 1, 1, GL_RGBA, GL_FLOAT, glm::value_ptr(lo));
+    glReadBuffer(GL_COLOR_ATTACHMENT2);
+    glReadPixels(0, 0, 1, 1, GL_RGBA, GL_FLOAT, glm::value_ptr(hi));
     
-    float rhoSum    = 0.0f;
-    float rhouSum   = 0.0f;
-    float rhovSum   = 0.0f;
-    float ESum      = 0.0f;
+    reduceKernel.back()->unbind();
     
-    for (size_t x = 0; x < Nx; x++) {
-        for (size_t y = 0; y < Ny; y++) {
-            size_t k = (Nx * y + x)*4;
-            
-            rhoSum    += data[k];
-            rhouSum   += data[k+1];
-            rhovSum   += data[k+2];
-            ESum      += data[k+3];
-            
-            maxrho = glm::max(maxrho,data[k]);
-            minrho = glm::min(minrho,data[k]);
-            
-            maxu = glm::max(maxu,data[k+1]/data[k]);
-            minu = glm::min(minu,data[k+1]/data[k]);
-            
-            maxv = glm::max(maxv,data[k+2]/data[k]);
-            minv = glm::min(minv,data[k+2]/data[k]);
-            
-            maxE = glm::max(maxE,data[k+3]);
-            minE = glm::min(minE,data[k+3]);
-        }
+    for (size_t t = 0; t < 3; t++) {
+        glActiveTexture(GL_TEXTURE0+t);
+        glBindTexture(GL_TEXTURE_2D, 0);
     }
+    glActiveTexture(GL_TEXTURE0);
+    
+    CHECK_GL_ERRORS();
+}
+
+void AppManager::debugDownload(bool texDump){
+    glm::vec4 sum, lo, hi;
+    reduceDiagnostics(sum, lo, hi);
     
     std::cout << "Debug information @ s " << step << " t " << time << ": " << std::endl <<
         "Value Range: " << std::endl <<
-        "p range: [" << minrho << "," << maxrho << "]" << std::endl <<
-        "u range: [" << minu << "," << maxu << "]" << std::endl <<
-        "v range: [" << minv << "," << maxv << "]" << std::endl <<
-        "E range: [" << minE << "," << maxE << "]" << std::endl << std::endl <<
+        "p range: [" << lo.x << "," << hi.x << "]" << std::endl <<
+        "u range: [" << lo.y << "," << hi.y << "]" << std::endl <<
+        "v range: [" << lo.z << "," << hi.z << "]" << std::endl <<
+        "E range: [" << lo.w << "," << hi.w << "]" << std::endl << std::endl <<
         "Value summation" << std::endl <<
-        "p summation: " << rhoSum << std::endl <<
-        "pu summation: " << rhouSum << std::endl <<
-        "pv summation: " << rhovSum << std::endl <<
-        "E summation: " << ESum << std::endl << std::endl;
+        "p summation: " << sum.x << std::endl <<
+        "pu summation: " << sum.y << std::endl <<
+        "pv summation: " << sum.z << std::endl <<
+        "E summation: " << sum.w << std::endl << std::endl;
     
     if(!texDump){
         return;
     }
     
+    glBindTexture(GL_TEXTURE_2D, kernelRK[N_RK]->getTexture());
+    
+    std::vector<GLfloat> data(Nx*Ny*4);
+    glGetTexImage(GL_TEXTURE_2D,0,GL_RGBA,GL_FLOAT,&data[0]);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    
     std::cout << "~ Texture dump ~" << std::endl << std::endl;
     std::cout << "RK tex: [";
     for (size_t y = 0; y < Ny; y++) {
@@ -853,6 +870,7 @@ void AppManager::createProgram(){
     boundary        = new Program("boundary_kernel.vert","boundary.frag");
     eigen           = new Program("kernel.vert","eigenvalue.frag");
     gradient        = new Program("kernel.vert","gradients.frag");
+    reduce          = new Program("kernel.vert","reduce.frag");
     
     //Set uniforms
 
@@ -936,6 +954,15 @@ void AppManager::createFBO(){
     dtKernel            = new TextureFBO(Nx,Ny);
     gradKernel          = new TextureFBO(Nx,Ny);
     
+    // Halve until a single texel is left
+    size_t w = Nx;
+    size_t h = Ny;
+    do {
+        w = (w+1)/2;
+        h = (h+1)/2;
+        reduceKernel.push_back(new TextureFBO(w,h,3));
+    } while (w > 1 || h > 1);
+    
     CHECK_GL_ERRORS();
 }
 
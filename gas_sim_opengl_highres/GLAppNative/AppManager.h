@@ -95,10 +95,17 @@ private:
 	void render();
     
     /**
-	 * Downloads latest simulation result for debugging
+	 * Prints conservation sums and value ranges of the latest result,
+     * optionally downloading the whole texture for a dump
 	 */
     void debugDownload(bool texDump);
     
+    /**
+     * Reduces the latest result on the GPU to the sums of rho, rhou, rhov, E
+     * and the min/max of rho, u, v, E
+     */
+    void reduceDiagnostics(glm::vec4& sum, glm::vec4& lo, glm::vec4& hi);
+    
 	/**
 	 * Creates the OpenGL context using GLFW
 	 */
@@ -177,6 +184,7 @@ private:
     Program* boundary;
     Program* eigen;
     Program* gradient;
+    Program* reduce;
     
     BO<GL_ARRAY_BUFFER>* vert;
     BO<GL_ELEMENT_ARRAY_BUFFER>* ind;
@@ -188,6 +196,9 @@ private:
     TextureFBO* dtKernel;
     TextureFBO* gradKernel;
     
+    // Diagnostics pyramid, each level halves the one above (sum, min, max)
+    std::vector<TextureFBO*> reduceKernel;
+    
     GLuint vao[2];
 };
 
@@ -0,0 +1,48 @@
+#version 150
+
+// One level of the diagnostics pyramid, every fragment reduces a 2x2 block
+out vec4 color0;    // sum of rho, rhou, rhov, E
+out vec4 color1;    // min of rho, u, v, E
+out vec4 color2;    // max of rho, u, v, E
+
+uniform sampler2D SumTex;
+uniform sampler2D MinTex;
+uniform sampler2D MaxTex;
+
+uniform ivec2 size;     // size of the level being reduced
+uniform bool first;     // first level reads the conserved variables in SumTex
+
+const float FLT_MAX = 3.402823466e+38;
+
+void main() {
+    ivec2 base = ivec2(gl_FragCoord.xy)*2;
+    
+    vec4 sum    = vec4(0.0);
+    vec4 lo     = vec4(FLT_MAX);
+    vec4 hi     = vec4(-FLT_MAX);
+    
+    for (int j = 0; j < 2; j++) {
+        for (int i = 0; i < 2; i++) {
+            ivec2 p = base + ivec2(i,j);
+            if (p.x >= size.x || p.y >= size.y) {
+                continue;
+            }
+            
+            if (first) {
+                vec4 Q = texelFetch(SumTex, p, 0);
+                vec4 P = vec4(Q.x, Q.yz/Q.x, Q.w);
+                sum += Q;
+                lo  = min(lo, P);
+                hi  = max(hi, P);
+            } else {
+                sum += texelFetch(SumTex, p, 0);
+                lo  = min(lo, texelFetch(MinTex, p, 0));
+                hi  = max(hi, texelFetch(MaxTex, p, 0));
+            }
+        }
+    }
+    
+    color0 = sum;
+    color1 = lo;
+    color2 = hi;
+}
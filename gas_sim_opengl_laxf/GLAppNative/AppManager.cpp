@@ -14,6 +14,7 @@ AppManager::AppManager():
     lax_f(NULL),
     visualize(NULL),
     copy(NULL),
+    reduce_max(NULL),
     vert(NULL),
     ind(NULL),
     kernel0(NULL),
@@ -64,6 +65,10 @@ void AppManager::quit(){
     delete ind;
     delete kernel0;
     delete kernel1;
+    delete reduce_max;
+    for (size_t i = 0; i < reduceKernel.size(); i++) {
+        delete reduceKernel[i];
+    }
     
     glfwDestroyWindow(window);
     glfwTerminate();
@@ -286,26 +291,43 @@ void AppManager::runKernel(double dt){
    
     CHECK_GL_ERRORS();
     
-    /* DOWNLOAD RESULTS */
-    
-    glBindTexture(GL_TEXTURE_2D, kernel0->getTexture());
+    std::cout << reduceMax().x << std::endl;
     
-    std::vector<GLfloat> data(Nx*Ny*4);
-    glGetTexImage(GL_TEXTURE_2D,0,GL_RGBA,GL_FLOAT,&data[0]);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    CHECK_GL_ERRORS();
+}
+
+glm::vec4 AppManager::reduceMax(){
+    reduce_max->use();
+    glUniform1i(reduce_max->getUniform("QTex"), 0);
+    glActiveTexture(GL_TEXTURE0);
     
-    float max = 0.0;
-    for (size_t x = 0; x < Nx; x++) {
-        for (size_t y = 0; y < Ny; y++) {
-            max = glm::max(max,data[(Nx * y + x)*4]);
-        }
+    glm::ivec2 size(Nx,Ny);
+    for (size_t i = 0; i < reduceKernel.size(); i++) {
+        reduceKernel[i]->bind();
+        glViewport(0, 0, reduceKernel[i]->getWidth(), reduceKernel[i]->getHeight());
+        
+        glUniform2i(reduce_max->getUniform("size"), size.x, size.y);
+        glBindTexture(GL_TEXTURE_2D, i == 0 ? kernel0->getTexture() : reduceKernel[i-1]->getTexture());
+        
+        glBindVertexArray(vao);
+        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_BYTE, NULL);
+        glBindVertexArray(0);
+        
+        size = glm::ivec2(reduceKernel[i]->getWidth(), reduceKernel[i]->getHeight());
     }
     
-    std::cout << max << std::endl;
+    reduce_max->disuse();
     
-    /* DOWNLOAD END */
+    // Only the 1x1 top level is read back
+    glm::vec4 hi;
+    glReadPixels(0, 0, 1, 1, GL_RGBA, GL_FLOAT, &hi[0]);
+    
+    reduceKernel.back()->unbind();
+    glBindTexture(GL_TEXTURE_2D, 0);
     
     CHECK_GL_ERRORS();
+    
+    return hi;
 }
 
 void AppManager::render(){
@@ -387,6 +409,7 @@ void AppManager::createProgram(){
     lax_f       = new Program("kernel.vert","lax-f.frag");
     visualize   = new Program("kernel.vert","visualize.frag");
     copy        = new Program("kernel.vert","copy.frag");
+    reduce_max  = new Program("kernel.vert","reduce_max.frag");
     
     //Set uniforms
 
@@ -423,6 +446,15 @@ void AppManager::createFBO(){
     kernel0 = new TextureFBO(Nx, Ny, GL_RGBA32F);
     kernel1 = new TextureFBO(Nx, Ny, GL_RGBA32F);
     
+    // Halve until a single texel is left
+    size_t w = Nx;
+    size_t h = Ny;
+    do {
+        w = (w+1)/2;
+        h = (h+1)/2;
+        reduceKernel.push_back(new TextureFBO(w, h, GL_RGBA32F));
+    } while (w > 1 || h > 1);
+    
     CHECK_GL_ERRORS();
 }
 
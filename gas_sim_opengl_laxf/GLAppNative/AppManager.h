@@ -57,6 +57,11 @@ private:
 	 */
     void runKernel(double dt);
     
+    /**
+     * Component-wise max of the latest result, reduced on the GPU
+     */
+    glm::vec4 reduceMax();
+    
 	/**
 	 * Function that handles rendering into the OpenGL context
 	 */
@@ -130,6 +135,7 @@ private:
     Program* lax_f;
     Program* visualize;
     Program* copy;
+    Program* reduce_max;
     
     BO<GL_ARRAY_BUFFER>* vert;
     BO<GL_ELEMENT_ARRAY_BUFFER>* ind;
@@ -137,6 +143,9 @@ private:
     TextureFBO* kernel0;
     TextureFBO* kernel1;
     
+    // Max pyramid, each level halves the one above
+    std::vector<TextureFBO*> reduceKernel;
+    
     GLuint vao;
 };
 
@@ -0,0 +1,26 @@
+#version 150
+
+// One level of the max pyramid, every fragment reduces a 2x2 block
+out vec4 color;
+
+uniform sampler2D QTex;
+
+uniform ivec2 size;     // size of the level being reduced
+
+const float FLT_MAX = 3.402823466e+38;
+
+void main() {
+    ivec2 base = ivec2(gl_FragCoord.xy)*2;
+    
+    vec4 hi = vec4(-FLT_MAX);
+    for (int j = 0; j < 2; j++) {
+        for (int i = 0; i < 2; i++) {
+            ivec2 p = base + ivec2(i,j);
+            if (p.x < size.x && p.y < size.y) {
+                hi = max(hi, texelFetch(QTex, p, 0));
+            }
+        }
+    }
+    
+    color = hi;
+}
@@ -18,6 +18,7 @@ VirtualTrackball AppManager::trackball;
 bool AppManager::enableCulling = true;
 size_t AppManager::skipped = 0;
 float AppManager::fps = 0.0f;
+float AppManager::frame_gpu_time = 0.0f;
 float AppManager::occlusion_fps = 0.0f;
 
 AppManager::AppManager(){
@@ -47,6 +48,9 @@ void AppManager::init(){
     setOpenGLStates();
     createProgram();
     
+    frame_timer = new GLTimer();
+    occlusion_timer = new GLTimer();
+    
     srand((unsigned)time(0));
     
     
@@ -126,14 +130,18 @@ void AppManager::begin(){
 
 void AppManager::render(){
     timer.restart();
+    frame_timer->begin();
     
     glm::mat4 view_matrix = camera.view*trackball.getTransform();
     
-    occlusion_timer.restart();
+    occlusion_timer->begin();
     if (enableCulling) {
         checkOcclusion(view_matrix);
     }
-    occlusion_fps = (float)occlusion_timer.elapsed();
+    occlusion_timer->end();
+    
+    // Results lag a few frames behind, but reading them never waits
+    occlusion_fps = (float)occlusion_timer->elapsed();
     
     // Find actual screen width and height
     int width, height;
@@ -168,6 +176,9 @@ void AppManager::render(){
         planes.at(i)->render(phong, camera.projection, view_matrix);
     }
     
+    frame_timer->end();
+    frame_gpu_time = (float)frame_timer->elapsed();
+    
     fps = 1.0f / timer.elapsed();
     
     glFinish();
@@ -228,6 +239,9 @@ void AppManager::quit(){
     
     delete hzmap;
     
+    delete frame_timer;
+    delete occlusion_timer;
+    
     delete bbCenters;
     delete transFeedback;
 
@@ -315,10 +329,10 @@ void AppManager::key_callback(GLFWwindow* window, int key, int scancode, int act
         std::cout << "Geometry culled last frame: " << skipped << std::endl;
     }
     if (key == GLFW_KEY_4 && action == GLFW_PRESS){
-        std::cout << "FPS: " << fps << std::endl;
+        std::cout << "FPS: " << fps << ", GPU frame time: " << frame_gpu_time*1e3f << " ms" << std::endl;
     }
     if (key == GLFW_KEY_5 && action == GLFW_PRESS){
-        std::cout << "Occlusion timer: " << occlusion_fps << std::endl;
+        std::cout << "Occlusion timer: " << occlusion_fps*1e3f << " ms" << std::endl;
     }
 }
 
@@ -18,6 +18,7 @@
 #include "Cube.h"
 #include "HZMap.h"
 #include "Timer.hpp"
+#include "GPUTimer.hpp"
 
 #include <IL/IL.h>
 #include <IL/ILU.h>
@@ -109,7 +110,10 @@ private:
     GLFWwindow* window;
     
     Timer timer;
-    Timer occlusion_timer;
+    
+    // Device time of the whole frame and of the occlusion pass
+    GLTimer* frame_timer;
+    GLTimer* occlusion_timer;
     
     static const unsigned int window_width  = 800;
 	static const unsigned int window_height = 600;
@@ -141,6 +145,7 @@ private:
     
     static size_t skipped;
     static float fps;
+    static float frame_gpu_time;
     static float occlusion_fps;
     
     static bool enableCulling;
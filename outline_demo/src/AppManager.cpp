@@ -17,6 +17,8 @@
 // Static decleration
 VirtualTrackball AppManager::trackball;
 float AppManager::fovx = 65.0f;
+float AppManager::geometry_time = 0.0f;
+float AppManager::shading_time = 0.0f;
 RenderMode AppManager::mode = PHONG;
 
 AppManager::AppManager(){
@@ -52,6 +54,9 @@ void AppManager::init(std::string model){
     
     setOpenGLStates();
     createProgram();
+    
+    geometry_timer.reset(new GLTimer());
+    shading_timer.reset(new GLTimer());
     createVAO();
     
     int width, height;
@@ -123,6 +128,7 @@ void AppManager::renderMeshRecursive(MeshPart& mesh, const std::shared_ptr<Progr
 void AppManager::render(){
     glm::mat4 view_matrix_new = camera.view*trackball.getTransform();
     
+    geometry_timer->begin();
     deferred->use();
     
     camera.projection = glm::perspective(fovx,
@@ -141,11 +147,13 @@ void AppManager::render(){
     deferred_kernel->unbind();
     
     deferred->disuse();
+    geometry_timer->end();
     
     int width, height;
     glfwGetFramebufferSize(window,&width,&height);
     glViewport(0, 0, width, height);
     glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
+    shading_timer->begin();
     
     switch (mode) {
         case PHONG:
@@ -159,6 +167,12 @@ void AppManager::render(){
             break;
     }
     
+    shading_timer->end();
+    
+    // Results from a few frames back, reading them never waits
+    geometry_time = (float)geometry_timer->elapsed();
+    shading_time = (float)shading_timer->elapsed();
+    
     glFinish();
     CHECK_GL_ERRORS();
 }
@@ -237,6 +251,10 @@ void AppManager::renderGoochOutline(){
 }
 
 void AppManager::quit(){
+    // Queries belong to the context, release them while it is alive
+    geometry_timer.reset();
+    shading_timer.reset();
+    
     glfwDestroyWindow(window);
     glfwTerminate();
 }
@@ -350,6 +368,9 @@ void AppManager::key_callback(GLFWwindow* window, int key, int scancode, int act
     
     if (key == GLFW_KEY_1 && action == GLFW_PRESS)
         mode = PHONG;
+    if (key == GLFW_KEY_T && action == GLFW_PRESS)
+        std::cout << "GPU geometry pass: " << geometry_time*1e3f << " ms, "
+            << "shading pass: " << shading_time*1e3f << " ms" << std::endl;
     if (key == GLFW_KEY_2 && action == GLFW_PRESS)
         mode = GOOCH;
     if (key == GLFW_KEY_3 && action == GLFW_PRESS)